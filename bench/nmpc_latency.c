@@ -0,0 +1,329 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Latency benchmark for the full NMPC cycle. Runs the closed-loop sequence of
+nmpc_preparation_step, nmpc_feedback_step and nmpc_update_horizon along a
+reference trajectory, and reports the p50/p99/max latency of each phase
+(from nmpc_get_timing_stats), the time and cycles per evaluation of the
+dynamics model during the preparation step, and the QP iteration counts.
+
+The same source is built against both the C++ library (nmpc_latency) and
+the C66x library built for the host (nmpc_latency_c66, with BENCH_C66NMPC
+defined), so the two implementations can be compared directly.
+
+The reference trajectory is either synthetic (straight and level flight,
+with the measurement offset from the reference by a slowly varying amount
+so the QP has some work to do), or read from a file with one reference
+point per line: NMPC_REFERENCE_DIM whitespace- or comma-separated values,
+the state followed by the control, one line per base step. With a recorded
+trajectory, each reference point is also used as the measurement when it
+reaches the start of the horizon.
+
+Usage: nmpc_latency [iterations] [trajectory]
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC
+#endif
+
+#include "config.h"
+#include "cnmpc.h"
+
+#define BENCH_AIRSPEED ((real_t)20.0)
+#define BENCH_WARMUP_ITERATIONS 20u
+
+#ifdef BENCH_C66NMPC
+#define BENCH_IMPLEMENTATION "c66nmpc"
+#else
+#define BENCH_IMPLEMENTATION "cnmpc"
+#endif
+
+/*
+Number of dynamics model evaluations per integration step, and integrations
+per interval in the preparation step. The C66x version always uses RK4 and
+finite differences; with automatic differentiation, each evaluation also
+calculates the derivatives with respect to every state delta and control.
+*/
+#if defined(BENCH_C66NMPC) || defined(NMPC_INTEGRATOR_RK4)
+#define BENCH_INTEGRATOR_STAGES 4u
+#elif defined(NMPC_INTEGRATOR_RK45)
+#define BENCH_INTEGRATOR_STAGES 6u
+#elif defined(NMPC_INTEGRATOR_HEUN)
+#define BENCH_INTEGRATOR_STAGES 2u
+#else
+#define BENCH_INTEGRATOR_STAGES 1u
+#endif
+
+#if defined(BENCH_C66NMPC) || defined(NMPC_JACOBIAN_FD)
+#define BENCH_INTEGRATIONS (NMPC_GRADIENT_DIM + 1u)
+#define BENCH_JACOBIAN "finite differences"
+#else
+#define BENCH_INTEGRATIONS 1u
+#define BENCH_JACOBIAN "automatic differentiation"
+#endif
+
+static const char *phase_names[NMPC_TIMING_PHASES] = {
+    "preparation",
+    "  solve IVPs",
+    "  QP update",
+    "feedback",
+    "  initial constraint",
+    "  QP solve",
+    "    Newton setup",
+    "    factorisation",
+    "    line search",
+    "    stage QPs",
+    "update horizon"
+};
+
+static real_t *trajectory;
+static uint32_t trajectory_length;
+
+static double _get_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1.0e-9;
+}
+
+/*
+Estimates the time stamp counter frequency against the monotonic clock, so
+the dynamics evaluation time can be given in cycles. Returns zero if there's
+no time stamp counter.
+*/
+static double _tsc_frequency(void) {
+#ifdef BENCH_HAVE_TSC
+    double start, end;
+    uint64_t start_tsc, end_tsc;
+
+    start = _get_time();
+    start_tsc = __rdtsc();
+    do {
+        end = _get_time();
+    } while (end - start < 0.1);
+    end_tsc = __rdtsc();
+
+    return (double)(end_tsc - start_tsc) / (end - start);
+#else
+    return 0.0;
+#endif
+}
+
+/* Reads a recorded trajectory; returns the number of reference points. */
+static uint32_t _load_trajectory(const char *path) {
+    FILE *f;
+    uint32_t capacity = 1024u, n = 0, i;
+    double value;
+
+    f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    trajectory = malloc(sizeof(real_t) * NMPC_REFERENCE_DIM * capacity);
+    while (trajectory) {
+        for (i = 0; i < NMPC_REFERENCE_DIM; i++) {
+            if (fscanf(f, " %lf ,", &value) != 1) {
+                break;
+            }
+            trajectory[n * NMPC_REFERENCE_DIM + i] = (real_t)value;
+        }
+        if (i < NMPC_REFERENCE_DIM) {
+            break;
+        }
+
+        if (++n == capacity) {
+            capacity *= 2u;
+            trajectory = realloc(trajectory,
+                sizeof(real_t) * NMPC_REFERENCE_DIM * capacity);
+        }
+    }
+
+    fclose(f);
+    return trajectory ? n : 0;
+}
+
+static void _reference_point(real_t out[NMPC_REFERENCE_DIM], uint32_t i) {
+    real_t t;
+
+    if (trajectory_length) {
+        i = i < trajectory_length ? i : trajectory_length - 1u;
+        memcpy(out, &trajectory[i * NMPC_REFERENCE_DIM],
+               sizeof(real_t) * NMPC_REFERENCE_DIM);
+        return;
+    }
+
+    /* Straight and level flight heading north at 100 m altitude. */
+    t = nmpc_config_get_step_length() * (real_t)i;
+    memset(out, 0, sizeof(real_t) * NMPC_REFERENCE_DIM);
+    out[0] = BENCH_AIRSPEED * t;
+    out[2] = (real_t)-100.0;
+    out[3] = BENCH_AIRSPEED;
+    out[9] = (real_t)1.0;
+    out[13] = (real_t)0.4;
+    out[14] = (real_t)0.5;
+    out[15] = (real_t)0.5;
+}
+
+static void _measurement(real_t out[NMPC_STATE_DIM], uint32_t i) {
+    real_t reference[NMPC_REFERENCE_DIM], offset;
+
+    _reference_point(reference, i);
+    memcpy(out, reference, sizeof(real_t) * NMPC_STATE_DIM);
+
+    if (!trajectory_length) {
+        offset = (real_t)sin(0.05 * (double)i);
+        out[1] += (real_t)2.0 * offset;
+        out[2] -= (real_t)0.5 * offset;
+        out[6] = (real_t)0.01 * offset;
+        out[9] = (real_t)sqrt(1.0 - (double)(out[6] * out[6]));
+    }
+}
+
+int main(int argc, char **argv) {
+    real_t state_weights[NMPC_DELTA_DIM] =
+        {1, 1, 1, 1, 1, 1, 10, 10, 10, 1, 1, 1};
+    real_t control_weights[NMPC_CONTROL_DIM] = {1, 1, 1};
+    real_t lower_control_bound[NMPC_CONTROL_DIM] = {0, 0.25, 0.25};
+    real_t upper_control_bound[NMPC_CONTROL_DIM] = {1, 0.75, 0.75};
+    real_t reference[NMPC_REFERENCE_DIM], measurement[NMPC_STATE_DIM],
+           controls[NMPC_CONTROL_DIM];
+    struct nmpc_timing_stats_t stats[NMPC_TIMING_PHASES];
+    uint32_t iterations = 1000u, i, qp_iterations, min_qp_iterations = 0,
+             max_qp_iterations = 0, infeasible = 0, evaluations;
+    double total_qp_iterations = 0.0, tsc_hz, evaluation_time;
+
+    if (argc > 1) {
+        iterations = (uint32_t)atoi(argv[1]);
+    }
+    if (argc > 2) {
+        trajectory_length = _load_trajectory(argv[2]);
+        if (!trajectory_length) {
+            fprintf(stderr, "couldn't read a trajectory from %s\n", argv[2]);
+            return 1;
+        }
+    }
+    if (iterations < 1) {
+        fprintf(stderr, "usage: %s [iterations] [trajectory]\n", argv[0]);
+        return 1;
+    }
+
+    nmpc_set_state_weights(state_weights);
+    nmpc_set_control_weights(control_weights);
+    nmpc_set_terminal_weights(state_weights);
+    nmpc_set_lower_control_bound(lower_control_bound);
+    nmpc_set_upper_control_bound(upper_control_bound);
+    nmpc_set_wind_velocity(0, 0, 0);
+    nmpc_init();
+
+    for (i = 0; i <= nmpc_config_get_horizon_steps(); i++) {
+        _reference_point(reference, i);
+        nmpc_set_reference_point(reference, i);
+    }
+
+    /*
+    Run the closed loop; the statistics are reset after the warm-up
+    iterations, so they only cover the steady state.
+    */
+    for (i = 0; i < BENCH_WARMUP_ITERATIONS + iterations; i++) {
+        if (i == BENCH_WARMUP_ITERATIONS) {
+            nmpc_reset_timing_stats();
+        }
+
+        nmpc_preparation_step();
+
+        _measurement(measurement, i);
+        nmpc_feedback_step(measurement);
+        if (nmpc_get_controls(controls) != NMPC_OK) {
+            infeasible++;
+        }
+
+        if (i >= BENCH_WARMUP_ITERATIONS) {
+            qp_iterations = nmpc_get_qp_iterations();
+            if (i == BENCH_WARMUP_ITERATIONS ||
+                    qp_iterations < min_qp_iterations) {
+                min_qp_iterations = qp_iterations;
+            }
+            if (qp_iterations > max_qp_iterations) {
+                max_qp_iterations = qp_iterations;
+            }
+            total_qp_iterations += (double)qp_iterations;
+        }
+
+        _reference_point(reference,
+                         i + nmpc_config_get_horizon_steps() + 1u);
+        nmpc_update_horizon(reference);
+    }
+
+    nmpc_get_timing_stats(stats);
+
+    printf("%s, %s precision, horizon %u x %g s, %u iterations, %s "
+           "trajectory\n", BENCH_IMPLEMENTATION,
+           nmpc_config_get_precision() == NMPC_PRECISION_FLOAT ?
+               "single" : "double",
+           nmpc_config_get_horizon_length(),
+           (double)nmpc_config_get_step_length(), iterations,
+           trajectory_length ? "recorded" : "synthetic");
+
+    printf("\nphase                       p50 (us)  p99 (us)  max (us)\n");
+    for (i = 0; i < NMPC_TIMING_PHASES; i++) {
+        if (!stats[i].count) {
+            continue;
+        }
+
+        printf("%-24s  %10.1f%10.1f%10.1f\n", phase_names[i],
+               stats[i].p50 * 1e6, stats[i].p99 * 1e6, stats[i].max * 1e6);
+    }
+
+    /*
+    The IVP time per evaluation includes the Jacobian arithmetic around the
+    integrator, so it's an upper bound on the cost of the model itself.
+    */
+    evaluations = nmpc_config_get_horizon_length() * BENCH_INTEGRATIONS *
+                  BENCH_INTEGRATOR_STAGES;
+    evaluation_time = (double)stats[NMPC_TIMING_SOLVE_IVPS].mean /
+                      (double)evaluations;
+    tsc_hz = _tsc_frequency();
+
+    printf("\ndynamics (%s): %u evaluations per preparation step, "
+           "%.1f ns", BENCH_JACOBIAN, evaluations, evaluation_time * 1e9);
+    if (tsc_hz > 0.0) {
+        printf(" (%.0f cycles)", evaluation_time * tsc_hz);
+    }
+    printf(" per evaluation\n");
+
+    printf("QP iterations: min %u, mean %.2f, max %u; %u infeasible\n",
+           min_qp_iterations, total_qp_iterations / (double)iterations,
+           max_qp_iterations, infeasible);
+
+    free(trajectory);
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Benchmark comparing the QP backends across a range of horizon lengths: the
+sparse qpDUNES QP, the fully condensed dense QP and the Riccati recursion.
+Each configuration runs the same closed-loop sequence of preparation and
+feedback steps, and reports the mean time for each step along with the
+largest difference in the final controls relative to the sparse qpDUNES
+run.
+
+Partial condensing block sizes for qpDUNES can also be given on the command
+line, and require qpDUNES to be built with its qpOASES stage QP solver.
+
+Usage: qp_backends [iterations] [block_size ...]
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "config.h"
+#include "cnmpc.h"
+
+#define BENCH_AIRSPEED ((real_t)20.0)
+#define BENCH_MAX_BLOCK_SIZES 8
+
+static double _get_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1.0e-9;
+}
+
+static void _reference_point(real_t out[NMPC_REFERENCE_DIM], uint32_t i) {
+    real_t t = nmpc_config_get_step_length() * (real_t)i;
+
+    /* Straight and level flight heading north at 100 m altitude. */
+    memset(out, 0, sizeof(real_t) * NMPC_REFERENCE_DIM);
+    out[0] = BENCH_AIRSPEED * t;
+    out[2] = (real_t)-100.0;
+    out[3] = BENCH_AIRSPEED;
+    out[9] = (real_t)1.0;
+    out[13] = (real_t)0.4;
+    out[14] = (real_t)0.5;
+    out[15] = (real_t)0.5;
+}
+
+static void _run(uint32_t horizon_length, enum nmpc_qp_backend_t backend,
+uint32_t block_size, uint32_t iterations, double *preparation_time,
+double *feedback_time, real_t controls[NMPC_CONTROL_DIM]) {
+    real_t state_weights[NMPC_DELTA_DIM] =
+        {1, 1, 1, 1, 1, 1, 10, 10, 10, 1, 1, 1};
+    real_t control_weights[NMPC_CONTROL_DIM] = {1, 1, 1};
+    real_t lower_control_bound[NMPC_CONTROL_DIM] = {0, 0.25, 0.25};
+    real_t upper_control_bound[NMPC_CONTROL_DIM] = {1, 0.75, 0.75};
+    real_t reference[NMPC_REFERENCE_DIM], measurement[NMPC_STATE_DIM];
+    uint32_t i;
+    double start;
+
+    nmpc_set_state_weights(state_weights);
+    nmpc_set_control_weights(control_weights);
+    nmpc_set_terminal_weights(state_weights);
+    nmpc_set_lower_control_bound(lower_control_bound);
+    nmpc_set_upper_control_bound(upper_control_bound);
+    nmpc_set_wind_velocity(0, 0, 0);
+    nmpc_config_set_horizon_length(horizon_length);
+    nmpc_config_set_qp_backend(backend);
+    nmpc_config_set_qp_condensing(block_size);
+    nmpc_init();
+
+    for (i = 0; i <= nmpc_config_get_horizon_steps(); i++) {
+        _reference_point(reference, i);
+        nmpc_set_reference_point(reference, i);
+    }
+
+    *preparation_time = 0.0;
+    *feedback_time = 0.0;
+
+    for (i = 0; i < iterations; i++) {
+        start = _get_time();
+        nmpc_preparation_step();
+        *preparation_time += _get_time() - start;
+
+        /*
+        Offset the measurement from the reference slightly, so the solver
+        has some work to do.
+        */
+        _reference_point(reference, i);
+        memcpy(measurement, reference, sizeof(measurement));
+        measurement[0] += (real_t)0.1;
+        measurement[1] += (real_t)0.2;
+        measurement[2] -= (real_t)0.5;
+        measurement[6] = (real_t)0.01;
+        measurement[9] = (real_t)sqrt(1.0 - 0.01 * 0.01);
+
+        start = _get_time();
+        nmpc_feedback_step(measurement);
+        *feedback_time += _get_time() - start;
+
+        nmpc_get_controls(controls);
+
+        _reference_point(reference,
+                         i + nmpc_config_get_horizon_steps() + 1u);
+        nmpc_update_horizon(reference);
+    }
+
+    *preparation_time /= (double)iterations;
+    *feedback_time /= (double)iterations;
+}
+
+static void _report(uint32_t horizon_length, const char *name,
+double preparation_time, double feedback_time,
+const real_t controls[NMPC_CONTROL_DIM],
+const real_t reference_controls[NMPC_CONTROL_DIM]) {
+    real_t difference = 0.0;
+    uint32_t i;
+
+    for (i = 0; i < NMPC_CONTROL_DIM; i++) {
+        real_t d = (real_t)fabs(controls[i] - reference_controls[i]);
+        difference = d > difference ? d : difference;
+    }
+
+    printf("%7u  %-10s  %16.1f  %13.1f  %10.2g\n", horizon_length, name,
+           preparation_time * 1e6, feedback_time * 1e6, difference);
+}
+
+int main(int argc, char **argv) {
+    static const uint32_t horizon_lengths[] = {10, 20, 30, 50, 100};
+    uint32_t iterations = 200, block_sizes[BENCH_MAX_BLOCK_SIZES],
+             n_block_sizes = 0, i, j, horizon_length;
+    real_t reference_controls[NMPC_CONTROL_DIM],
+           controls[NMPC_CONTROL_DIM];
+    double preparation_time, feedback_time;
+    char name[32];
+
+    if (argc > 1) {
+        iterations = (uint32_t)atoi(argv[1]);
+    }
+    for (i = 2; i < (uint32_t)argc && n_block_sizes < BENCH_MAX_BLOCK_SIZES;
+            i++) {
+        block_sizes[n_block_sizes++] = (uint32_t)atoi(argv[i]);
+    }
+    if (iterations < 1) {
+        fprintf(stderr, "usage: %s [iterations] [block_size ...]\n",
+                argv[0]);
+        return 1;
+    }
+
+    printf("%u iterations\n", iterations);
+    printf("horizon  qp          preparation (us)  feedback (us)  "
+           "max du\n");
+
+    for (i = 0; i < sizeof(horizon_lengths) / sizeof(horizon_lengths[0]);
+            i++) {
+        horizon_length = horizon_lengths[i];
+        if (horizon_length > nmpc_config_get_max_horizon_length()) {
+            break;
+        }
+
+        _run(horizon_length, NMPC_QP_QPDUNES, 0, iterations,
+             &preparation_time, &feedback_time, reference_controls);
+        _report(horizon_length, "qpdunes", preparation_time, feedback_time,
+                reference_controls, reference_controls);
+
+        for (j = 0; j < n_block_sizes; j++) {
+            if (block_sizes[j] < 1 || block_sizes[j] >= horizon_length) {
+                continue;
+            }
+
+            _run(horizon_length, NMPC_QP_QPDUNES, block_sizes[j],
+                 iterations, &preparation_time, &feedback_time, controls);
+            snprintf(name, sizeof(name), "partial %u", block_sizes[j]);
+            _report(horizon_length, name, preparation_time, feedback_time,
+                    controls, reference_controls);
+        }
+
+        _run(horizon_length, NMPC_QP_DENSE, 0, iterations,
+             &preparation_time, &feedback_time, controls);
+        _report(horizon_length, "dense", preparation_time, feedback_time,
+                controls, reference_controls);
+
+        _run(horizon_length, NMPC_QP_RICCATI, 0, iterations,
+             &preparation_time, &feedback_time, controls);
+        _report(horizon_length, "riccati", preparation_time, feedback_time,
+                controls, reference_controls);
+    }
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Benchmark for the OpenMP-parallel qpDUNES stage loops. Runs the same
+closed-loop sequence of preparation and feedback steps for each thread
+count, and reports the mean feedback step (QP solve) time and speedup
+relative to a single thread. The controls at the end of each run are also
+compared against the single-threaded run, since the parallel mode must not
+change the result.
+
+Usage: qpdunes_parallel [max_threads] [iterations]
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <omp.h>
+
+#include "config.h"
+#include "cnmpc.h"
+
+#if !defined(_OPENMP)
+    #error "The qpDUNES parallel benchmark must be built with OpenMP"
+#endif
+
+#define BENCH_AIRSPEED ((real_t)20.0)
+
+static void _reference_point(real_t out[NMPC_REFERENCE_DIM], uint32_t i) {
+    real_t t = nmpc_config_get_step_length() * (real_t)i;
+
+    /* Straight and level flight heading north at 100 m altitude. */
+    memset(out, 0, sizeof(real_t) * NMPC_REFERENCE_DIM);
+    out[0] = BENCH_AIRSPEED * t;
+    out[2] = (real_t)-100.0;
+    out[3] = BENCH_AIRSPEED;
+    out[9] = (real_t)1.0;
+    out[13] = (real_t)0.4;
+    out[14] = (real_t)0.5;
+    out[15] = (real_t)0.5;
+}
+
+static double _run(uint32_t iterations, real_t controls[NMPC_CONTROL_DIM]) {
+    real_t state_weights[NMPC_DELTA_DIM] =
+        {1, 1, 1, 1, 1, 1, 10, 10, 10, 1, 1, 1};
+    real_t control_weights[NMPC_CONTROL_DIM] = {1, 1, 1};
+    real_t lower_control_bound[NMPC_CONTROL_DIM] = {0, 0.25, 0.25};
+    real_t upper_control_bound[NMPC_CONTROL_DIM] = {1, 0.75, 0.75};
+    real_t reference[NMPC_REFERENCE_DIM], measurement[NMPC_STATE_DIM];
+    double start, feedback_time = 0.0;
+    uint32_t i;
+
+    nmpc_set_state_weights(state_weights);
+    nmpc_set_control_weights(control_weights);
+    nmpc_set_terminal_weights(state_weights);
+    nmpc_set_lower_control_bound(lower_control_bound);
+    nmpc_set_upper_control_bound(upper_control_bound);
+    nmpc_set_wind_velocity(0, 0, 0);
+    nmpc_init();
+
+    for (i = 0; i <= nmpc_config_get_horizon_steps(); i++) {
+        _reference_point(reference, i);
+        nmpc_set_reference_point(reference, i);
+    }
+
+    for (i = 0; i < iterations; i++) {
+        nmpc_preparation_step();
+
+        /*
+        Offset the measurement from the reference slightly, so the solver
+        has some work to do.
+        */
+        _reference_point(reference, i);
+        memcpy(measurement, reference, sizeof(measurement));
+        measurement[0] += (real_t)0.1;
+        measurement[1] += (real_t)0.2;
+        measurement[2] -= (real_t)0.5;
+        measurement[6] = (real_t)0.01;
+        measurement[9] = (real_t)sqrt(1.0 - 0.01 * 0.01);
+
+        start = omp_get_wtime();
+        nmpc_feedback_step(measurement);
+        feedback_time += omp_get_wtime() - start;
+
+        nmpc_get_controls(controls);
+
+        _reference_point(reference,
+                         i + nmpc_config_get_horizon_steps() + 1u);
+        nmpc_update_horizon(reference);
+    }
+
+    return feedback_time / (double)iterations;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = omp_get_num_procs(), threads;
+    uint32_t iterations = 500;
+    real_t reference_controls[NMPC_CONTROL_DIM],
+           controls[NMPC_CONTROL_DIM];
+    double serial_time = 0.0, t;
+
+    if (argc > 1) {
+        max_threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        iterations = (uint32_t)atoi(argv[2]);
+    }
+    if (max_threads < 1 || iterations < 1) {
+        fprintf(stderr, "usage: %s [max_threads] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    printf("horizon length %u, %u iterations\n",
+           nmpc_config_get_horizon_length(), iterations);
+    printf("threads  feedback (us)  speedup  identical\n");
+
+    for (threads = 1; threads <= max_threads; threads++) {
+        omp_set_num_threads(threads);
+        t = _run(iterations, controls);
+
+        if (threads == 1) {
+            serial_time = t;
+            memcpy(reference_controls, controls, sizeof(controls));
+        }
+
+        printf("%7d  %13.1f  %7.2f  %9s\n", threads, t * 1e6,
+               serial_time / t,
+               memcmp(reference_controls, controls, sizeof(controls)) == 0 ?
+                   "yes" : "NO");
+    }
+
+    return 0;
+}
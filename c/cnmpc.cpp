@@ -20,6 +20,19 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <new>
+#include <cassert>
+#include <cstring>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "types.h"
 #include "state.h"
 #include "integrator.h"
@@ -28,93 +41,657 @@ SOFTWARE.
 
 #include "cnmpc.h"
 
-static X8DynamicsModel dynamics_model =
-    X8DynamicsModel();
+struct nmpc_runtime_t;
+
+/*
+Everything needed for one controller. The OCP keeps a pointer to the
+dynamics model, so a context can't be copied. runtime is only set while the
+asynchronous runtime is running.
+*/
+struct nmpc_ctx_t {
+    X8Dynamics dynamics_model;
+    OptimalControlProblem<X8StateSpace> ocp;
+    nmpc_runtime_t *runtime;
+
+    nmpc_ctx_t() : ocp(&dynamics_model), runtime(NULL) {}
+    ~nmpc_ctx_t() { nmpc_ctx_runtime_stop(this); }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+    nmpc_ctx_t(const nmpc_ctx_t &);
+    nmpc_ctx_t &operator=(const nmpc_ctx_t &);
+};
+
+static nmpc_ctx_t default_ctx;
+
 static State current;
-#if defined(NMPC_INTEGRATOR_RK4)
-    IntegratorRK4 integrator;
-#elif defined(NMPC_INTEGRATOR_HEUN)
-    IntegratorHeun integrator;
-#elif defined(NMPC_INTEGRATOR_EULER)
-    IntegratorEuler integrator;
-#endif
+DefaultIntegrator integrator;
 
-static OptimalControlProblem ocp =
-    OptimalControlProblem(&dynamics_model);
+struct nmpc_ctx_t *nmpc_create() {
+    return new (std::nothrow) nmpc_ctx_t();
+}
 
-void nmpc_init() {
-    ocp.initialise();
+void nmpc_destroy(struct nmpc_ctx_t *ctx) {
+    delete ctx;
 }
 
-void nmpc_preparation_step() {
-    ocp.preparation_step();
+void nmpc_ctx_init(struct nmpc_ctx_t *ctx) {
+    ctx->ocp.initialise();
 }
 
-void nmpc_feedback_step(real_t measurement[NMPC_STATE_DIM]) {
+void nmpc_ctx_preparation_step(struct nmpc_ctx_t *ctx) {
+    ctx->ocp.preparation_step();
+}
+
+void nmpc_ctx_feedback_step(struct nmpc_ctx_t *ctx,
+real_t measurement[NMPC_STATE_DIM]) {
     Eigen::Map<StateVector> measurement_map =
         Eigen::Map<StateVector>(measurement);
     StateVector m = measurement_map;
-    ocp.feedback_step(m);
+    ctx->ocp.feedback_step(m);
 }
 
-enum nmpc_result_t nmpc_get_controls(real_t controls[NMPC_CONTROL_DIM]) {
+enum nmpc_result_t nmpc_ctx_get_controls(struct nmpc_ctx_t *ctx,
+real_t controls[NMPC_CONTROL_DIM]) {
     Eigen::Map<ControlVector> control_map(controls);
-    control_map = ocp.get_controls();
+    control_map = ctx->ocp.get_controls();
     return NMPC_OK;
 }
 
-void nmpc_update_horizon(real_t new_reference[NMPC_REFERENCE_DIM]) {
+void nmpc_ctx_update_horizon(struct nmpc_ctx_t *ctx,
+real_t new_reference[NMPC_REFERENCE_DIM]) {
     Eigen::Map<ReferenceVector> reference_map =
         Eigen::Map<ReferenceVector>(new_reference);
     ReferenceVector m = reference_map;
-    ocp.update_horizon(m);
+    ctx->ocp.update_horizon(m);
 }
 
-void nmpc_set_state_weights(real_t coeffs[NMPC_DELTA_DIM]) {
+void nmpc_ctx_shift_horizon(struct nmpc_ctx_t *ctx) {
+    ctx->ocp.shift_horizon();
+}
+
+void nmpc_ctx_set_state_weights(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_DELTA_DIM]) {
     Eigen::Map<DeltaVector> state_weight_map =
         Eigen::Map<DeltaVector>(coeffs);
     DeltaVector state_weight = state_weight_map;
-    ocp.set_state_weights(state_weight);
+    ctx->ocp.set_state_weights(state_weight);
 }
 
-void nmpc_set_control_weights(real_t coeffs[NMPC_CONTROL_DIM]) {
+void nmpc_ctx_set_control_weights(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_CONTROL_DIM]) {
     Eigen::Map<ControlVector> control_weight_map =
         Eigen::Map<ControlVector>(coeffs);
     ControlVector control_weight = control_weight_map;
-    ocp.set_control_weights(control_weight);
+    ctx->ocp.set_control_weights(control_weight);
 }
 
-void nmpc_set_terminal_weights(real_t coeffs[NMPC_DELTA_DIM]) {
+void nmpc_ctx_set_terminal_weights(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_DELTA_DIM]) {
     Eigen::Map<DeltaVector> terminal_weight_map =
         Eigen::Map<DeltaVector>(coeffs);
     DeltaVector terminal_weight = terminal_weight_map;
-    ocp.set_terminal_weights(terminal_weight);
+    ctx->ocp.set_terminal_weights(terminal_weight);
 }
 
-void nmpc_set_lower_control_bound(real_t coeffs[NMPC_CONTROL_DIM]) {
+void nmpc_ctx_set_lower_control_bound(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_CONTROL_DIM]) {
     Eigen::Map<ControlConstraintVector> control_constraint_map =
         Eigen::Map<ControlConstraintVector>(coeffs);
     ControlConstraintVector control_constraint = control_constraint_map;
-    ocp.set_lower_control_bound(control_constraint);
+    ctx->ocp.set_lower_control_bound(control_constraint);
 }
 
-void nmpc_set_upper_control_bound(real_t coeffs[NMPC_CONTROL_DIM]) {
+void nmpc_ctx_set_upper_control_bound(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_CONTROL_DIM]) {
     Eigen::Map<ControlConstraintVector> control_constraint_map =
         Eigen::Map<ControlConstraintVector>(coeffs);
     ControlConstraintVector control_constraint = control_constraint_map;
-    ocp.set_upper_control_bound(control_constraint);
+    ctx->ocp.set_upper_control_bound(control_constraint);
 }
 
-void nmpc_set_reference_point(real_t coeffs[NMPC_REFERENCE_DIM],
-uint32_t i) {
+void nmpc_ctx_set_reference_point(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_REFERENCE_DIM], uint32_t i) {
     Eigen::Map<ReferenceVector> reference_map =
         Eigen::Map<ReferenceVector>(coeffs);
     ReferenceVector reference = reference_map;
-    ocp.set_reference_point(reference, i);
+    ctx->ocp.set_reference_point(reference, i);
+}
+
+void nmpc_ctx_set_reference_horizon(struct nmpc_ctx_t *ctx,
+const real_t references[], uint32_t n) {
+    ctx->ocp.set_reference_horizon(references, n);
+}
+
+enum nmpc_result_t nmpc_ctx_queue_reference_point(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_REFERENCE_DIM], uint32_t step) {
+    Eigen::Map<ReferenceVector> reference_map =
+        Eigen::Map<ReferenceVector>(coeffs);
+    ReferenceVector reference = reference_map;
+    return ctx->ocp.queue_reference_point(reference, step) ?
+        NMPC_OK : NMPC_ERROR;
+}
+
+uint32_t nmpc_ctx_get_reference_step(const struct nmpc_ctx_t *ctx) {
+    return ctx->ocp.get_reference_step();
+}
+
+void nmpc_ctx_set_preparation_threads(struct nmpc_ctx_t *ctx, uint32_t n) {
+    ctx->ocp.set_preparation_threads(n);
+}
+
+void nmpc_ctx_set_wind_velocity(struct nmpc_ctx_t *ctx,
+real_t x, real_t y, real_t z) {
+    ctx->dynamics_model.set_wind_velocity(Vector3r(x, y, z));
+}
+
+uint32_t nmpc_ctx_config_get_horizon_length(const struct nmpc_ctx_t *ctx) {
+    return ctx->ocp.get_horizon_length();
+}
+
+uint32_t nmpc_ctx_config_get_horizon_steps(const struct nmpc_ctx_t *ctx) {
+    return ctx->ocp.get_horizon_steps();
+}
+
+real_t nmpc_ctx_config_get_step_length(const struct nmpc_ctx_t *ctx) {
+    return ctx->ocp.get_step_length();
+}
+
+void nmpc_ctx_config_set_horizon_length(struct nmpc_ctx_t *ctx,
+uint32_t length) {
+    ctx->ocp.set_horizon_length(length);
+}
+
+void nmpc_ctx_config_set_step_length(struct nmpc_ctx_t *ctx, real_t length) {
+    ctx->ocp.set_step_length(length);
+}
+
+void nmpc_ctx_config_set_integration_substeps(struct nmpc_ctx_t *ctx,
+uint32_t substeps) {
+    ctx->ocp.set_integration_substeps(substeps);
+}
+
+void nmpc_ctx_config_set_integration_tolerance(struct nmpc_ctx_t *ctx,
+real_t tolerance) {
+    ctx->ocp.set_integration_tolerance(tolerance);
+}
+
+void nmpc_ctx_config_set_horizon_grid(struct nmpc_ctx_t *ctx,
+const uint32_t steps[], uint32_t length) {
+    ctx->ocp.set_horizon_grid(steps, length);
+}
+
+void nmpc_ctx_config_set_move_blocking(struct nmpc_ctx_t *ctx,
+const uint32_t blocks[], uint32_t length) {
+    ctx->ocp.set_move_blocking(blocks, length);
+}
+
+void nmpc_ctx_config_set_qp_condensing(struct nmpc_ctx_t *ctx,
+uint32_t block_size) {
+    ctx->ocp.set_qp_condensing(block_size);
+}
+
+void nmpc_ctx_config_set_qp_backend(struct nmpc_ctx_t *ctx,
+enum nmpc_qp_backend_t backend) {
+    switch(backend) {
+        case NMPC_QP_DENSE:
+            ctx->ocp.set_qp_backend(QP_BACKEND_DENSE);
+            break;
+        case NMPC_QP_RICCATI:
+            ctx->ocp.set_qp_backend(QP_BACKEND_RICCATI);
+            break;
+        case NMPC_QP_QPDUNES:
+        default:
+            ctx->ocp.set_qp_backend(QP_BACKEND_QPDUNES);
+            break;
+    }
+}
+
+/* The C phases are numbered the same way as TimingPhase. */
+void nmpc_ctx_get_timing_stats(const struct nmpc_ctx_t *ctx,
+struct nmpc_timing_stats_t stats[NMPC_TIMING_PHASES]) {
+    uint32_t i;
+
+    for(i = 0; i < NMPC_TIMING_PHASES; i++) {
+        const TimingStats &phase = ctx->ocp.get_timing_stats((TimingPhase)i);
+
+        stats[i].count = phase.get_count();
+        stats[i].min = phase.get_min();
+        stats[i].max = phase.get_max();
+        stats[i].mean = phase.get_mean();
+        stats[i].p50 = phase.get_percentile((real_t)0.5);
+        stats[i].p90 = phase.get_percentile((real_t)0.9);
+        stats[i].p99 = phase.get_percentile((real_t)0.99);
+    }
+}
+
+void nmpc_ctx_reset_timing_stats(struct nmpc_ctx_t *ctx) {
+    ctx->ocp.reset_timing_stats();
+}
+
+uint32_t nmpc_ctx_get_qp_iterations(const struct nmpc_ctx_t *ctx) {
+    return ctx->ocp.get_qp_iterations();
+}
+
+void nmpc_ctx_config_set_linearisation_cache_tolerance(struct nmpc_ctx_t *ctx,
+real_t tolerance) {
+    ctx->ocp.set_linearisation_cache_tolerance(tolerance);
+}
+
+void nmpc_ctx_get_linearisation_cache_stats(const struct nmpc_ctx_t *ctx,
+uint32_t *hits, uint32_t *misses) {
+    assert(hits && misses);
+
+    *hits = ctx->ocp.get_linearisation_cache_hits();
+    *misses = ctx->ocp.get_linearisation_cache_misses();
+}
+
+void nmpc_ctx_reset_linearisation_cache_stats(struct nmpc_ctx_t *ctx) {
+    ctx->ocp.reset_linearisation_cache_stats();
+}
+
+void nmpc_ctx_config_set_jacobian_refresh(struct nmpc_ctx_t *ctx,
+uint32_t interval, uint32_t stages) {
+    assert(interval > 0);
+    ctx->ocp.set_jacobian_refresh(interval, stages);
+}
+
+struct nmpc_fleet_t {
+    uint32_t size;
+    uint32_t threads;
+    nmpc_ctx_t *contexts;
+};
+
+struct nmpc_fleet_t *nmpc_fleet_create(uint32_t size) {
+    nmpc_fleet_t *fleet;
+
+    assert(size > 0);
+
+    fleet = new (std::nothrow) nmpc_fleet_t();
+    if(!fleet) {
+        return NULL;
+    }
+
+    /* Eigen only provides a throwing operator new[] for aligned types. */
+    fleet->size = size;
+    fleet->threads = 0;
+    try {
+        fleet->contexts = new nmpc_ctx_t[size];
+    } catch(const std::bad_alloc &) {
+        delete fleet;
+        return NULL;
+    }
+
+    return fleet;
+}
+
+void nmpc_fleet_destroy(struct nmpc_fleet_t *fleet) {
+    if(fleet) {
+        delete[] fleet->contexts;
+        delete fleet;
+    }
+}
+
+uint32_t nmpc_fleet_get_size(const struct nmpc_fleet_t *fleet) {
+    return fleet->size;
+}
+
+struct nmpc_ctx_t *nmpc_fleet_get_ctx(struct nmpc_fleet_t *fleet,
+uint32_t i) {
+    assert(i < fleet->size);
+    return &fleet->contexts[i];
+}
+
+void nmpc_fleet_set_threads(struct nmpc_fleet_t *fleet, uint32_t n) {
+    fleet->threads = n;
+}
+
+/*
+Instances can take quite different amounts of time to solve, so they're
+handed out to the threads one at a time.
+*/
+void nmpc_fleet_step(struct nmpc_fleet_t *fleet, real_t measurements[],
+real_t new_references[], real_t controls[], enum nmpc_result_t results[]) {
+    int32_t i, size = (int32_t)fleet->size;
+
+    assert(measurements && controls);
+
+#if defined(_OPENMP)
+    int32_t threads = fleet->threads ?
+        (int32_t)fleet->threads : omp_get_max_threads();
+
+    #pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+    for(i = 0; i < size; i++) {
+        nmpc_ctx_t *ctx = &fleet->contexts[i];
+        enum nmpc_result_t result;
+
+        nmpc_ctx_preparation_step(ctx);
+        nmpc_ctx_feedback_step(ctx, &measurements[i * NMPC_STATE_DIM]);
+        result = nmpc_ctx_get_controls(ctx,
+                                       &controls[i * NMPC_CONTROL_DIM]);
+        if(new_references) {
+            nmpc_ctx_update_horizon(
+                ctx, &new_references[i * NMPC_REFERENCE_DIM]);
+        }
+
+        if(results) {
+            results[i] = result;
+        }
+    }
+}
+
+#if !defined(_WIN32)
+/*
+Asynchronous runtime state. The worker owns the context while preparing is
+set, and the caller owns it otherwise; the inputs for the next preparation
+step are written to the pending buffers by the caller, and taken by the
+worker before it starts. All of the flags and buffers are protected by
+lock, and changed is signalled whenever preparing or stopping changes.
+*/
+struct nmpc_runtime_t {
+    nmpc_ctx_t *ctx;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool preparing;
+    bool stopping;
+    bool shift_pending;
+    bool reference_pending;
+    bool wind_pending;
+    real_t reference[NMPC_REFERENCE_DIM];
+    real_t wind_velocity[3];
+};
+
+static void *runtime_worker(void *arg) {
+    nmpc_runtime_t *rt = (nmpc_runtime_t *)arg;
+    real_t reference[NMPC_REFERENCE_DIM], wind_velocity[3];
+    bool shift, update_reference, update_wind;
+
+    pthread_mutex_lock(&rt->lock);
+    for(;;) {
+        while(!rt->preparing && !rt->stopping) {
+            pthread_cond_wait(&rt->changed, &rt->lock);
+        }
+
+        /* Finish the step the caller has handed over before stopping. */
+        if(!rt->preparing) {
+            break;
+        }
+
+        shift = rt->shift_pending;
+        update_reference = rt->reference_pending;
+        update_wind = rt->wind_pending;
+        memcpy(reference, rt->reference, sizeof(reference));
+        memcpy(wind_velocity, rt->wind_velocity, sizeof(wind_velocity));
+        rt->shift_pending = false;
+        rt->reference_pending = false;
+        rt->wind_pending = false;
+        pthread_mutex_unlock(&rt->lock);
+
+        if(update_wind) {
+            nmpc_ctx_set_wind_velocity(rt->ctx, wind_velocity[0],
+                                       wind_velocity[1], wind_velocity[2]);
+        }
+        if(update_reference) {
+            nmpc_ctx_update_horizon(rt->ctx, reference);
+        } else if(shift) {
+            nmpc_ctx_shift_horizon(rt->ctx);
+        }
+        nmpc_ctx_preparation_step(rt->ctx);
+
+        pthread_mutex_lock(&rt->lock);
+        rt->preparing = false;
+        pthread_cond_broadcast(&rt->changed);
+    }
+    pthread_mutex_unlock(&rt->lock);
+
+    return NULL;
+}
+
+/*
+The worker's scheduling and affinity are set through its creation
+attributes, so that it never runs with the wrong ones.
+*/
+enum nmpc_result_t nmpc_ctx_runtime_start(struct nmpc_ctx_t *ctx,
+const struct nmpc_runtime_options_t *options) {
+    nmpc_runtime_t *rt;
+    pthread_attr_t attr;
+    struct sched_param param;
+    int32_t cpu = options ? options->cpu : -1,
+            priority = options ? options->priority : 0;
+    int status = 0;
+
+    assert(!ctx->runtime);
+
+#if defined(__linux__)
+    if(cpu >= CPU_SETSIZE) {
+        return NMPC_ERROR;
+    }
+#else
+    if(cpu >= 0) {
+        return NMPC_ERROR;
+    }
+#endif
+
+    rt = new (std::nothrow) nmpc_runtime_t();
+    if(!rt) {
+        return NMPC_ERROR;
+    }
+
+    rt->ctx = ctx;
+    rt->preparing = true;
+    rt->stopping = false;
+    rt->shift_pending = false;
+    rt->reference_pending = false;
+    rt->wind_pending = false;
+    pthread_mutex_init(&rt->lock, NULL);
+    pthread_cond_init(&rt->changed, NULL);
+
+    pthread_attr_init(&attr);
+    if(priority > 0) {
+        param.sched_priority = priority;
+        status |= pthread_attr_setinheritsched(&attr,
+                                               PTHREAD_EXPLICIT_SCHED);
+        status |= pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        status |= pthread_attr_setschedparam(&attr, &param);
+    }
+#if defined(__linux__)
+    if(cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        status |= pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+#endif
+    if(status == 0) {
+        status = pthread_create(&rt->worker, &attr, runtime_worker, rt);
+    }
+    pthread_attr_destroy(&attr);
+
+    if(status != 0) {
+        pthread_cond_destroy(&rt->changed);
+        pthread_mutex_destroy(&rt->lock);
+        delete rt;
+        return NMPC_ERROR;
+    }
+
+    ctx->runtime = rt;
+    return NMPC_OK;
+}
+
+void nmpc_ctx_runtime_stop(struct nmpc_ctx_t *ctx) {
+    nmpc_runtime_t *rt = ctx->runtime;
+
+    if(!rt) {
+        return;
+    }
+
+    pthread_mutex_lock(&rt->lock);
+    rt->stopping = true;
+    pthread_cond_broadcast(&rt->changed);
+    pthread_mutex_unlock(&rt->lock);
+    pthread_join(rt->worker, NULL);
+
+    if(rt->wind_pending) {
+        nmpc_ctx_set_wind_velocity(ctx, rt->wind_velocity[0],
+                                   rt->wind_velocity[1],
+                                   rt->wind_velocity[2]);
+    }
+
+    pthread_cond_destroy(&rt->changed);
+    pthread_mutex_destroy(&rt->lock);
+    delete rt;
+    ctx->runtime = NULL;
+}
+
+enum nmpc_result_t nmpc_ctx_runtime_feedback(struct nmpc_ctx_t *ctx,
+real_t measurement[NMPC_STATE_DIM], real_t new_reference[NMPC_REFERENCE_DIM],
+real_t controls[NMPC_CONTROL_DIM]) {
+    nmpc_runtime_t *rt = ctx->runtime;
+    enum nmpc_result_t result;
+
+    assert(rt && measurement && controls);
+
+    pthread_mutex_lock(&rt->lock);
+    while(rt->preparing) {
+        pthread_cond_wait(&rt->changed, &rt->lock);
+    }
+    pthread_mutex_unlock(&rt->lock);
+
+    nmpc_ctx_feedback_step(ctx, measurement);
+    result = nmpc_ctx_get_controls(ctx, controls);
+
+    pthread_mutex_lock(&rt->lock);
+    if(new_reference) {
+        memcpy(rt->reference, new_reference, sizeof(rt->reference));
+        rt->reference_pending = true;
+    }
+    rt->shift_pending = true;
+    rt->preparing = true;
+    pthread_cond_broadcast(&rt->changed);
+    pthread_mutex_unlock(&rt->lock);
+
+    return result;
+}
+
+void nmpc_ctx_runtime_set_wind_velocity(struct nmpc_ctx_t *ctx,
+real_t x, real_t y, real_t z) {
+    nmpc_runtime_t *rt = ctx->runtime;
+
+    assert(rt);
+
+    pthread_mutex_lock(&rt->lock);
+    rt->wind_velocity[0] = x;
+    rt->wind_velocity[1] = y;
+    rt->wind_velocity[2] = z;
+    rt->wind_pending = true;
+    pthread_mutex_unlock(&rt->lock);
+}
+#else
+/* There's no worker thread without pthreads. */
+enum nmpc_result_t nmpc_ctx_runtime_start(struct nmpc_ctx_t *ctx,
+const struct nmpc_runtime_options_t *options) {
+    (void)ctx;
+    (void)options;
+    return NMPC_ERROR;
+}
+
+void nmpc_ctx_runtime_stop(struct nmpc_ctx_t *ctx) {
+    (void)ctx;
+}
+
+enum nmpc_result_t nmpc_ctx_runtime_feedback(struct nmpc_ctx_t *ctx,
+real_t measurement[NMPC_STATE_DIM], real_t new_reference[NMPC_REFERENCE_DIM],
+real_t controls[NMPC_CONTROL_DIM]) {
+    (void)ctx;
+    (void)measurement;
+    (void)new_reference;
+    (void)controls;
+    assert(false);
+    return NMPC_ERROR;
+}
+
+void nmpc_ctx_runtime_set_wind_velocity(struct nmpc_ctx_t *ctx,
+real_t x, real_t y, real_t z) {
+    (void)ctx;
+    (void)x;
+    (void)y;
+    (void)z;
+    assert(false);
+}
+#endif
+
+/* The single-instance interface works on the default context. */
+void nmpc_init() {
+    nmpc_ctx_init(&default_ctx);
+}
+
+void nmpc_preparation_step() {
+    nmpc_ctx_preparation_step(&default_ctx);
+}
+
+void nmpc_feedback_step(real_t measurement[NMPC_STATE_DIM]) {
+    nmpc_ctx_feedback_step(&default_ctx, measurement);
+}
+
+enum nmpc_result_t nmpc_get_controls(real_t controls[NMPC_CONTROL_DIM]) {
+    return nmpc_ctx_get_controls(&default_ctx, controls);
+}
+
+void nmpc_update_horizon(real_t new_reference[NMPC_REFERENCE_DIM]) {
+    nmpc_ctx_update_horizon(&default_ctx, new_reference);
+}
+
+void nmpc_shift_horizon() {
+    nmpc_ctx_shift_horizon(&default_ctx);
+}
+
+void nmpc_set_state_weights(real_t coeffs[NMPC_DELTA_DIM]) {
+    nmpc_ctx_set_state_weights(&default_ctx, coeffs);
+}
+
+void nmpc_set_control_weights(real_t coeffs[NMPC_CONTROL_DIM]) {
+    nmpc_ctx_set_control_weights(&default_ctx, coeffs);
+}
+
+void nmpc_set_terminal_weights(real_t coeffs[NMPC_DELTA_DIM]) {
+    nmpc_ctx_set_terminal_weights(&default_ctx, coeffs);
+}
+
+void nmpc_set_lower_control_bound(real_t coeffs[NMPC_CONTROL_DIM]) {
+    nmpc_ctx_set_lower_control_bound(&default_ctx, coeffs);
+}
+
+void nmpc_set_upper_control_bound(real_t coeffs[NMPC_CONTROL_DIM]) {
+    nmpc_ctx_set_upper_control_bound(&default_ctx, coeffs);
+}
+
+void nmpc_set_reference_point(real_t coeffs[NMPC_REFERENCE_DIM],
+uint32_t i) {
+    nmpc_ctx_set_reference_point(&default_ctx, coeffs, i);
+}
+
+void nmpc_set_reference_horizon(const real_t references[], uint32_t n) {
+    nmpc_ctx_set_reference_horizon(&default_ctx, references, n);
+}
+
+enum nmpc_result_t nmpc_queue_reference_point(
+real_t coeffs[NMPC_REFERENCE_DIM], uint32_t step) {
+    return nmpc_ctx_queue_reference_point(&default_ctx, coeffs, step);
+}
+
+uint32_t nmpc_get_reference_step() {
+    return nmpc_ctx_get_reference_step(&default_ctx);
+}
+
+void nmpc_set_preparation_threads(uint32_t n) {
+    nmpc_ctx_set_preparation_threads(&default_ctx, n);
 }
 
 void nmpc_set_wind_velocity(real_t x, real_t y, real_t z) {
-    dynamics_model.set_wind_velocity(Vector3r(x, y, z));
+    nmpc_ctx_set_wind_velocity(&default_ctx, x, y, z);
 }
 
 void nmpc_fixedwingdynamics_set_position(
@@ -175,7 +752,7 @@ float dt, real_t control_vector[NMPC_CONTROL_DIM]) {
     current = integrator.integrate(
         current,
         ControlVector(control_vector),
-        &dynamics_model,
+        &default_ctx.dynamics_model,
         dt);
 }
 
@@ -188,11 +765,100 @@ uint32_t nmpc_config_get_control_dim() {
 }
 
 uint32_t nmpc_config_get_horizon_length() {
-    return OCP_HORIZON_LENGTH;
+    return nmpc_ctx_config_get_horizon_length(&default_ctx);
+}
+
+uint32_t nmpc_config_get_max_horizon_length() {
+    return OCP_MAX_HORIZON_LENGTH;
+}
+
+uint32_t nmpc_config_get_horizon_steps() {
+    return nmpc_ctx_config_get_horizon_steps(&default_ctx);
 }
 
 real_t nmpc_config_get_step_length() {
-    return OCP_STEP_LENGTH;
+    return nmpc_ctx_config_get_step_length(&default_ctx);
+}
+
+void nmpc_config_set_horizon_length(uint32_t length) {
+    nmpc_ctx_config_set_horizon_length(&default_ctx, length);
+}
+
+void nmpc_config_set_step_length(real_t length) {
+    nmpc_ctx_config_set_step_length(&default_ctx, length);
+}
+
+void nmpc_config_set_integration_substeps(uint32_t substeps) {
+    nmpc_ctx_config_set_integration_substeps(&default_ctx, substeps);
+}
+
+void nmpc_config_set_integration_tolerance(real_t tolerance) {
+    nmpc_ctx_config_set_integration_tolerance(&default_ctx, tolerance);
+}
+
+void nmpc_config_set_horizon_grid(const uint32_t steps[], uint32_t length) {
+    nmpc_ctx_config_set_horizon_grid(&default_ctx, steps, length);
+}
+
+void nmpc_config_set_move_blocking(const uint32_t blocks[], uint32_t length) {
+    nmpc_ctx_config_set_move_blocking(&default_ctx, blocks, length);
+}
+
+void nmpc_config_set_qp_condensing(uint32_t block_size) {
+    nmpc_ctx_config_set_qp_condensing(&default_ctx, block_size);
+}
+
+void nmpc_config_set_qp_backend(enum nmpc_qp_backend_t backend) {
+    nmpc_ctx_config_set_qp_backend(&default_ctx, backend);
+}
+
+void nmpc_get_timing_stats(
+struct nmpc_timing_stats_t stats[NMPC_TIMING_PHASES]) {
+    nmpc_ctx_get_timing_stats(&default_ctx, stats);
+}
+
+void nmpc_reset_timing_stats() {
+    nmpc_ctx_reset_timing_stats(&default_ctx);
+}
+
+uint32_t nmpc_get_qp_iterations() {
+    return nmpc_ctx_get_qp_iterations(&default_ctx);
+}
+
+void nmpc_config_set_linearisation_cache_tolerance(real_t tolerance) {
+    nmpc_ctx_config_set_linearisation_cache_tolerance(
+        &default_ctx, tolerance);
+}
+
+void nmpc_get_linearisation_cache_stats(uint32_t *hits, uint32_t *misses) {
+    nmpc_ctx_get_linearisation_cache_stats(&default_ctx, hits, misses);
+}
+
+void nmpc_reset_linearisation_cache_stats() {
+    nmpc_ctx_reset_linearisation_cache_stats(&default_ctx);
+}
+
+void nmpc_config_set_jacobian_refresh(uint32_t interval, uint32_t stages) {
+    nmpc_ctx_config_set_jacobian_refresh(&default_ctx, interval, stages);
+}
+
+enum nmpc_result_t nmpc_runtime_start(
+const struct nmpc_runtime_options_t *options) {
+    return nmpc_ctx_runtime_start(&default_ctx, options);
+}
+
+void nmpc_runtime_stop() {
+    nmpc_ctx_runtime_stop(&default_ctx);
+}
+
+enum nmpc_result_t nmpc_runtime_feedback(real_t measurement[NMPC_STATE_DIM],
+real_t new_reference[NMPC_REFERENCE_DIM], real_t controls[NMPC_CONTROL_DIM]) {
+    return nmpc_ctx_runtime_feedback(&default_ctx, measurement, new_reference,
+                                     controls);
+}
+
+void nmpc_runtime_set_wind_velocity(real_t x, real_t y, real_t z) {
+    nmpc_ctx_runtime_set_wind_velocity(&default_ctx, x, y, z);
 }
 
 enum nmpc_precision_t nmpc_config_get_precision() {
@@ -54,6 +54,7 @@ void nmpc_preparation_step(void);
 void nmpc_feedback_step(real_t measurement[NMPC_STATE_DIM]);
 enum nmpc_result_t nmpc_get_controls(real_t controls[NMPC_CONTROL_DIM]);
 void nmpc_update_horizon(real_t new_reference[NMPC_REFERENCE_DIM]);
+void nmpc_shift_horizon(void);
 
 /* Functions for setting weights and bounds for the OCP solver. */
 void nmpc_set_state_weights(real_t coeffs[NMPC_DELTA_DIM]);
@@ -64,6 +65,44 @@ void nmpc_set_upper_control_bound(real_t coeffs[NMPC_CONTROL_DIM]);
 void nmpc_set_reference_point(real_t coeffs[NMPC_REFERENCE_DIM],
 uint32_t i);
 
+/*
+Set reference points 0 to n - 1 at once, from n reference vectors stored
+one after another (point i starts at references[i * NMPC_REFERENCE_DIM]);
+n is at most nmpc_config_get_horizon_steps() + 1. Use this to load a whole
+new trajectory: the next preparation step re-linearises every interval,
+including their Jacobians, in a single pass.
+*/
+void nmpc_set_reference_horizon(const real_t references[], uint32_t n);
+
+/*
+Reference queue, for feeding the reference trajectory from another thread
+such as a mission planner. nmpc_queue_reference_point() is the only function
+which may be called concurrently with the others (including the runtime
+below), and only from one thread at a time; it never blocks, and returns
+NMPC_ERROR if the queue is full (OCP_REFERENCE_QUEUE_LENGTH points).
+
+Each point is tagged with the base step of the trajectory it belongs to,
+counted from when the instance was created; nmpc_get_reference_step()
+returns the step of reference point 0, and every nmpc_update_horizon() or
+nmpc_shift_horizon() call moves it on by one. Queued points are applied at
+the start of the next preparation step, in order, with point `step` going
+to reference point step - nmpc_get_reference_step(). Points which have
+already been shifted out of the horizon are dropped, and a point beyond the
+end of the horizon waits in the queue (along with the points queued after
+it) until the horizon reaches it. nmpc_shift_horizon() shifts the horizon
+without adding a point, leaving the last point to be replaced from the
+queue.
+*/
+enum nmpc_result_t nmpc_queue_reference_point(
+real_t coeffs[NMPC_REFERENCE_DIM], uint32_t step);
+uint32_t nmpc_get_reference_step(void);
+
+/*
+Set the number of worker threads used by the preparation step. Ignored by
+implementations which are not built with OpenMP support.
+*/
+void nmpc_set_preparation_threads(uint32_t n);
+
 /* Function to set the wind estimate for the dynamics model. */
 void nmpc_set_wind_velocity(real_t x, real_t y, real_t z);
 
@@ -95,9 +134,287 @@ enum nmpc_precision_t {
 uint32_t nmpc_config_get_state_dim(void);
 uint32_t nmpc_config_get_control_dim(void);
 uint32_t nmpc_config_get_horizon_length(void);
+uint32_t nmpc_config_get_max_horizon_length(void);
+uint32_t nmpc_config_get_horizon_steps(void);
 real_t nmpc_config_get_step_length(void);
 enum nmpc_precision_t nmpc_config_get_precision(void);
 
+/*
+Functions to change the horizon length (up to the compiled maximum) and the
+step length. These must be called before nmpc_init(); the reference
+trajectory must then be set for all horizon steps + 1 points.
+
+nmpc_config_set_horizon_grid sets up a non-uniform grid of `length`
+intervals, where interval i covers steps[i] base steps of the step length.
+The reference trajectory and nmpc_update_horizon stay on the base grid, so
+the number of reference points is given by nmpc_config_get_horizon_steps().
+
+nmpc_config_set_move_blocking sets up the same grid, but each interval is a
+block of base steps sharing one control input, and the dynamics are still
+integrated with the base step length across the block.
+*/
+void nmpc_config_set_horizon_length(uint32_t length);
+void nmpc_config_set_horizon_grid(const uint32_t steps[], uint32_t length);
+void nmpc_config_set_move_blocking(const uint32_t blocks[], uint32_t length);
+void nmpc_config_set_step_length(real_t length);
+
+/*
+nmpc_config_set_integration_substeps divides the integration across each
+interval (or each base step, for a move-blocked interval) into that many
+steps, so that longer intervals can be used without losing accuracy.
+
+With a non-zero tolerance, nmpc_config_set_integration_tolerance lets an
+integrator with an error estimate (NMPC_INTEGRATOR_RK45 in config.h) choose
+its own steps across each interval, starting from the fixed steps above and
+taking at most OCP_MAX_INTEGRATION_STEPS. Other integrators ignore the
+tolerance, as does the C66x version, which always uses fixed RK4 steps.
+*/
+void nmpc_config_set_integration_substeps(uint32_t substeps);
+void nmpc_config_set_integration_tolerance(real_t tolerance);
+
+/*
+Selects how the QP is solved; must be called before nmpc_init(). A block
+size of 0 (the default) solves the sparse multiple-shooting QP with qpDUNES.
+A block size of at least the horizon length fully condenses the QP onto the
+controls and solves it with a dense solver, which is usually faster for
+short horizons. Anything in between partially condenses blocks of that many
+intervals into dense qpDUNES stages.
+*/
+void nmpc_config_set_qp_condensing(uint32_t block_size);
+
+/*
+Selects the QP solver; must be called before nmpc_init(). NMPC_QP_QPDUNES
+(the default) uses qpDUNES, with the condensing options above.
+NMPC_QP_DENSE fully condenses the QP and solves it with the dense solver,
+regardless of the block size. NMPC_QP_RICCATI solves the sparse QP with a
+Riccati recursion, which needs no allocation and scales linearly with the
+horizon length.
+*/
+enum nmpc_qp_backend_t {
+    NMPC_QP_QPDUNES = 0,
+    NMPC_QP_DENSE = 1,
+    NMPC_QP_RICCATI = 2
+};
+
+void nmpc_config_set_qp_backend(enum nmpc_qp_backend_t backend);
+
+/*
+Latency statistics for each phase of the NMPC iteration, in seconds. The
+count, minimum, maximum and mean cover every sample since the statistics
+were last reset; the percentiles cover the last OCP_TIMING_WINDOW samples.
+The parts of the QP solve are only measured by the C66x version, when it's
+configured with QPDUNES_MEASURE_TIMINGS=ON, and have a count of zero
+otherwise.
+*/
+enum nmpc_timing_phase_t {
+    NMPC_TIMING_PREPARATION = 0,
+    NMPC_TIMING_SOLVE_IVPS = 1,
+    NMPC_TIMING_QP_UPDATE = 2,
+    NMPC_TIMING_FEEDBACK = 3,
+    NMPC_TIMING_INITIAL_CONSTRAINT = 4,
+    NMPC_TIMING_QP_SOLVE = 5,
+    NMPC_TIMING_QP_NEWTON_SETUP = 6,
+    NMPC_TIMING_QP_FACTORISATION = 7,
+    NMPC_TIMING_QP_LINE_SEARCH = 8,
+    NMPC_TIMING_QP_STAGE_QPS = 9,
+    NMPC_TIMING_UPDATE_HORIZON = 10,
+    NMPC_TIMING_PHASES = 11
+};
+
+struct nmpc_timing_stats_t {
+    uint32_t count;
+    real_t min;
+    real_t max;
+    real_t mean;
+    real_t p50;
+    real_t p90;
+    real_t p99;
+};
+
+void nmpc_get_timing_stats(
+    struct nmpc_timing_stats_t stats[NMPC_TIMING_PHASES]);
+void nmpc_reset_timing_stats(void);
+
+/* Number of QP solver iterations taken by the last feedback step. */
+uint32_t nmpc_get_qp_iterations(void);
+
+/*
+Linearisation cache (see OCP_LINEARISATION_CACHE_SIZE in config.h), which
+is enabled by a non-zero tolerance. The statistics count the intervals the
+preparation steps found (hits) and didn't find (misses) in the cache since
+they were last reset. The C66x version has no cache, so it ignores the
+tolerance and reports no hits or misses.
+*/
+void nmpc_config_set_linearisation_cache_tolerance(real_t tolerance);
+void nmpc_get_linearisation_cache_stats(uint32_t *hits, uint32_t *misses);
+void nmpc_reset_linearisation_cache_stats(void);
+
+/*
+Jacobian refresh schedule (see OCP_JACOBIAN_REFRESH_INTERVAL in config.h):
+all of the Jacobians are recalculated on every interval'th preparation
+step, and those of the first stages intervals on every step.
+*/
+void nmpc_config_set_jacobian_refresh(uint32_t interval, uint32_t stages);
+
+/*
+Handle-based interface for running several independent controllers in one
+process. The functions above operate on a default instance; each function
+below does the same thing as its counterpart above, on the instance given.
+Each instance has its own OCP, QP solver workspace, wind estimate and
+timing statistics, and nmpc_config_* settings apply only to it.
+
+nmpc_create() allocates an instance with the default configuration, or
+returns NULL if there isn't enough memory, so instances should be created
+at start-up. Different instances can be used from different threads at the
+same time, but each instance must only be used by one thread at a time.
+The nmpc_fixedwingdynamics_* functions are not per-instance.
+*/
+struct nmpc_ctx_t;
+
+struct nmpc_ctx_t *nmpc_create(void);
+void nmpc_destroy(struct nmpc_ctx_t *ctx);
+
+void nmpc_ctx_init(struct nmpc_ctx_t *ctx);
+void nmpc_ctx_preparation_step(struct nmpc_ctx_t *ctx);
+void nmpc_ctx_feedback_step(struct nmpc_ctx_t *ctx,
+real_t measurement[NMPC_STATE_DIM]);
+enum nmpc_result_t nmpc_ctx_get_controls(struct nmpc_ctx_t *ctx,
+real_t controls[NMPC_CONTROL_DIM]);
+void nmpc_ctx_update_horizon(struct nmpc_ctx_t *ctx,
+real_t new_reference[NMPC_REFERENCE_DIM]);
+void nmpc_ctx_shift_horizon(struct nmpc_ctx_t *ctx);
+
+void nmpc_ctx_set_state_weights(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_DELTA_DIM]);
+void nmpc_ctx_set_control_weights(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_CONTROL_DIM]);
+void nmpc_ctx_set_terminal_weights(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_DELTA_DIM]);
+void nmpc_ctx_set_lower_control_bound(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_CONTROL_DIM]);
+void nmpc_ctx_set_upper_control_bound(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_CONTROL_DIM]);
+void nmpc_ctx_set_reference_point(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_REFERENCE_DIM], uint32_t i);
+void nmpc_ctx_set_reference_horizon(struct nmpc_ctx_t *ctx,
+const real_t references[], uint32_t n);
+enum nmpc_result_t nmpc_ctx_queue_reference_point(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_REFERENCE_DIM], uint32_t step);
+uint32_t nmpc_ctx_get_reference_step(const struct nmpc_ctx_t *ctx);
+void nmpc_ctx_set_preparation_threads(struct nmpc_ctx_t *ctx, uint32_t n);
+void nmpc_ctx_set_wind_velocity(struct nmpc_ctx_t *ctx,
+real_t x, real_t y, real_t z);
+
+uint32_t nmpc_ctx_config_get_horizon_length(const struct nmpc_ctx_t *ctx);
+uint32_t nmpc_ctx_config_get_horizon_steps(const struct nmpc_ctx_t *ctx);
+real_t nmpc_ctx_config_get_step_length(const struct nmpc_ctx_t *ctx);
+void nmpc_ctx_config_set_horizon_length(struct nmpc_ctx_t *ctx,
+uint32_t length);
+void nmpc_ctx_config_set_horizon_grid(struct nmpc_ctx_t *ctx,
+const uint32_t steps[], uint32_t length);
+void nmpc_ctx_config_set_move_blocking(struct nmpc_ctx_t *ctx,
+const uint32_t blocks[], uint32_t length);
+void nmpc_ctx_config_set_step_length(struct nmpc_ctx_t *ctx, real_t length);
+void nmpc_ctx_config_set_integration_substeps(struct nmpc_ctx_t *ctx,
+uint32_t substeps);
+void nmpc_ctx_config_set_integration_tolerance(struct nmpc_ctx_t *ctx,
+real_t tolerance);
+void nmpc_ctx_config_set_qp_condensing(struct nmpc_ctx_t *ctx,
+uint32_t block_size);
+void nmpc_ctx_config_set_qp_backend(struct nmpc_ctx_t *ctx,
+enum nmpc_qp_backend_t backend);
+
+void nmpc_ctx_get_timing_stats(const struct nmpc_ctx_t *ctx,
+struct nmpc_timing_stats_t stats[NMPC_TIMING_PHASES]);
+void nmpc_ctx_reset_timing_stats(struct nmpc_ctx_t *ctx);
+uint32_t nmpc_ctx_get_qp_iterations(const struct nmpc_ctx_t *ctx);
+void nmpc_ctx_config_set_linearisation_cache_tolerance(struct nmpc_ctx_t *ctx,
+real_t tolerance);
+void nmpc_ctx_get_linearisation_cache_stats(const struct nmpc_ctx_t *ctx,
+uint32_t *hits, uint32_t *misses);
+void nmpc_ctx_reset_linearisation_cache_stats(struct nmpc_ctx_t *ctx);
+void nmpc_ctx_config_set_jacobian_refresh(struct nmpc_ctx_t *ctx,
+uint32_t interval, uint32_t stages);
+
+/*
+Batch interface for running a fleet of independent instances, which are
+allocated together in one contiguous block by nmpc_fleet_create() (NULL is
+returned if there isn't enough memory). Each instance is configured and
+initialised through the handle returned by nmpc_fleet_get_ctx().
+
+nmpc_fleet_step() runs one NMPC iteration for every instance -- the
+preparation step, the feedback step and a horizon update, in the same order
+as the single-instance interface -- and then fetches the controls. The
+arrays are indexed by instance: measurement i starts at
+measurements[i * NMPC_STATE_DIM], reference i at
+new_references[i * NMPC_REFERENCE_DIM], and so on. If new_references is
+NULL the horizons aren't updated, and results may be NULL if the result of
+each solve isn't needed.
+
+When built with OpenMP, the instances are spread across
+nmpc_fleet_set_threads() threads, or the OpenMP default number if that is
+0 (the default). Each instance's own preparation threads are then only
+used if nested parallelism is enabled.
+*/
+struct nmpc_fleet_t;
+
+struct nmpc_fleet_t *nmpc_fleet_create(uint32_t size);
+void nmpc_fleet_destroy(struct nmpc_fleet_t *fleet);
+uint32_t nmpc_fleet_get_size(const struct nmpc_fleet_t *fleet);
+struct nmpc_ctx_t *nmpc_fleet_get_ctx(struct nmpc_fleet_t *fleet,
+uint32_t i);
+void nmpc_fleet_set_threads(struct nmpc_fleet_t *fleet, uint32_t n);
+void nmpc_fleet_step(struct nmpc_fleet_t *fleet, real_t measurements[],
+real_t new_references[], real_t controls[], enum nmpc_result_t results[]);
+
+/*
+Asynchronous runtime, which runs the preparation step on a worker thread so
+that the control latency is just the feedback step. The runtime is started
+once the instance has been initialised and its reference trajectory set,
+and the worker runs the first preparation step straight away.
+
+Each call to nmpc_runtime_feedback() waits for the preparation step to
+finish (only if it hasn't already), runs the feedback step on the calling
+thread and fetches the controls. It then hands new_reference to the worker,
+which updates the horizon and runs the next preparation step while the
+caller applies the controls. new_reference may be NULL to shift the horizon
+with nmpc_shift_horizon() instead, when the reference trajectory comes from
+the reference queue. Wind estimates given to
+nmpc_runtime_set_wind_velocity() are buffered in the same way, and take
+effect from the next preparation step.
+Until the runtime is stopped, no other functions may be called on the
+instance; nmpc_runtime_stop() waits for the worker to finish and applies
+any wind estimate it didn't get to.
+
+The options pin the worker to a CPU (-1 for any), and give it a SCHED_FIFO
+priority (0 keeps the default scheduling); NULL selects the defaults.
+nmpc_runtime_start() returns NMPC_ERROR if the worker can't be created with
+those options, for instance without permission to use real-time
+priorities. CPU affinity is only available on Linux. The C66x version has
+no worker thread; it ignores the options and runs the horizon update and
+preparation step at the end of each nmpc_runtime_feedback() call instead.
+*/
+struct nmpc_runtime_options_t {
+    int32_t cpu;
+    int32_t priority;
+};
+
+enum nmpc_result_t nmpc_runtime_start(
+    const struct nmpc_runtime_options_t *options);
+void nmpc_runtime_stop(void);
+enum nmpc_result_t nmpc_runtime_feedback(real_t measurement[NMPC_STATE_DIM],
+real_t new_reference[NMPC_REFERENCE_DIM], real_t controls[NMPC_CONTROL_DIM]);
+void nmpc_runtime_set_wind_velocity(real_t x, real_t y, real_t z);
+
+enum nmpc_result_t nmpc_ctx_runtime_start(struct nmpc_ctx_t *ctx,
+const struct nmpc_runtime_options_t *options);
+void nmpc_ctx_runtime_stop(struct nmpc_ctx_t *ctx);
+enum nmpc_result_t nmpc_ctx_runtime_feedback(struct nmpc_ctx_t *ctx,
+real_t measurement[NMPC_STATE_DIM], real_t new_reference[NMPC_REFERENCE_DIM],
+real_t controls[NMPC_CONTROL_DIM]);
+void nmpc_ctx_runtime_set_wind_velocity(struct nmpc_ctx_t *ctx,
+real_t x, real_t y, real_t z);
+
 #ifdef __cplusplus
 }
 #endif
@@ -38,6 +38,34 @@ SOFTWARE.
 
 #include "qpDUNES/qpDUNES.h"
 
+#ifdef _TMS320C6X
+#include <c6x.h>
+
+/* Core clock (Hz) used to convert the time stamp counter to seconds. */
+#ifndef NMPC_CPU_CLOCK_HZ
+#define NMPC_CPU_CLOCK_HZ 1.25e9
+#endif
+#else
+#include <time.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+Index accesses for the reference queue, which is written by one thread (or
+interrupt handler) and read by the preparation step. Without the GCC atomics,
+volatile accesses rely on the C66x cores executing in order.
+*/
+#if defined(__GNUC__)
+#define _QUEUE_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _QUEUE_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define _QUEUE_LOAD(p) (*(volatile uint32_t *)(p))
+#define _QUEUE_STORE(p, v) (*(volatile uint32_t *)(p) = (v))
+#endif
+
 /*
 Use static allocation for qpDUNES structures, since the sizes are all known at
 compile time -- see qpDUNES/setup_qp.c:40-267
@@ -45,7 +73,7 @@ compile time -- see qpDUNES/setup_qp.c:40-267
 #define nX NMPC_DELTA_DIM
 #define nU NMPC_CONTROL_DIM
 #define nD 0
-#define nI OCP_HORIZON_LENGTH
+#define nI OCP_MAX_HORIZON_LENGTH
 #define nZ (nX + nU)
 #define nV nZ
 
@@ -279,46 +307,135 @@ static inline float fatan2(float y, float x) {
 #undef PIBY2_FLOAT
 }
 
-static real_t wind_velocity[3];
+/*
+Latency statistics for each phase -- see nmpc_get_timing_stats(). Samples
+are written to the window as a ring buffer.
+*/
+struct timing_stats_t {
+    uint32_t count;
+    real_t min;
+    real_t max;
+    double total;
+    real_t window[OCP_TIMING_WINDOW];
+};
+
+/* A queued reference point -- see nmpc_queue_reference_point(). */
+struct queued_reference_t {
+    real_t point[NMPC_REFERENCE_DIM];
+    uint32_t step;
+};
 
-/* 26052B */
-static real_t ocp_state_reference[(OCP_HORIZON_LENGTH + 1u) * NMPC_STATE_DIM];
+/*
+Everything belonging to one controller instance -- about 680KB, most of it
+the qpDUNES data. The nmpc_* functions use the statically-allocated
+default_ctx; nmpc_create() allocates others.
+*/
+struct nmpc_ctx_t {
+    real_t wind_velocity[3];
 
-/* 6000B */
-static real_t ocp_control_reference[OCP_HORIZON_LENGTH * NMPC_CONTROL_DIM];
+    /*
+    Horizon length (number of intervals) and base step length in use.
+    Storage is allocated for the maximum sizes, so these can be changed
+    before nmpc_init() without allocating. Interval i covers
+    interval_steps[i] base steps starting at base step interval_offset[i];
+    horizon_steps is the total number of base steps in the horizon.
+    */
+    uint32_t horizon_length;
+    uint32_t horizon_steps;
+    real_t step_length;
+    uint32_t interval_steps[OCP_MAX_HORIZON_LENGTH];
+    uint32_t interval_offset[OCP_MAX_HORIZON_LENGTH + 1u];
+
+    /*
+    If set, each interval is a block of base steps sharing one control
+    input, integrated one base step at a time.
+    */
+    bool move_blocking;
 
-static real_t ocp_lower_state_bound[NMPC_DELTA_DIM];
-static real_t ocp_upper_state_bound[NMPC_DELTA_DIM];
-static real_t ocp_lower_control_bound[NMPC_CONTROL_DIM];
-static real_t ocp_upper_control_bound[NMPC_CONTROL_DIM];
-static real_t ocp_state_weights[NMPC_DELTA_DIM]; /* diagonal only */
-static real_t ocp_terminal_weights[NMPC_DELTA_DIM]; /* diagonal only */
-static real_t ocp_control_weights[NMPC_CONTROL_DIM]; /* diagonal only */
+    /* RK4 steps per interval, or per base step of a move-blocked interval */
+    uint32_t integration_substeps;
 
-static struct static_qpdata_t ocp_qp_data;
+    /*
+    Jacobian refresh schedule (see config.h), and the number of preparation
+    steps left until the next full refresh. Intervals which aren't refreshed
+    keep the Jacobian already in their qpDUNES data.
+    */
+    uint32_t jacobian_refresh_interval;
+    uint32_t jacobian_refresh_stages;
+    uint32_t jacobian_refresh_countdown;
 
-/* Current control solution */
-static real_t ocp_control_value[NMPC_CONTROL_DIM];
-static bool ocp_last_result;
+    /* Reference trajectory on the base grid -- 26052B */
+    real_t state_reference[(OCP_MAX_HORIZON_STEPS + 1u) * NMPC_STATE_DIM];
+
+    /* 6000B */
+    real_t control_reference[OCP_MAX_HORIZON_STEPS * NMPC_CONTROL_DIM];
+
+    /*
+    Trajectory step of reference point 0, and the reference queue -- 17KB.
+    The head and tail count the points taken and added, and are each only
+    written by one side.
+    */
+    uint32_t reference_step;
+    struct queued_reference_t reference_queue[OCP_REFERENCE_QUEUE_LENGTH];
+    uint32_t reference_queue_head;
+    uint32_t reference_queue_tail;
+
+    real_t lower_state_bound[NMPC_DELTA_DIM];
+    real_t upper_state_bound[NMPC_DELTA_DIM];
+    real_t lower_control_bound[NMPC_CONTROL_DIM];
+    real_t upper_control_bound[NMPC_CONTROL_DIM];
+    real_t state_weights[NMPC_DELTA_DIM]; /* diagonal only */
+    real_t terminal_weights[NMPC_DELTA_DIM]; /* diagonal only */
+    real_t control_weights[NMPC_CONTROL_DIM]; /* diagonal only */
+
+    struct static_qpdata_t qp_data;
+
+    /* Current control solution */
+    real_t control_value[NMPC_CONTROL_DIM];
+    bool last_result;
+
+    /* 11.5KB */
+    struct timing_stats_t timing_stats[NMPC_TIMING_PHASES];
+};
+
+static struct nmpc_ctx_t default_ctx = {
+    .horizon_length = OCP_HORIZON_LENGTH,
+    .horizon_steps = OCP_HORIZON_LENGTH,
+    .step_length = OCP_STEP_LENGTH,
+    .integration_substeps = OCP_INTEGRATION_SUBSTEPS,
+    .jacobian_refresh_interval = OCP_JACOBIAN_REFRESH_INTERVAL,
+    .jacobian_refresh_stages = OCP_JACOBIAN_REFRESH_STAGES
+};
 
 static void _state_model(real_t *restrict out, const real_t *restrict state,
-const real_t *restrict control);
+const real_t *restrict control, const real_t *restrict wind_velocity);
 static void _state_integrate_rk4(real_t *restrict out,
 const real_t *restrict state, const real_t *restrict control,
-const real_t delta);
+const real_t *restrict wind_velocity, const real_t delta);
+static void _state_integrate_steps(real_t *restrict out,
+const real_t *restrict state, const real_t *restrict control,
+const real_t *restrict wind_velocity, const real_t delta,
+const uint32_t steps);
 static void _state_x8_dynamics(real_t *restrict out,
-const real_t *restrict state, const real_t *restrict control);
+const real_t *restrict state, const real_t *restrict control,
+const real_t *restrict wind_velocity);
 static void _state_to_delta(real_t *delta, const real_t *restrict s1,
 const real_t *restrict s2);
-static void _solve_interval_ivp(const real_t *restrict state_ref,
-const real_t *restrict control_ref, real_t *restrict out_jacobian,
+static void _solve_interval_ivp(const struct nmpc_ctx_t *ctx,
+const real_t *restrict state_ref, const real_t *restrict control_ref,
+const real_t delta, const uint32_t substeps, real_t *restrict out_jacobian,
 const real_t *restrict next_state_ref, real_t *restrict out_residuals);
-static void _initial_constraint(const real_t measurement[NMPC_STATE_DIM]);
-static bool _solve_qp(void);
+static void _initial_constraint(struct nmpc_ctx_t *ctx,
+const real_t measurement[NMPC_STATE_DIM]);
+static bool _solve_qp(struct nmpc_ctx_t *ctx);
+static void _drain_references(struct nmpc_ctx_t *ctx);
+static double _get_time(void);
+static void _record_timing(struct nmpc_ctx_t *ctx,
+enum nmpc_timing_phase_t phase, real_t seconds);
 
 
 static void _state_model(real_t *restrict out, const real_t *restrict state,
-const real_t *restrict control) {
+const real_t *restrict control, const real_t *restrict wind_velocity) {
     assert(out && state && control);
     _nassert((size_t)out % 4 == 0);
     _nassert((size_t)state % 4 == 0);
@@ -326,7 +443,7 @@ const real_t *restrict control) {
 
     /* See src/state.cpp */
     real_t accel[6];
-    _state_x8_dynamics(accel, state, control);
+    _state_x8_dynamics(accel, state, control, wind_velocity);
 
     /* Change in position */
     out[0] = state[3];
@@ -364,7 +481,7 @@ const real_t *restrict control) {
 
 static void _state_integrate_rk4(real_t *restrict out,
 const real_t *restrict state, const real_t *restrict control,
-const real_t delta) {
+const real_t *restrict wind_velocity, const real_t delta) {
     assert(out && state && control);
     _nassert((size_t)out % 4 == 0);
     _nassert((size_t)state % 4 == 0);
@@ -375,19 +492,19 @@ const real_t delta) {
            d[NMPC_STATE_DIM], temp[NMPC_STATE_DIM];
 
     /* a = in.model() */
-    _state_model(a, state, control);
+    _state_model(a, state, control, wind_velocity);
 
     /* b = (in + 0.5 * delta * a).model() */
     state_scale_add(temp, a, delta * 0.5f, state);
-    _state_model(b, temp, control);
+    _state_model(b, temp, control, wind_velocity);
 
     /* c = (in + 0.5 * delta * b).model() */
     state_scale_add(temp, b, delta * 0.5f, state);
-    _state_model(c, temp, control);
+    _state_model(c, temp, control, wind_velocity);
 
     /* d = (in + delta * c).model */
     state_scale_add(temp, c, delta, state);
-    _state_model(d, temp, control);
+    _state_model(d, temp, control, wind_velocity);
 
     /* in = in + (delta / 6.0) * (a + (b * 2.0) + (c * 2.0) + d) */
     real_t delta_on_3 = delta * (1.0f/3.0f), delta_on_6 = delta * (1.0f/6.0f);
@@ -400,7 +517,8 @@ const real_t delta) {
 }
 
 static void _state_x8_dynamics(real_t *restrict out,
-const real_t *restrict state, const real_t *restrict control) {
+const real_t *restrict state, const real_t *restrict control,
+const real_t *restrict wind_velocity) {
     assert(out && state && control);
     _nassert((size_t)out % 4 == 0);
     _nassert((size_t)state % 4 == 0);
@@ -580,15 +698,34 @@ const real_t *restrict s2) {
 
 #define IVP_PERTURBATION NMPC_EPS_4RT
 #define IVP_PERTURBATION_RECIP (real_t)(1.0 / NMPC_EPS_4RT)
-static void _solve_interval_ivp(const real_t *restrict state_ref,
-const real_t *restrict control_ref, real_t *restrict out_jacobian,
+/*
+Integrate a number of consecutive steps with the control held constant, as
+used for move-blocked intervals.
+*/
+static void _state_integrate_steps(real_t *restrict out,
+const real_t *restrict state, const real_t *restrict control,
+const real_t *restrict wind_velocity, const real_t delta,
+const uint32_t steps) {
+    real_t temp[NMPC_STATE_DIM];
+    uint32_t i;
+
+    _state_integrate_rk4(out, state, control, wind_velocity, delta);
+    for (i = 1u; i < steps; i++) {
+        memcpy(temp, out, sizeof(temp));
+        _state_integrate_rk4(out, temp, control, wind_velocity, delta);
+    }
+}
+
+static void _solve_interval_ivp(const struct nmpc_ctx_t *ctx,
+const real_t *restrict state_ref, const real_t *restrict control_ref,
+const real_t delta, const uint32_t substeps, real_t *restrict out_jacobian,
 const real_t *restrict next_state_ref, real_t *restrict out_residuals) {
     size_t i, j;
     real_t integrated_state[NMPC_STATE_DIM], new_state[NMPC_STATE_DIM];
 
     /* Solve the initial value problem at this horizon step. */
-    _state_integrate_rk4(integrated_state, state_ref, control_ref,
-                         OCP_STEP_LENGTH);
+    _state_integrate_steps(integrated_state, state_ref, control_ref,
+                           ctx->wind_velocity, delta, substeps);
 
     /*
     Calculate integration residuals -- the difference between the integrated
@@ -641,15 +778,15 @@ const real_t *restrict next_state_ref, real_t *restrict out_residuals) {
             precision.
             */
             perturbation *=
-                (ocp_upper_control_bound[i - NMPC_DELTA_DIM] -
-                ocp_lower_control_bound[i - NMPC_DELTA_DIM]);
+                (ctx->upper_control_bound[i - NMPC_DELTA_DIM] -
+                ctx->lower_control_bound[i - NMPC_DELTA_DIM]);
             perturbation_recip = (real_t)1.0 / perturbation;
             perturbed_reference[i + 1u] += perturbation;
         }
 
-        _state_integrate_rk4(new_state, perturbed_reference,
-                             &perturbed_reference[NMPC_STATE_DIM],
-                             OCP_STEP_LENGTH);
+        _state_integrate_steps(new_state, perturbed_reference,
+                               &perturbed_reference[NMPC_STATE_DIM],
+                               ctx->wind_velocity, delta, substeps);
 
         /*
         Calculate delta between perturbed state and original state, to
@@ -672,7 +809,8 @@ measurement should be provided in order to to set up the initial state for
 the SQP iteration. This allows the feedback delay to be significantly less
 than one time step.
 */
-static void _initial_constraint(const real_t measurement[NMPC_STATE_DIM]) {
+static void _initial_constraint(struct nmpc_ctx_t *ctx,
+const real_t measurement[NMPC_STATE_DIM]) {
     real_t z_low[NMPC_GRADIENT_DIM], z_upp[NMPC_GRADIENT_DIM];
     size_t i;
 
@@ -680,42 +818,109 @@ static void _initial_constraint(const real_t measurement[NMPC_STATE_DIM]) {
     Initial delta is constrained to be the difference between the measurement
     and the initial state horizon point.
     */
-    _state_to_delta(z_low, ocp_state_reference, measurement);
+    _state_to_delta(z_low, ctx->state_reference, measurement);
     memcpy(z_upp, z_low, sizeof(real_t) * NMPC_DELTA_DIM);
 
     /* Control constraints are unchanged. */
     #pragma MUST_ITERATE(NMPC_CONTROL_DIM, NMPC_CONTROL_DIM)
     for (i = 0; i < NMPC_CONTROL_DIM; i++) {
-        z_low[NMPC_DELTA_DIM + i] = ocp_lower_control_bound[i] -
-                                    ocp_control_reference[i];
-        z_upp[NMPC_DELTA_DIM + i] = ocp_upper_control_bound[i] -
-                                    ocp_control_reference[i];
+        z_low[NMPC_DELTA_DIM + i] = ctx->lower_control_bound[i] -
+                                    ctx->control_reference[i];
+        z_upp[NMPC_DELTA_DIM + i] = ctx->upper_control_bound[i] -
+                                    ctx->control_reference[i];
     }
 
     return_t status_flag;
     status_flag = qpDUNES_updateIntervalData(
-        &ocp_qp_data.qpdata, ocp_qp_data.qpdata.intervals[0], 0, 0, 0, 0,
+        &ctx->qp_data.qpdata, ctx->qp_data.qpdata.intervals[0], 0, 0, 0, 0,
         z_low, z_upp, 0, 0, 0, 0);
     assert(status_flag == QPDUNES_OK);
 
-    qpDUNES_indicateDataChange(&ocp_qp_data.qpdata);
+    qpDUNES_indicateDataChange(&ctx->qp_data.qpdata);
+}
+
+/*
+Monotonic time in seconds. On the C66x this is the time stamp counter,
+which nmpc_init() starts.
+*/
+static double _get_time(void) {
+#ifdef _TMS320C6X
+    uint32_t low = TSCL, high = TSCH;
+
+    return ((double)high * 4294967296.0 + (double)low) /
+           (double)NMPC_CPU_CLOCK_HZ;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1.0e-9;
+#endif
+}
+
+#ifdef __MEASURE_TIMINGS__
+/* qpDUNES uses the same clock for its iteration log timings. */
+double qpDUNES_getTime(void) {
+    return _get_time();
+}
+#endif
+
+static void _record_timing(struct nmpc_ctx_t *ctx,
+enum nmpc_timing_phase_t phase, real_t seconds) {
+    struct timing_stats_t *stats = &ctx->timing_stats[phase];
+
+    if (stats->count == 0 || seconds < stats->min) {
+        stats->min = seconds;
+    }
+    if (stats->count == 0 || seconds > stats->max) {
+        stats->max = seconds;
+    }
+
+    stats->window[stats->count % OCP_TIMING_WINDOW] = seconds;
+    stats->total += seconds;
+    stats->count++;
+}
+
+static int _compare_timings(const void *a, const void *b) {
+    real_t x = *(const real_t *)a, y = *(const real_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+Calculates the p-th percentile of the samples in the window by the
+nearest-rank method; `sorted` must be the window sorted in ascending order.
+*/
+static real_t _timing_percentile(const real_t *sorted, uint32_t n, real_t p) {
+    uint32_t rank;
+
+    if (n == 0) {
+        return 0.0;
+    }
+
+    rank = (uint32_t)(p * (real_t)n);
+    if ((real_t)rank < p * (real_t)n) {
+        rank++;
+    }
+    rank = rank < 1u ? 1u : (rank > n ? n : rank);
+
+    return sorted[rank - 1u];
 }
 
 /* Solves the QP using qpDUNES. */
-static bool _solve_qp(void) {
+static bool _solve_qp(struct nmpc_ctx_t *ctx) {
     return_t status_flag;
 
-    status_flag = qpDUNES_solve(&ocp_qp_data.qpdata);
+    status_flag = qpDUNES_solve(&ctx->qp_data.qpdata);
     if (status_flag == QPDUNES_SUCC_OPTIMAL_SOLUTION_FOUND) {
         size_t i;
-        real_t solution[NMPC_GRADIENT_DIM * (OCP_HORIZON_LENGTH + 1u)];
+        real_t solution[NMPC_GRADIENT_DIM * (OCP_MAX_HORIZON_LENGTH + 1u)];
 
         /* Get the solution. */
-        qpDUNES_getPrimalSol(&ocp_qp_data.qpdata, solution);
+        qpDUNES_getPrimalSol(&ctx->qp_data.qpdata, solution);
 
         /* Get the first set of control values */
         for (i = 0; i < NMPC_CONTROL_DIM; i++) {
-            ocp_control_value[i] = ocp_control_reference[i] +
+            ctx->control_value[i] = ctx->control_reference[i] +
                                    solution[NMPC_DELTA_DIM + i];
         }
         return true;
@@ -792,21 +997,27 @@ qpDUNES_setup at qpDUNES/setup_qp.c:40.
 Equivalent to:
     qpDUNES_setup(
         &qp->qpdata,
-        OCP_HORIZON_LENGTH,
+        horizon_length,
         NMPC_DELTA_DIM,
         NMPC_CONTROL_DIM,
         0,
         opts);
 */
 static void _init_static_qp(struct static_qpdata_t *qp,
-const qpOptions_t *opts) {
+uint32_t horizon_length, const qpOptions_t *opts) {
     assert(qp);
     assert(opts);
 
     size_t i, nV;
 
+    /*
+    Clear out any multipliers and workspace left over from a previous
+    initialisation, so that the solver always starts from the same point.
+    */
+    memset(qp, 0, sizeof(struct static_qpdata_t));
+
     qp->qpdata.options = *opts;
-    qp->qpdata.nI = OCP_HORIZON_LENGTH;
+    qp->qpdata.nI = horizon_length;
     qp->qpdata.nX = NMPC_DELTA_DIM;
     qp->qpdata.nU = NMPC_CONTROL_DIM;
     qp->qpdata.nZ = NMPC_DELTA_DIM + NMPC_CONTROL_DIM;
@@ -814,8 +1025,8 @@ const qpOptions_t *opts) {
 
     qp->qpdata.intervals = qp->intervals_data;
 
-    for (i = 0; i < OCP_HORIZON_LENGTH + 1u; i++) {
-        if (i < OCP_HORIZON_LENGTH) {
+    for (i = 0; i < horizon_length + 1u; i++) {
+        if (i < horizon_length) {
             nV = NMPC_DELTA_DIM + NMPC_CONTROL_DIM;
         } else {
             nV = NMPC_DELTA_DIM;
@@ -828,10 +1039,10 @@ const qpOptions_t *opts) {
     }
 
     /* Last interval doesn't need a Jacobian */
-    qpDUNES_setMatrixNull(&(qp->qpdata.intervals[OCP_HORIZON_LENGTH]->C));
+    qpDUNES_setMatrixNull(&(qp->qpdata.intervals[horizon_length]->C));
 
     qp->qpdata.intervals[0]->lambdaK.isDefined = QPDUNES_FALSE;
-    qp->qpdata.intervals[OCP_HORIZON_LENGTH]->lambdaK1.isDefined =
+    qp->qpdata.intervals[horizon_length]->lambdaK1.isDefined =
         QPDUNES_FALSE;
 
     qp->qpdata.lambda.data = qp->lambda_data;
@@ -859,7 +1070,7 @@ const qpOptions_t *opts) {
     qp->qpdata.log.itLog = &(qp->itLog_data);
     qp->qpdata.log.itLog[0].ieqStatus = qp->ieqStatus_data;
     qp->qpdata.log.itLog[0].prevIeqStatus = qp->prevIeqStatus_data;
-    for (i = 0; i < OCP_HORIZON_LENGTH + 1u; i++) {
+    for (i = 0; i < horizon_length + 1u; i++) {
         qp->qpdata.log.itLog[0].ieqStatus[i] =
             &(qp->ieqStatus_n_data[i * qp->qpdata.nZ]);
         qp->qpdata.log.itLog[0].prevIeqStatus[i] =
@@ -869,7 +1080,7 @@ const qpOptions_t *opts) {
     qpDUNES_indicateDataChange(&qp->qpdata);
 }
 
-void nmpc_init(void) {
+void nmpc_ctx_init(struct nmpc_ctx_t *ctx) {
     real_t C[NMPC_DELTA_DIM * NMPC_GRADIENT_DIM], /* 720B */
            z_low[NMPC_GRADIENT_DIM],
            z_upp[NMPC_GRADIENT_DIM],
@@ -879,12 +1090,17 @@ void nmpc_init(void) {
            R[NMPC_CONTROL_DIM * NMPC_CONTROL_DIM];
     return_t status_flag;
     qpOptions_t qp_options;
-    size_t i;
+    size_t i, j;
+
+#ifdef _TMS320C6X
+    /* Any write to TSCL starts the time stamp counter. */
+    TSCL = 0;
+#endif
 
     /* Initialise state inequality constraints to +/-infinity. */
     for (i = 0; i < NMPC_DELTA_DIM; i++) {
-        ocp_lower_state_bound[i] = -NMPC_INFTY;
-        ocp_upper_state_bound[i] = NMPC_INFTY;
+        ctx->lower_state_bound[i] = -NMPC_INFTY;
+        ctx->upper_state_bound[i] = NMPC_INFTY;
     }
 
     /* qpDUNES configuration */
@@ -893,19 +1109,16 @@ void nmpc_init(void) {
     qp_options.printLevel = 0;
     qp_options.stationarityTolerance = 1e-3f;
 
+    /* Use a uniform grid unless a different one has been configured */
+    if (ctx->interval_steps[0] == 0u) {
+        nmpc_ctx_config_set_horizon_length(ctx, ctx->horizon_length);
+    }
+
     /* Set up problem dimensions. */
-    _init_static_qp(&ocp_qp_data, &qp_options);
+    _init_static_qp(&ctx->qp_data, ctx->horizon_length, &qp_options);
 
-    /* Convert state and control diagonals into full matrices */
     memset(Q, 0, sizeof(Q));
-    for (i = 0; i < NMPC_DELTA_DIM; i++) {
-        Q[NMPC_DELTA_DIM * i + i] = ocp_state_weights[i];
-    }
-
     memset(R, 0, sizeof(R));
-    for (i = 0; i < NMPC_CONTROL_DIM; i++) {
-        R[NMPC_CONTROL_DIM * i + i] = ocp_control_weights[i];
-    }
 
     /* Gradient vector fixed to zero. */
     memset(g, 0, sizeof(g));
@@ -917,172 +1130,400 @@ void nmpc_init(void) {
     memset(C, 0, sizeof(C));
 
     /* Global state and control constraints */
-    memcpy(z_low, ocp_lower_state_bound, sizeof(real_t) * NMPC_DELTA_DIM);
-    memcpy(&z_low[NMPC_DELTA_DIM], ocp_lower_control_bound,
+    memcpy(z_low, ctx->lower_state_bound, sizeof(real_t) * NMPC_DELTA_DIM);
+    memcpy(&z_low[NMPC_DELTA_DIM], ctx->lower_control_bound,
            sizeof(real_t) * NMPC_CONTROL_DIM);
-    memcpy(z_upp, ocp_upper_state_bound, sizeof(real_t) * NMPC_DELTA_DIM);
-    memcpy(&z_upp[NMPC_DELTA_DIM], ocp_upper_control_bound,
+    memcpy(z_upp, ctx->upper_state_bound, sizeof(real_t) * NMPC_DELTA_DIM);
+    memcpy(&z_upp[NMPC_DELTA_DIM], ctx->upper_control_bound,
            sizeof(real_t) * NMPC_CONTROL_DIM);
 
-    for (i = 0; i < OCP_HORIZON_LENGTH; i++) {
+    for (i = 0; i < ctx->horizon_length; i++) {
+        /*
+        Convert state and control diagonals into full matrices, scaled by
+        the number of base steps the interval covers so that coarse
+        intervals are weighted by the length of time they represent.
+        */
+        real_t steps = (real_t)ctx->interval_steps[i];
+
+        for (j = 0; j < NMPC_DELTA_DIM; j++) {
+            Q[NMPC_DELTA_DIM * j + j] = ctx->state_weights[j] * steps;
+        }
+
+        for (j = 0; j < NMPC_CONTROL_DIM; j++) {
+            R[NMPC_CONTROL_DIM * j + j] = ctx->control_weights[j] * steps;
+        }
+
         /* Copy the relevant data into the qpDUNES arrays. */
         status_flag = qpDUNES_setupRegularInterval(
-            &ocp_qp_data.qpdata, ocp_qp_data.qpdata.intervals[i],
+            &ctx->qp_data.qpdata, ctx->qp_data.qpdata.intervals[i],
             0, Q, R, 0, g, C, 0, 0, c, z_low, z_upp, 0, 0, 0, 0, 0, 0, 0);
         assert(status_flag == QPDUNES_OK);
     }
 
     /* Set up final interval. */
     for (i = 0; i < NMPC_DELTA_DIM; i++) {
-        Q[NMPC_DELTA_DIM * i + i] = ocp_terminal_weights[i];
+        Q[NMPC_DELTA_DIM * i + i] = ctx->terminal_weights[i];
     }
 
     status_flag = qpDUNES_setupFinalInterval(
-        &ocp_qp_data.qpdata, ocp_qp_data.qpdata.intervals[OCP_HORIZON_LENGTH],
+        &ctx->qp_data.qpdata,
+        ctx->qp_data.qpdata.intervals[ctx->horizon_length],
         Q, g, z_low, z_upp, 0, 0, 0);
     assert(status_flag == QPDUNES_OK);
 
-    qpDUNES_setupAllLocalQPs(&ocp_qp_data.qpdata, QPDUNES_FALSE);
+    qpDUNES_setupAllLocalQPs(&ctx->qp_data.qpdata, QPDUNES_FALSE);
 
-    qpDUNES_indicateDataChange(&ocp_qp_data.qpdata);
+    qpDUNES_indicateDataChange(&ctx->qp_data.qpdata);
+
+    ctx->jacobian_refresh_countdown = 0;
 }
 
-void nmpc_preparation_step(void) {
+/*
+Re-linearise the whole horizon around the current reference trajectory and
+rebuild all of the interval data. Passing the gradient to
+qpDUNES_updateIntervalData also re-runs the stage QP setup for each interval,
+so the feedback step only has to embed the initial value and solve the QP.
+*/
+void nmpc_ctx_preparation_step(struct nmpc_ctx_t *ctx) {
+    real_t jacobian[NMPC_DELTA_DIM * NMPC_GRADIENT_DIM], /* 720B */
+           z_low[NMPC_GRADIENT_DIM],
+           z_upp[NMPC_GRADIENT_DIM],
+           gradient[NMPC_GRADIENT_DIM],
+           residuals[NMPC_STATE_DIM];
+    return_t status_flag;
+    size_t i, j, refresh_stages;
+    double t_start, t_ivp_start, t_update_start, t_ivps = 0.0,
+           t_update = 0.0;
+
+    t_start = _get_time();
+
+    _drain_references(ctx);
+
+    /*
+    Intervals below refresh_stages get new Jacobians, as does the final
+    interval, which holds the data shifted out of the first one.
+    */
+    if (ctx->jacobian_refresh_countdown == 0) {
+        refresh_stages = ctx->horizon_length;
+        ctx->jacobian_refresh_countdown = ctx->jacobian_refresh_interval - 1u;
+    } else {
+        refresh_stages = ctx->jacobian_refresh_stages;
+        ctx->jacobian_refresh_countdown--;
+    }
+
+    /* Zero the gradient */
+    memset(gradient, 0, sizeof(gradient));
+
+    /* State constraints are the same for every interval */
+    memcpy(z_low, ctx->lower_state_bound, sizeof(real_t) * NMPC_DELTA_DIM);
+    memcpy(z_upp, ctx->upper_state_bound, sizeof(real_t) * NMPC_DELTA_DIM);
+
+    for (i = 0; i < ctx->horizon_length; i++) {
+        /*
+        Interval i starts at base step ctx->interval_offset[i] and is
+        integrated across all of its base steps in one go, divided into
+        ctx->integration_substeps steps.
+        */
+        size_t k = ctx->interval_offset[i],
+               next = ctx->interval_offset[i + 1u];
+        bool refresh = i < refresh_stages || i == ctx->horizon_length - 1u;
+        real_t *state_ref = &ctx->state_reference[k * NMPC_STATE_DIM];
+        real_t *control_ref = &ctx->control_reference[k * NMPC_CONTROL_DIM];
+        uint32_t blocks = ctx->move_blocking ? ctx->interval_steps[i] : 1u;
+        uint32_t substeps = blocks * ctx->integration_substeps;
+        real_t delta = ctx->step_length *
+                       (real_t)(ctx->interval_steps[i] / blocks) /
+                       (real_t)ctx->integration_substeps;
+
+        /* Update control constraints */
+        #pragma MUST_ITERATE(NMPC_CONTROL_DIM, NMPC_CONTROL_DIM)
+        for (j = 0; j < NMPC_CONTROL_DIM; j++) {
+            z_low[NMPC_DELTA_DIM + j] = ctx->lower_control_bound[j] -
+                                        control_ref[j];
+            z_upp[NMPC_DELTA_DIM + j] = ctx->upper_control_bound[j] -
+                                        control_ref[j];
+        }
+
+        /*
+        Solve the IVP for this interval to get the Jacobian (aka continuity
+        constraint matrix, C) and integration residuals (c). Between
+        refreshes, only the residuals are updated.
+        */
+        t_ivp_start = _get_time();
+        if (refresh) {
+            _solve_interval_ivp(ctx, state_ref, control_ref, delta, substeps,
+                                jacobian,
+                                &ctx->state_reference[next * NMPC_STATE_DIM],
+                                residuals);
+        } else {
+            real_t integrated_state[NMPC_STATE_DIM];
+
+            _state_integrate_steps(integrated_state, state_ref, control_ref,
+                                   ctx->wind_velocity, delta, substeps);
+            _state_to_delta(residuals,
+                            &ctx->state_reference[next * NMPC_STATE_DIM],
+                            integrated_state);
+        }
+        t_update_start = _get_time();
+        t_ivps += t_update_start - t_ivp_start;
+
+        /*
+        Copy the relevant data into the qpDUNES arrays; a null Jacobian
+        leaves the previous one in place.
+        */
+        status_flag = qpDUNES_updateIntervalData(
+            &ctx->qp_data.qpdata, ctx->qp_data.qpdata.intervals[i],
+            0, gradient, refresh ? jacobian : 0, residuals, z_low, z_upp,
+            0, 0, 0, 0);
+        assert(status_flag == QPDUNES_OK);
+        t_update += _get_time() - t_update_start;
+    }
+
+    /* Force the Newton Hessian to be refactorised on the next solve */
+    qpDUNES_indicateDataChange(&ctx->qp_data.qpdata);
+
+    _record_timing(ctx, NMPC_TIMING_SOLVE_IVPS, (real_t)t_ivps);
+    _record_timing(ctx, NMPC_TIMING_QP_UPDATE, (real_t)t_update);
+    _record_timing(ctx, NMPC_TIMING_PREPARATION,
+                   (real_t)(_get_time() - t_start));
 }
 
-void nmpc_feedback_step(real_t measurement[NMPC_STATE_DIM]) {
-    _initial_constraint(measurement);
-    ocp_last_result = _solve_qp();
+void nmpc_ctx_feedback_step(struct nmpc_ctx_t *ctx,
+real_t measurement[NMPC_STATE_DIM]) {
+    double t_start, t_solve_start, t_end;
+
+    t_start = _get_time();
+    _initial_constraint(ctx, measurement);
+    t_solve_start = _get_time();
+    ctx->last_result = _solve_qp(ctx);
+    t_end = _get_time();
+
+    _record_timing(ctx, NMPC_TIMING_INITIAL_CONSTRAINT,
+                   (real_t)(t_solve_start - t_start));
+    _record_timing(ctx, NMPC_TIMING_QP_SOLVE,
+                   (real_t)(t_end - t_solve_start));
+    _record_timing(ctx, NMPC_TIMING_FEEDBACK, (real_t)(t_end - t_start));
+
+#ifdef __MEASURE_TIMINGS__
+    {
+        /* qpDUNES accumulates these over the whole solve in the first entry */
+        const itLog_t *log = &ctx->qp_data.qpdata.log.itLog[0];
+
+        _record_timing(ctx, NMPC_TIMING_QP_NEWTON_SETUP, log->tNwtnSetup);
+        _record_timing(ctx, NMPC_TIMING_QP_FACTORISATION, log->tNwtnSolve);
+        _record_timing(ctx, NMPC_TIMING_QP_LINE_SEARCH, log->tLineSearch);
+        _record_timing(ctx, NMPC_TIMING_QP_STAGE_QPS, log->tQP);
+    }
+#endif
 }
 
-enum nmpc_result_t nmpc_get_controls(real_t controls[NMPC_CONTROL_DIM]) {
+enum nmpc_result_t nmpc_ctx_get_controls(struct nmpc_ctx_t *ctx,
+real_t controls[NMPC_CONTROL_DIM]) {
     assert(controls);
 
     /* Return the next control state */
-    memcpy(controls, ocp_control_value, sizeof(real_t) * NMPC_CONTROL_DIM);
+    memcpy(controls, ctx->control_value, sizeof(real_t) * NMPC_CONTROL_DIM);
 
-    if (ocp_last_result) {
+    if (ctx->last_result) {
         return NMPC_OK;
     } else {
         return NMPC_INFEASIBLE;
     }
 }
 
-void nmpc_update_horizon(real_t new_reference[NMPC_REFERENCE_DIM]) {
+void nmpc_ctx_update_horizon(struct nmpc_ctx_t *ctx,
+real_t new_reference[NMPC_REFERENCE_DIM]) {
+    nmpc_ctx_shift_horizon(ctx);
+    nmpc_ctx_set_reference_point(ctx, new_reference, ctx->horizon_steps);
+}
+
+/*
+Shift the horizon by one base step, leaving the last reference point where
+it is.
+*/
+void nmpc_ctx_shift_horizon(struct nmpc_ctx_t *ctx) {
+    double t_start = _get_time();
+
+    ctx->reference_step++;
+
     /*
     Shift reference state and control -- we need to track all these values
     so we can calculate the appropriate delta in _initial_constraint
     */
-    memmove(ocp_state_reference, &ocp_state_reference[NMPC_STATE_DIM],
-            sizeof(real_t) * NMPC_STATE_DIM * OCP_HORIZON_LENGTH);
-    memmove(ocp_control_reference, &ocp_control_reference[NMPC_CONTROL_DIM],
-            sizeof(real_t) * NMPC_CONTROL_DIM * (OCP_HORIZON_LENGTH - 1u));
+    memmove(ctx->state_reference, &ctx->state_reference[NMPC_STATE_DIM],
+            sizeof(real_t) * NMPC_STATE_DIM * ctx->horizon_steps);
+    memmove(ctx->control_reference, &ctx->control_reference[NMPC_CONTROL_DIM],
+            sizeof(real_t) * NMPC_CONTROL_DIM * (ctx->horizon_steps - 1u));
 
-    /* Prepare the QP for the next solution. */
-    qpDUNES_shiftLambda(&ocp_qp_data.qpdata);
-    qpDUNES_shiftIntervals(&ocp_qp_data.qpdata);
+    /*
+    Prepare the QP for the next solution. The multipliers and interval data
+    are only shifted on a uniform grid, since otherwise a base step doesn't
+    correspond to a whole interval.
+    */
+    if (ctx->horizon_steps == ctx->horizon_length) {
+        qpDUNES_shiftLambda(&ctx->qp_data.qpdata);
+        qpDUNES_shiftIntervals(&ctx->qp_data.qpdata);
+    }
 
-    nmpc_set_reference_point(new_reference, OCP_HORIZON_LENGTH);
+    _record_timing(ctx, NMPC_TIMING_UPDATE_HORIZON,
+                   (real_t)(_get_time() - t_start));
 }
 
-void nmpc_set_state_weights(real_t coeffs[NMPC_DELTA_DIM]) {
+void nmpc_ctx_set_state_weights(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_DELTA_DIM]) {
     assert(coeffs);
 
     /*
     We only store the diagonal of the weight matrices, so they're effectively
     vectors.
     */
-    memcpy(ocp_state_weights, coeffs, sizeof(ocp_state_weights));
+    memcpy(ctx->state_weights, coeffs, sizeof(ctx->state_weights));
 }
 
-void nmpc_set_control_weights(real_t coeffs[NMPC_CONTROL_DIM]) {
+void nmpc_ctx_set_control_weights(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_CONTROL_DIM]) {
     assert(coeffs);
 
-    memcpy(ocp_control_weights, coeffs, sizeof(ocp_control_weights));
+    memcpy(ctx->control_weights, coeffs, sizeof(ctx->control_weights));
 }
 
-void nmpc_set_terminal_weights(real_t coeffs[NMPC_DELTA_DIM]) {
+void nmpc_ctx_set_terminal_weights(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_DELTA_DIM]) {
     assert(coeffs);
 
-    memcpy(ocp_terminal_weights, coeffs, sizeof(ocp_terminal_weights));
+    memcpy(ctx->terminal_weights, coeffs, sizeof(ctx->terminal_weights));
 }
 
-void nmpc_set_lower_control_bound(real_t coeffs[NMPC_CONTROL_DIM]) {
+void nmpc_ctx_set_lower_control_bound(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_CONTROL_DIM]) {
     assert(coeffs);
 
-    memcpy(ocp_lower_control_bound, coeffs, sizeof(ocp_lower_control_bound));
+    memcpy(ctx->lower_control_bound, coeffs, sizeof(ctx->lower_control_bound));
+    ctx->jacobian_refresh_countdown = 0;
 }
 
-void nmpc_set_upper_control_bound(real_t coeffs[NMPC_CONTROL_DIM]) {
+void nmpc_ctx_set_upper_control_bound(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_CONTROL_DIM]) {
     assert(coeffs);
 
-    memcpy(ocp_upper_control_bound, coeffs, sizeof(ocp_upper_control_bound));
+    memcpy(ctx->upper_control_bound, coeffs, sizeof(ctx->upper_control_bound));
+    ctx->jacobian_refresh_countdown = 0;
 }
 
-void nmpc_set_reference_point(real_t coeffs[NMPC_REFERENCE_DIM],
-uint32_t i) {
+/*
+Point i holds the state reference for base step i, and the control
+reference for the base step leading up to it. The IVPs are solved during the
+next preparation step.
+*/
+void nmpc_ctx_set_reference_point(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_REFERENCE_DIM], uint32_t i) {
     assert(coeffs);
-    assert(i <= OCP_HORIZON_LENGTH);
+    assert(i <= ctx->horizon_steps);
 
-    memcpy(&ocp_state_reference[i * NMPC_STATE_DIM], coeffs,
+    memcpy(&ctx->state_reference[i * NMPC_STATE_DIM], coeffs,
            sizeof(real_t) * NMPC_STATE_DIM);
 
     /*
-    Only set control and solve IVPs for regular points, not the final one
+    Only set control for regular points, not the final one
     */
-    if (i > 0 && i <= OCP_HORIZON_LENGTH) {
-        real_t jacobian[NMPC_DELTA_DIM * NMPC_GRADIENT_DIM], /* 720B */
-               z_low[NMPC_GRADIENT_DIM],
-               z_upp[NMPC_GRADIENT_DIM],
-               gradient[NMPC_GRADIENT_DIM],
-               residuals[NMPC_STATE_DIM];
-        return_t status_flag;
-        real_t *state_ref = &ocp_state_reference[(i - 1u) * NMPC_STATE_DIM];
-        real_t *control_ref =
-                    &ocp_control_reference[(i - 1u) * NMPC_CONTROL_DIM];
-        size_t j;
-
-        /* Copy the control reference */
-        memcpy(control_ref, &coeffs[NMPC_STATE_DIM],
-               sizeof(real_t) * NMPC_CONTROL_DIM);
-
-        /* Zero the gradient */
-        memset(gradient, 0, sizeof(gradient));
-
-        /* Update state and control constraints */
-        memcpy(z_low, ocp_lower_state_bound, sizeof(real_t) * NMPC_DELTA_DIM);
-        memcpy(z_upp, ocp_upper_state_bound, sizeof(real_t) * NMPC_DELTA_DIM);
+    if (i > 0 && i <= ctx->horizon_steps) {
+        memcpy(&ctx->control_reference[(i - 1u) * NMPC_CONTROL_DIM],
+               &coeffs[NMPC_STATE_DIM], sizeof(real_t) * NMPC_CONTROL_DIM);
+    }
+}
 
-        #pragma MUST_ITERATE(NMPC_CONTROL_DIM, NMPC_CONTROL_DIM)
-        for (j = 0; j < NMPC_CONTROL_DIM; j++) {
-            z_low[NMPC_DELTA_DIM + j] = ocp_lower_control_bound[j] -
-                                        control_ref[j];
-            z_upp[NMPC_DELTA_DIM + j] = ocp_upper_control_bound[j] -
-                                        control_ref[j];
+/*
+Loading a new trajectory makes the Jacobians kept from the old one useless,
+so the next preparation step refreshes all of them.
+*/
+void nmpc_ctx_set_reference_horizon(struct nmpc_ctx_t *ctx,
+const real_t references[], uint32_t n) {
+    uint32_t i;
+
+    assert(references);
+    assert(n > 0 && n <= ctx->horizon_steps + 1u);
+
+    for (i = 0; i < n; i++) {
+        memcpy(&ctx->state_reference[i * NMPC_STATE_DIM],
+               &references[i * NMPC_REFERENCE_DIM],
+               sizeof(real_t) * NMPC_STATE_DIM);
+        if (i > 0) {
+            memcpy(&ctx->control_reference[(i - 1u) * NMPC_CONTROL_DIM],
+                   &references[i * NMPC_REFERENCE_DIM + NMPC_STATE_DIM],
+                   sizeof(real_t) * NMPC_CONTROL_DIM);
         }
+    }
 
-        /*
-        Solve the IVP for the previous reference point to get the Jacobian
-        (aka continuity constraint matrix, C) and integration residuals (c).
+    ctx->jacobian_refresh_countdown = 0;
+}
 
-        We do this for the previous point because we need the current point to
-        work out the residuals.
-        */
-        _solve_interval_ivp(state_ref, control_ref, jacobian, coeffs,
-                            residuals);
+/*
+Producer side of the reference queue; the only function which may be called
+while another is running on the same context.
+*/
+enum nmpc_result_t nmpc_ctx_queue_reference_point(struct nmpc_ctx_t *ctx,
+real_t coeffs[NMPC_REFERENCE_DIM], uint32_t step) {
+    struct queued_reference_t *queued;
+    uint32_t head, tail;
 
-        /* Copy the relevant data into the qpDUNES arrays. */
-        status_flag = qpDUNES_updateIntervalData(
-            &ocp_qp_data.qpdata, ocp_qp_data.qpdata.intervals[i - 1u],
-            0, gradient, jacobian, residuals, z_low, z_upp, 0, 0, 0, 0);
-        assert(status_flag == QPDUNES_OK);
+    assert(coeffs);
+
+    head = _QUEUE_LOAD(&ctx->reference_queue_head);
+    tail = ctx->reference_queue_tail;
+    if (tail - head == OCP_REFERENCE_QUEUE_LENGTH) {
+        return NMPC_ERROR;
+    }
+
+    queued = &ctx->reference_queue[tail & (OCP_REFERENCE_QUEUE_LENGTH - 1u)];
+    memcpy(queued->point, coeffs, sizeof(queued->point));
+    queued->step = step;
+    _QUEUE_STORE(&ctx->reference_queue_tail, tail + 1u);
+
+    return NMPC_OK;
+}
+
+uint32_t nmpc_ctx_get_reference_step(const struct nmpc_ctx_t *ctx) {
+    return ctx->reference_step;
+}
+
+/*
+Consumer side of the reference queue: applies the queued points in order,
+dropping any which have been shifted out of the horizon, and stopping at the
+first one beyond the end of the horizon.
+*/
+static void _drain_references(struct nmpc_ctx_t *ctx) {
+    struct queued_reference_t *queued;
+    uint32_t head = ctx->reference_queue_head;
+
+    while (head != _QUEUE_LOAD(&ctx->reference_queue_tail)) {
+        queued =
+            &ctx->reference_queue[head & (OCP_REFERENCE_QUEUE_LENGTH - 1u)];
+
+        if (queued->step >= ctx->reference_step) {
+            if (queued->step - ctx->reference_step > ctx->horizon_steps) {
+                break;
+            }
+
+            nmpc_ctx_set_reference_point(ctx, queued->point,
+                                         queued->step - ctx->reference_step);
+        }
+
+        head++;
+        _QUEUE_STORE(&ctx->reference_queue_head, head);
     }
 }
 
-void nmpc_set_wind_velocity(real_t x, real_t y, real_t z) {
-    wind_velocity[0] = x;
-    wind_velocity[1] = y;
-    wind_velocity[2] = z;
+void nmpc_ctx_set_preparation_threads(struct nmpc_ctx_t *ctx, uint32_t n) {
+    /* The preparation step always runs on a single core on the C66x. */
+    (void)ctx;
+    (void)n;
+}
+
+void nmpc_ctx_set_wind_velocity(struct nmpc_ctx_t *ctx,
+real_t x, real_t y, real_t z) {
+    ctx->wind_velocity[0] = x;
+    ctx->wind_velocity[1] = y;
+    ctx->wind_velocity[2] = z;
 }
 
 uint32_t nmpc_config_get_state_dim(void) {
@@ -1093,12 +1534,105 @@ uint32_t nmpc_config_get_control_dim(void) {
     return NMPC_CONTROL_DIM;
 }
 
-uint32_t nmpc_config_get_horizon_length(void) {
-    return OCP_HORIZON_LENGTH;
+uint32_t nmpc_ctx_config_get_horizon_length(const struct nmpc_ctx_t *ctx) {
+    return ctx->horizon_length;
 }
 
-real_t nmpc_config_get_step_length(void) {
-    return OCP_STEP_LENGTH;
+uint32_t nmpc_config_get_max_horizon_length(void) {
+    return OCP_MAX_HORIZON_LENGTH;
+}
+
+uint32_t nmpc_ctx_config_get_horizon_steps(const struct nmpc_ctx_t *ctx) {
+    return ctx->horizon_steps;
+}
+
+real_t nmpc_ctx_config_get_step_length(const struct nmpc_ctx_t *ctx) {
+    return ctx->step_length;
+}
+
+/*
+The static QP structures are always sized for OCP_MAX_HORIZON_LENGTH, so
+changing the horizon length just changes how much of them nmpc_init() sets
+up.
+*/
+void nmpc_ctx_config_set_horizon_length(struct nmpc_ctx_t *ctx,
+uint32_t length) {
+    uint32_t i;
+
+    assert(length > 0 && length <= OCP_MAX_HORIZON_LENGTH &&
+           length <= OCP_MAX_HORIZON_STEPS);
+
+    for (i = 0; i < length; i++) {
+        ctx->interval_steps[i] = 1u;
+        ctx->interval_offset[i] = i;
+    }
+
+    ctx->interval_offset[length] = length;
+    ctx->horizon_length = length;
+    ctx->horizon_steps = length;
+    ctx->move_blocking = false;
+}
+
+void nmpc_ctx_config_set_horizon_grid(struct nmpc_ctx_t *ctx,
+const uint32_t steps[], uint32_t length) {
+    uint32_t i;
+
+    assert(steps);
+    assert(length > 0 && length <= OCP_MAX_HORIZON_LENGTH);
+
+    ctx->interval_offset[0] = 0;
+    for (i = 0; i < length; i++) {
+        assert(steps[i] > 0);
+        ctx->interval_steps[i] = steps[i];
+        ctx->interval_offset[i + 1u] = ctx->interval_offset[i] + steps[i];
+    }
+
+    assert(ctx->interval_offset[length] <= OCP_MAX_HORIZON_STEPS);
+    ctx->horizon_length = length;
+    ctx->horizon_steps = ctx->interval_offset[length];
+    ctx->move_blocking = false;
+}
+
+void nmpc_ctx_config_set_move_blocking(struct nmpc_ctx_t *ctx,
+const uint32_t blocks[], uint32_t length) {
+    nmpc_ctx_config_set_horizon_grid(ctx, blocks, length);
+    ctx->move_blocking = true;
+}
+
+void nmpc_ctx_config_set_integration_substeps(struct nmpc_ctx_t *ctx,
+uint32_t substeps) {
+    assert(substeps > 0);
+
+    ctx->integration_substeps = substeps;
+    ctx->jacobian_refresh_countdown = 0;
+}
+
+void nmpc_ctx_config_set_integration_tolerance(struct nmpc_ctx_t *ctx,
+real_t tolerance) {
+    /* The C66x always takes fixed RK4 steps. */
+    (void)ctx;
+    (void)tolerance;
+}
+
+void nmpc_ctx_config_set_qp_condensing(struct nmpc_ctx_t *ctx,
+uint32_t block_size) {
+    /* The C66x always solves the sparse QP with the static qpDUNES data. */
+    (void)ctx;
+    (void)block_size;
+}
+
+void nmpc_ctx_config_set_qp_backend(struct nmpc_ctx_t *ctx,
+enum nmpc_qp_backend_t backend) {
+    /* As above, only qpDUNES is available on the C66x. */
+    (void)ctx;
+    (void)backend;
+}
+
+void nmpc_ctx_config_set_step_length(struct nmpc_ctx_t *ctx, real_t length) {
+    assert(length > (real_t)0.0);
+
+    ctx->step_length = length;
+    ctx->jacobian_refresh_countdown = 0;
 }
 
 enum nmpc_precision_t nmpc_config_get_precision(void) {
@@ -1108,3 +1642,403 @@ enum nmpc_precision_t nmpc_config_get_precision(void) {
     return NMPC_PRECISION_DOUBLE;
 #endif
 }
+
+void nmpc_ctx_get_timing_stats(const struct nmpc_ctx_t *ctx,
+struct nmpc_timing_stats_t stats[NMPC_TIMING_PHASES]) {
+    real_t sorted[OCP_TIMING_WINDOW];
+    uint32_t i, n;
+
+    assert(stats);
+
+    for (i = 0; i < NMPC_TIMING_PHASES; i++) {
+        const struct timing_stats_t *phase = &ctx->timing_stats[i];
+
+        n = phase->count < OCP_TIMING_WINDOW ?
+            phase->count : OCP_TIMING_WINDOW;
+        memcpy(sorted, phase->window, sizeof(real_t) * n);
+        qsort(sorted, n, sizeof(real_t), _compare_timings);
+
+        stats[i].count = phase->count;
+        stats[i].min = phase->min;
+        stats[i].max = phase->max;
+        stats[i].mean = phase->count ?
+            (real_t)(phase->total / phase->count) : (real_t)0.0;
+        stats[i].p50 = _timing_percentile(sorted, n, (real_t)0.5);
+        stats[i].p90 = _timing_percentile(sorted, n, (real_t)0.9);
+        stats[i].p99 = _timing_percentile(sorted, n, (real_t)0.99);
+    }
+}
+
+void nmpc_ctx_reset_timing_stats(struct nmpc_ctx_t *ctx) {
+    memset(ctx->timing_stats, 0, sizeof(ctx->timing_stats));
+}
+
+uint32_t nmpc_ctx_get_qp_iterations(const struct nmpc_ctx_t *ctx) {
+    return (uint32_t)ctx->qp_data.qpdata.log.numIter;
+}
+
+void nmpc_ctx_config_set_linearisation_cache_tolerance(struct nmpc_ctx_t *ctx,
+real_t tolerance) {
+    /* The C66x has no linearisation cache; every interval is linearised. */
+    (void)ctx;
+    (void)tolerance;
+}
+
+void nmpc_ctx_get_linearisation_cache_stats(const struct nmpc_ctx_t *ctx,
+uint32_t *hits, uint32_t *misses) {
+    assert(hits && misses);
+
+    (void)ctx;
+    *hits = 0;
+    *misses = 0;
+}
+
+void nmpc_ctx_reset_linearisation_cache_stats(struct nmpc_ctx_t *ctx) {
+    (void)ctx;
+}
+
+void nmpc_ctx_config_set_jacobian_refresh(struct nmpc_ctx_t *ctx,
+uint32_t interval, uint32_t stages) {
+    assert(interval > 0);
+
+    ctx->jacobian_refresh_interval = interval;
+    ctx->jacobian_refresh_stages = stages;
+    ctx->jacobian_refresh_countdown = 0;
+}
+
+/*
+The C66x has no threads to run the preparation step on, so the runtime
+runs it at the end of each feedback call instead, after the controls have
+been calculated.
+*/
+enum nmpc_result_t nmpc_ctx_runtime_start(struct nmpc_ctx_t *ctx,
+const struct nmpc_runtime_options_t *options) {
+    (void)options;
+
+    nmpc_ctx_preparation_step(ctx);
+    return NMPC_OK;
+}
+
+void nmpc_ctx_runtime_stop(struct nmpc_ctx_t *ctx) {
+    (void)ctx;
+}
+
+enum nmpc_result_t nmpc_ctx_runtime_feedback(struct nmpc_ctx_t *ctx,
+real_t measurement[NMPC_STATE_DIM], real_t new_reference[NMPC_REFERENCE_DIM],
+real_t controls[NMPC_CONTROL_DIM]) {
+    enum nmpc_result_t result;
+
+    assert(measurement && controls);
+
+    nmpc_ctx_feedback_step(ctx, measurement);
+    result = nmpc_ctx_get_controls(ctx, controls);
+
+    if (new_reference) {
+        nmpc_ctx_update_horizon(ctx, new_reference);
+    } else {
+        nmpc_ctx_shift_horizon(ctx);
+    }
+    nmpc_ctx_preparation_step(ctx);
+
+    return result;
+}
+
+void nmpc_ctx_runtime_set_wind_velocity(struct nmpc_ctx_t *ctx,
+real_t x, real_t y, real_t z) {
+    nmpc_ctx_set_wind_velocity(ctx, x, y, z);
+}
+
+/* Sets up a context with the same defaults as default_ctx. */
+static void _init_ctx(struct nmpc_ctx_t *ctx) {
+    memset(ctx, 0, sizeof(struct nmpc_ctx_t));
+    ctx->horizon_length = OCP_HORIZON_LENGTH;
+    ctx->horizon_steps = OCP_HORIZON_LENGTH;
+    ctx->step_length = OCP_STEP_LENGTH;
+    ctx->integration_substeps = OCP_INTEGRATION_SUBSTEPS;
+    ctx->jacobian_refresh_interval = OCP_JACOBIAN_REFRESH_INTERVAL;
+    ctx->jacobian_refresh_stages = OCP_JACOBIAN_REFRESH_STAGES;
+}
+
+/*
+Contexts other than the default are allocated on the heap, so should be
+created at start-up.
+*/
+struct nmpc_ctx_t *nmpc_create(void) {
+    struct nmpc_ctx_t *ctx;
+
+    ctx = (struct nmpc_ctx_t *)malloc(sizeof(struct nmpc_ctx_t));
+    if (ctx) {
+        _init_ctx(ctx);
+    }
+
+    return ctx;
+}
+
+void nmpc_destroy(struct nmpc_ctx_t *ctx) {
+    assert(ctx != &default_ctx);
+
+    free(ctx);
+}
+
+struct nmpc_fleet_t {
+    uint32_t size;
+    uint32_t threads;
+    struct nmpc_ctx_t *contexts;
+};
+
+struct nmpc_fleet_t *nmpc_fleet_create(uint32_t size) {
+    struct nmpc_fleet_t *fleet;
+    uint32_t i;
+
+    assert(size > 0);
+
+    fleet = (struct nmpc_fleet_t *)malloc(sizeof(struct nmpc_fleet_t));
+    if (!fleet) {
+        return NULL;
+    }
+
+    fleet->size = size;
+    fleet->threads = 0;
+    fleet->contexts =
+        (struct nmpc_ctx_t *)malloc(sizeof(struct nmpc_ctx_t) * size);
+    if (!fleet->contexts) {
+        free(fleet);
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++) {
+        _init_ctx(&fleet->contexts[i]);
+    }
+
+    return fleet;
+}
+
+void nmpc_fleet_destroy(struct nmpc_fleet_t *fleet) {
+    if (fleet) {
+        free(fleet->contexts);
+        free(fleet);
+    }
+}
+
+uint32_t nmpc_fleet_get_size(const struct nmpc_fleet_t *fleet) {
+    assert(fleet);
+
+    return fleet->size;
+}
+
+struct nmpc_ctx_t *nmpc_fleet_get_ctx(struct nmpc_fleet_t *fleet,
+uint32_t i) {
+    assert(fleet);
+    assert(i < fleet->size);
+
+    return &fleet->contexts[i];
+}
+
+void nmpc_fleet_set_threads(struct nmpc_fleet_t *fleet, uint32_t n) {
+    assert(fleet);
+
+    fleet->threads = n;
+}
+
+/*
+Without OpenMP (as on a single C66x core) the instances are just solved one
+after another; with it, they're handed out to the threads one at a time,
+since some take much longer to solve than others.
+*/
+void nmpc_fleet_step(struct nmpc_fleet_t *fleet, real_t measurements[],
+real_t new_references[], real_t controls[], enum nmpc_result_t results[]) {
+    int32_t i, size;
+
+    assert(fleet);
+    assert(measurements && controls);
+
+    size = (int32_t)fleet->size;
+
+#ifdef _OPENMP
+    int32_t threads = fleet->threads ?
+        (int32_t)fleet->threads : omp_get_max_threads();
+
+    #pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+    for (i = 0; i < size; i++) {
+        struct nmpc_ctx_t *ctx = &fleet->contexts[i];
+        enum nmpc_result_t result;
+
+        nmpc_ctx_preparation_step(ctx);
+        nmpc_ctx_feedback_step(ctx, &measurements[i * NMPC_STATE_DIM]);
+        result = nmpc_ctx_get_controls(ctx,
+                                       &controls[i * NMPC_CONTROL_DIM]);
+        if (new_references) {
+            nmpc_ctx_update_horizon(
+                ctx, &new_references[i * NMPC_REFERENCE_DIM]);
+        }
+
+        if (results) {
+            results[i] = result;
+        }
+    }
+}
+
+/* The single-instance interface works on the default context. */
+void nmpc_init(void) {
+    nmpc_ctx_init(&default_ctx);
+}
+
+void nmpc_preparation_step(void) {
+    nmpc_ctx_preparation_step(&default_ctx);
+}
+
+void nmpc_feedback_step(real_t measurement[NMPC_STATE_DIM]) {
+    nmpc_ctx_feedback_step(&default_ctx, measurement);
+}
+
+enum nmpc_result_t nmpc_get_controls(real_t controls[NMPC_CONTROL_DIM]) {
+    return nmpc_ctx_get_controls(&default_ctx, controls);
+}
+
+void nmpc_update_horizon(real_t new_reference[NMPC_REFERENCE_DIM]) {
+    nmpc_ctx_update_horizon(&default_ctx, new_reference);
+}
+
+void nmpc_shift_horizon(void) {
+    nmpc_ctx_shift_horizon(&default_ctx);
+}
+
+void nmpc_set_state_weights(real_t coeffs[NMPC_DELTA_DIM]) {
+    nmpc_ctx_set_state_weights(&default_ctx, coeffs);
+}
+
+void nmpc_set_control_weights(real_t coeffs[NMPC_CONTROL_DIM]) {
+    nmpc_ctx_set_control_weights(&default_ctx, coeffs);
+}
+
+void nmpc_set_terminal_weights(real_t coeffs[NMPC_DELTA_DIM]) {
+    nmpc_ctx_set_terminal_weights(&default_ctx, coeffs);
+}
+
+void nmpc_set_lower_control_bound(real_t coeffs[NMPC_CONTROL_DIM]) {
+    nmpc_ctx_set_lower_control_bound(&default_ctx, coeffs);
+}
+
+void nmpc_set_upper_control_bound(real_t coeffs[NMPC_CONTROL_DIM]) {
+    nmpc_ctx_set_upper_control_bound(&default_ctx, coeffs);
+}
+
+void nmpc_set_reference_point(real_t coeffs[NMPC_REFERENCE_DIM],
+uint32_t i) {
+    nmpc_ctx_set_reference_point(&default_ctx, coeffs, i);
+}
+
+void nmpc_set_reference_horizon(const real_t references[], uint32_t n) {
+    nmpc_ctx_set_reference_horizon(&default_ctx, references, n);
+}
+
+enum nmpc_result_t nmpc_queue_reference_point(
+real_t coeffs[NMPC_REFERENCE_DIM], uint32_t step) {
+    return nmpc_ctx_queue_reference_point(&default_ctx, coeffs, step);
+}
+
+uint32_t nmpc_get_reference_step(void) {
+    return nmpc_ctx_get_reference_step(&default_ctx);
+}
+
+void nmpc_set_preparation_threads(uint32_t n) {
+    nmpc_ctx_set_preparation_threads(&default_ctx, n);
+}
+
+void nmpc_set_wind_velocity(real_t x, real_t y, real_t z) {
+    nmpc_ctx_set_wind_velocity(&default_ctx, x, y, z);
+}
+
+uint32_t nmpc_config_get_horizon_length(void) {
+    return nmpc_ctx_config_get_horizon_length(&default_ctx);
+}
+
+uint32_t nmpc_config_get_horizon_steps(void) {
+    return nmpc_ctx_config_get_horizon_steps(&default_ctx);
+}
+
+real_t nmpc_config_get_step_length(void) {
+    return nmpc_ctx_config_get_step_length(&default_ctx);
+}
+
+void nmpc_config_set_horizon_length(uint32_t length) {
+    nmpc_ctx_config_set_horizon_length(&default_ctx, length);
+}
+
+void nmpc_config_set_horizon_grid(const uint32_t steps[], uint32_t length) {
+    nmpc_ctx_config_set_horizon_grid(&default_ctx, steps, length);
+}
+
+void nmpc_config_set_move_blocking(const uint32_t blocks[], uint32_t length) {
+    nmpc_ctx_config_set_move_blocking(&default_ctx, blocks, length);
+}
+
+void nmpc_config_set_qp_condensing(uint32_t block_size) {
+    nmpc_ctx_config_set_qp_condensing(&default_ctx, block_size);
+}
+
+void nmpc_config_set_qp_backend(enum nmpc_qp_backend_t backend) {
+    nmpc_ctx_config_set_qp_backend(&default_ctx, backend);
+}
+
+void nmpc_config_set_step_length(real_t length) {
+    nmpc_ctx_config_set_step_length(&default_ctx, length);
+}
+
+void nmpc_config_set_integration_substeps(uint32_t substeps) {
+    nmpc_ctx_config_set_integration_substeps(&default_ctx, substeps);
+}
+
+void nmpc_config_set_integration_tolerance(real_t tolerance) {
+    nmpc_ctx_config_set_integration_tolerance(&default_ctx, tolerance);
+}
+
+void nmpc_get_timing_stats(
+struct nmpc_timing_stats_t stats[NMPC_TIMING_PHASES]) {
+    nmpc_ctx_get_timing_stats(&default_ctx, stats);
+}
+
+void nmpc_reset_timing_stats(void) {
+    nmpc_ctx_reset_timing_stats(&default_ctx);
+}
+
+uint32_t nmpc_get_qp_iterations(void) {
+    return nmpc_ctx_get_qp_iterations(&default_ctx);
+}
+
+void nmpc_config_set_linearisation_cache_tolerance(real_t tolerance) {
+    nmpc_ctx_config_set_linearisation_cache_tolerance(
+        &default_ctx, tolerance);
+}
+
+void nmpc_get_linearisation_cache_stats(uint32_t *hits, uint32_t *misses) {
+    nmpc_ctx_get_linearisation_cache_stats(&default_ctx, hits, misses);
+}
+
+void nmpc_reset_linearisation_cache_stats(void) {
+    nmpc_ctx_reset_linearisation_cache_stats(&default_ctx);
+}
+
+void nmpc_config_set_jacobian_refresh(uint32_t interval, uint32_t stages) {
+    nmpc_ctx_config_set_jacobian_refresh(&default_ctx, interval, stages);
+}
+
+enum nmpc_result_t nmpc_runtime_start(
+const struct nmpc_runtime_options_t *options) {
+    return nmpc_ctx_runtime_start(&default_ctx, options);
+}
+
+void nmpc_runtime_stop(void) {
+    nmpc_ctx_runtime_stop(&default_ctx);
+}
+
+enum nmpc_result_t nmpc_runtime_feedback(real_t measurement[NMPC_STATE_DIM],
+real_t new_reference[NMPC_REFERENCE_DIM], real_t controls[NMPC_CONTROL_DIM]) {
+    return nmpc_ctx_runtime_feedback(&default_ctx, measurement, new_reference,
+                                     controls);
+}
+
+void nmpc_runtime_set_wind_velocity(real_t x, real_t y, real_t z) {
+    nmpc_ctx_runtime_set_wind_velocity(&default_ctx, x, y, z);
+}
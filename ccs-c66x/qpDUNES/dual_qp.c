@@ -41,9 +41,8 @@ return_t qpDUNES_solve(qpData_t* const qpData) {
 
 
 	#ifdef __MEASURE_TIMINGS__
-    real_t 	tItStart, tItEnd, tQpStart, tQpEnd, tNwtnSetupStart, tNwtnSetupEnd,
-			tNwtnFactorStart, tNwtnFactorEnd, tNwtnSolveStart, tNwtnSolveEnd,
-			tLineSearchStart, tLineSearchEnd, tDiff;
+	/* timings are accumulated over the whole solve in itLog[0] */
+	double	tQpStart, tNwtnSetupStart, tNwtnFactorStart, tLineSearchStart;
 	#endif
 
 	return_t statusFlag = QPDUNES_OK; /* generic status flag */
@@ -56,11 +55,18 @@ return_t qpDUNES_solve(qpData_t* const qpData) {
     *itCntr = 0;
 	itLogPtr->itNbr = 0;
 
+	#ifdef __MEASURE_TIMINGS__
+	itLogPtr->tNwtnSetup = 0.;
+	itLogPtr->tNwtnSolve = 0.;
+	itLogPtr->tQP = 0.;
+	itLogPtr->tLineSearch = 0.;
+	#endif
+
 	/** (1) todo: initialize local active sets (at least when using qpOASES) with initial guess from previous iteration */
 
 	/** (2) solve local QP problems for initial guess of lambda */
 	#ifdef __MEASURE_TIMINGS__
-	tQpStart = getTime();
+	tQpStart = qpDUNES_getTime();
 	#endif
 
 	/* resolve initial QPs for possibly changed bounds (initial value embedding) */
@@ -88,6 +94,9 @@ return_t qpDUNES_solve(qpData_t* const qpData) {
 			statusFlag = qpOASES_doStep(qpData, interval->qpSolverQpoases.qpoasesObject, interval, 1, &(interval->z), &(interval->y), &(interval->q), &(interval->p));
 		}
 	}
+	#ifdef __MEASURE_TIMINGS__
+	itLogPtr->tQP += (real_t)(qpDUNES_getTime() - tQpStart);
+	#endif
 	objValIncumbent = qpDUNES_computeObjectiveValue(qpData);
 	if (statusFlag != QPDUNES_OK) {
 		return statusFlag;
@@ -121,7 +130,14 @@ return_t qpDUNES_solve(qpData_t* const qpData) {
 		}
 		else {
 			/** (1Ba) set up Newton system */
+			#ifdef __MEASURE_TIMINGS__
+			tNwtnSetupStart = qpDUNES_getTime();
+			#endif
 			statusFlag = qpDUNES_setupNewtonSystem(qpData);
+			#ifdef __MEASURE_TIMINGS__
+			itLogPtr->tNwtnSetup +=
+				(real_t)(qpDUNES_getTime() - tNwtnSetupStart);
+			#endif
 			switch (statusFlag) {
 				case QPDUNES_OK:
 					break;
@@ -134,7 +150,7 @@ return_t qpDUNES_solve(qpData_t* const qpData) {
 
 			/** (1Bb) factorize Newton system */
 			#ifdef __MEASURE_TIMINGS__
-			tNwtnFactorStart = getTime();
+			tNwtnFactorStart = qpDUNES_getTime();
 			#endif
 			statusFlag = qpDUNES_factorNewtonSystem(qpData, &(itLogPtr->isHessianRegularized), lastActSetChangeIdx);		/* TODO! can we get a problem with on-the-fly regularization in partial refactorization? might only be partially reg.*/
 			switch (statusFlag) {
@@ -143,14 +159,8 @@ return_t qpDUNES_solve(qpData_t* const qpData) {
 				default:
 					return statusFlag;
 			}
-			#ifdef __MEASURE_TIMINGS__
-			tNwtnFactorEnd = getTime();
-			#endif
 
 			/** (1Bc) compute step direction */
-			#ifdef __MEASURE_TIMINGS__
-			tNwtnSolveStart = getTime();
-			#endif
 			switch (qpData->options.nwtnHssnFacAlg) {
 			case QPDUNES_NH_FAC_BAND_FORWARD:
 				statusFlag = qpDUNES_solveNewtonEquation(qpData, &(qpData->deltaLambda), &(qpData->cholHessian), &(qpData->gradient));
@@ -166,19 +176,36 @@ return_t qpDUNES_solve(qpData_t* const qpData) {
 			if (statusFlag != QPDUNES_OK) {
 				return statusFlag;
 			}
+			#ifdef __MEASURE_TIMINGS__
+			itLogPtr->tNwtnSolve +=
+				(real_t)(qpDUNES_getTime() - tNwtnFactorStart);
+			#endif
 		}
 
 
 		/** (2) do QP solution for full step */
+		#ifdef __MEASURE_TIMINGS__
+		tQpStart = qpDUNES_getTime();
+		#endif
 		qpDUNES_solveAllLocalQPs(qpData, &(qpData->deltaLambda));
 		/* clipping solver: now unsaturated dz is available locally */
+		#ifdef __MEASURE_TIMINGS__
+		itLogPtr->tQP += (real_t)(qpDUNES_getTime() - tQpStart);
+		#endif
 
 		/** (4) determine step length: do line search along the way of the full step
 		 * 		and do the step */
+		#ifdef __MEASURE_TIMINGS__
+		tLineSearchStart = qpDUNES_getTime();
+		#endif
 		statusFlag = qpDUNES_determineStepLength(qpData, &(qpData->lambda),
 				&(qpData->deltaLambda), &(itLogPtr->numLineSearchIter),
 				&(qpData->alpha), &objValIncumbent,
 				itLogPtr->isHessianRegularized);
+		#ifdef __MEASURE_TIMINGS__
+		itLogPtr->tLineSearch +=
+			(real_t)(qpDUNES_getTime() - tLineSearchStart);
+		#endif
 		switch (statusFlag) {
 			case QPDUNES_OK:
 			case QPDUNES_ERR_NUMBER_OF_MAX_LINESEARCH_ITERATIONS_REACHED:
@@ -312,6 +339,7 @@ return_t qpDUNES_updateAllLocalQPs(	qpData_t* const qpData,
 {
 	int_t kk;
 	interval_t* interval;
+	int_t errCntr = 0;
 
 	/* first interval: */
 	interval = qpData->intervals[0];
@@ -326,6 +354,10 @@ return_t qpDUNES_updateAllLocalQPs(	qpData_t* const qpData,
 	interval = qpData->intervals[_NI_];
 	qpDUNES_updateVector( &(interval->lambdaK), &(lambda->data[(_NI_ - 1) * _NX_]), _NX_ );
 
+	/* stages only touch their own data from here on */
+	#ifdef __QPDUNES_PARALLEL__
+	#pragma omp parallel for private(interval) reduction(+:errCntr) schedule(static)
+	#endif
 	for (kk = 0; kk < _NI_ + 1; ++kk) {
 		interval = qpData->intervals[kk];
 		switch (interval->qpSolverSpecification) {
@@ -336,9 +368,13 @@ return_t qpDUNES_updateAllLocalQPs(	qpData_t* const qpData,
 			qpOASES_updateStageData( qpData, interval, &(interval->lambdaK), &(interval->lambdaK1) );
 			break;
 		default:
-			return QPDUNES_ERR_UNKNOWN_ERROR;
+			errCntr++;	/* no return from inside a parallel loop */
+			break;
 		}
 	}
+	if (errCntr > 0) {
+		return QPDUNES_ERR_UNKNOWN_ERROR;
+	}
 
 	return QPDUNES_OK;
 }
@@ -363,6 +399,9 @@ return_t qpDUNES_solveAllLocalQPs(	qpData_t* const qpData,
 	/* 2) solve local QPs */
 	/* TODO: check what happens in case of errors (return)*/
 	/* Note: const variables are predetermined shared (at least on apple)*/
+	#ifdef __QPDUNES_PARALLEL__
+	#pragma omp parallel for private(statusFlag) reduction(+:errCntr) schedule(static)
+	#endif
 		for (kk = 0; kk < _NI_ + 1; ++kk) {
 			statusFlag = qpDUNES_solveLocalQP(qpData, qpData->intervals[kk]);
 			if (statusFlag != QPDUNES_OK) { /* note that QPDUNES_OK == 0 */
@@ -422,6 +461,78 @@ return_t qpDUNES_solveLocalQP(	qpData_t* const qpData,
  >>>>>>                                           */
 return_t qpDUNES_setupNewtonSystem(	qpData_t* const qpData
 									)
+{
+	newtonWorkspace_t ws;
+
+	/** calculate gradient and check gradient norm for convergence */
+	qpDUNES_computeNewtonGradient(qpData, &(qpData->gradient), &(qpData->xVecTmp));
+	if ((vectorNorm(&(qpData->gradient), _NX_ * _NI_)
+			< qpData->options.stationarityTolerance)) {
+		return QPDUNES_SUCC_OPTIMAL_SOLUTION_FOUND;
+	}
+
+
+	/** calculate hessian */
+	#ifdef __QPDUNES_PARALLEL__
+	#pragma omp parallel private(ws)
+	{
+		/* every thread gets its own block workspace on the stack */
+		real_t xVecTmpData[_NX_];
+		real_t xxMatTmpData[_NX_ * _NX_];
+		real_t xxMatTmp2Data[_NX_ * _NX_];
+		real_t uxMatTmpData[_NU_ * _NX_];
+		real_t zxMatTmpData[_NZ_ * _NX_];
+		real_t zxMatTmp2Data[_NZ_ * _NX_];
+		real_t ZTData[_NZ_ * _NZ_];
+		real_t cholProjHessData[_NZ_ * _NZ_];
+
+		x_vector_t xVecTmp = { QPDUNES_FALSE, QPDUNES_FALSE, xVecTmpData };
+		xx_matrix_t xxMatTmp = { QPDUNES_MATRIX_UNDEFINED, xxMatTmpData };
+		xx_matrix_t xxMatTmp2 = { QPDUNES_MATRIX_UNDEFINED, xxMatTmp2Data };
+		ux_matrix_t uxMatTmp = { QPDUNES_MATRIX_UNDEFINED, uxMatTmpData };
+		zx_matrix_t zxMatTmp = { QPDUNES_MATRIX_UNDEFINED, zxMatTmpData };
+		zx_matrix_t zxMatTmp2 = { QPDUNES_MATRIX_UNDEFINED, zxMatTmp2Data };
+		zz_matrix_t ZT = { QPDUNES_MATRIX_UNDEFINED, ZTData };
+		zz_matrix_t cholProjHess = { QPDUNES_MATRIX_UNDEFINED, cholProjHessData };
+
+		ws.xVecTmp = &xVecTmp;
+		ws.xxMatTmp = &xxMatTmp;
+		ws.xxMatTmp2 = &xxMatTmp2;
+		ws.uxMatTmp = &uxMatTmp;
+		ws.zxMatTmp = &zxMatTmp;
+		ws.zxMatTmp2 = &zxMatTmp2;
+		ws.ZT = &ZT;
+		ws.cholProjHess = &cholProjHess;
+
+		qpDUNES_setupNewtonHessianBlocks(qpData, &ws);
+	}	/* END of omp parallel */
+	#else
+	ws.xVecTmp = &(qpData->xVecTmp);
+	ws.xxMatTmp = &(qpData->xxMatTmp);
+	ws.xxMatTmp2 = &(qpData->xxMatTmp2);
+	ws.uxMatTmp = &(qpData->uxMatTmp);
+	ws.zxMatTmp = &(qpData->zxMatTmp);
+	ws.zxMatTmp2 = &(qpData->xzMatTmp);
+	ws.ZT = &(qpData->zzMatTmp);		/* TODO: share memory between qpOASES and qpDUNES!!!*/
+	ws.cholProjHess = &(qpData->zzMatTmp2);	/* TODO: share memory between qpOASES and qpDUNES!!!*/
+
+	qpDUNES_setupNewtonHessianBlocks(qpData, &ws);
+	#endif
+
+	return QPDUNES_OK;
+}
+/*<<< END OF qpDUNES_setupNewtonSystem */
+
+
+/* ----------------------------------------------
+ * compute the diagonal and sub-diagonal blocks of the Newton Hessian;
+ * the loops are orphaned worksharing constructs, so in parallel mode the
+ * blocks are shared out over the threads of the enclosing parallel region
+ *
+ >>>>>>                                           */
+return_t qpDUNES_setupNewtonHessianBlocks(	qpData_t* const qpData,
+											newtonWorkspace_t* const ws
+											)
 {
 	int_t ii, jj, kk;
 
@@ -429,33 +540,26 @@ return_t qpDUNES_setupNewtonSystem(	qpData_t* const qpData
 
 	zx_matrix_t* ZTCT;
 
-	x_vector_t* xVecTmp = &(qpData->xVecTmp);
-	xx_matrix_t* xxMatTmp = &(qpData->xxMatTmp);
-	xx_matrix_t* xxMatTmp2 = &(qpData->xxMatTmp2);
-	ux_matrix_t* uxMatTmp = &(qpData->uxMatTmp);
-	zx_matrix_t* zxMatTmp = &(qpData->zxMatTmp);
-	zx_matrix_t* zxMatTmp2 = &(qpData->xzMatTmp);
+	x_vector_t* xVecTmp = ws->xVecTmp;
+	xx_matrix_t* xxMatTmp = ws->xxMatTmp;
+	xx_matrix_t* xxMatTmp2 = ws->xxMatTmp2;
+	ux_matrix_t* uxMatTmp = ws->uxMatTmp;
+	zx_matrix_t* zxMatTmp = ws->zxMatTmp;
+	zx_matrix_t* zxMatTmp2 = ws->zxMatTmp2;
 
-	zz_matrix_t* ZT = &(qpData->zzMatTmp);/* TODO: share memory between qpOASES and qpDUNES!!!*/
-	zz_matrix_t* cholProjHess = &(qpData->zzMatTmp2);/* TODO: share memory between qpOASES and qpDUNES!!!*/
+	zz_matrix_t* ZT = ws->ZT;
+	zz_matrix_t* cholProjHess = ws->cholProjHess;
 	int_t nFree; /* number of active constraints of stage QP */
 
 	interval_t** intervals = qpData->intervals;
 
 	xn2x_matrix_t* hessian = &(qpData->hessian);
 
-	/** calculate gradient and check gradient norm for convergence */
-	qpDUNES_computeNewtonGradient(qpData, &(qpData->gradient), xVecTmp);
-	if ((vectorNorm(&(qpData->gradient), _NX_ * _NI_)
-			< qpData->options.stationarityTolerance)) {
-		return QPDUNES_SUCC_OPTIMAL_SOLUTION_FOUND;
-	}
-
-
-	/** calculate hessian */
-
 	/* 1) diagonal blocks */
 	/*    E_{k+1} P_{k+1}^-1 E_{k+1}' + C_{k} P_{k} C_{k}'  for projected Hessian  P = Z (Z'HZ)^-1 Z'  */
+	#ifdef __QPDUNES_PARALLEL__
+	#pragma omp for private(ii, jj, addToRes, ZTCT, nFree) schedule(static)
+	#endif
 	for (kk = 0; kk < _NI_; ++kk) {
 		/* check whether block needs to be recomputed */
 		if ( (intervals[kk]->actSetHasChanged == QPDUNES_TRUE) || (intervals[kk+1]->actSetHasChanged == QPDUNES_TRUE) ) {
@@ -499,7 +603,7 @@ return_t qpDUNES_setupNewtonSystem(	qpData_t* const qpData
 				multiplyMatrixTMatrixDenseDense(xxMatTmp->data, zxMatTmp2->data, zxMatTmp2->data, nFree, _NX_, _NX_, addToRes);
 			}
 			else { /* clipping QP solver */
-				addCInvHCT(qpData, xxMatTmp, &(intervals[kk]->cholH), &(intervals[kk]->C), &(intervals[kk]->y), xxMatTmp2, uxMatTmp, zxMatTmp);
+				addCInvHCT(qpData, xxMatTmp, &(intervals[kk]->cholH), &(intervals[kk]->C), &(intervals[kk]->y), xxMatTmp2, uxMatTmp, zxMatTmp, xVecTmp);
 			}
 
 			/* write Hessian part */
@@ -514,6 +618,9 @@ return_t qpDUNES_setupNewtonSystem(	qpData_t* const qpData
 	}	/* END OF diagonal block for loop */
 
 	/* 2) sub-diagonal blocks */
+	#ifdef __QPDUNES_PARALLEL__
+	#pragma omp for private(ii, jj, addToRes, nFree) schedule(static)
+	#endif
 	for (kk = 1; kk < _NI_; ++kk) {
 		if (intervals[kk]->actSetHasChanged == QPDUNES_TRUE) {
 			if (intervals[kk]->qpSolverSpecification == QPDUNES_STAGE_QP_SOLVER_QPOASES) {
@@ -541,7 +648,7 @@ return_t qpDUNES_setupNewtonSystem(	qpData_t* const qpData
 				}
 			}
 			else { /* clipping QP solver */
-				multiplyAInvQ( qpData, &(qpData->xxMatTmp), &(intervals[kk]->C), &(intervals[kk]->cholH) );
+				multiplyAInvQ( qpData, xxMatTmp, &(intervals[kk]->C), &(intervals[kk]->cholH) );
 
 				/* write Hessian part */
 				for (ii=0; ii<_NX_; ++ii) {
@@ -564,7 +671,7 @@ return_t qpDUNES_setupNewtonSystem(	qpData_t* const qpData
 
 	return QPDUNES_OK;
 }
-/*<<< END OF qpDUNES_setupNewtonSystem */
+/*<<< END OF qpDUNES_setupNewtonHessianBlocks */
 
 
 /* ----------------------------------------------
@@ -578,7 +685,14 @@ return_t qpDUNES_computeNewtonGradient(qpData_t* const qpData, xn_vector_t* grad
 	interval_t** intervals = qpData->intervals;
 
 	/* d/(d lambda_ii) for kk=0.._NI_-1 */
+	#ifdef __QPDUNES_PARALLEL__
+	#pragma omp parallel for private(ii) firstprivate(gradPiece) schedule(static)
+	#endif
 	for (kk = 0; kk < _NI_; ++kk) {
+		#ifdef __QPDUNES_PARALLEL__
+		gradPiece = &(intervals[kk]->xVecTmp);	/* stage workspace, so that threads do not share gradPiece */
+		#endif
+
 		/* ( C_kk*z_kk^opt + c_kk ) - x_(kk+1)^opt */
 		multiplyCz(qpData, gradPiece, &(intervals[kk]->C), &(intervals[kk]->z));
 		addToVector(gradPiece, &(intervals[kk]->c), _NX_);
@@ -1545,6 +1659,9 @@ real_t qpDUNES_computeObjectiveValue(qpData_t* const qpData) {
 
 	real_t objVal = 0.;
 
+	#ifdef __QPDUNES_PARALLEL__
+	#pragma omp parallel for private(interval) schedule(static)
+	#endif
 	for (kk = 0; kk < _NI_ + 1; ++kk) {
 		interval = qpData->intervals[kk];
 
@@ -1557,9 +1674,12 @@ real_t qpDUNES_computeObjectiveValue(qpData_t* const qpData) {
 				interval->nV);
 		/* constant objective part */
 		interval->optObjVal += interval->p;
+	}
 
-		/* sum up */
-		objVal += interval->optObjVal;
+	/* sum up in stage order, so that the result does not depend on the
+	 * number of threads */
+	for (kk = 0; kk < _NI_ + 1; ++kk) {
+		objVal += qpData->intervals[kk]->optObjVal;
 	}
 
 	return objVal;
@@ -1584,7 +1704,12 @@ real_t qpDUNES_computeParametricObjectiveValue(	qpData_t* const qpData,
 
 	interval_t* interval;
 
+	int_t errCntr = 0;
+
 	/* TODO: move to own function in direct QP solver, a la getObjVal( qpData, interval, alpha ) */
+	#ifdef __QPDUNES_PARALLEL__
+	#pragma omp parallel for private(interval, qTry, pTry) reduction(+:errCntr) schedule(static)
+	#endif
 	for (kk = 0; kk < _NI_ + 1; ++kk) {
 		interval = qpData->intervals[kk];
 		qTry = &(interval->zVecTmp);
@@ -1600,7 +1725,8 @@ real_t qpDUNES_computeParametricObjectiveValue(	qpData_t* const qpData,
 			break;
 
 		default:
-			return QPDUNES_ERR_UNKNOWN_ERROR;
+			errCntr++;	/* no return from inside a parallel loop */
+			continue;
 		}
 
 		/* quadratic objective part */
@@ -1609,8 +1735,15 @@ real_t qpDUNES_computeParametricObjectiveValue(	qpData_t* const qpData,
 		interval->optObjVal += scalarProd(qTry, &(interval->z), interval->nV);
 		/* constant objective part */
 		interval->optObjVal += pTry;
+	}
+	if (errCntr > 0) {
+		return QPDUNES_ERR_UNKNOWN_ERROR;
+	}
 
-		objVal += interval->optObjVal;
+	/* sum up in stage order, so that the result does not depend on the
+	 * number of threads */
+	for (kk = 0; kk < _NI_ + 1; ++kk) {
+		objVal += qpData->intervals[kk]->optObjVal;
 	}
 
 	return objVal;
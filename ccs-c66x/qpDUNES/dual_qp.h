@@ -77,6 +77,29 @@ return_t qpDUNES_solveLocalQP(	qpData_t* const qpData,
 return_t qpDUNES_setupNewtonSystem(	qpData_t* const qpData
 									);
 
+
+/* ----------------------------------------------
+ * workspace for computing Newton Hessian blocks;
+ * one per thread in parallel mode
+ *
+ >>>>>>                                           */
+typedef struct
+{
+	x_vector_t* xVecTmp;
+	xx_matrix_t* xxMatTmp;
+	xx_matrix_t* xxMatTmp2;
+	ux_matrix_t* uxMatTmp;
+	zx_matrix_t* zxMatTmp;
+	zx_matrix_t* zxMatTmp2;
+	zz_matrix_t* ZT;
+	zz_matrix_t* cholProjHess;
+} newtonWorkspace_t;
+
+
+return_t qpDUNES_setupNewtonHessianBlocks(	qpData_t* const qpData,
+											newtonWorkspace_t* const ws
+											);
+
 return_t qpDUNES_factorNewtonSystem(	qpData_t* const qpData,
 									boolean_t* const isHessianRegularized,
 									int_t lastActSetChangeIdx
@@ -313,12 +313,13 @@ return_t addCInvHCT(	qpData_t* const qpData,
 						const d2_vector_t* const y,
 						xx_matrix_t* const xxMatTmp,
 						ux_matrix_t* const uxMatTmp,
-						zx_matrix_t* const zxMatTmp
+						zx_matrix_t* const zxMatTmp,
+						x_vector_t* const xVecTmp
 						)
 {
 	/* TODO: summarize to one function */
 	return addMultiplyMatrixInvMatrixMatrixT(qpData, res, cholH, C, y->data,
-			zxMatTmp, &(qpData->xVecTmp), _NX_, _NZ_);
+			zxMatTmp, xVecTmp, _NX_, _NZ_);
 }
 /*<<< END OF addCInvHC */
 
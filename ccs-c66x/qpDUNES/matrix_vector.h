@@ -552,7 +552,8 @@ return_t addCInvHCT(	qpData_t* const qpData,
 /*						xz_matrix_t* const C,*/			/**< temporary matrix to build up C as once */
 						xx_matrix_t* const xxMatTmp,
 						ux_matrix_t* const uxMatTmp,
-						zx_matrix_t* const zxMatTmp
+						zx_matrix_t* const zxMatTmp,
+						x_vector_t* const xVecTmp
 						);
 
 
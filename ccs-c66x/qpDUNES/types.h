@@ -56,8 +56,12 @@
 #define __ANALYZE_FACTORIZATION__			/* log inverse Newton Hessian for analysis */
 #undef __ANALYZE_FACTORIZATION__
 
-#define __QPDUNES_PARALLEL__				/* use openMP parallelization */
-#undef __QPDUNES_PARALLEL__
+/*#define __QPDUNES_PARALLEL__*/			/* use openMP parallelization of the per-stage loops */
+/*#undef __QPDUNES_PARALLEL__*/
+
+#if defined(__QPDUNES_PARALLEL__) && !defined(_OPENMP)
+	#error "__QPDUNES_PARALLEL__ requires compiling with OpenMP enabled"
+#endif
 
 #define PRINTING_PRECISION 14
 
@@ -405,6 +405,16 @@ void qpDUNES_assertOK(	return_t statusFlag,
 );
 
 
+#ifdef __MEASURE_TIMINGS__
+/**
+ *	\brief Monotonic time in seconds for the timings in the iteration log
+ *
+ *	Provided by the application, since the clock is platform-specific.
+ */
+double qpDUNES_getTime( void );
+#endif
+
+
 #endif	/* QPDUNES_UTILS_H */
 
 
@@ -0,0 +1,156 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CONDENSING_H
+#define CONDENSING_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+/*
+Condenses a block of consecutive multiple-shooting intervals into a single
+dense stage, by using the linearised dynamics to eliminate the state deltas
+inside the block.
+
+The variables of the condensed stage are the state delta at the start of the
+block followed by the control deltas of each interval in the block, so the
+stage has DELTA_DIM + CONTROL_DIM * n variables for a block of n intervals,
+with the dimensions taken from Types (see OCPTypes). The outputs are the
+dense stage Hessian and gradient, and the continuity constraint mapping the
+stage variables onto the state delta at the end of the block.
+
+The sensitivities are calculated one variable group at a time with a forward
+sweep, and folded into the Hessian with a backward sweep, so the cost is
+quadratic rather than cubic in the block length.
+*/
+template <class Types>
+class QPCondenser {
+    enum {
+        DELTA_DIM = Types::DELTA_DIM,
+        CONTROL_DIM = Types::CONTROL_DIM
+    };
+
+    typedef typename Types::DeltaVector DeltaVector;
+    typedef typename Types::StateWeightMatrix StateWeightMatrix;
+    typedef typename Types::ControlWeightMatrix ControlWeightMatrix;
+    typedef typename Types::ContinuityConstraintMatrix
+        ContinuityConstraintMatrix;
+    typedef Eigen::Matrix<
+        real_t,
+        DELTA_DIM,
+        DELTA_DIM> SensitivityMatrix;
+
+    /*
+    Sensitivities of each state delta in the block to the variable group
+    currently being condensed, and the state delta offsets due to the
+    integration residuals.
+    */
+    SensitivityMatrix sensitivities[OCP_MAX_HORIZON_LENGTH+1];
+    DeltaVector offsets[OCP_MAX_HORIZON_LENGTH+1];
+
+    template <int Cols>
+    void condense_group(
+        const ContinuityConstraintMatrix *jacobians,
+        const uint32_t *weight_scale,
+        uint32_t n,
+        uint32_t first,
+        uint32_t col,
+        const StateWeightMatrix &state_weights,
+        const StateWeightMatrix *terminal_weights,
+        MatrixXr &hessian,
+        MatrixXr &continuity,
+        Eigen::Matrix<real_t, DELTA_DIM, Cols> &z);
+
+public:
+    /*
+    Condenses intervals 0 to n - 1 of the arrays passed in. Interval i has
+    state weights state_weights * weight_scale[i] and control weights
+    control_weights * weight_scale[i]. If terminal_weights is given, it
+    weights the state delta at the end of the block; otherwise that state is
+    left to the next stage.
+
+    The outputs must already be large enough for the block; only the leading
+    DELTA_DIM + CONTROL_DIM * n rows and columns are written.
+    */
+    void condense(
+        const ContinuityConstraintMatrix *jacobians,
+        const DeltaVector *residuals,
+        const uint32_t *weight_scale,
+        uint32_t n,
+        const StateWeightMatrix &state_weights,
+        const ControlWeightMatrix &control_weights,
+        const StateWeightMatrix *terminal_weights,
+        MatrixXr &hessian,
+        VectorXr &gradient,
+        MatrixXr &continuity,
+        DeltaVector &residual);
+};
+
+/*
+Dense QP solver for problems with simple bounds only:
+
+    minimise 0.5 x'Hx + g'x  subject to  lower <= x <= upper
+
+which is what a fully condensed horizon reduces to, since the state bounds
+are unconstrained. This uses a projected Newton method: each iteration fixes
+the variables held at a bound by their gradient, takes a Newton step in the
+remaining variables using a Cholesky factorisation of that part of the
+Hessian, and projects the step back onto the bounds. The active set can
+change by many variables per iteration, and warm starting from the previous
+solution usually gives convergence in one or two iterations.
+*/
+class DenseQPSolver {
+    /* Workspace, sized by resize() so that solve() doesn't allocate. */
+    MatrixXr reduced_hessian;
+    VectorXr reduced_step;
+    VectorXr qp_gradient;
+    VectorXr trial_gradient;
+    VectorXr step;
+    VectorXr trial;
+    Eigen::Matrix<uint32_t, Eigen::Dynamic, 1> free_variables;
+    uint32_t max_iterations;
+    uint32_t iterations;
+
+    bool factorise(uint32_t n);
+    void backsolve(uint32_t n);
+
+public:
+    DenseQPSolver() : max_iterations(50), iterations(0) {}
+    void resize(uint32_t n);
+    void set_max_iterations(uint32_t in) { max_iterations = in; }
+    uint32_t get_iterations() const { return iterations; }
+
+    /*
+    Solves the QP, starting from the value of `solution` (which is projected
+    onto the bounds first). Returns false if the iteration limit was reached
+    or the reduced Hessian couldn't be factorised.
+    */
+    bool solve(
+        const MatrixXr &hessian,
+        const VectorXr &gradient,
+        const VectorXr &lower,
+        const VectorXr &upper,
+        VectorXr &solution);
+};
+
+#endif
@@ -32,11 +32,38 @@ Choose the integration method here:
     - NMPC_INTEGRATOR_RK4: 4th-order integration method. Requires most CPU time.
     - NMPC_INTEGRATOR_HEUN: 2nd-order Heun's method. Requires middle CPU time.
     - NMPC_INTEGRATOR_EULER: 1st-orer Euler's method. Requires least CPU time.
+    - NMPC_INTEGRATOR_RK45: 5th-order Dormand-Prince method, with an error
+      estimate for adaptive steps (see OCP_INTEGRATION_TOLERANCE below).
 */
 
 #define NMPC_INTEGRATOR_RK4
 /* #define NMPC_INTEGRATOR_HEUN */
 /* #define NMPC_INTEGRATOR_EULER */
+/* #define NMPC_INTEGRATOR_RK45 */
+
+/*
+Choose the method used to calculate the continuity constraint Jacobians:
+    - NMPC_JACOBIAN_AD: forward-mode automatic differentiation through the
+      integrator and dynamics model. Exact to machine precision.
+    - NMPC_JACOBIAN_FD: finite differences, requiring one additional
+      integration for each state and control perturbation.
+    - NMPC_JACOBIAN_FD_LANES: the same finite differences, but with the
+      reference and all of the perturbations of an interval integrated
+      together, one per lane, so that the integrator and dynamics model are
+      vectorised across the perturbations. Build with AVX2 or AVX-512
+      enabled (e.g. -march=native) for the widest vectors.
+*/
+#define NMPC_JACOBIAN_AD
+/* #define NMPC_JACOBIAN_FD */
+/* #define NMPC_JACOBIAN_FD_LANES */
+
+/*
+Uncomment to have the OCP call the dynamics model through the virtual
+DynamicsModel interface, so that the model can be chosen at run time. By
+default the OCP and integrators call X8DynamicsModel directly, which lets
+the compiler inline the model into each integration step.
+*/
+/* #define NMPC_VIRTUAL_DYNAMICS */
 
 /* NMPC vector dimensioning. */
 #define NMPC_CONTROL_DIM 3
@@ -53,10 +80,114 @@ Definitions for parameters used to calculated MRP vectors.
 #define NMPC_MRP_F ((real_t)2.0*(NMPC_MRP_A + 1))
 #define NMPC_MRP_F_2 (NMPC_MRP_F*NMPC_MRP_F)
 
-/* OCP control and prediction horizon (number of steps). */
-#define OCP_HORIZON_LENGTH 100
+/*
+Maximum OCP control and prediction horizon (number of steps). All horizon
+storage is allocated for this many steps, so it determines the memory usage
+regardless of the horizon length actually used.
+*/
+#define OCP_MAX_HORIZON_LENGTH 100
+
+/*
+Maximum number of base steps (of the step length below) covered by the
+horizon. Intervals can span several base steps when a non-uniform grid is
+used, but the reference trajectory is always stored on the base grid.
+*/
+#define OCP_MAX_HORIZON_STEPS OCP_MAX_HORIZON_LENGTH
 
-/* OCP control step length (seconds). */
+/*
+Default OCP control and prediction horizon (number of steps), and control step
+length (seconds). Both can be changed at runtime before nmpc_init() is
+called; the horizon length must not exceed OCP_MAX_HORIZON_LENGTH.
+*/
+#define OCP_HORIZON_LENGTH 100
 #define OCP_STEP_LENGTH ((real_t)(1.0/50.0))
 
+#if OCP_HORIZON_LENGTH > OCP_MAX_HORIZON_LENGTH || \
+    OCP_HORIZON_LENGTH > OCP_MAX_HORIZON_STEPS
+#error "OCP_HORIZON_LENGTH exceeds the maximum horizon length or steps"
+#endif
+
+/*
+Default number of integration steps per interval (or per base step, for a
+move-blocked interval), and integration tolerance. With a tolerance of zero
+the steps are fixed; otherwise an integrator with an error estimate
+(NMPC_INTEGRATOR_RK45) adjusts the step lengths to keep within it, starting
+from the fixed step length and taking at most OCP_MAX_INTEGRATION_STEPS
+steps per interval. Both can be changed at runtime.
+*/
+#define OCP_INTEGRATION_SUBSTEPS 1
+#define OCP_INTEGRATION_TOLERANCE ((real_t)0.0)
+#define OCP_MAX_INTEGRATION_STEPS 16
+
+/*
+Number of entries in the linearisation cache (a power of two), and the
+default cache tolerance. With a non-zero tolerance, the preparation step
+looks up each interval by its reference state and control, the wind
+velocity and the interval length, each quantised to a multiple of the
+tolerance, and on a hit reuses the Jacobian and integrated state stored
+when an interval with the same key was last linearised. The tolerance can
+be changed at runtime; zero disables the cache.
+*/
+#define OCP_LINEARISATION_CACHE_SIZE 64
+#define OCP_LINEARISATION_CACHE_TOLERANCE ((real_t)0.0)
+
+#if OCP_LINEARISATION_CACHE_SIZE < 1 || \
+    (OCP_LINEARISATION_CACHE_SIZE & (OCP_LINEARISATION_CACHE_SIZE - 1)) != 0
+#error "OCP_LINEARISATION_CACHE_SIZE must be a power of two"
+#endif
+
+/*
+Default Jacobian refresh schedule. The Jacobians of the whole horizon are
+recalculated on every OCP_JACOBIAN_REFRESH_INTERVAL'th preparation step, and
+those of the first OCP_JACOBIAN_REFRESH_STAGES intervals (and of the final
+interval, which is new after each shift) on every step; in between, the
+other intervals keep their previous Jacobians, and only the reference is
+integrated to update their residuals. An interval of 1 recalculates every
+Jacobian on every step. Both can be changed at runtime.
+*/
+#define OCP_JACOBIAN_REFRESH_INTERVAL 1
+#define OCP_JACOBIAN_REFRESH_STAGES 0
+
+/*
+Number of points the reference queue can hold (a power of two). Points are
+queued by another thread, such as a mission planner, and applied at the
+start of each preparation step.
+*/
+#define OCP_REFERENCE_QUEUE_LENGTH 256
+
+#if OCP_REFERENCE_QUEUE_LENGTH < 1 || \
+    (OCP_REFERENCE_QUEUE_LENGTH & (OCP_REFERENCE_QUEUE_LENGTH - 1)) != 0
+#error "OCP_REFERENCE_QUEUE_LENGTH must be a power of two"
+#endif
+
+/*
+Default number of worker threads used to linearise the horizon during the
+preparation step. Only has an effect when built with OpenMP support; can be
+changed at runtime with nmpc_set_preparation_threads().
+*/
+#define OCP_PREPARATION_THREADS 1
+
+/*
+Number of recent samples kept for each phase by the timing statistics; the
+latency percentiles are calculated over these.
+*/
+#define OCP_TIMING_WINDOW 256
+
+/*
+Alignment (bytes) of the statically-allocated QP solver workspace; should be
+the cache line size of the target.
+*/
+#define OCP_CACHE_LINE_SIZE 64
+
+/*
+Uncomment to have Eigen assert if it allocates during the preparation and
+feedback steps or a horizon update. All allocation is meant to happen when
+the OCP is created or initialised, so this is a debugging aid; like any
+other assertion it has no effect when NDEBUG is defined. Eigen's flag is
+process-wide, so only one controller instance can be running when it is
+used. It only sees Eigen's own allocations; tests/no_malloc.c checks for
+any allocation at all.
+*/
+/* #define NMPC_ASSERT_NO_MALLOC */
+
 #endif
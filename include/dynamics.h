@@ -36,22 +36,68 @@ SOFTWARE.
 #define NMPC_AIRFRAME_MIN_MOMENT 1e-6
 
 /*
-Dynamics model base class. The public interface is via the evaluate() method,
-which returns a 6-dimensional column vector containing linear acceleration
-and angular acceleration. In the future, this will need to accept a control
-input vector as a parameter.
+Dynamics model interface. A model provides evaluate() methods which return
+a 6-dimensional column vector containing linear acceleration and angular
+acceleration, for a state and control input.
+
+The real_ad_t overload is used to calculate exact Jacobians by forward-mode
+automatic differentiation; models will generally implement both overloads
+using a single template. The StateLanes overload evaluates the model for
+each lane (column) at once, for the lane-parallel finite differences, and
+should give the same results as the real_t overload in every lane.
+
+Models also provide get_wind_velocity(), which the OCP's linearisation
+cache includes in its key; it returns the WindVector type of the model's
+state space.
+
+The state model and integrators are templated on the model type, so a model
+doesn't need to derive from this class, and shouldn't: calling the concrete
+model lets the compiler inline it into each integration step. This base
+class is for selecting X8 models at run time, via DynamicsModelAdapter.
 */
 class DynamicsModel {
 public:
     virtual ~DynamicsModel();
     virtual AccelerationVector evaluate(
     const State &in, const ControlVector &control) const = 0;
+    virtual AccelerationVectorAD evaluate(
+    const StateAD &in, const ControlVectorAD &control) const = 0;
+    virtual AccelerationVectorLanes evaluate(
+    const StateLanes &in, const ControlVectorLanes &control) const = 0;
+    virtual const Vector3r &get_wind_velocity() const = 0;
+};
+
+/*
+Wraps a model in the DynamicsModel interface, so that it can be called
+through a DynamicsModel pointer.
+*/
+template <class Model>
+class DynamicsModelAdapter: public DynamicsModel, public Model {
+public:
+    AccelerationVector evaluate(
+    const State &in, const ControlVector &control) const {
+        return Model::evaluate(in, control);
+    }
+
+    AccelerationVectorAD evaluate(
+    const StateAD &in, const ControlVectorAD &control) const {
+        return Model::evaluate(in, control);
+    }
+
+    AccelerationVectorLanes evaluate(
+    const StateLanes &in, const ControlVectorLanes &control) const {
+        return Model::evaluate(in, control);
+    }
+
+    const Vector3r &get_wind_velocity() const {
+        return Model::get_wind_velocity();
+    }
 };
 
 /*
 Dynamics model tuned for the X8
 */
-class X8DynamicsModel: public DynamicsModel {
+class X8DynamicsModel {
     /* Use reciprocal of mass for performance */
     real_t mass_inv;
 
@@ -61,6 +107,12 @@ class X8DynamicsModel: public DynamicsModel {
     /* Store wind velocity as a parameter, because we can't control it. */
     Vector3r wind_velocity;
 
+    /* Shared implementation of the real_t and real_ad_t overloads. */
+    template <typename Scalar>
+    Eigen::Matrix<Scalar, 6, 1> evaluate_model(
+    const GenericState<Scalar> &in,
+    const Eigen::Matrix<Scalar, NMPC_CONTROL_DIM, 1> &control) const;
+
 public:
     X8DynamicsModel(void) {
         mass_inv = (real_t)1.0 / 3.8;
@@ -76,9 +128,508 @@ public:
     }
 
     void set_wind_velocity(const Vector3r &in) { wind_velocity = in; }
+    const Vector3r &get_wind_velocity() const { return wind_velocity; }
+    void set_mass(real_t in) { mass_inv = (real_t)1.0 / in; }
+    real_t get_mass() const { return (real_t)1.0 / mass_inv; }
 
     AccelerationVector evaluate(
     const State &in, const ControlVector &control) const;
+    AccelerationVectorAD evaluate(
+    const StateAD &in, const ControlVectorAD &control) const;
+    AccelerationVectorLanes evaluate(
+    const StateLanes &in, const ControlVectorLanes &control) const;
+};
+
+/*
+atan2() which keeps the fixed-size derivatives of the automatic
+differentiation scalar; Eigen's AutoDiffScalar version returns dynamically
+sized derivatives, which allocate on every call.
+*/
+inline real_t fixed_atan2(real_t y, real_t x) {
+    return std::atan2(y, x);
+}
+
+template <typename DerType>
+inline Eigen::AutoDiffScalar<DerType> fixed_atan2(
+const Eigen::AutoDiffScalar<DerType> &y,
+const Eigen::AutoDiffScalar<DerType> &x) {
+    real_t squared_hypot = y.value() * y.value() + x.value() * x.value();
+
+    return Eigen::AutoDiffScalar<DerType>(
+        std::atan2(y.value(), x.value()),
+        (y.derivatives() * x.value() - y.value() * x.derivatives()) /
+        squared_hypot);
+}
+
+/*
+Runs a dynamics model with hard-coded coefficients for the X8.
+
+The branches on the airflow magnitudes avoid taking square roots or atan2 of
+zero, which have infinite derivatives; the results are unchanged for real_t.
+*/
+template <typename Scalar>
+Eigen::Matrix<Scalar, 6, 1> X8DynamicsModel::evaluate_model(
+const GenericState<Scalar> &in,
+const Eigen::Matrix<Scalar, NMPC_CONTROL_DIM, 1> &control) const {
+    typedef Eigen::Matrix<Scalar, 3, 1> Vector3s;
+    typedef Eigen::Quaternion<Scalar> Quaternions;
+    using std::sqrt;
+    using std::abs;
+
+    /* Cache state data for convenience */
+    Quaternions attitude = Quaternions(in.attitude());
+    Scalar yaw_rate = in.angular_velocity()[2],
+           pitch_rate = in.angular_velocity()[1],
+           roll_rate = in.angular_velocity()[0];
+
+    /* External axes */
+    Vector3s airflow;
+    Scalar v2, v_inv, horizontal_v2, vertical_v2, vertical_v, vertical_v_inv;
+
+    airflow = attitude * (wind_velocity.cast<Scalar>() - in.velocity());
+    v2 = airflow.squaredNorm();
+    horizontal_v2 = airflow.y() * airflow.y() + airflow.x() * airflow.x();
+    vertical_v2 = airflow.z() * airflow.z() + airflow.x() * airflow.x();
+
+    v_inv = v2 > (real_t)1.0 ?
+        Scalar((real_t)1.0 / sqrt(v2)) : Scalar(1.0);
+    vertical_v = vertical_v2 > (real_t)0.0 ?
+        Scalar(sqrt(vertical_v2)) : Scalar(0.0);
+    vertical_v_inv = vertical_v > (real_t)1.0 ?
+        Scalar((real_t)1.0 / vertical_v) : Scalar(1.0);
+
+    /* Determine alpha and beta: alpha = atan(wz/wx), beta = atan(wy/|wxz|) */
+    Scalar alpha, sin_alpha, cos_alpha, sin_beta, cos_beta, a2, sin_cos_alpha;
+    alpha = vertical_v2 > (real_t)0.0 ?
+        fixed_atan2(Scalar(-airflow.z()), Scalar(-airflow.x())) :
+        Scalar(0.0);
+
+    sin_alpha = -airflow.z() * vertical_v_inv;
+    cos_alpha = -airflow.x() * vertical_v_inv;
+    sin_cos_alpha = sin_alpha * cos_alpha;
+    sin_beta = airflow.y() * v_inv;
+    cos_beta = vertical_v * v_inv;
+
+    a2 = alpha * alpha;
+
+    Scalar lift, alt_lift, drag, side_force, roll_moment, pitch_moment,
+           yaw_moment;
+    lift = (real_t)-5.0 * a2 * alpha + a2 + (real_t)2.5 * alpha +
+           (real_t)0.12;
+    alt_lift = (real_t)0.8 * sin_cos_alpha;
+    if (alpha < (real_t)-0.25) {
+        if (alt_lift < lift) {
+            lift = alt_lift;
+        }
+    } else {
+        if (lift < alt_lift) {
+            lift = alt_lift;
+        }
+    }
+
+    drag = (real_t)0.05 + (real_t)0.7 * sin_alpha * sin_alpha;
+    side_force = (real_t)0.3 * sin_beta * cos_beta;
+
+    pitch_moment = (real_t)0.001 - (real_t)0.1 * sin_cos_alpha -
+                   (real_t)0.003 * pitch_rate -
+                   (real_t)0.04 * (control[1] - (real_t)0.5) -
+                   (real_t)0.04 * (control[2] - (real_t)0.5);
+    roll_moment = (real_t)0.03 * sin_beta - (real_t)0.015 * roll_rate +
+                  (real_t)0.1 * (control[1] - (real_t)0.5) -
+                  (real_t)0.1 * (control[2] - (real_t)0.5);
+    yaw_moment = (real_t)-0.02 * sin_beta - (real_t)0.05 * yaw_rate -
+                 (real_t)0.01 * abs(control[1] - (real_t)0.5) +
+                 (real_t)0.01 * abs(control[2] - (real_t)0.5);
+
+    /*
+    Determine motor thrust and torque.
+    */
+    Scalar thrust, ve = (real_t)0.0025 * (control[0] * (real_t)25000.0),
+           v0 = airflow.x();
+    thrust = (real_t)(0.5 * RHO * 0.025) * (ve * ve - v0 * v0);
+    if (thrust < (real_t)0.0) {
+        /* Folding prop, so assume no drag */
+        thrust = Scalar(0.0);
+    }
+
+    /*
+    Sum and apply forces and moments
+    */
+    Vector3s sum_force;
+    Scalar qbar = (RHO * (real_t)0.5) * horizontal_v2;
+    sum_force << thrust + qbar * (lift * sin_alpha - drag * cos_alpha -
+                                  side_force * sin_beta),
+                 qbar * side_force * cos_beta,
+                 -qbar * (lift * cos_alpha + drag * sin_alpha);
+
+    /* Calculate linear acceleration (F / m) */
+    Eigen::Matrix<Scalar, 6, 1> output;
+    output.template segment<3>(0) = sum_force * Scalar(mass_inv) +
+        attitude * Vector3s(Scalar(0.0), Scalar(0.0), Scalar(G_ACCEL));
+
+    /* Calculate angular acceleration (tau / inertia tensor) */
+    /*output.segment<3>(3) = inertia_tensor_inv * sum_torque;*/
+    output.template segment<3>(3) <<
+        qbar * ((real_t)3.364222 * roll_moment +
+                (real_t)0.27744448 * yaw_moment),
+        qbar * (real_t)5.8823528 * pitch_moment,
+        qbar * ((real_t)0.27744448 * roll_moment +
+                (real_t)2.4920163 * yaw_moment);
+
+    return output;
+}
+
+inline AccelerationVector X8DynamicsModel::evaluate(
+const State &in, const ControlVector &control) const {
+    return evaluate_model<real_t>(in, control);
+}
+
+inline AccelerationVectorAD X8DynamicsModel::evaluate(
+const StateAD &in, const ControlVectorAD &control) const {
+    return evaluate_model<real_ad_t>(in, control);
+}
+
+/* Element-wise atan2 for the lane-parallel model. */
+struct lane_atan2_op {
+    typedef real_t result_type;
+
+    real_t operator()(const real_t &y, const real_t &x) const {
+        return std::atan2(y, x);
+    }
+};
+
+/*
+The same model as evaluate_model(), for every lane at once. The branches
+are replaced by selects, which evaluate both sides but keep the result of
+the one the scalar version would have taken.
+*/
+inline AccelerationVectorLanes X8DynamicsModel::evaluate(
+const StateLanes &in, const ControlVectorLanes &control) const {
+    uint32_t i;
+
+    /* Cache state data for convenience */
+    Vector4Lanes attitude = in.middleRows<4>(6).array();
+    LaneArray yaw_rate = in.row(12).array(),
+              pitch_rate = in.row(11).array(),
+              roll_rate = in.row(10).array();
+
+    /* External axes */
+    Vector3Lanes relative_wind, airflow;
+    LaneArray v2, v_inv, horizontal_v2, vertical_v2, vertical_v,
+              vertical_v_inv;
+
+    for(i = 0; i < 3; i++) {
+        relative_wind.row(i) = wind_velocity[i] - in.row(3 + i).array();
+    }
+
+    airflow = rotate_lanes(attitude, relative_wind);
+    v2 = airflow.row(0) * airflow.row(0) + airflow.row(1) * airflow.row(1) +
+         airflow.row(2) * airflow.row(2);
+    horizontal_v2 = airflow.row(1) * airflow.row(1) +
+                    airflow.row(0) * airflow.row(0);
+    vertical_v2 = airflow.row(2) * airflow.row(2) +
+                  airflow.row(0) * airflow.row(0);
+
+    v_inv = (v2 > (real_t)1.0).select(v2.sqrt().inverse(), (real_t)1.0);
+    vertical_v = (vertical_v2 > (real_t)0.0).select(
+        vertical_v2.sqrt(), (real_t)0.0);
+    vertical_v_inv = (vertical_v > (real_t)1.0).select(
+        vertical_v.inverse(), (real_t)1.0);
+
+    /* Determine alpha and beta: alpha = atan(wz/wx), beta = atan(wy/|wxz|) */
+    LaneArray alpha, sin_alpha, cos_alpha, sin_beta, cos_beta, a2,
+              sin_cos_alpha;
+    alpha = (vertical_v2 > (real_t)0.0).select(
+        (-airflow.row(2)).binaryExpr(-airflow.row(0), lane_atan2_op()),
+        (real_t)0.0);
+
+    sin_alpha = -airflow.row(2) * vertical_v_inv;
+    cos_alpha = -airflow.row(0) * vertical_v_inv;
+    sin_cos_alpha = sin_alpha * cos_alpha;
+    sin_beta = airflow.row(1) * v_inv;
+    cos_beta = vertical_v * v_inv;
+
+    a2 = alpha * alpha;
+
+    LaneArray lift, alt_lift, drag, side_force, roll_moment, pitch_moment,
+              yaw_moment;
+    lift = (real_t)-5.0 * a2 * alpha + a2 + (real_t)2.5 * alpha +
+           (real_t)0.12;
+    alt_lift = (real_t)0.8 * sin_cos_alpha;
+    lift = (alpha < (real_t)-0.25).select(
+        lift.min(alt_lift), lift.max(alt_lift));
+
+    drag = (real_t)0.05 + (real_t)0.7 * sin_alpha * sin_alpha;
+    side_force = (real_t)0.3 * sin_beta * cos_beta;
+
+    LaneArray elevon_left = control.row(1).array() - (real_t)0.5,
+              elevon_right = control.row(2).array() - (real_t)0.5;
+    pitch_moment = (real_t)0.001 - (real_t)0.1 * sin_cos_alpha -
+                   (real_t)0.003 * pitch_rate -
+                   (real_t)0.04 * elevon_left -
+                   (real_t)0.04 * elevon_right;
+    roll_moment = (real_t)0.03 * sin_beta - (real_t)0.015 * roll_rate +
+                  (real_t)0.1 * elevon_left -
+                  (real_t)0.1 * elevon_right;
+    yaw_moment = (real_t)-0.02 * sin_beta - (real_t)0.05 * yaw_rate -
+                 (real_t)0.01 * elevon_left.abs() +
+                 (real_t)0.01 * elevon_right.abs();
+
+    /*
+    Determine motor thrust and torque.
+    */
+    LaneArray thrust, ve, v0 = airflow.row(0);
+    ve = (real_t)0.0025 * (control.row(0).array() * (real_t)25000.0);
+    thrust = (real_t)(0.5 * RHO * 0.025) * (ve * ve - v0 * v0);
+
+    /* Folding prop, so assume no drag */
+    thrust = (thrust < (real_t)0.0).select((real_t)0.0, thrust);
+
+    /*
+    Sum and apply forces and moments
+    */
+    Vector3Lanes sum_force, gravity;
+    LaneArray qbar = (RHO * (real_t)0.5) * horizontal_v2;
+    sum_force.row(0) = thrust + qbar * (lift * sin_alpha - drag * cos_alpha -
+                                        side_force * sin_beta);
+    sum_force.row(1) = qbar * side_force * cos_beta;
+    sum_force.row(2) = -qbar * (lift * cos_alpha + drag * sin_alpha);
+
+    gravity.topRows<2>().setZero();
+    gravity.row(2).setConstant(G_ACCEL);
+    gravity = rotate_lanes(attitude, gravity);
+
+    /* Calculate linear acceleration (F / m) */
+    AccelerationVectorLanes output;
+    output.topRows<3>() = (sum_force * mass_inv + gravity).matrix();
+
+    /* Calculate angular acceleration (tau / inertia tensor) */
+    output.row(3) = (qbar * ((real_t)3.364222 * roll_moment +
+                             (real_t)0.27744448 * yaw_moment)).matrix();
+    output.row(4) = (qbar * (real_t)5.8823528 * pitch_moment).matrix();
+    output.row(5) = (qbar * ((real_t)0.27744448 * roll_moment +
+                             (real_t)2.4920163 * yaw_moment)).matrix();
+
+    return output;
+}
+
+/*
+The model X8StateSpace::Dynamics points to: with NMPC_VIRTUAL_DYNAMICS
+defined, the OCP calls it through the DynamicsModel interface.
+*/
+#ifdef NMPC_VIRTUAL_DYNAMICS
+typedef DynamicsModelAdapter<X8DynamicsModel> X8Dynamics;
+#else
+typedef X8DynamicsModel X8Dynamics;
+#endif
+
+/*
+Longitudinal dynamics model for the X8 (see LongitudinalStateSpace in
+state.h), with the same lift, drag, pitching moment and thrust as
+X8DynamicsModel restricted to the vertical plane. The controls are the
+throttle and the elevator (both elevons together, 0.5 being neutral).
+evaluate() returns the north and down accelerations and the pitch
+acceleration.
+*/
+class LongitudinalDynamicsModel {
+    /* Use reciprocal of mass for performance */
+    real_t mass_inv;
+
+    /* Wind velocity (north and down) */
+    Vector2r wind_velocity;
+
+    /* Shared implementation of the real_t and AD overloads. */
+    template <typename Scalar>
+    Eigen::Matrix<Scalar, 3, 1> evaluate_model(
+    const LongitudinalState<Scalar> &in,
+    const Eigen::Matrix<Scalar, LongitudinalTypes::CONTROL_DIM, 1> &control)
+    const;
+
+public:
+    typedef Eigen::Matrix<real_t, 3, 1> AccelerationVector;
+    typedef Eigen::Matrix<
+        LongitudinalTypes::ADScalar, 3, 1> AccelerationVectorAD;
+    typedef Eigen::Matrix<
+        real_t,
+        3,
+        LongitudinalTypes::LANES,
+        Eigen::RowMajor> AccelerationVectorLanes;
+
+    LongitudinalDynamicsModel(void) {
+        mass_inv = (real_t)1.0 / 3.8;
+        wind_velocity << 0.0, 0.0;
+    }
+
+    void set_wind_velocity(const Vector2r &in) { wind_velocity = in; }
+    const Vector2r &get_wind_velocity() const { return wind_velocity; }
+    void set_mass(real_t in) { mass_inv = (real_t)1.0 / in; }
+    real_t get_mass() const { return (real_t)1.0 / mass_inv; }
+
+    AccelerationVector evaluate(
+    const LongitudinalStateSpace::State &in,
+    const LongitudinalTypes::ControlVector &control) const {
+        return evaluate_model<real_t>(in, control);
+    }
+
+    AccelerationVectorAD evaluate(
+    const LongitudinalStateSpace::StateAD &in,
+    const LongitudinalTypes::ControlVectorAD &control) const {
+        return evaluate_model<LongitudinalTypes::ADScalar>(in, control);
+    }
+
+    AccelerationVectorLanes evaluate(
+    const LongitudinalStateLanes &in,
+    const LongitudinalTypes::ControlVectorLanes &control) const;
 };
 
+/*
+The airflow is rotated into the body x-z plane by the pitch; otherwise this
+follows X8DynamicsModel::evaluate_model(), including the branches which
+avoid infinite derivatives at zero airspeed.
+*/
+template <typename Scalar>
+Eigen::Matrix<Scalar, 3, 1> LongitudinalDynamicsModel::evaluate_model(
+const LongitudinalState<Scalar> &in,
+const Eigen::Matrix<Scalar, LongitudinalTypes::CONTROL_DIM, 1> &control)
+const {
+    using std::sqrt;
+    using std::sin;
+    using std::cos;
+
+    Scalar sin_pitch = sin(in.pitch()), cos_pitch = cos(in.pitch());
+
+    /* Airflow in the body frame */
+    Scalar wind_n, wind_d, airflow_x, airflow_z, v2, v_inv;
+    wind_n = wind_velocity[0] - in.velocity()[0];
+    wind_d = wind_velocity[1] - in.velocity()[1];
+    airflow_x = cos_pitch * wind_n - sin_pitch * wind_d;
+    airflow_z = sin_pitch * wind_n + cos_pitch * wind_d;
+
+    v2 = airflow_x * airflow_x + airflow_z * airflow_z;
+    v_inv = v2 > (real_t)1.0 ?
+        Scalar((real_t)1.0 / sqrt(v2)) : Scalar(1.0);
+
+    /* Determine alpha = atan(wz/wx) */
+    Scalar alpha, sin_alpha, cos_alpha, a2, sin_cos_alpha;
+    alpha = v2 > (real_t)0.0 ?
+        fixed_atan2(Scalar(-airflow_z), Scalar(-airflow_x)) : Scalar(0.0);
+
+    sin_alpha = -airflow_z * v_inv;
+    cos_alpha = -airflow_x * v_inv;
+    sin_cos_alpha = sin_alpha * cos_alpha;
+
+    a2 = alpha * alpha;
+
+    Scalar lift, alt_lift, drag, pitch_moment;
+    lift = (real_t)-5.0 * a2 * alpha + a2 + (real_t)2.5 * alpha +
+           (real_t)0.12;
+    alt_lift = (real_t)0.8 * sin_cos_alpha;
+    if (alpha < (real_t)-0.25) {
+        if (alt_lift < lift) {
+            lift = alt_lift;
+        }
+    } else {
+        if (lift < alt_lift) {
+            lift = alt_lift;
+        }
+    }
+
+    drag = (real_t)0.05 + (real_t)0.7 * sin_alpha * sin_alpha;
+
+    pitch_moment = (real_t)0.001 - (real_t)0.1 * sin_cos_alpha -
+                   (real_t)0.003 * in.pitch_rate() -
+                   (real_t)0.08 * (control[1] - (real_t)0.5);
+
+    /* Determine motor thrust */
+    Scalar thrust, ve = (real_t)0.0025 * (control[0] * (real_t)25000.0);
+    thrust = (real_t)(0.5 * RHO * 0.025) *
+             (ve * ve - airflow_x * airflow_x);
+    if (thrust < (real_t)0.0) {
+        /* Folding prop, so assume no drag */
+        thrust = Scalar(0.0);
+    }
+
+    /* Sum forces in the body frame, and rotate them back to north/down */
+    Scalar qbar = (RHO * (real_t)0.5) * v2, force_x, force_z;
+    force_x = thrust + qbar * (lift * sin_alpha - drag * cos_alpha);
+    force_z = -qbar * (lift * cos_alpha + drag * sin_alpha);
+
+    Eigen::Matrix<Scalar, 3, 1> output;
+    output << (cos_pitch * force_x + sin_pitch * force_z) * mass_inv,
+              (cos_pitch * force_z - sin_pitch * force_x) * mass_inv +
+                  G_ACCEL,
+              qbar * (real_t)5.8823528 * pitch_moment;
+
+    return output;
+}
+
+/* As for evaluate_model(), in every lane. */
+inline LongitudinalDynamicsModel::AccelerationVectorLanes
+LongitudinalDynamicsModel::evaluate(
+const LongitudinalStateLanes &in,
+const LongitudinalTypes::ControlVectorLanes &control) const {
+    typedef LongitudinalTypes::LaneArray LaneArray;
+
+    LaneArray sin_pitch = in.row(4).array().sin(),
+              cos_pitch = in.row(4).array().cos();
+
+    /* Airflow in the body frame */
+    LaneArray wind_n, wind_d, airflow_x, airflow_z, v2, v_inv;
+    wind_n = wind_velocity[0] - in.row(2).array();
+    wind_d = wind_velocity[1] - in.row(3).array();
+    airflow_x = cos_pitch * wind_n - sin_pitch * wind_d;
+    airflow_z = sin_pitch * wind_n + cos_pitch * wind_d;
+
+    v2 = airflow_x * airflow_x + airflow_z * airflow_z;
+    v_inv = (v2 > (real_t)1.0).select(v2.sqrt().inverse(), (real_t)1.0);
+
+    /* Determine alpha = atan(wz/wx) */
+    LaneArray alpha, sin_alpha, cos_alpha, a2, sin_cos_alpha;
+    alpha = (v2 > (real_t)0.0).select(
+        (-airflow_z).binaryExpr(-airflow_x, lane_atan2_op()),
+        (real_t)0.0);
+
+    sin_alpha = -airflow_z * v_inv;
+    cos_alpha = -airflow_x * v_inv;
+    sin_cos_alpha = sin_alpha * cos_alpha;
+
+    a2 = alpha * alpha;
+
+    LaneArray lift, alt_lift, drag, pitch_moment;
+    lift = (real_t)-5.0 * a2 * alpha + a2 + (real_t)2.5 * alpha +
+           (real_t)0.12;
+    alt_lift = (real_t)0.8 * sin_cos_alpha;
+    lift = (alpha < (real_t)-0.25).select(
+        lift.min(alt_lift), lift.max(alt_lift));
+
+    drag = (real_t)0.05 + (real_t)0.7 * sin_alpha * sin_alpha;
+
+    pitch_moment = (real_t)0.001 - (real_t)0.1 * sin_cos_alpha -
+                   (real_t)0.003 * in.row(5).array() -
+                   (real_t)0.08 * (control.row(1).array() - (real_t)0.5);
+
+    /* Determine motor thrust */
+    LaneArray thrust, ve;
+    ve = (real_t)0.0025 * (control.row(0).array() * (real_t)25000.0);
+    thrust = (real_t)(0.5 * RHO * 0.025) *
+             (ve * ve - airflow_x * airflow_x);
+
+    /* Folding prop, so assume no drag */
+    thrust = (thrust < (real_t)0.0).select((real_t)0.0, thrust);
+
+    /* Sum forces in the body frame, and rotate them back to north/down */
+    LaneArray qbar = (RHO * (real_t)0.5) * v2, force_x, force_z;
+    force_x = thrust + qbar * (lift * sin_alpha - drag * cos_alpha);
+    force_z = -qbar * (lift * cos_alpha + drag * sin_alpha);
+
+    AccelerationVectorLanes output;
+    output.row(0) = ((cos_pitch * force_x + sin_pitch * force_z) *
+                     mass_inv).matrix();
+    output.row(1) = ((cos_pitch * force_z - sin_pitch * force_x) *
+                     mass_inv + G_ACCEL).matrix();
+    output.row(2) = (qbar * (real_t)5.8823528 * pitch_moment).matrix();
+
+    return output;
+}
+
 #endif
@@ -23,33 +23,89 @@ SOFTWARE.
 #ifndef INTEGRATOR_H_
 #define INTEGRATOR_H_
 
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+
+#include "types.h"
+
+/*
+Step lengths for integrating over one interval, as chosen by an integrator's
+plan() method: count steps, each of uniform_length unless adaptive is set,
+in which case lengths holds each of them.
+*/
+struct IntegrationSteps {
+    uint32_t count;
+    bool adaptive;
+    real_t uniform_length;
+    real_t lengths[OCP_MAX_INTEGRATION_STEPS];
+
+    real_t length(uint32_t i) const {
+        return adaptive ? lengths[i] : uniform_length;
+    }
+};
+
 /*
 Integrator base class. The public interface is via the integrate() method,
 which takes a template parameter that at a minimum must support addition,
 subtraction and scalar multiplication. It also must have a public method
-"model" which takes no arguments and returns a type which can be added to
-the template parameter and also supports scalar multiplication.
+"model" which takes a control vector and dynamics model, and returns a type
+which can be added to the template parameter and also supports scalar
+multiplication. The control vector and dynamics model types are template
+parameters as well, so that real_ad_t states and controls can be integrated
+to obtain Jacobians, and so that the integrators work for any state space.
+
+Integration methods derive from Integrator<Derived> and implement step(),
+which integrate() dispatches to at compile time, so code which is templated
+on the integrator (such as OptimalControlProblem) has no dispatch overhead.
+
+plan() chooses the steps for integrating from a (real_t) state over an
+interval of `steps` steps of length `delta`. Fixed-step methods take those
+steps and ignore the tolerance; methods with an error estimate can hide it
+with their own, adaptive version. The steps are chosen once per interval
+and then used for every integration across it, so that the Jacobians are
+those of the same discrete map as the integrated state.
 */
 template<typename Derived>
 class Integrator {
 public:
-    template<typename StateModel>
-    StateModel integrate(
-        StateModel in,
-        ControlVector control,
-        DynamicsModel *dynamics,
+    template<typename StateModel, typename ControlModel, typename Dynamics>
+    const StateModel integrate(
+        const StateModel &in,
+        const ControlModel &control,
+        Dynamics *dynamics,
         real_t delta) const {
-        static_cast<Derived *>(this)->integrate(in, control, dynamics, delta);
+        return static_cast<const Derived *>(this)->step(
+            in, control, dynamics, delta);
+    }
+
+    template<typename StateModel, typename ControlModel, typename Dynamics>
+    void plan(
+        const StateModel &in,
+        const ControlModel &control,
+        Dynamics *dynamics,
+        real_t delta,
+        uint32_t steps,
+        real_t tolerance,
+        IntegrationSteps &out) const {
+        (void)in;
+        (void)control;
+        (void)dynamics;
+        (void)tolerance;
+
+        out.count = steps;
+        out.adaptive = false;
+        out.uniform_length = delta;
     }
 };
 
-class IntegratorRK4: Integrator<IntegratorRK4> {
+class IntegratorRK4: public Integrator<IntegratorRK4> {
 public:
-    template<typename StateModel>
-    const StateModel integrate(
-        StateModel in,
-        ControlVector control,
-        DynamicsModel *dynamics,
+    template<typename StateModel, typename ControlModel, typename Dynamics>
+    const StateModel step(
+        const StateModel &in,
+        const ControlModel &control,
+        Dynamics *dynamics,
         real_t delta) const {
         StateModel a = in.model(control, dynamics);
         StateModel b = static_cast<StateModel>(
@@ -63,13 +119,13 @@ public:
     }
 };
 
-class IntegratorHeun: Integrator<IntegratorHeun> {
+class IntegratorHeun: public Integrator<IntegratorHeun> {
 public:
-    template<typename StateModel>
-    const StateModel integrate(
-        StateModel in,
-        ControlVector control,
-        DynamicsModel *dynamics,
+    template<typename StateModel, typename ControlModel, typename Dynamics>
+    const StateModel step(
+        const StateModel &in,
+        const ControlModel &control,
+        Dynamics *dynamics,
         real_t delta) const {
         StateModel initial = in.model(control, dynamics);
         StateModel predictor = in + delta * initial;
@@ -78,16 +134,189 @@ public:
     }
 };
 
-class IntegratorEuler: Integrator<IntegratorEuler> {
+class IntegratorEuler: public Integrator<IntegratorEuler> {
 public:
-    template<typename StateModel>
-    const StateModel integrate(
-        StateModel in,
-        ControlVector control,
-        DynamicsModel *dynamics,
+    template<typename StateModel, typename ControlModel, typename Dynamics>
+    const StateModel step(
+        const StateModel &in,
+        const ControlModel &control,
+        Dynamics *dynamics,
         real_t delta) const {
         return in + delta * in.model(control, dynamics);
     }
 };
 
+/*
+5th-order Dormand-Prince method, with an embedded 4th-order error estimate.
+step() takes a 5th-order step (six model evaluations); with a non-zero
+tolerance, plan() adjusts the step lengths so that the estimated error of
+each step is within the tolerance, relative to 1 + |x| for each component x
+of the state, taking at most OCP_MAX_INTEGRATION_STEPS steps.
+*/
+class IntegratorRK45: public Integrator<IntegratorRK45> {
+    /*
+    Takes a step of length delta from in to out, and returns the largest
+    error estimate relative to the tolerance.
+    */
+    template<typename StateModel, typename ControlModel, typename Dynamics>
+    real_t step_error(
+        const StateModel &in,
+        const ControlModel &control,
+        Dynamics *dynamics,
+        real_t delta,
+        real_t tolerance,
+        StateModel &out) const {
+        StateModel k1, k2, k3, k4, k5, k6, k7, error;
+
+        k1 = in.model(control, dynamics);
+        k2 = static_cast<StateModel>(in + delta * (
+            (real_t)(1.0/5.0) * k1)).model(control, dynamics);
+        k3 = static_cast<StateModel>(in + delta * (
+            (real_t)(3.0/40.0) * k1 +
+            (real_t)(9.0/40.0) * k2)).model(control, dynamics);
+        k4 = static_cast<StateModel>(in + delta * (
+            (real_t)(44.0/45.0) * k1 -
+            (real_t)(56.0/15.0) * k2 +
+            (real_t)(32.0/9.0) * k3)).model(control, dynamics);
+        k5 = static_cast<StateModel>(in + delta * (
+            (real_t)(19372.0/6561.0) * k1 -
+            (real_t)(25360.0/2187.0) * k2 +
+            (real_t)(64448.0/6561.0) * k3 -
+            (real_t)(212.0/729.0) * k4)).model(control, dynamics);
+        k6 = static_cast<StateModel>(in + delta * (
+            (real_t)(9017.0/3168.0) * k1 -
+            (real_t)(355.0/33.0) * k2 +
+            (real_t)(46732.0/5247.0) * k3 +
+            (real_t)(49.0/176.0) * k4 -
+            (real_t)(5103.0/18656.0) * k5)).model(control, dynamics);
+        out = in + delta * (
+            (real_t)(35.0/384.0) * k1 +
+            (real_t)(500.0/1113.0) * k3 +
+            (real_t)(125.0/192.0) * k4 -
+            (real_t)(2187.0/6784.0) * k5 +
+            (real_t)(11.0/84.0) * k6);
+        k7 = out.model(control, dynamics);
+
+        /* Difference between the 5th- and 4th-order solutions. */
+        error = delta * (
+            (real_t)(71.0/57600.0) * k1 -
+            (real_t)(71.0/16695.0) * k3 +
+            (real_t)(71.0/1920.0) * k4 -
+            (real_t)(17253.0/339200.0) * k5 +
+            (real_t)(22.0/525.0) * k6 -
+            (real_t)(1.0/40.0) * k7);
+
+        return (error.array().abs() /
+            (tolerance * ((real_t)1.0 + out.array().abs()))).maxCoeff();
+    }
+
+public:
+    template<typename StateModel, typename ControlModel, typename Dynamics>
+    const StateModel step(
+        const StateModel &in,
+        const ControlModel &control,
+        Dynamics *dynamics,
+        real_t delta) const {
+        StateModel k1 = in.model(control, dynamics);
+        StateModel k2 = static_cast<StateModel>(in + delta * (
+            (real_t)(1.0/5.0) * k1)).model(control, dynamics);
+        StateModel k3 = static_cast<StateModel>(in + delta * (
+            (real_t)(3.0/40.0) * k1 +
+            (real_t)(9.0/40.0) * k2)).model(control, dynamics);
+        StateModel k4 = static_cast<StateModel>(in + delta * (
+            (real_t)(44.0/45.0) * k1 -
+            (real_t)(56.0/15.0) * k2 +
+            (real_t)(32.0/9.0) * k3)).model(control, dynamics);
+        StateModel k5 = static_cast<StateModel>(in + delta * (
+            (real_t)(19372.0/6561.0) * k1 -
+            (real_t)(25360.0/2187.0) * k2 +
+            (real_t)(64448.0/6561.0) * k3 -
+            (real_t)(212.0/729.0) * k4)).model(control, dynamics);
+        StateModel k6 = static_cast<StateModel>(in + delta * (
+            (real_t)(9017.0/3168.0) * k1 -
+            (real_t)(355.0/33.0) * k2 +
+            (real_t)(46732.0/5247.0) * k3 +
+            (real_t)(49.0/176.0) * k4 -
+            (real_t)(5103.0/18656.0) * k5)).model(control, dynamics);
+        return in + delta * (
+            (real_t)(35.0/384.0) * k1 +
+            (real_t)(500.0/1113.0) * k3 +
+            (real_t)(125.0/192.0) * k4 -
+            (real_t)(2187.0/6784.0) * k5 +
+            (real_t)(11.0/84.0) * k6);
+    }
+
+    /*
+    Starts with steps of length delta, and after each step scales the step
+    length by the usual 0.9 * error^(-1/5), within a factor of 0.2 to 4;
+    steps with an error above the tolerance are retried with a shorter
+    step. No step is shorter than is needed to finish the interval within
+    OCP_MAX_INTEGRATION_STEPS, and a step which would leave less than a
+    tenth of itself is stretched to finish the interval.
+    */
+    template<typename StateModel, typename ControlModel, typename Dynamics>
+    void plan(
+        const StateModel &in,
+        const ControlModel &control,
+        Dynamics *dynamics,
+        real_t delta,
+        uint32_t steps,
+        real_t tolerance,
+        IntegrationSteps &out) const {
+        StateModel state = in, next;
+        real_t remaining = delta * (real_t)steps, h = delta, shortest,
+               error, scale;
+
+        if(tolerance <= (real_t)0.0) {
+            Integrator<IntegratorRK45>::plan(
+                in, control, dynamics, delta, steps, tolerance, out);
+            return;
+        }
+
+        out.count = 0;
+        out.adaptive = true;
+        while(out.count < OCP_MAX_INTEGRATION_STEPS) {
+            shortest = remaining /
+                (real_t)(OCP_MAX_INTEGRATION_STEPS - out.count);
+            h = std::max(h, shortest);
+            if(remaining - h < (real_t)0.1 * h) {
+                h = remaining;
+            }
+
+            error = step_error(state, control, dynamics, h, tolerance, next);
+            scale = error > (real_t)0.0 ?
+                (real_t)0.9 * std::pow(error, (real_t)-0.2) : (real_t)4.0;
+            scale = std::min(std::max(scale, (real_t)0.2), (real_t)4.0);
+
+            if(error > (real_t)1.0 && h > shortest) {
+                h = std::max(h * scale, shortest);
+                continue;
+            }
+
+            out.lengths[out.count++] = h;
+            if(h == remaining) {
+                break;
+            }
+
+            remaining -= h;
+            state = next;
+            h *= scale;
+        }
+    }
+};
+
+/*
+Integrator selected in `config.h`, which OptimalControlProblem uses unless
+it's instantiated with another one.
+*/
+#if defined(NMPC_INTEGRATOR_RK4)
+typedef IntegratorRK4 DefaultIntegrator;
+#elif defined(NMPC_INTEGRATOR_HEUN)
+typedef IntegratorHeun DefaultIntegrator;
+#elif defined(NMPC_INTEGRATOR_EULER)
+typedef IntegratorEuler DefaultIntegrator;
+#elif defined(NMPC_INTEGRATOR_RK45)
+typedef IntegratorRK45 DefaultIntegrator;
+#endif
+
 #endif
@@ -1,122 +1,339 @@
-/*
-Copyright (C) 2013 Daniel Dyer
-
-Permission is hereby granted, free of charge, to any person obtaining a copy
-of this software and associated documentation files (the "Software"), to deal
-in the Software without restriction, including without limitation the rights
-to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
-copies of the Software, and to permit persons to whom the Software is
-furnished to do so, subject to the following conditions:
-
-The above copyright notice and this permission notice shall be included in
-all copies or substantial portions of the Software.
-
-THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
-AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
-SOFTWARE.
-*/
-
-#ifndef OCP_H
-#define OCP_H
-
-#include <stdint.h>
-#include <cmath>
-#include <qpDUNES.h>
-
-#include "types.h"
-#include "state.h"
-#include "integrator.h"
-
-/*
-Optimal Control Problem object.
-*/
-class OptimalControlProblem {
-    /* Integrator object, depends on selection in `config.h`. */
-#if defined(NMPC_INTEGRATOR_RK4)
-    IntegratorRK4 integrator;
-#elif defined(NMPC_INTEGRATOR_HEUN)
-    IntegratorHeun integrator;
-#elif defined(NMPC_INTEGRATOR_EULER)
-    IntegratorEuler integrator;
-#endif
-
-    DynamicsModel *dynamics;
-
-    ControlVector control_reference[OCP_HORIZON_LENGTH];
-    StateVector state_reference[OCP_HORIZON_LENGTH+1];
-    ControlVector control_horizon[OCP_HORIZON_LENGTH];
-    StateVector state_horizon[OCP_HORIZON_LENGTH+1];
-    StateVector integrated_state_horizon[OCP_HORIZON_LENGTH];
-
-    /*
-    Affine constraint matrix and bounding vectors. These will be generated
-    each iteration from the non-linear constraints.
-    */
-    InequalityConstraintMatrix affine_constraints[OCP_HORIZON_LENGTH];
-    InequalityConstraintVector affine_upper_bound[OCP_HORIZON_LENGTH];
-    InequalityConstraintVector affine_lower_bound[OCP_HORIZON_LENGTH];
-
-    /*
-    Simple inequality constraints.
-    */
-    StateConstraintVector lower_state_bound, upper_state_bound;
-    ControlConstraintVector lower_control_bound, upper_control_bound;
-
-    /*
-    Matrices for continuity constraints. These are actually Jacobian
-    matrices, which contain the linearised dynamics model for each point on
-    the horizon.
-    */
-    ContinuityConstraintMatrix jacobians[OCP_HORIZON_LENGTH];
-    DeltaVector integration_residuals[OCP_HORIZON_LENGTH];
-
-    /* Weight matrices. */
-    StateWeightMatrix state_weights;
-    ControlWeightMatrix control_weights;
-    StateWeightMatrix terminal_weights;
-
-    /* Data structures for use by qpDUNES. */
-    qpData_t qp_data;
-    qpOptions_t qp_options;
-
-    DeltaVector state_to_delta(
-        const StateVector &s1,
-        const StateVector &s2);
-    void calculate_gradient();
-    void solve_ivps(uint32_t i);
-    void initialise_qp();
-    void update_qp();
-    void initial_constraint(StateVector measurement);
-    void solve_qp();
-
-public:
-    OptimalControlProblem(DynamicsModel *d);
-    void initialise();
-    void set_state_weights(const DeltaVector &in) {
-        state_weights.diagonal() = in;
-    }
-    void set_control_weights(const ControlVector &in) {
-        control_weights.diagonal() = in;
-    }
-    void set_terminal_weights(const DeltaVector &in) {
-        terminal_weights.diagonal() = in;
-    }
-    void set_lower_control_bound(const ControlConstraintVector &in) {
-        lower_control_bound = in;
-    }
-    void set_upper_control_bound(const ControlConstraintVector &in) {
-        upper_control_bound = in;
-    }
-    void set_reference_point(const ReferenceVector &in, uint32_t i);
-    void preparation_step();
-    void feedback_step(StateVector measurement);
-    const ControlVector& get_controls() const { return control_horizon[0]; }
-    void update_horizon(ReferenceVector new_reference);
-    void set_dynamics_model(DynamicsModel *in) { dynamics = in; }
-};
-
-#endif
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef OCP_H
+#define OCP_H
+
+#include <stdint.h>
+#include <cmath>
+
+#include "types.h"
+#include "state.h"
+#include "integrator.h"
+#include "qp.h"
+#include "timing.h"
+#include "queue.h"
+
+/*
+Optimal Control Problem object, templated on the state space of the model
+(see X8StateSpace in state.h). The state space provides the dimensions and
+fixed-size types, the state classes for integration, the dynamics model type
+and the mapping between states and state deltas, so problems of different
+shapes can be used side by side. The problem is also templated on the
+integration method (see integrator.h), which defaults to the one selected in
+`config.h`. The library is built with instantiations for X8StateSpace and
+LongitudinalStateSpace with the default integrator; other combinations need
+an explicit instantiation of their own in ocp.cpp, and other state spaces in
+the QP sources as well.
+*/
+template <class StateSpace, class IntegratorType = DefaultIntegrator>
+class OptimalControlProblem {
+public:
+    enum {
+        STATE_DIM = StateSpace::STATE_DIM,
+        DELTA_DIM = StateSpace::DELTA_DIM,
+        CONTROL_DIM = StateSpace::CONTROL_DIM,
+        REFERENCE_DIM = StateSpace::REFERENCE_DIM,
+        GRADIENT_DIM = StateSpace::GRADIENT_DIM
+    };
+
+    typedef typename StateSpace::Types Types;
+    typedef typename StateSpace::State State;
+    typedef typename StateSpace::StateAD StateAD;
+    typedef typename StateSpace::StateLanes StateLanes;
+    typedef typename StateSpace::Dynamics Dynamics;
+    typedef typename StateSpace::StateVector StateVector;
+    typedef typename StateSpace::ControlVector ControlVector;
+    typedef typename StateSpace::DeltaVector DeltaVector;
+    typedef typename StateSpace::ReferenceVector ReferenceVector;
+    typedef typename StateSpace::StateWeightMatrix StateWeightMatrix;
+    typedef typename StateSpace::ControlWeightMatrix ControlWeightMatrix;
+    typedef typename StateSpace::StateConstraintVector StateConstraintVector;
+    typedef typename StateSpace::ControlConstraintVector
+        ControlConstraintVector;
+    typedef typename StateSpace::InequalityConstraintVector
+        InequalityConstraintVector;
+    typedef typename StateSpace::InequalityConstraintMatrix
+        InequalityConstraintMatrix;
+    typedef typename StateSpace::ContinuityConstraintMatrix
+        ContinuityConstraintMatrix;
+    typedef typename StateSpace::ADScalar ADScalar;
+    typedef typename StateSpace::DeltaVectorAD DeltaVectorAD;
+    typedef typename StateSpace::ControlVectorAD ControlVectorAD;
+    typedef typename StateSpace::ControlVectorLanes ControlVectorLanes;
+    typedef typename StateSpace::GradientVector GradientVector;
+
+private:
+    IntegratorType integrator;
+
+    Dynamics *dynamics;
+
+    /*
+    Horizon length (number of intervals) and base step length in use;
+    storage is always allocated for the maximum sizes so these can be changed
+    without allocating. Interval i covers interval_steps[i] base steps, and
+    starts at base step interval_offset[i]; horizon_steps is the total number
+    of base steps covered by the horizon.
+    */
+    uint32_t horizon_length;
+    uint32_t horizon_steps;
+    real_t step_length;
+    uint32_t interval_steps[OCP_MAX_HORIZON_LENGTH];
+    uint32_t interval_offset[OCP_MAX_HORIZON_LENGTH+1];
+
+    /*
+    If set, each interval is a block of base steps which share a single
+    control input, and is integrated one base step at a time rather than in
+    a single step of the whole interval length.
+    */
+    bool move_blocking;
+
+    /*
+    Integration steps per interval (or per base step of a move-blocked
+    interval), and the tolerance for integrators which choose their own
+    steps; see `config.h`.
+    */
+    uint32_t integration_substeps;
+    real_t integration_tolerance;
+
+    /*
+    Reference trajectory, stored on the base grid. reference_step counts
+    the base steps the horizon has been shifted by since the OCP was
+    created (initialise() doesn't reset it), so reference point i is base
+    step reference_step + i of the trajectory.
+    */
+    uint32_t reference_step;
+    ControlVector control_reference[OCP_MAX_HORIZON_STEPS];
+    StateVector state_reference[OCP_MAX_HORIZON_STEPS+1];
+    ControlVector control_horizon[OCP_MAX_HORIZON_LENGTH];
+    StateVector state_horizon[OCP_MAX_HORIZON_LENGTH+1];
+    StateVector integrated_state_horizon[OCP_MAX_HORIZON_LENGTH];
+
+    /*
+    Affine constraint matrix and bounding vectors. These will be generated
+    each iteration from the non-linear constraints.
+    */
+    InequalityConstraintMatrix affine_constraints[OCP_MAX_HORIZON_LENGTH];
+    InequalityConstraintVector affine_upper_bound[OCP_MAX_HORIZON_LENGTH];
+    InequalityConstraintVector affine_lower_bound[OCP_MAX_HORIZON_LENGTH];
+
+    /*
+    Simple inequality constraints.
+    */
+    StateConstraintVector lower_state_bound, upper_state_bound;
+    ControlConstraintVector lower_control_bound, upper_control_bound;
+
+    /*
+    Matrices for continuity constraints. These are actually Jacobian
+    matrices, which contain the linearised dynamics model for each point on
+    the horizon.
+    */
+    ContinuityConstraintMatrix jacobians[OCP_MAX_HORIZON_LENGTH];
+    DeltaVector integration_residuals[OCP_MAX_HORIZON_LENGTH];
+
+    /* Weight matrices. */
+    StateWeightMatrix state_weights;
+    ControlWeightMatrix control_weights;
+    StateWeightMatrix terminal_weights;
+
+    /*
+    QP backends (see qp.h). initialise() points qp_backend at the selected
+    one. For the qpDUNES backend, a non-zero condensing block size condenses
+    each block of that many intervals into a single dense stage; if one
+    block covers the whole horizon, the dense backend is used instead.
+    */
+    QPBackendType qp_backend_type;
+    uint32_t condensing_block_size;
+    QPDUNESBackend<Types> qpdunes_backend;
+    DenseQPBackend<Types> dense_backend;
+    RiccatiQPBackend<Types> riccati_backend;
+    QPBackend<Types> *qp_backend;
+
+    /*
+    The linearised OCP as seen by the backends, and the control bounds of
+    each interval relative to its control reference.
+    */
+    OCPQPData<Types> qp_problem;
+    ControlConstraintVector qp_lower_control_bound[OCP_MAX_HORIZON_LENGTH];
+    ControlConstraintVector qp_upper_control_bound[OCP_MAX_HORIZON_LENGTH];
+    DeltaVector initial_delta;
+
+    /* Number of threads used to linearise the horizon. */
+    uint32_t preparation_threads;
+
+    /*
+    Linearisation cache (see `config.h`), indexed by a hash of each
+    interval's key: the quantised reference state (less the components the
+    dynamics are invariant to), control and wind velocity (WIND_DIM
+    components), followed by the interval length in base steps and the move
+    blocking flag. An entry holds the reference it was linearised at, with
+    the integrated state and Jacobian. cache_slots and cache_hits hold the
+    result of the lookup for each interval during the preparation step.
+    */
+    enum {
+        CACHE_KEY_DIM = STATE_DIM - StateSpace::INVARIANT_DIM +
+            CONTROL_DIM + StateSpace::WIND_DIM + 1
+    };
+
+    struct LinearisationCacheEntry {
+        bool valid;
+        int32_t key[CACHE_KEY_DIM];
+        StateVector state;
+        ControlVector control;
+        StateVector integrated_state;
+        ContinuityConstraintMatrix jacobian;
+    };
+
+    LinearisationCacheEntry
+        linearisation_cache[OCP_LINEARISATION_CACHE_SIZE];
+    uint32_t cache_slots[OCP_MAX_HORIZON_LENGTH];
+    bool cache_hits[OCP_MAX_HORIZON_LENGTH];
+    real_t cache_tolerance;
+    uint32_t cache_hit_count, cache_miss_count;
+
+    /*
+    Jacobian refresh schedule (see `config.h`), and the number of
+    preparation steps left until the next full refresh; the Jacobians of a
+    uniform grid are shifted along with the horizon in between.
+    */
+    uint32_t jacobian_refresh_interval;
+    uint32_t jacobian_refresh_stages;
+    uint32_t jacobian_refresh_countdown;
+
+    /*
+    Reference points queued by another thread, each with the base step of
+    the trajectory it belongs to; see queue_reference_point().
+    */
+    struct QueuedReference {
+        ReferenceVector point;
+        uint32_t step;
+    };
+
+    SPSCQueue<QueuedReference, OCP_REFERENCE_QUEUE_LENGTH> reference_queue;
+
+    /* Latency statistics for each phase of the iteration. */
+    TimingStats timing_stats[TIMING_PHASES];
+
+    void calculate_gradient();
+    void plan_integration(uint32_t i, IntegrationSteps &steps) const;
+    void solve_ivps(uint32_t i);
+    void integrate_reference(uint32_t i);
+    uint32_t linearisation_key(uint32_t i, int32_t key[]) const;
+    void lookup_linearisation(uint32_t i);
+    void reuse_linearisation(uint32_t i);
+    void prepare_interval(uint32_t i, int32_t refresh_stages);
+    void store_linearisation(uint32_t i);
+    void drain_references();
+    void initialise_qp();
+    void update_qp();
+    void update_qp_bounds();
+    void initial_constraint(StateVector measurement);
+    void solve_qp();
+
+public:
+    OptimalControlProblem(Dynamics *d);
+    void initialise();
+    void set_state_weights(const DeltaVector &in) {
+        state_weights.diagonal() = in;
+    }
+    void set_control_weights(const ControlVector &in) {
+        control_weights.diagonal() = in;
+    }
+    void set_terminal_weights(const DeltaVector &in) {
+        terminal_weights.diagonal() = in;
+    }
+    void set_lower_control_bound(const ControlConstraintVector &in) {
+        lower_control_bound = in;
+        clear_linearisation_cache();
+    }
+    void set_upper_control_bound(const ControlConstraintVector &in) {
+        upper_control_bound = in;
+        clear_linearisation_cache();
+    }
+    void set_horizon_length(uint32_t in);
+    void set_horizon_grid(const uint32_t *steps, uint32_t length);
+    void set_move_blocking(const uint32_t *blocks, uint32_t length);
+    bool get_move_blocking() const { return move_blocking; }
+    uint32_t get_horizon_length() const { return horizon_length; }
+    uint32_t get_horizon_steps() const { return horizon_steps; }
+    void set_step_length(real_t in);
+    real_t get_step_length() const { return step_length; }
+    void set_integration_substeps(uint32_t in);
+    uint32_t get_integration_substeps() const {
+        return integration_substeps;
+    }
+    void set_integration_tolerance(real_t in);
+    real_t get_integration_tolerance() const {
+        return integration_tolerance;
+    }
+    void set_qp_condensing(uint32_t block_size) {
+        condensing_block_size = block_size;
+    }
+    uint32_t get_qp_condensing() const { return condensing_block_size; }
+    void set_qp_backend(QPBackendType in) { qp_backend_type = in; }
+    QPBackendType get_qp_backend() const { return qp_backend_type; }
+    void set_preparation_threads(uint32_t in) {
+        preparation_threads = in > 0 ? in : 1;
+    }
+    void set_reference_point(const ReferenceVector &in, uint32_t i);
+    void set_reference_horizon(const real_t *in, uint32_t n);
+    void preparation_step();
+    void feedback_step(StateVector measurement);
+    const ControlVector& get_controls() const { return control_horizon[0]; }
+    void update_horizon(ReferenceVector new_reference);
+    void shift_horizon();
+    bool queue_reference_point(const ReferenceVector &in, uint32_t step);
+    uint32_t get_reference_step() const { return reference_step; }
+    void set_dynamics_model(Dynamics *in) {
+        dynamics = in;
+        clear_linearisation_cache();
+    }
+    void set_linearisation_cache_tolerance(real_t in);
+    real_t get_linearisation_cache_tolerance() const {
+        return cache_tolerance;
+    }
+    void clear_linearisation_cache();
+    void set_jacobian_refresh(uint32_t interval, uint32_t stages);
+    uint32_t get_jacobian_refresh_interval() const {
+        return jacobian_refresh_interval;
+    }
+    uint32_t get_jacobian_refresh_stages() const {
+        return jacobian_refresh_stages;
+    }
+    uint32_t get_linearisation_cache_hits() const { return cache_hit_count; }
+    uint32_t get_linearisation_cache_misses() const {
+        return cache_miss_count;
+    }
+    void reset_linearisation_cache_stats() {
+        cache_hit_count = 0;
+        cache_miss_count = 0;
+    }
+    const TimingStats &get_timing_stats(TimingPhase phase) const {
+        return timing_stats[phase];
+    }
+    void reset_timing_stats();
+    uint32_t get_qp_iterations() const {
+        return qp_backend->get_iterations();
+    }
+};
+
+#endif
@@ -0,0 +1,377 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef QP_H
+#define QP_H
+
+#include <stdint.h>
+#include <qpDUNES.h>
+
+#include "types.h"
+/* Included after types.h, which configures Eigen. */
+#include <Eigen/Cholesky>
+#include "condensing.h"
+
+/* QP solvers which can be selected with OptimalControlProblem. */
+enum QPBackendType {
+    QP_BACKEND_QPDUNES = 0,
+    QP_BACKEND_DENSE = 1,
+    QP_BACKEND_RICCATI = 2
+};
+
+/*
+The linearised OCP, as handed to the QP backends. All of the arrays belong to
+the OptimalControlProblem; interval i has the linearised dynamics
+x_{i+1} = jacobians[i] * [x_i; u_i] + integration_residuals[i] in the state
+and control deltas, weights scaled by interval_steps[i], and control bounds
+relative to the control reference of that interval.
+
+The QP classes are templated on the OCPTypes of the problem.
+*/
+template <class Types>
+struct OCPQPData {
+    typedef typename Types::DeltaVector DeltaVector;
+    typedef typename Types::StateWeightMatrix StateWeightMatrix;
+    typedef typename Types::ControlWeightMatrix ControlWeightMatrix;
+    typedef typename Types::StateConstraintVector StateConstraintVector;
+    typedef typename Types::ControlConstraintVector ControlConstraintVector;
+    typedef typename Types::ContinuityConstraintMatrix
+        ContinuityConstraintMatrix;
+
+    uint32_t horizon_length;
+    uint32_t horizon_steps;
+    const uint32_t *interval_steps;
+    const ContinuityConstraintMatrix *jacobians;
+    const DeltaVector *integration_residuals;
+    const ControlConstraintVector *lower_control_bound;
+    const ControlConstraintVector *upper_control_bound;
+    const StateConstraintVector *lower_state_bound;
+    const StateConstraintVector *upper_state_bound;
+    const StateWeightMatrix *state_weights;
+    const ControlWeightMatrix *control_weights;
+    const StateWeightMatrix *terminal_weights;
+};
+
+/*
+Time (seconds) spent in each part of the last QP solve; see TimingPhase in
+timing.h.
+*/
+struct QPSolveTimings {
+    real_t newton_setup;
+    real_t factorisation;
+    real_t line_search;
+    real_t stage_qps;
+};
+
+/*
+Interface to a QP solver. initialise() is called whenever the horizon
+structure may have changed and is the only place a backend may allocate;
+update() loads the latest linearisations at the end of the preparation step;
+solve() embeds the initial state delta and solves the QP in the feedback
+step; and shift() is called when the horizon moves on by one base step, so
+the backend can shift its warm start. Backends which time the parts of their
+solve report them through get_solve_timings(), which returns false
+otherwise. get_iterations() returns the number of iterations taken by the
+last solve.
+*/
+template <class Types>
+class QPBackend {
+public:
+    typedef OCPQPData<Types> QPData;
+    typedef typename Types::DeltaVector DeltaVector;
+    typedef typename Types::ControlVector ControlVector;
+
+    virtual ~QPBackend() {}
+    virtual void initialise(const QPData &qp) = 0;
+    virtual void update(const QPData &qp) = 0;
+    virtual bool solve(
+        const QPData &qp,
+        const DeltaVector &initial_delta,
+        ControlVector &control_delta) = 0;
+    virtual void shift(const QPData &qp) = 0;
+    virtual uint32_t get_iterations() const = 0;
+    virtual bool get_solve_timings(QPSolveTimings &timings) const {
+        (void)timings;
+        return false;
+    }
+};
+
+/*
+Solves the sparse multiple-shooting QP with qpDUNES. With a non-zero block
+size, each block of that many intervals is condensed into a single dense
+stage first (see condensing.h), and the blocks are handed to qpDUNES as
+stages of CONTROL_DIM * block size controls each.
+
+The sparse QP lives in a workspace inside the backend rather than being
+allocated by qpDUNES_setup(), so once the OCP has been created the only
+allocation is for partial condensing, where qpDUNES needs dense stage QP
+solvers of its own.
+*/
+template <class Types>
+class QPDUNESBackend : public QPBackend<Types> {
+    enum {
+        DELTA_DIM = Types::DELTA_DIM,
+        CONTROL_DIM = Types::CONTROL_DIM,
+        GRADIENT_DIM = Types::GRADIENT_DIM
+    };
+
+    /*
+    Statically-allocated qpDUNES data for the sparse QP, sized for
+    OCP_MAX_HORIZON_LENGTH intervals -- the same layout as the C66x version
+    in ccs-c66x/cnmpc.c. There are no affine constraints, so their arrays
+    have a single element to avoid zero-length arrays.
+    */
+    struct IntervalWorkspace {
+        interval_t interval;
+        real_t H_data[GRADIENT_DIM * GRADIENT_DIM];
+        real_t cholH_data[GRADIENT_DIM * GRADIENT_DIM];
+        real_t g_data[GRADIENT_DIM];
+        real_t q_data[GRADIENT_DIM];
+        real_t C_data[DELTA_DIM * GRADIENT_DIM];
+        real_t c_data[DELTA_DIM];
+        real_t zLow_data[GRADIENT_DIM];
+        real_t zUpp_data[GRADIENT_DIM];
+        real_t D_data[1];
+        real_t dLow_data[1];
+        real_t dUpp_data[1];
+        real_t z_data[GRADIENT_DIM];
+        real_t y_data[2 * GRADIENT_DIM];
+        real_t lambdaK_data[DELTA_DIM];
+        real_t lambdaK1_data[DELTA_DIM];
+        real_t clippingSolver_qStep_data[GRADIENT_DIM];
+        real_t clippingSolver_zUnconstrained_data[GRADIENT_DIM];
+        real_t clippingSolver_dz_data[GRADIENT_DIM];
+        real_t xVecTmp_data[DELTA_DIM];
+        real_t uVecTmp_data[CONTROL_DIM];
+        real_t zVecTmp_data[GRADIENT_DIM];
+    };
+
+    struct Workspace {
+        interval_t *intervals_data[OCP_MAX_HORIZON_LENGTH + 1];
+        IntervalWorkspace interval_recs[OCP_MAX_HORIZON_LENGTH + 1];
+        real_t lambda_data[DELTA_DIM * OCP_MAX_HORIZON_LENGTH];
+        real_t deltaLambda_data[DELTA_DIM * OCP_MAX_HORIZON_LENGTH];
+        real_t hessian_data[DELTA_DIM * 2 * DELTA_DIM *
+                            OCP_MAX_HORIZON_LENGTH];
+        real_t cholHessian_data[DELTA_DIM * 2 * DELTA_DIM *
+                                OCP_MAX_HORIZON_LENGTH];
+        real_t gradient_data[DELTA_DIM * OCP_MAX_HORIZON_LENGTH];
+        real_t xVecTmp_data[DELTA_DIM];
+        real_t uVecTmp_data[CONTROL_DIM];
+        real_t zVecTmp_data[GRADIENT_DIM];
+        real_t xnVecTmp_data[DELTA_DIM * OCP_MAX_HORIZON_LENGTH];
+        real_t xnVecTmp2_data[DELTA_DIM * OCP_MAX_HORIZON_LENGTH];
+        real_t xxMatTmp_data[DELTA_DIM * DELTA_DIM];
+        real_t xxMatTmp2_data[DELTA_DIM * DELTA_DIM];
+        real_t xzMatTmp_data[DELTA_DIM * GRADIENT_DIM];
+        real_t uxMatTmp_data[CONTROL_DIM * DELTA_DIM];
+        real_t zxMatTmp_data[GRADIENT_DIM * DELTA_DIM];
+        real_t zzMatTmp_data[GRADIENT_DIM * GRADIENT_DIM];
+        real_t zzMatTmp2_data[GRADIENT_DIM * GRADIENT_DIM];
+
+        /* Logging data */
+        itLog_t itLog_data;
+        int_t *ieqStatus_data[OCP_MAX_HORIZON_LENGTH + 1];
+        int_t *prevIeqStatus_data[OCP_MAX_HORIZON_LENGTH + 1];
+        int_t ieqStatus_n_data[(OCP_MAX_HORIZON_LENGTH + 1) * GRADIENT_DIM];
+        int_t prevIeqStatus_n_data[
+            (OCP_MAX_HORIZON_LENGTH + 1) * GRADIENT_DIM];
+    };
+
+    /*
+    The workspace is placed at the first cache line boundary in
+    workspace_data, so that it's aligned wherever the backend is allocated.
+    */
+    unsigned char workspace_data[sizeof(Workspace) + OCP_CACHE_LINE_SIZE];
+
+    typedef OCPQPData<Types> QPData;
+    typedef typename Types::DeltaVector DeltaVector;
+    typedef typename Types::ControlVector ControlVector;
+    typedef typename Types::GradientVector GradientVector;
+    typedef typename Types::StateWeightMatrix StateWeightMatrix;
+    typedef typename Types::ControlWeightMatrix ControlWeightMatrix;
+    typedef typename Types::ContinuityConstraintMatrix
+        ContinuityConstraintMatrix;
+
+    qpData_t qp_data;
+    qpOptions_t qp_options;
+    bool qp_allocated;
+    VectorXr qp_solution;
+
+    /* Partial condensing. */
+    uint32_t block_size;
+    uint32_t qp_stages;
+    QPCondenser<Types> condenser;
+    MatrixXr stage_hessian;
+    MatrixXr stage_continuity;
+    VectorXr stage_gradient;
+    VectorXr stage_lower_bound;
+    VectorXr stage_upper_bound;
+    DeltaVector stage_residual;
+
+    Workspace *workspace();
+    void setup_static_interval(IntervalWorkspace *rec, uint32_t nV);
+    void setup_static_qp(uint32_t horizon_length);
+    void initialise_condensed(const QPData &qp);
+    void update_condensed(const QPData &qp);
+    void condensed_stage_bounds(
+        const QPData &qp, uint32_t first, uint32_t n);
+
+public:
+    QPDUNESBackend();
+    ~QPDUNESBackend();
+    void set_block_size(uint32_t in) { block_size = in; }
+    void initialise(const QPData &qp);
+    void update(const QPData &qp);
+    bool solve(
+        const QPData &qp,
+        const DeltaVector &initial_delta,
+        ControlVector &control_delta);
+    void shift(const QPData &qp);
+    uint32_t get_iterations() const { return (uint32_t)qp_data.log.numIter; }
+};
+
+/*
+Fully condenses the horizon onto the control deltas, and solves the
+resulting dense QP with DenseQPSolver. Since the work grows with the square
+of the horizon length, this is usually only worthwhile for short horizons.
+*/
+template <class Types>
+class DenseQPBackend : public QPBackend<Types> {
+    enum {
+        DELTA_DIM = Types::DELTA_DIM,
+        CONTROL_DIM = Types::CONTROL_DIM
+    };
+
+    typedef OCPQPData<Types> QPData;
+    typedef typename Types::DeltaVector DeltaVector;
+    typedef typename Types::ControlVector ControlVector;
+
+    QPCondenser<Types> condenser;
+    DenseQPSolver dense_qp;
+    MatrixXr stage_hessian;
+    MatrixXr stage_continuity;
+    VectorXr stage_gradient;
+    DeltaVector stage_residual;
+    MatrixXr dense_hessian;
+    VectorXr dense_gradient;
+    VectorXr dense_lower_bound;
+    VectorXr dense_upper_bound;
+    VectorXr dense_solution;
+
+public:
+    void initialise(const QPData &qp);
+    void update(const QPData &qp);
+    bool solve(
+        const QPData &qp,
+        const DeltaVector &initial_delta,
+        ControlVector &control_delta);
+    void shift(const QPData &qp);
+    uint32_t get_iterations() const { return dense_qp.get_iterations(); }
+};
+
+/*
+Structure-exploiting QP solver using a Riccati recursion over the horizon,
+with all of its storage sized at compile time from the dimensions in
+config.h so that it never allocates.
+
+The control bounds are handled with the same projected Newton method as
+DenseQPSolver, but run directly on the sparse QP: the objective and its
+gradient with respect to the controls come from a forward simulation of the
+linearised dynamics and a backward sweep of the costates, and each Newton
+step solves the LQR problem with the controls held at their bounds fixed, by
+a Riccati recursion in which those controls are masked out. Each iteration
+is therefore linear in the horizon length.
+
+The Riccati factorisation only depends on the linearisation and on which
+controls are fixed, so it is calculated in update() using the active set of
+the previous solution, and only recalculated in solve() if the active set
+changes; otherwise a Newton step just needs the cheaper vector recursion.
+
+State bounds are not supported, since the OCP leaves them unbounded.
+*/
+template <class Types>
+class RiccatiQPBackend : public QPBackend<Types> {
+    enum {
+        DELTA_DIM = Types::DELTA_DIM,
+        CONTROL_DIM = Types::CONTROL_DIM
+    };
+
+    typedef OCPQPData<Types> QPData;
+    typedef typename Types::DeltaVector DeltaVector;
+    typedef typename Types::ControlVector ControlVector;
+    typedef typename Types::StateWeightMatrix StateWeightMatrix;
+    typedef typename Types::ControlWeightMatrix ControlWeightMatrix;
+    typedef typename Types::ContinuityConstraintMatrix
+        ContinuityConstraintMatrix;
+    typedef Eigen::Matrix<
+        real_t,
+        CONTROL_DIM,
+        DELTA_DIM> GainMatrix;
+
+    /*
+    Factorisation: cost-to-go Hessians, feedback gains and the factorised
+    control Hessian for each stage, along with the masks (1 for free, 0 for
+    fixed) of the controls it was calculated for. The feedforward terms come
+    from the vector recursion.
+    */
+    StateWeightMatrix cost_to_go[OCP_MAX_HORIZON_LENGTH+1];
+    GainMatrix gains[OCP_MAX_HORIZON_LENGTH];
+    ControlVector feedforward[OCP_MAX_HORIZON_LENGTH];
+    Eigen::LLT<ControlWeightMatrix> control_hessians[OCP_MAX_HORIZON_LENGTH];
+    ControlVector factorised_mask[OCP_MAX_HORIZON_LENGTH];
+    bool factorised;
+
+    /* Iterates and workspace. */
+    ControlVector controls[OCP_MAX_HORIZON_LENGTH];
+    ControlVector steps[OCP_MAX_HORIZON_LENGTH];
+    ControlVector trial[OCP_MAX_HORIZON_LENGTH];
+    ControlVector gradients[OCP_MAX_HORIZON_LENGTH];
+    ControlVector free_mask[OCP_MAX_HORIZON_LENGTH];
+    DeltaVector states[OCP_MAX_HORIZON_LENGTH+1];
+
+    uint32_t max_iterations;
+    uint32_t iterations;
+
+    bool factorise(const QPData &qp);
+    void newton_step(const QPData &qp, const DeltaVector &initial_delta);
+    real_t objective(
+        const QPData &qp,
+        const DeltaVector &initial_delta,
+        const ControlVector *u);
+    void objective_gradient(const QPData &qp);
+
+public:
+    RiccatiQPBackend() : factorised(false), max_iterations(50),
+        iterations(0) {}
+    void set_max_iterations(uint32_t in) { max_iterations = in; }
+    uint32_t get_iterations() const { return iterations; }
+    void initialise(const QPData &qp);
+    void update(const QPData &qp);
+    bool solve(
+        const QPData &qp,
+        const DeltaVector &initial_delta,
+        ControlVector &control_delta);
+    void shift(const QPData &qp);
+};
+
+#endif
@@ -0,0 +1,81 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+/*
+Lock-free single-producer, single-consumer ring buffer of up to Capacity (a
+power of two) items. One thread may push() while another uses front() and
+pop(); neither ever waits for the other, and push() just fails if the
+queue is full.
+
+head and tail count the items taken and added since the queue was created,
+and are each only written by one side; the release store of one and the
+acquire load by the other side make the item data visible along with it.
+They're kept on separate cache lines so the two threads don't contend for
+one.
+*/
+template <class T, uint32_t Capacity>
+class SPSCQueue {
+    T items[Capacity];
+    uint32_t head;
+    unsigned char head_padding[OCP_CACHE_LINE_SIZE - sizeof(uint32_t)];
+    uint32_t tail;
+    unsigned char tail_padding[OCP_CACHE_LINE_SIZE - sizeof(uint32_t)];
+
+public:
+    SPSCQueue() : head(0), tail(0) {}
+
+    /* Producer side. Returns false if the queue is full. */
+    bool push(const T &in) {
+        uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+
+        if(tail - h == Capacity) {
+            return false;
+        }
+
+        items[tail & (Capacity - 1)] = in;
+        __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /* Consumer side. Returns the oldest item, or NULL if there are none. */
+    const T *front() const {
+        if(head == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+
+        return &items[head & (Capacity - 1)];
+    }
+
+    /* Consumer side. Removes the item returned by front(). */
+    void pop() {
+        __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+    }
+};
+
+#endif
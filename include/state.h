@@ -23,10 +23,14 @@ SOFTWARE.
 #ifndef STATE_H
 #define STATE_H
 
+#include <stdint.h>
+
 #include "types.h"
 
-/* DynamicsModel forward declaration. */
+/* Dynamics model forward declarations. */
 class DynamicsModel;
+class X8DynamicsModel;
+class LongitudinalDynamicsModel;
 
 /*
 Definition for filter state vector.
@@ -36,57 +40,404 @@ Contents are as follows:
     - Attitude (quaternion (x, y, z, w), describes rotation from local NED
       frame to body frame.)
     - Angular Velocity (3-vector, rad/s, body frame)
+
+The class is templated on the scalar type so that the same kinematics can be
+evaluated on real_t for integration and on real_ad_t for the Jacobians.
+model() is also templated on the dynamics model type, and defined here, so
+that the model can be inlined into the integrators.
+
+This is the X8's state, so it has the NMPC_*_DIM dimensions from config.h;
+other state spaces have state classes of their own (see LongitudinalState).
 */
-class State: public StateVector {
+template <typename Scalar>
+class GenericState: public Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> {
+    typedef Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> Base;
+    typedef Eigen::Matrix<Scalar, 3, 1> Vector3s;
+    typedef Eigen::Matrix<Scalar, 4, 1> Vector4s;
+
 public:
-    State() : StateVector() {}
+    GenericState() : Base() {}
 
     template<typename OtherDerived>
-    State(const Eigen::MatrixBase<OtherDerived>& other) :
-        StateVector(other) { }
+    GenericState(const Eigen::MatrixBase<OtherDerived>& other) :
+        Base(other) { }
 
     template<typename OtherDerived>
-    State & operator= (const Eigen::MatrixBase<OtherDerived>& other)
+    GenericState & operator= (const Eigen::MatrixBase<OtherDerived>& other)
     {
-        StateVector::operator=(other);
+        Base::operator=(other);
         return *this;
     }
 
-    const StateVectorDerivative model(ControlVector c, DynamicsModel *d);
+    template <class Dynamics>
+    const Base model(
+        const Eigen::Matrix<Scalar, NMPC_CONTROL_DIM, 1> &c,
+        const Dynamics *d) const;
 
     /* Read-only accessors */
-    const Vector3r position() const {
-        return segment<3>(0);
+    const Vector3s position() const {
+        return this->template segment<3>(0);
     }
 
-    const Vector3r velocity() const {
-        return segment<3>(3);
+    const Vector3s velocity() const {
+        return this->template segment<3>(3);
     }
 
-    const Vector4r attitude() const {
-        return segment<4>(6);
+    const Vector4s attitude() const {
+        return this->template segment<4>(6);
     }
 
-    const Vector3r angular_velocity() const {
-        return segment<3>(10);
+    const Vector3s angular_velocity() const {
+        return this->template segment<3>(10);
     }
 
     /* Mutable accessors */
-    Eigen::VectorBlock<StateVector, 3> position() {
-        return segment<3>(0);
+    Eigen::VectorBlock<Base, 3> position() {
+        return this->template segment<3>(0);
+    }
+
+    Eigen::VectorBlock<Base, 3> velocity() {
+        return this->template segment<3>(3);
+    }
+
+    Eigen::VectorBlock<Base, 4> attitude() {
+        return this->template segment<4>(6);
+    }
+
+    Eigen::VectorBlock<Base, 3> angular_velocity() {
+        return this->template segment<3>(10);
+    }
+};
+
+/*
+Runs the kinematics model on the state vector and returns a vector with the
+derivative of each components (except for the accelerations, which must be
+calculated directly using a dynamics model).
+Contents are as follows:
+    - Rate of change in position (3-vector, m/s, NED frame)
+    - Rate of change in linear velocity (3-vector, m/s^2, NED frame)
+    - Rate of change in attitude (quaternion (x, y, z, w), 1/s, body frame)
+    - Rate of change in angular velocity (3-vector, rad/s^2, body frame)
+*/
+template <typename Scalar>
+template <class Dynamics>
+inline const typename GenericState<Scalar>::Base
+GenericState<Scalar>::model(
+const Eigen::Matrix<Scalar, NMPC_CONTROL_DIM, 1> &c,
+const Dynamics *d) const {
+    typedef Eigen::Quaternion<Scalar> Quaternions;
+    Base output;
+
+    Eigen::Matrix<Scalar, 6, 1> a = d->evaluate(*this, c);
+
+    /* Calculate change in position. */
+    output.template segment<3>(0) << velocity();
+
+    /* Calculate change in velocity. */
+    Quaternions attitude_q = Quaternions(attitude());
+    output.template segment<3>(3) =
+        attitude_q.conjugate() * a.template segment<3>(0);
+
+    /* Calculate change in attitude. */
+    Eigen::Matrix<Scalar, 4, 1> omega_q;
+    omega_q << angular_velocity(), Scalar(0);
+
+    attitude_q = Quaternions(omega_q).conjugate() * attitude_q;
+    output.template segment<4>(6) << attitude_q.vec(), attitude_q.w();
+    output.template segment<4>(6) *= Scalar(0.5);
+
+    /* Calculate change in angular velocity (just angular acceleration). */
+    output.template segment<3>(10) = a.template segment<3>(3);
+
+    return output;
+}
+
+typedef GenericState<real_t> State;
+typedef GenericState<real_ad_t> StateAD;
+
+/*
+A state for each of NMPC_LANES integrations, one per column, so that the
+reference and all of the finite-difference perturbations of an interval can
+be integrated together. model() evaluates the same kinematics as
+GenericState::model() in every lane at once.
+*/
+class StateLanes: public StateVectorLanes {
+    typedef StateVectorLanes Base;
+
+public:
+    StateLanes() : Base() {}
+
+    template<typename OtherDerived>
+    StateLanes(const Eigen::MatrixBase<OtherDerived>& other) :
+        Base(other) { }
+
+    template<typename OtherDerived>
+    StateLanes & operator= (const Eigen::MatrixBase<OtherDerived>& other)
+    {
+        Base::operator=(other);
+        return *this;
+    }
+
+    template <class Dynamics>
+    const Base model(const ControlVectorLanes &c, const Dynamics *d) const;
+};
+
+/*
+Cross product of a and b in every lane, with the same operation order as
+Eigen's cross().
+*/
+template <typename A, typename B>
+inline Vector3Lanes cross_lanes(const A &a, const B &b) {
+    Vector3Lanes out;
+
+    out.row(0) = a.row(1) * b.row(2) - a.row(2) * b.row(1);
+    out.row(1) = a.row(2) * b.row(0) - a.row(0) * b.row(2);
+    out.row(2) = a.row(0) * b.row(1) - a.row(1) * b.row(0);
+    return out;
+}
+
+/*
+Rotates v by the quaternion q (x, y, z, w) in every lane, with the same
+formula as Eigen's Quaternion * vector.
+*/
+inline Vector3Lanes rotate_lanes(const Vector4Lanes &q,
+const Vector3Lanes &v) {
+    Vector3Lanes uv, out;
+    uint32_t i;
+
+    uv = cross_lanes(q.topRows<3>(), v);
+    uv += uv;
+    out = cross_lanes(q.topRows<3>(), uv);
+    for(i = 0; i < 3; i++) {
+        out.row(i) += v.row(i) + q.row(3) * uv.row(i);
+    }
+
+    return out;
+}
+
+/* As for GenericState::model(), in every lane. */
+template <class Dynamics>
+inline const StateVectorLanes StateLanes::model(
+const ControlVectorLanes &c, const Dynamics *d) const {
+    StateVectorLanes output;
+    Vector4Lanes attitude, attitude_conj;
+    Vector3Lanes omega, omega_q;
+    uint32_t i;
+
+    AccelerationVectorLanes a = d->evaluate(*this, c);
+
+    /* Calculate change in position. */
+    output.topRows<3>() = middleRows<3>(3);
+
+    /* Calculate change in velocity. */
+    attitude = middleRows<4>(6).array();
+    attitude_conj.topRows<3>() = -attitude.topRows<3>();
+    attitude_conj.row(3) = attitude.row(3);
+    output.middleRows<3>(3) = rotate_lanes(
+        attitude_conj, a.topRows<3>().array()).matrix();
+
+    /*
+    Calculate change in attitude; this is the product of the conjugate of
+    the angular velocity quaternion (which has a zero scalar part) and the
+    attitude.
+    */
+    omega = -middleRows<3>(10).array();
+    omega_q = cross_lanes(omega, attitude.topRows<3>());
+    for(i = 0; i < 3; i++) {
+        output.row(6 + i) = (real_t)0.5 *
+            (attitude.row(3) * omega.row(i) + omega_q.row(i)).matrix();
+    }
+    output.row(9) = (real_t)-0.5 * (
+        omega.row(0) * attitude.row(0) +
+        omega.row(1) * attitude.row(1) +
+        omega.row(2) * attitude.row(2)).matrix();
+
+    /* Calculate change in angular velocity (just angular acceleration). */
+    output.bottomRows<3>() = a.bottomRows<3>();
+
+    return output;
+}
+
+/*
+State space of the X8 model, which OptimalControlProblem is templated on.
+Along with the dimensions and types from OCPTypes, a state space provides
+the state classes the integrators operate on (for real_t, for the
+automatic differentiation scalar and for lanes of real_t), the dynamics
+model type passed to their model() method, and the mapping between states
+and state deltas: state_to_delta() returns the delta taking s1 to s2, and
+apply_delta() applies a delta to a state. Both are templated on the scalar
+type so they can be differentiated when calculating the Jacobians.
+
+The attitude delta is a 3-vector of Modified Rodrigues Parameters (MRP),
+which is why the delta is one component shorter than the state.
+
+The dynamics don't depend on the first INVARIANT_DIM components of the state
+(the position), so the linearisation cache leaves them out of its key. The
+key does include the WIND_DIM components of the wind velocity returned by
+the dynamics model's get_wind_velocity().
+*/
+struct X8StateSpace: public OCPTypes<
+        NMPC_STATE_DIM,
+        NMPC_DELTA_DIM,
+        NMPC_CONTROL_DIM> {
+    enum {
+        INVARIANT_DIM = 3,
+        WIND_DIM = 3
+    };
+
+    typedef ::State State;
+    typedef ::StateAD StateAD;
+    typedef ::StateLanes StateLanes;
+#ifdef NMPC_VIRTUAL_DYNAMICS
+    typedef DynamicsModel Dynamics;
+#else
+    typedef X8DynamicsModel Dynamics;
+#endif
+    typedef Vector3r WindVector;
+
+    template <typename Scalar>
+    static Eigen::Matrix<Scalar, NMPC_DELTA_DIM, 1> state_to_delta(
+        const Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> &s1,
+        const Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> &s2);
+
+    template <typename Scalar>
+    static Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> apply_delta(
+        const Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> &s,
+        const Eigen::Matrix<Scalar, NMPC_DELTA_DIM, 1> &delta);
+};
+
+/*
+State vector for flight in the vertical plane, for controllers which only
+track airspeed, altitude and pitch.
+Contents are as follows:
+    - Position (2-vector, m, north and down)
+    - Linear Velocity (2-vector, m/s, north and down)
+    - Pitch (rad)
+    - Pitch rate (rad/s)
+
+As for GenericState, this is templated on the scalar type, and model() runs
+the kinematics with the accelerations from the dynamics model (a 3-vector
+of the north and down accelerations and the pitch acceleration).
+*/
+template <typename Scalar>
+class LongitudinalState: public Eigen::Matrix<
+        Scalar, LongitudinalTypes::STATE_DIM, 1> {
+    typedef Eigen::Matrix<Scalar, LongitudinalTypes::STATE_DIM, 1> Base;
+    typedef Eigen::Matrix<Scalar, 2, 1> Vector2s;
+
+public:
+    LongitudinalState() : Base() {}
+
+    template<typename OtherDerived>
+    LongitudinalState(const Eigen::MatrixBase<OtherDerived>& other) :
+        Base(other) { }
+
+    template<typename OtherDerived>
+    LongitudinalState & operator= (
+        const Eigen::MatrixBase<OtherDerived>& other)
+    {
+        Base::operator=(other);
+        return *this;
     }
 
-    Eigen::VectorBlock<StateVector, 3> velocity() {
-        return segment<3>(3);
+    template <class Dynamics>
+    const Base model(
+        const Eigen::Matrix<Scalar, LongitudinalTypes::CONTROL_DIM, 1> &c,
+        const Dynamics *d) const {
+        Base output;
+
+        Eigen::Matrix<Scalar, 3, 1> a = d->evaluate(*this, c);
+
+        output.template segment<2>(0) = velocity();
+        output.template segment<2>(2) = a.template segment<2>(0);
+        output[4] = pitch_rate();
+        output[5] = a[2];
+
+        return output;
     }
 
-    Eigen::VectorBlock<StateVector, 4> attitude() {
-        return segment<4>(6);
+    /* Read-only accessors */
+    const Vector2s position() const {
+        return this->template segment<2>(0);
     }
 
-    Eigen::VectorBlock<StateVector, 3> angular_velocity() {
-        return segment<3>(10);
+    const Vector2s velocity() const {
+        return this->template segment<2>(2);
     }
+
+    Scalar pitch() const {
+        return (*this)[4];
+    }
+
+    Scalar pitch_rate() const {
+        return (*this)[5];
+    }
+};
+
+/* A LongitudinalState for each lane, as StateLanes is for the X8. */
+class LongitudinalStateLanes: public LongitudinalTypes::StateVectorLanes {
+    typedef LongitudinalTypes::StateVectorLanes Base;
+
+public:
+    LongitudinalStateLanes() : Base() {}
+
+    template<typename OtherDerived>
+    LongitudinalStateLanes(const Eigen::MatrixBase<OtherDerived>& other) :
+        Base(other) { }
+
+    template<typename OtherDerived>
+    LongitudinalStateLanes & operator= (
+        const Eigen::MatrixBase<OtherDerived>& other)
+    {
+        Base::operator=(other);
+        return *this;
+    }
+
+    template <class Dynamics>
+    const Base model(
+        const LongitudinalTypes::ControlVectorLanes &c,
+        const Dynamics *d) const {
+        Base output;
+
+        typename Dynamics::AccelerationVectorLanes a = d->evaluate(*this, c);
+
+        output.topRows<2>() = middleRows<2>(2);
+        output.middleRows<2>(2) = a.template topRows<2>();
+        output.row(4) = row(5);
+        output.row(5) = a.row(2);
+
+        return output;
+    }
+};
+
+/*
+State space of the longitudinal model. The state has no attitude
+quaternion, so deltas are plain differences; the pitch is assumed to stay
+well within +/-pi, so it isn't wrapped. As for the X8, the dynamics don't
+depend on the position, and the wind velocity (north and down) is part of
+the linearisation cache key.
+*/
+struct LongitudinalStateSpace: public LongitudinalTypes {
+    enum {
+        INVARIANT_DIM = 2,
+        WIND_DIM = 2
+    };
+
+    typedef LongitudinalState<real_t> State;
+    typedef LongitudinalState<ADScalar> StateAD;
+    typedef LongitudinalStateLanes StateLanes;
+    typedef LongitudinalDynamicsModel Dynamics;
+    typedef Vector2r WindVector;
+
+    template <typename Scalar>
+    static Eigen::Matrix<Scalar, DELTA_DIM, 1> state_to_delta(
+        const Eigen::Matrix<Scalar, STATE_DIM, 1> &s1,
+        const Eigen::Matrix<Scalar, STATE_DIM, 1> &s2);
+
+    template <typename Scalar>
+    static Eigen::Matrix<Scalar, STATE_DIM, 1> apply_delta(
+        const Eigen::Matrix<Scalar, STATE_DIM, 1> &s,
+        const Eigen::Matrix<Scalar, DELTA_DIM, 1> &delta);
 };
 
 #endif
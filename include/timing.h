@@ -0,0 +1,84 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+#include "types.h"
+
+/* Phases of the NMPC iteration which are timed. */
+enum TimingPhase {
+    /* The whole preparation step, and its two parts. */
+    TIMING_PREPARATION = 0,
+    TIMING_SOLVE_IVPS = 1,
+    TIMING_QP_UPDATE = 2,
+
+    /* The whole feedback step, and its two parts. */
+    TIMING_FEEDBACK = 3,
+    TIMING_INITIAL_CONSTRAINT = 4,
+    TIMING_QP_SOLVE = 5,
+
+    /*
+    Parts of the QP solve, for backends which measure them: setting up and
+    factorising (including solving) the Newton system, the line search,
+    and the stage QPs.
+    */
+    TIMING_QP_NEWTON_SETUP = 6,
+    TIMING_QP_FACTORISATION = 7,
+    TIMING_QP_LINE_SEARCH = 8,
+    TIMING_QP_STAGE_QPS = 9,
+
+    TIMING_UPDATE_HORIZON = 10,
+    TIMING_PHASES = 11
+};
+
+/* Monotonic time in seconds, for timing the phases. */
+double timing_clock();
+
+/*
+Latency statistics for one phase. The count, minimum, maximum and mean cover
+every sample since the last reset; the percentiles are calculated from the
+last OCP_TIMING_WINDOW samples. Recording a sample is constant time and
+doesn't allocate, so this can be used in the real-time path; the
+percentiles sort a copy of the window, so they should be read elsewhere.
+*/
+class TimingStats {
+    uint32_t count;
+    real_t minimum;
+    real_t maximum;
+    double total;
+    real_t window[OCP_TIMING_WINDOW];
+
+public:
+    TimingStats() { reset(); }
+    void reset();
+    void record(real_t seconds);
+    uint32_t get_count() const { return count; }
+    real_t get_min() const { return minimum; }
+    real_t get_max() const { return maximum; }
+    real_t get_mean() const;
+    real_t get_percentile(real_t p) const;
+};
+
+#endif
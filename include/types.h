@@ -48,8 +48,14 @@ typedef double real_t;
 #define G_ACCEL ((real_t)9.80665)
 #define RHO ((real_t)1.225)
 
+/* Enables Eigen's allocation check; see config.h. */
+#if defined(NMPC_ASSERT_NO_MALLOC)
+#define EIGEN_RUNTIME_NO_MALLOC
+#endif
+
 #include <Eigen/Core>
 #include <Eigen/Geometry>
+#include <unsupported/Eigen/AutoDiff>
 
 typedef Eigen::Matrix<real_t, 1, 1> Vector1r;
 typedef Eigen::Matrix<real_t, 2, 1> Vector2r;
@@ -59,60 +65,167 @@ typedef Eigen::Matrix<real_t, 5, 1> Vector5r;
 typedef Eigen::Quaternion<real_t> Quaternionr;
 typedef Eigen::Matrix<real_t, 3, 3, Eigen::RowMajor> Matrix3x3r;
 typedef Eigen::Matrix<real_t, Eigen::Dynamic, 1> VectorXr;
-
-typedef Eigen::Matrix<real_t, NMPC_STATE_DIM, 1> StateVector;
-typedef Eigen::Matrix<real_t, NMPC_STATE_DIM, 1> StateVectorDerivative;
-
-/*
-Typedef for a gradient vector. Dimension is smaller than a reference vector
-by one because orientation is represented by MRP rather than quaternion.
- */
-typedef Eigen::Matrix<real_t, NMPC_GRADIENT_DIM, 1> GradientVector;
-
-/* Matrices for state and control weights. */
 typedef Eigen::Matrix<
     real_t,
-    NMPC_DELTA_DIM,
-    NMPC_DELTA_DIM,
-    Eigen::RowMajor> StateWeightMatrix;
-
-typedef Eigen::Matrix<
-    real_t,
-    NMPC_CONTROL_DIM,
-    NMPC_CONTROL_DIM,
-    Eigen::RowMajor> ControlWeightMatrix;
-
-/* Typedef for control vector. */
-typedef Eigen::Matrix<real_t, NMPC_CONTROL_DIM, 1> ControlVector;
-
-/* Reference vector is for both state and control. */
-typedef Eigen::Matrix<real_t, NMPC_REFERENCE_DIM, 1> ReferenceVector;
+    Eigen::Dynamic,
+    Eigen::Dynamic,
+    Eigen::RowMajor> MatrixXr;
 
-/* Typedef for delta vector. */
-typedef Eigen::Matrix<real_t, NMPC_DELTA_DIM, 1> DeltaVector;
+/*
+Vector and matrix types for an optimal control problem with StateDim state
+components, DeltaDim state delta components and ControlDim controls. The
+state delta is smaller than the state when the state uses a non-minimal
+parameterisation; for the X8 model the attitude quaternion becomes an MRP
+3-vector. Each set of dimensions gets its own fixed-size Eigen types, so
+problems of different shapes can coexist in one binary.
+*/
+template <int StateDim, int DeltaDim, int ControlDim>
+struct OCPTypes {
+    typedef OCPTypes Types;
+
+    enum {
+        STATE_DIM = StateDim,
+        DELTA_DIM = DeltaDim,
+        CONTROL_DIM = ControlDim,
+        REFERENCE_DIM = StateDim + ControlDim,
+        GRADIENT_DIM = DeltaDim + ControlDim,
+        LANES = GRADIENT_DIM + 1
+    };
+
+    typedef Eigen::Matrix<real_t, StateDim, 1> StateVector;
+    typedef Eigen::Matrix<real_t, StateDim, 1> StateVectorDerivative;
+
+    /* Gradient vector, over the state delta and the controls. */
+    typedef Eigen::Matrix<real_t, GRADIENT_DIM, 1> GradientVector;
+
+    /* Matrices for state and control weights. */
+    typedef Eigen::Matrix<
+        real_t,
+        DeltaDim,
+        DeltaDim,
+        Eigen::RowMajor> StateWeightMatrix;
+
+    typedef Eigen::Matrix<
+        real_t,
+        ControlDim,
+        ControlDim,
+        Eigen::RowMajor> ControlWeightMatrix;
+
+    /* Typedef for control vector. */
+    typedef Eigen::Matrix<real_t, ControlDim, 1> ControlVector;
+
+    /* Reference vector is for both state and control. */
+    typedef Eigen::Matrix<real_t, REFERENCE_DIM, 1> ReferenceVector;
+
+    /* Typedef for delta vector. */
+    typedef Eigen::Matrix<real_t, DeltaDim, 1> DeltaVector;
+
+    /* Typedef for constraint vectors. */
+    typedef Eigen::Matrix<
+        real_t,
+        GRADIENT_DIM,
+        1> InequalityConstraintVector;
+    typedef Eigen::Matrix<real_t, DeltaDim, 1> StateConstraintVector;
+    typedef Eigen::Matrix<real_t, ControlDim, 1> ControlConstraintVector;
+
+    /* Typedef for inequality constraint matrix. */
+    typedef Eigen::Matrix<
+        real_t,
+        GRADIENT_DIM,
+        GRADIENT_DIM,
+        Eigen::RowMajor> InequalityConstraintMatrix;
+
+    /* Typedef for continuity constraint matrix.  */
+    typedef Eigen::Matrix<
+        real_t,
+        DeltaDim,
+        GRADIENT_DIM,
+        Eigen::RowMajor> ContinuityConstraintMatrix;
+
+    /*
+    Typedefs for forward-mode automatic differentiation. Each scalar carries
+    its derivatives with respect to the state delta and the control vector,
+    so an evaluation yields one full row of the continuity constraint
+    Jacobian per output component.
+    */
+    typedef Eigen::Matrix<real_t, GRADIENT_DIM, 1> DerivativeVector;
+    typedef Eigen::AutoDiffScalar<DerivativeVector> ADScalar;
+    typedef Eigen::Matrix<ADScalar, StateDim, 1> StateVectorAD;
+    typedef Eigen::Matrix<ADScalar, DeltaDim, 1> DeltaVectorAD;
+    typedef Eigen::Matrix<ADScalar, ControlDim, 1> ControlVectorAD;
+
+    /*
+    Typedefs for integrating the reference and every finite-difference
+    perturbation of an interval at once, with one column (lane) for each.
+    Each row holds one component for all of the lanes, so arithmetic on a
+    row vectorises across them.
+    */
+    typedef Eigen::Array<real_t, 1, LANES> LaneArray;
+    typedef Eigen::Matrix<
+        real_t,
+        StateDim,
+        LANES,
+        Eigen::RowMajor> StateVectorLanes;
+    typedef Eigen::Matrix<
+        real_t,
+        ControlDim,
+        LANES,
+        Eigen::RowMajor> ControlVectorLanes;
+};
+
+/* Types for the dimensions set in config.h. */
+typedef OCPTypes<
+    NMPC_STATE_DIM,
+    NMPC_DELTA_DIM,
+    NMPC_CONTROL_DIM> NMPCTypes;
 
-/* Typedef for constraint vectors. */
-typedef Eigen::Matrix<
-    real_t,
-    NMPC_GRADIENT_DIM,
-    1> InequalityConstraintVector;
-typedef Eigen::Matrix<real_t, NMPC_DELTA_DIM, 1> StateConstraintVector;
-typedef Eigen::Matrix<real_t, NMPC_CONTROL_DIM, 1> ControlConstraintVector;
+/*
+Types for the 6-state longitudinal model (see LongitudinalStateSpace in
+state.h), which has no attitude quaternion, so the delta is the same size
+as the state.
+*/
+typedef OCPTypes<6, 6, 2> LongitudinalTypes;
+
+typedef NMPCTypes::StateVector StateVector;
+typedef NMPCTypes::StateVectorDerivative StateVectorDerivative;
+typedef NMPCTypes::GradientVector GradientVector;
+typedef NMPCTypes::StateWeightMatrix StateWeightMatrix;
+typedef NMPCTypes::ControlWeightMatrix ControlWeightMatrix;
+typedef NMPCTypes::ControlVector ControlVector;
+typedef NMPCTypes::ReferenceVector ReferenceVector;
+typedef NMPCTypes::DeltaVector DeltaVector;
+typedef NMPCTypes::InequalityConstraintVector InequalityConstraintVector;
+typedef NMPCTypes::StateConstraintVector StateConstraintVector;
+typedef NMPCTypes::ControlConstraintVector ControlConstraintVector;
+typedef NMPCTypes::InequalityConstraintMatrix InequalityConstraintMatrix;
+typedef NMPCTypes::ContinuityConstraintMatrix ContinuityConstraintMatrix;
 
-/* Typedef for inequality constraint matrix. */
-typedef Eigen::Matrix<
-    real_t,
-    NMPC_GRADIENT_DIM,
-    NMPC_GRADIENT_DIM,
-    Eigen::RowMajor> InequalityConstraintMatrix;
+typedef Eigen::Matrix<real_t, 6, 1> AccelerationVector;
 
-/* Typedef for continuity constraint matrix.  */
+/* Automatic differentiation types for the dimensions set in config.h. */
+typedef NMPCTypes::DerivativeVector DerivativeVector;
+typedef NMPCTypes::ADScalar real_ad_t;
+
+typedef Eigen::Matrix<real_ad_t, 3, 1> Vector3AD;
+typedef Eigen::Matrix<real_ad_t, 4, 1> Vector4AD;
+typedef Eigen::Quaternion<real_ad_t> QuaternionAD;
+typedef NMPCTypes::StateVectorAD StateVectorAD;
+typedef NMPCTypes::DeltaVectorAD DeltaVectorAD;
+typedef NMPCTypes::ControlVectorAD ControlVectorAD;
+typedef Eigen::Matrix<real_ad_t, 6, 1> AccelerationVectorAD;
+
+/* Lane-parallel types for the dimensions set in config.h. */
+#define NMPC_LANES (NMPC_GRADIENT_DIM + 1)
+
+typedef NMPCTypes::LaneArray LaneArray;
+typedef Eigen::Array<real_t, 3, NMPC_LANES, Eigen::RowMajor> Vector3Lanes;
+typedef Eigen::Array<real_t, 4, NMPC_LANES, Eigen::RowMajor> Vector4Lanes;
+typedef NMPCTypes::StateVectorLanes StateVectorLanes;
+typedef NMPCTypes::ControlVectorLanes ControlVectorLanes;
 typedef Eigen::Matrix<
     real_t,
-    NMPC_DELTA_DIM,
-    NMPC_GRADIENT_DIM,
-    Eigen::RowMajor> ContinuityConstraintMatrix;
-
-typedef Eigen::Matrix<real_t, 6, 1> AccelerationVector;
+    6,
+    NMPC_LANES,
+    Eigen::RowMajor> AccelerationVectorLanes;
 
 #endif
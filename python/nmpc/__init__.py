@@ -6,6 +6,23 @@ from ctypes import *
 NMPC_PRECISION_FLOAT = 0
 NMPC_PRECISION_DOUBLE = 1
 
+NMPC_QP_QPDUNES = 0
+NMPC_QP_DENSE = 1
+NMPC_QP_RICCATI = 2
+
+NMPC_TIMING_PREPARATION = 0
+NMPC_TIMING_SOLVE_IVPS = 1
+NMPC_TIMING_QP_UPDATE = 2
+NMPC_TIMING_FEEDBACK = 3
+NMPC_TIMING_INITIAL_CONSTRAINT = 4
+NMPC_TIMING_QP_SOLVE = 5
+NMPC_TIMING_QP_NEWTON_SETUP = 6
+NMPC_TIMING_QP_FACTORISATION = 7
+NMPC_TIMING_QP_LINE_SEARCH = 8
+NMPC_TIMING_QP_STAGE_QPS = 9
+NMPC_TIMING_UPDATE_HORIZON = 10
+NMPC_TIMING_PHASES = 11
+
 state = None
 
 # Internal globals, set during init
@@ -16,6 +33,8 @@ _STATE_DIM = None
 
 # Externally accessible globals
 HORIZON_LENGTH = None
+HORIZON_STEPS = None
+MAX_HORIZON_LENGTH = None
 STEP_LENGTH = None
 
 class _State(Structure):
@@ -29,6 +48,17 @@ class _State(Structure):
         return str(fields)
 
 
+class _TimingStats(Structure):
+    pass
+
+
+class _RuntimeOptions(Structure):
+    _fields_ = [
+        ("cpu", c_int32),
+        ("priority", c_int32)
+    ]
+
+
 # Public interface
 def integrate(dt, control=None):
     global _cnmpc, state
@@ -66,6 +96,95 @@ def set_reference(point, index):
         (_REAL_T * (_CONTROL_DIM+_STATE_DIM))(*point),
         index)
 
+def _reference_block(points):
+    # Packs a list of reference points into one contiguous array
+    values = [v for point in points for v in point]
+    return (_REAL_T * len(values))(*values)
+
+def set_reference_horizon(points):
+    # Sets reference points 0 to len(points) - 1 in one call
+    if len(points) < 1 or len(points) > HORIZON_STEPS + 1:
+        raise ValueError(
+            "Between 1 and %d reference points required" %
+            (HORIZON_STEPS + 1))
+    _cnmpc.nmpc_set_reference_horizon(_reference_block(points), len(points))
+
+def set_preparation_threads(n):
+    _cnmpc.nmpc_set_preparation_threads(n)
+
+def set_horizon(horizon_length, step_length):
+    # Must be called before initialise_horizon()
+    global HORIZON_LENGTH, HORIZON_STEPS, STEP_LENGTH
+
+    if horizon_length < 1 or horizon_length > MAX_HORIZON_LENGTH:
+        raise ValueError(
+            "Horizon length must be between 1 and %d" % MAX_HORIZON_LENGTH)
+
+    _cnmpc.nmpc_config_set_horizon_length(horizon_length)
+    _cnmpc.nmpc_config_set_step_length(step_length)
+
+    HORIZON_LENGTH = _cnmpc.nmpc_config_get_horizon_length()
+    HORIZON_STEPS = _cnmpc.nmpc_config_get_horizon_steps()
+    STEP_LENGTH = _cnmpc.nmpc_config_get_step_length()
+
+def set_horizon_grid(interval_steps, step_length):
+    # Must be called before initialise_horizon(). The reference trajectory
+    # has HORIZON_STEPS + 1 points, spaced step_length apart.
+    global HORIZON_LENGTH, HORIZON_STEPS, STEP_LENGTH
+
+    if len(interval_steps) < 1 or len(interval_steps) > MAX_HORIZON_LENGTH:
+        raise ValueError(
+            "Horizon length must be between 1 and %d" % MAX_HORIZON_LENGTH)
+    if min(interval_steps) < 1:
+        raise ValueError("Each interval must cover at least one step")
+
+    _cnmpc.nmpc_config_set_horizon_grid(
+        (c_uint * len(interval_steps))(*interval_steps), len(interval_steps))
+    _cnmpc.nmpc_config_set_step_length(step_length)
+
+    HORIZON_LENGTH = _cnmpc.nmpc_config_get_horizon_length()
+    HORIZON_STEPS = _cnmpc.nmpc_config_get_horizon_steps()
+    STEP_LENGTH = _cnmpc.nmpc_config_get_step_length()
+
+def set_move_blocking(block_steps, step_length):
+    # Must be called before initialise_horizon(). Each block shares a single
+    # control input; the reference trajectory has HORIZON_STEPS + 1 points.
+    global HORIZON_LENGTH, HORIZON_STEPS, STEP_LENGTH
+
+    if len(block_steps) < 1 or len(block_steps) > MAX_HORIZON_LENGTH:
+        raise ValueError(
+            "Number of blocks must be between 1 and %d" % MAX_HORIZON_LENGTH)
+    if min(block_steps) < 1:
+        raise ValueError("Each block must cover at least one step")
+
+    _cnmpc.nmpc_config_set_move_blocking(
+        (c_uint * len(block_steps))(*block_steps), len(block_steps))
+    _cnmpc.nmpc_config_set_step_length(step_length)
+
+    HORIZON_LENGTH = _cnmpc.nmpc_config_get_horizon_length()
+    HORIZON_STEPS = _cnmpc.nmpc_config_get_horizon_steps()
+    STEP_LENGTH = _cnmpc.nmpc_config_get_step_length()
+
+def set_integration(substeps, tolerance=0.0):
+    # Integration steps per interval (or per base step of a move-blocked
+    # interval); a non-zero tolerance lets an RK45 build adapt the steps
+    if substeps < 1:
+        raise ValueError("Each interval needs at least one integration step")
+    if tolerance < 0.0:
+        raise ValueError("Integration tolerance must not be negative")
+    _cnmpc.nmpc_config_set_integration_substeps(substeps)
+    _cnmpc.nmpc_config_set_integration_tolerance(tolerance)
+
+def set_qp_condensing(block_size):
+    # Must be called before initialise_horizon(); 0 disables condensing
+    _cnmpc.nmpc_config_set_qp_condensing(block_size)
+
+def set_qp_backend(backend):
+    # Must be called before initialise_horizon(); one of the NMPC_QP_* values
+    if backend not in (NMPC_QP_QPDUNES, NMPC_QP_DENSE, NMPC_QP_RICCATI):
+        raise ValueError("Unknown QP backend %r" % backend)
+    _cnmpc.nmpc_config_set_qp_backend(backend)
+
 def initialise_horizon():
     _cnmpc.nmpc_init()
 
@@ -91,9 +210,230 @@ def update_horizon(new_reference):
     _cnmpc.nmpc_update_horizon(
         (_REAL_T * (_STATE_DIM+_CONTROL_DIM))(*new_reference))
 
+def shift_horizon():
+    # Moves the horizon on by one step, leaving the last reference point to
+    # be replaced from the reference queue
+    _cnmpc.nmpc_shift_horizon()
+
+def queue_reference(new_reference, step):
+    # Queues the reference point for base step `step` of the trajectory,
+    # for the next preparation step; may be called from one other thread,
+    # such as a mission planner. Returns False if the queue is full
+    return _cnmpc.nmpc_queue_reference_point(
+        (_REAL_T * (_STATE_DIM+_CONTROL_DIM))(*new_reference), step) == 0
+
+def get_reference_step():
+    # Returns the trajectory step of reference point 0
+    return _cnmpc.nmpc_get_reference_step()
+
+def get_timing_stats():
+    # Returns a dict of latency statistics (seconds) for each NMPC_TIMING_*
+    # phase
+    stats = (_TimingStats * NMPC_TIMING_PHASES)()
+    _cnmpc.nmpc_get_timing_stats(stats)
+
+    return dict((i, {
+        "count": s.count,
+        "min": s.min,
+        "max": s.max,
+        "mean": s.mean,
+        "p50": s.p50,
+        "p90": s.p90,
+        "p99": s.p99
+    }) for i, s in enumerate(stats))
+
+def reset_timing_stats():
+    _cnmpc.nmpc_reset_timing_stats()
+
+def get_qp_iterations():
+    return _cnmpc.nmpc_get_qp_iterations()
+
+def set_linearisation_cache(tolerance):
+    # Reuse interval linearisations whose reference, control and wind agree
+    # to within tolerance; 0 disables the cache
+    if tolerance < 0.0:
+        raise ValueError("Cache tolerance must not be negative")
+    _cnmpc.nmpc_config_set_linearisation_cache_tolerance(tolerance)
+
+def get_linearisation_cache_stats():
+    # Returns (hits, misses) since the last reset
+    hits = c_uint(0)
+    misses = c_uint(0)
+    _cnmpc.nmpc_get_linearisation_cache_stats(byref(hits), byref(misses))
+
+    return hits.value, misses.value
+
+def reset_linearisation_cache_stats():
+    _cnmpc.nmpc_reset_linearisation_cache_stats()
+
+def start_runtime(cpu=-1, priority=0):
+    # Runs the preparation step on a worker thread, optionally pinned to a
+    # CPU and at a SCHED_FIFO priority; call after initialise_horizon() and
+    # set_reference(), and use only the runtime_* functions until
+    # stop_runtime()
+    if _cnmpc.nmpc_runtime_start(byref(_RuntimeOptions(cpu, priority))):
+        raise RuntimeError("Couldn't start the NMPC runtime")
+
+def stop_runtime():
+    _cnmpc.nmpc_runtime_stop()
+
+def runtime_feedback(measurement, new_reference=None):
+    # Returns the controls for the measurement and the NMPC result code, then
+    # moves the horizon on to new_reference in the background; without one,
+    # the new end point comes from the reference queue
+    controls = (_REAL_T * _CONTROL_DIM)()
+    reference = None
+    if new_reference is not None:
+        reference = (_REAL_T * (_STATE_DIM+_CONTROL_DIM))(*new_reference)
+
+    result = _cnmpc.nmpc_runtime_feedback(
+        (_REAL_T * _STATE_DIM)(*measurement), reference, controls)
+
+    return list(controls), result
+
+def runtime_set_wind_velocity(wind_velocity):
+    _cnmpc.nmpc_runtime_set_wind_velocity(
+        _REAL_T(wind_velocity[0]),
+        _REAL_T(wind_velocity[1]),
+        _REAL_T(wind_velocity[2]))
+
+def set_jacobian_refresh(interval, stages=0):
+    # Recalculate every Jacobian on each interval'th preparation step, and
+    # those of the first stages intervals on every step
+    if interval < 1:
+        raise ValueError("Jacobian refresh interval must be at least 1")
+    _cnmpc.nmpc_config_set_jacobian_refresh(interval, stages)
+
+class Fleet(object):
+    # A batch of independent controllers, all stepped by a single call to
+    # step(). Configuration methods apply to every instance unless an
+    # instance index is given.
+
+    def __init__(self, size):
+        if not _cnmpc:
+            raise RuntimeError("Please call nmpc.init()")
+        if size < 1:
+            raise ValueError("Fleet must contain at least one instance")
+
+        self._fleet = _cnmpc.nmpc_fleet_create(size)
+        if not self._fleet:
+            raise MemoryError("Couldn't allocate a fleet of %d" % size)
+
+        self.size = size
+        self._measurements = (_REAL_T * (size * _STATE_DIM))()
+        self._references = (_REAL_T * (size * (_STATE_DIM+_CONTROL_DIM)))()
+        self._controls = (_REAL_T * (size * _CONTROL_DIM))()
+        self._results = (c_int * size)()
+
+    def __del__(self):
+        if _cnmpc and getattr(self, "_fleet", None):
+            _cnmpc.nmpc_fleet_destroy(self._fleet)
+            self._fleet = None
+
+    def _contexts(self, instance):
+        if instance is None:
+            return [_cnmpc.nmpc_fleet_get_ctx(self._fleet, i)
+                    for i in range(self.size)]
+        if instance < 0 or instance >= self.size:
+            raise IndexError("Instance %d out of range" % instance)
+        return [_cnmpc.nmpc_fleet_get_ctx(self._fleet, instance)]
+
+    def set_threads(self, n):
+        # 0 uses the OpenMP default
+        _cnmpc.nmpc_fleet_set_threads(self._fleet, n)
+
+    def setup(self, state_weights, control_weights, terminal_weights,
+            upper_control_bound, lower_control_bound, instance=None):
+        for ctx in self._contexts(instance):
+            _cnmpc.nmpc_ctx_set_state_weights(
+                ctx, (_REAL_T * (_STATE_DIM-1))(*state_weights))
+            _cnmpc.nmpc_ctx_set_control_weights(
+                ctx, (_REAL_T * (_CONTROL_DIM))(*control_weights))
+            _cnmpc.nmpc_ctx_set_terminal_weights(
+                ctx, (_REAL_T * (_STATE_DIM-1))(*terminal_weights))
+            _cnmpc.nmpc_ctx_set_lower_control_bound(
+                ctx, (_REAL_T * (_CONTROL_DIM))(*lower_control_bound))
+            _cnmpc.nmpc_ctx_set_upper_control_bound(
+                ctx, (_REAL_T * (_CONTROL_DIM))(*upper_control_bound))
+
+    def set_horizon(self, horizon_length, step_length, instance=None):
+        # Must be called before initialise_horizon()
+        if horizon_length < 1 or horizon_length > MAX_HORIZON_LENGTH:
+            raise ValueError(
+                "Horizon length must be between 1 and %d" %
+                MAX_HORIZON_LENGTH)
+
+        for ctx in self._contexts(instance):
+            _cnmpc.nmpc_ctx_config_set_horizon_length(ctx, horizon_length)
+            _cnmpc.nmpc_ctx_config_set_step_length(ctx, step_length)
+
+    def set_qp_backend(self, backend, instance=None):
+        # Must be called before initialise_horizon()
+        if backend not in (NMPC_QP_QPDUNES, NMPC_QP_DENSE, NMPC_QP_RICCATI):
+            raise ValueError("Unknown QP backend %r" % backend)
+
+        for ctx in self._contexts(instance):
+            _cnmpc.nmpc_ctx_config_set_qp_backend(ctx, backend)
+
+    def set_wind_velocity(self, wind_velocity, instance=None):
+        for ctx in self._contexts(instance):
+            _cnmpc.nmpc_ctx_set_wind_velocity(
+                ctx,
+                _REAL_T(wind_velocity[0]),
+                _REAL_T(wind_velocity[1]),
+                _REAL_T(wind_velocity[2]))
+
+    def get_horizon_steps(self, instance=0):
+        return _cnmpc.nmpc_ctx_config_get_horizon_steps(
+            self._contexts(instance)[0])
+
+    def set_reference(self, point, index, instance=None):
+        for ctx in self._contexts(instance):
+            _cnmpc.nmpc_ctx_set_reference_point(
+                ctx, (_REAL_T * (_CONTROL_DIM+_STATE_DIM))(*point), index)
+
+    def set_reference_horizon(self, points, instance=None):
+        references = _reference_block(points)
+        for ctx in self._contexts(instance):
+            _cnmpc.nmpc_ctx_set_reference_horizon(
+                ctx, references, len(points))
+
+    def initialise_horizon(self):
+        for ctx in self._contexts(None):
+            _cnmpc.nmpc_ctx_init(ctx)
+
+    def step(self, measurements, new_references=None):
+        # Runs one iteration of every instance, given a measurement and
+        # (optionally) a new reference point for each, and returns a list
+        # of the controls and a list of the NMPC result codes
+        if len(measurements) != self.size or (
+                new_references is not None and
+                len(new_references) != self.size):
+            raise ValueError("Need one measurement and reference for each "
+                             "of the %d instances" % self.size)
+
+        n = _STATE_DIM
+        for i, measurement in enumerate(measurements):
+            self._measurements[i*n:(i+1)*n] = measurement
+
+        references = None
+        if new_references is not None:
+            n = _STATE_DIM + _CONTROL_DIM
+            for i, reference in enumerate(new_references):
+                self._references[i*n:(i+1)*n] = reference
+            references = self._references
+
+        _cnmpc.nmpc_fleet_step(self._fleet, self._measurements, references,
+                               self._controls, self._results)
+
+        n = _CONTROL_DIM
+        return ([list(self._controls[i*n:(i+1)*n])
+                 for i in range(self.size)],
+                list(self._results))
+
 def init(implementation="c"):
     global _cnmpc, _REAL_T, _STATE_DIM, _CONTROL_DIM, state
-    global HORIZON_LENGTH, STEP_LENGTH
+    global HORIZON_LENGTH, HORIZON_STEPS, MAX_HORIZON_LENGTH, STEP_LENGTH
 
     # Load the requested library and determine configuration parameters
     if implementation == "c":
@@ -128,10 +468,42 @@ def init(implementation="c"):
     _cnmpc.nmpc_config_get_horizon_length.argtypes = []
     _cnmpc.nmpc_config_get_horizon_length.restype = c_long
 
+    _cnmpc.nmpc_config_get_max_horizon_length.argtypes = []
+    _cnmpc.nmpc_config_get_max_horizon_length.restype = c_long
+
+    _cnmpc.nmpc_config_get_horizon_steps.argtypes = []
+    _cnmpc.nmpc_config_get_horizon_steps.restype = c_long
+
     _cnmpc.nmpc_config_get_step_length.argtypes = []
     _cnmpc.nmpc_config_get_step_length.restype = _REAL_T
 
+    _cnmpc.nmpc_config_set_horizon_length.argtypes = [c_uint]
+    _cnmpc.nmpc_config_set_horizon_length.restype = None
+
+    _cnmpc.nmpc_config_set_horizon_grid.argtypes = [POINTER(c_uint), c_uint]
+    _cnmpc.nmpc_config_set_horizon_grid.restype = None
+
+    _cnmpc.nmpc_config_set_move_blocking.argtypes = [POINTER(c_uint), c_uint]
+    _cnmpc.nmpc_config_set_move_blocking.restype = None
+
+    _cnmpc.nmpc_config_set_qp_condensing.argtypes = [c_uint]
+    _cnmpc.nmpc_config_set_qp_condensing.restype = None
+
+    _cnmpc.nmpc_config_set_qp_backend.argtypes = [c_uint]
+    _cnmpc.nmpc_config_set_qp_backend.restype = None
+
+    _cnmpc.nmpc_config_set_step_length.argtypes = [_REAL_T]
+    _cnmpc.nmpc_config_set_step_length.restype = None
+
+    _cnmpc.nmpc_config_set_integration_substeps.argtypes = [c_uint]
+    _cnmpc.nmpc_config_set_integration_substeps.restype = None
+
+    _cnmpc.nmpc_config_set_integration_tolerance.argtypes = [_REAL_T]
+    _cnmpc.nmpc_config_set_integration_tolerance.restype = None
+
     HORIZON_LENGTH = _cnmpc.nmpc_config_get_horizon_length()
+    HORIZON_STEPS = _cnmpc.nmpc_config_get_horizon_steps()
+    MAX_HORIZON_LENGTH = _cnmpc.nmpc_config_get_max_horizon_length()
     STEP_LENGTH = _cnmpc.nmpc_config_get_step_length()
 
     _State._fields_ = [
@@ -141,6 +513,16 @@ def init(implementation="c"):
         ("angular_velocity", _REAL_T * 3)
     ]
 
+    _TimingStats._fields_ = [
+        ("count", c_uint32),
+        ("min", _REAL_T),
+        ("max", _REAL_T),
+        ("mean", _REAL_T),
+        ("p50", _REAL_T),
+        ("p90", _REAL_T),
+        ("p99", _REAL_T)
+    ]
+
     _cnmpc.nmpc_preparation_step.argtypes = []
     _cnmpc.nmpc_preparation_step.restype = None
 
@@ -154,6 +536,16 @@ def init(implementation="c"):
         POINTER(_REAL_T * (_STATE_DIM+_CONTROL_DIM))]
     _cnmpc.nmpc_update_horizon.restype = None
 
+    _cnmpc.nmpc_shift_horizon.argtypes = []
+    _cnmpc.nmpc_shift_horizon.restype = None
+
+    _cnmpc.nmpc_queue_reference_point.argtypes = [
+        POINTER(_REAL_T * (_STATE_DIM+_CONTROL_DIM)), c_uint]
+    _cnmpc.nmpc_queue_reference_point.restype = c_int
+
+    _cnmpc.nmpc_get_reference_step.argtypes = []
+    _cnmpc.nmpc_get_reference_step.restype = c_uint
+
     _cnmpc.nmpc_set_state_weights.argtype = [
         POINTER(_REAL_T * (_STATE_DIM-1))]
     _cnmpc.nmpc_set_state_weights.restype = None
@@ -179,10 +571,109 @@ def init(implementation="c"):
         c_uint]
     _cnmpc.nmpc_set_reference_point.restype = None
 
+    _cnmpc.nmpc_set_reference_horizon.argtypes = [POINTER(_REAL_T), c_uint]
+    _cnmpc.nmpc_set_reference_horizon.restype = None
+
     _cnmpc.nmpc_set_wind_velocity.argtype = [
         _REAL_T, _REAL_T, _REAL_T]
     _cnmpc.nmpc_set_wind_velocity.restype = None
 
+    _cnmpc.nmpc_set_preparation_threads.argtypes = [c_uint]
+    _cnmpc.nmpc_set_preparation_threads.restype = None
+
+    _cnmpc.nmpc_get_timing_stats.argtypes = [
+        POINTER(_TimingStats * NMPC_TIMING_PHASES)]
+    _cnmpc.nmpc_get_timing_stats.restype = None
+
+    _cnmpc.nmpc_reset_timing_stats.argtypes = []
+    _cnmpc.nmpc_reset_timing_stats.restype = None
+
+    _cnmpc.nmpc_get_qp_iterations.argtypes = []
+    _cnmpc.nmpc_get_qp_iterations.restype = c_uint
+
+    _cnmpc.nmpc_config_set_linearisation_cache_tolerance.argtypes = [_REAL_T]
+    _cnmpc.nmpc_config_set_linearisation_cache_tolerance.restype = None
+
+    _cnmpc.nmpc_get_linearisation_cache_stats.argtypes = [
+        POINTER(c_uint), POINTER(c_uint)]
+    _cnmpc.nmpc_get_linearisation_cache_stats.restype = None
+
+    _cnmpc.nmpc_reset_linearisation_cache_stats.argtypes = []
+    _cnmpc.nmpc_reset_linearisation_cache_stats.restype = None
+
+    _cnmpc.nmpc_config_set_jacobian_refresh.argtypes = [c_uint, c_uint]
+    _cnmpc.nmpc_config_set_jacobian_refresh.restype = None
+
+    _cnmpc.nmpc_runtime_start.argtypes = [POINTER(_RuntimeOptions)]
+    _cnmpc.nmpc_runtime_start.restype = c_int
+
+    _cnmpc.nmpc_runtime_stop.argtypes = []
+    _cnmpc.nmpc_runtime_stop.restype = None
+
+    _cnmpc.nmpc_runtime_feedback.argtypes = [
+        POINTER(_REAL_T * _STATE_DIM),
+        POINTER(_REAL_T * (_STATE_DIM + _CONTROL_DIM)),
+        POINTER(_REAL_T * _CONTROL_DIM)]
+    _cnmpc.nmpc_runtime_feedback.restype = c_int
+
+    _cnmpc.nmpc_runtime_set_wind_velocity.argtypes = [
+        _REAL_T, _REAL_T, _REAL_T]
+    _cnmpc.nmpc_runtime_set_wind_velocity.restype = None
+
+    # Handle-based and batch interfaces; contexts are opaque pointers
+    _cnmpc.nmpc_ctx_init.argtypes = [c_void_p]
+    _cnmpc.nmpc_ctx_init.restype = None
+
+    for name, dim in (("state_weights", _STATE_DIM-1),
+                      ("control_weights", _CONTROL_DIM),
+                      ("terminal_weights", _STATE_DIM-1),
+                      ("lower_control_bound", _CONTROL_DIM),
+                      ("upper_control_bound", _CONTROL_DIM)):
+        fn = getattr(_cnmpc, "nmpc_ctx_set_" + name)
+        fn.argtypes = [c_void_p, POINTER(_REAL_T * dim)]
+        fn.restype = None
+
+    _cnmpc.nmpc_ctx_set_reference_point.argtypes = [
+        c_void_p, POINTER(_REAL_T * (_STATE_DIM+_CONTROL_DIM)), c_uint]
+    _cnmpc.nmpc_ctx_set_reference_point.restype = None
+
+    _cnmpc.nmpc_ctx_set_reference_horizon.argtypes = [
+        c_void_p, POINTER(_REAL_T), c_uint]
+    _cnmpc.nmpc_ctx_set_reference_horizon.restype = None
+
+    _cnmpc.nmpc_ctx_set_wind_velocity.argtypes = [
+        c_void_p, _REAL_T, _REAL_T, _REAL_T]
+    _cnmpc.nmpc_ctx_set_wind_velocity.restype = None
+
+    _cnmpc.nmpc_ctx_config_set_horizon_length.argtypes = [c_void_p, c_uint]
+    _cnmpc.nmpc_ctx_config_set_horizon_length.restype = None
+
+    _cnmpc.nmpc_ctx_config_set_step_length.argtypes = [c_void_p, _REAL_T]
+    _cnmpc.nmpc_ctx_config_set_step_length.restype = None
+
+    _cnmpc.nmpc_ctx_config_set_qp_backend.argtypes = [c_void_p, c_uint]
+    _cnmpc.nmpc_ctx_config_set_qp_backend.restype = None
+
+    _cnmpc.nmpc_ctx_config_get_horizon_steps.argtypes = [c_void_p]
+    _cnmpc.nmpc_ctx_config_get_horizon_steps.restype = c_uint
+
+    _cnmpc.nmpc_fleet_create.argtypes = [c_uint]
+    _cnmpc.nmpc_fleet_create.restype = c_void_p
+
+    _cnmpc.nmpc_fleet_destroy.argtypes = [c_void_p]
+    _cnmpc.nmpc_fleet_destroy.restype = None
+
+    _cnmpc.nmpc_fleet_get_ctx.argtypes = [c_void_p, c_uint]
+    _cnmpc.nmpc_fleet_get_ctx.restype = c_void_p
+
+    _cnmpc.nmpc_fleet_set_threads.argtypes = [c_void_p, c_uint]
+    _cnmpc.nmpc_fleet_set_threads.restype = None
+
+    _cnmpc.nmpc_fleet_step.argtypes = [
+        c_void_p, POINTER(_REAL_T), POINTER(_REAL_T), POINTER(_REAL_T),
+        POINTER(c_int)]
+    _cnmpc.nmpc_fleet_step.restype = None
+
     if implementation == "c":
         # Set up the function prototypes
         _cnmpc.nmpc_fixedwingdynamics_set_position.argtypes = [
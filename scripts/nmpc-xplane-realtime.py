@@ -191,11 +191,13 @@ except socket.error:
     pass
 
 # Set up the NMPC reference trajectory using correct interpolation.
-for i in xrange(0, nmpc.HORIZON_LENGTH+1):
+horizon = []
+for i in xrange(0, nmpc.HORIZON_STEPS+1):
     horizon_point = [a for a in interpolate_reference(
         i*nmpc.STEP_LENGTH, xplane_reference_points)]
     horizon_point.extend([0.5, 0.5, 0.5])
-    nmpc.set_reference(horizon_point[1:], i)
+    horizon.append(horizon_point[1:])
+nmpc.set_reference_horizon(horizon)
 
 # Set up initial attitude, velocity and angular velocity.
 initial_point = interpolate_reference(0, xplane_reference_points)
@@ -266,11 +268,13 @@ update = "set sim/operation/override/override_planepath [0,0,0,0,0,0,0,0,0,0,0,0
 
 sock.setblocking(0)
 
+# The preparation step runs in the background from here on, so each
+# iteration only waits for the QP.
+nmpc.start_runtime()
+
 for i in xrange(1000):
     start_iteration = datetime.datetime.now()
 
-    nmpc.prepare()
-
     # Get latest "measured" data.
     try:
         for line in socket_readlines(sock):
@@ -310,7 +314,7 @@ for i in xrange(1000):
     except socket.error:
         pass
 
-    nmpc.set_wind_velocity(wind_velocity)
+    nmpc.runtime_set_wind_velocity(wind_velocity)
 
     # Recalculate quaternion in case euler angles have been updated.
     attitude = euler_to_q(yaw, pitch, roll)
@@ -341,21 +345,18 @@ for i in xrange(1000):
         measured_state["wz"]]
     print state
 
-    nmpc.solve(state)
+    # Add one to the index because of the terminal point.
+    horizon_point = [a for a in interpolate_reference(
+        (i+1+nmpc.HORIZON_STEPS)*nmpc.STEP_LENGTH, xplane_reference_points)]
+    horizon_point.extend([0.5, 0.5, 0.5])
 
-    control_vec = nmpc.get_controls()
+    control_vec, result = nmpc.runtime_feedback(state, horizon_point[1:])
     print ("t: %.2f " % (i*nmpc.STEP_LENGTH)) + repr(control_vec)
 
     update += "set sim/flightmodel/engine/ENGN_thro_use [%.6f,0,0,0,0,0,0,0]\n" % control_vec[0]
     update += "set sim/flightmodel/controls/wing1l_ail1def %.6f\n" % math.degrees(control_vec[1] - 0.5)
     update += "set sim/flightmodel/controls/wing1r_ail1def %.6f\n" % math.degrees(control_vec[2] - 0.5)
 
-    # Add one to the index because of the terminal point.
-    horizon_point = [a for a in interpolate_reference(
-        (i+1+nmpc.HORIZON_LENGTH)*nmpc.STEP_LENGTH, xplane_reference_points)]
-    horizon_point.extend([0.5, 0.5, 0.5])
-    nmpc.update_horizon(horizon_point[1:])
-
     sock.sendall(update)
 
     update = ""
@@ -364,4 +365,6 @@ for i in xrange(1000):
     if s > 0:
         time.sleep(s)
 
+nmpc.stop_runtime()
+
 sock.sendall("set sim/operation/override/override_planepath [1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0]\n")
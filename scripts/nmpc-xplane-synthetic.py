@@ -190,11 +190,13 @@ except socket.error:
     pass
 
 # Set up the NMPC reference trajectory using correct interpolation.
-for i in xrange(0, nmpc.HORIZON_LENGTH+1):
+horizon = []
+for i in xrange(0, nmpc.HORIZON_STEPS+1):
     horizon_point = [a for a in interpolate_reference(
         i*nmpc.STEP_LENGTH, xplane_reference_points)]
     horizon_point.extend([0.5, 0.5, 0.5])
-    nmpc.set_reference(horizon_point[1:], i)
+    horizon.append(horizon_point[1:])
+nmpc.set_reference_horizon(horizon)
 
 # Set up initial attitude, velocity and angular velocity.
 initial_point = interpolate_reference(0, xplane_reference_points)
@@ -351,7 +353,7 @@ for i in xrange(10000):
 
     # Add one to the index because of the terminal point.
     horizon_point = [a for a in interpolate_reference(
-        (i+1+nmpc.HORIZON_LENGTH)*nmpc.STEP_LENGTH, xplane_reference_points)]
+        (i+1+nmpc.HORIZON_STEPS)*nmpc.STEP_LENGTH, xplane_reference_points)]
     horizon_point.extend([0.5, 0.5, 0.5])
     nmpc.update_horizon(horizon_point[1:])
 
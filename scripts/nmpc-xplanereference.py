@@ -130,7 +130,7 @@ for line in sys.stdin:
         xplane_reference_points.append(map(float, out))
 
 # Set up the NMPC reference trajectory using correct interpolation.
-for i in xrange(0, nmpc.HORIZON_LENGTH):
+for i in xrange(0, nmpc.HORIZON_STEPS):
     horizon_point = [a for a in interpolate_reference(
         i*nmpc.STEP_LENGTH, xplane_reference_points)]
     horizon_point.extend([15000, 0, 0])
@@ -138,8 +138,8 @@ for i in xrange(0, nmpc.HORIZON_LENGTH):
 
 # Set up terminal reference. No need for control values as they'd be ignored.
 terminal_point = [a for a in interpolate_reference(
-    nmpc.HORIZON_LENGTH*nmpc.STEP_LENGTH, xplane_reference_points)]
-nmpc.set_reference(terminal_point[1:], nmpc.HORIZON_LENGTH)
+    nmpc.HORIZON_STEPS*nmpc.STEP_LENGTH, xplane_reference_points)]
+nmpc.set_reference(terminal_point[1:], nmpc.HORIZON_STEPS)
 
 initial_point = interpolate_reference(0, xplane_reference_points)
 _cnmpc.nmpc_fixedwingdynamics_set_position(*initial_point[1:4])
@@ -171,6 +171,6 @@ for i in xrange(500):
     control_vec = nmpc.get_controls()
     nmpc.integrate(nmpc.STEP_LENGTH, (ctypes.c_double * 3)(*control_vec))
     horizon_point = [a for a in interpolate_reference(
-        (i+nmpc.HORIZON_LENGTH)*nmpc.STEP_LENGTH, xplane_reference_points)]
+        (i+nmpc.HORIZON_STEPS)*nmpc.STEP_LENGTH, xplane_reference_points)]
     horizon_point.extend([15000, 0, 0])
     nmpc.update_horizon(horizon_point[1:])
@@ -0,0 +1,357 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Closed-loop flight simulation, for regression testing the controller
+without X-Plane. The plant is a separate X8DynamicsModel integrated with
+RK4 at a finer step than the controller uses, and optionally differs from
+the controller's model in mass and wind (the controller always assumes
+still air). Each control step runs the preparation step, feeds the
+controller the plant state with Gaussian noise added, solves for the
+controls and applies them to the plant for one step. Nothing waits on the
+wall clock, so the simulation runs as fast as the controller does.
+
+The reference is a square circuit flown repeatedly at 20 m/s, like the one
+in nmpc-xplane-synthetic.py but with coordinated turns.
+
+At the end, the tracking error, the real-time factor and the controller's
+latency statistics are printed. The run fails (exit status 1) if the
+position error ever exceeds SIM_MAX_POSITION_ERROR or the state becomes
+non-finite.
+
+Usage: nmpc_sim [-t seconds] [-s seed] [-n noise_scale] [-m mass_ratio]
+                [-w north,east,down] [-j interval,stages] [-o log.csv]
+
+    -t  Flight time to simulate (default 600 s)
+    -s  Seed for the measurement noise
+    -n  Scale of the measurement noise; 0 disables it (default 1)
+    -m  Plant mass relative to the controller's model (default 1)
+    -w  Wind velocity seen by the plant (m/s, NED)
+    -j  Jacobian refresh schedule (see OCP_JACOBIAN_REFRESH_INTERVAL)
+    -o  Write the time, plant state, controls and reference to a CSV file
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "state.h"
+#include "integrator.h"
+#include "dynamics.h"
+#include "ocp.h"
+#include "timing.h"
+
+#define SIM_AIRSPEED 20.0
+#define SIM_LEG_TIME 29.0
+#define SIM_TURN_TIME 10.0
+#define SIM_CIRCUIT_LEGS 4u
+
+/* The plant is integrated at this many steps per control step. */
+#define SIM_PLANT_SUBSTEPS 10u
+
+#define SIM_MAX_POSITION_ERROR 100.0
+
+/* Standard deviations of the measurement noise at a scale of 1. */
+#define SIM_POSITION_NOISE 0.5
+#define SIM_VELOCITY_NOISE 0.1
+#define SIM_ATTITUDE_NOISE 0.005
+#define SIM_ANGULAR_VELOCITY_NOISE 0.01
+
+static X8Dynamics controller_model;
+static X8DynamicsModel plant_model;
+static OptimalControlProblem<X8StateSpace> ocp =
+    OptimalControlProblem<X8StateSpace>(&controller_model);
+static IntegratorRK4 plant_integrator;
+
+static uint64_t noise_state = 1u;
+
+/* Uniform on (0, 1], from a xorshift64* generator. */
+static double uniform() {
+    noise_state ^= noise_state >> 12;
+    noise_state ^= noise_state << 25;
+    noise_state ^= noise_state >> 27;
+    return (double)((noise_state * 2685821657736338717ull) >> 11) *
+        (1.0 / 9007199254740992.0) + (1.0 / 9007199254740992.0);
+}
+
+/* Standard normal, by the Box-Muller transform. */
+static real_t gaussian() {
+    return (real_t)(std::sqrt(-2.0 * std::log(uniform())) *
+                    std::cos(2.0 * M_PI * uniform()));
+}
+
+/*
+Reference point at time t on the circuit. Leg k heads k * 90 degrees from
+north, and ends with a coordinated right turn at constant airspeed onto the
+next leg; the reference banks into the turn and has the matching body
+rates.
+*/
+static ReferenceVector reference_point(double t) {
+    double leg_time = SIM_LEG_TIME + SIM_TURN_TIME,
+           rate = M_PI_2 / SIM_TURN_TIME, radius = SIM_AIRSPEED / rate,
+           side = SIM_AIRSPEED * SIM_LEG_TIME + radius,
+           yaw, theta = 0.0, roll = 0.0;
+    uint32_t i, leg;
+    Vector3r position = Vector3r::Zero(), along, across;
+    ReferenceVector out;
+
+    leg = (uint32_t)std::floor(t / leg_time);
+    t -= leg * leg_time;
+    leg %= SIM_CIRCUIT_LEGS;
+
+    /* Each leg starts a turn radius along from the end of the last. */
+    for(i = 0; i < leg; i++) {
+        position += (real_t)side * Vector3r(
+            (real_t)std::cos(i * M_PI_2), (real_t)std::sin(i * M_PI_2), 0);
+        position += (real_t)radius * Vector3r(
+            (real_t)std::cos((i + 1) * M_PI_2),
+            (real_t)std::sin((i + 1) * M_PI_2), 0);
+    }
+
+    yaw = leg * M_PI_2;
+    along << (real_t)std::cos(yaw), (real_t)std::sin(yaw), 0;
+    across << (real_t)-std::sin(yaw), (real_t)std::cos(yaw), 0;
+
+    if(t <= SIM_LEG_TIME) {
+        position += (real_t)(SIM_AIRSPEED * t) * along;
+    } else {
+        theta = (t - SIM_LEG_TIME) * rate;
+        roll = std::atan(SIM_AIRSPEED * rate / G_ACCEL);
+        position += (real_t)(SIM_AIRSPEED * SIM_LEG_TIME) * along +
+            (real_t)(radius * std::sin(theta)) * along +
+            (real_t)(radius * (1.0 - std::cos(theta))) * across;
+    }
+
+    out.setZero();
+    out.segment<3>(0) = position;
+    out[2] = (real_t)-100.0;
+    out.segment<3>(3) = (real_t)(SIM_AIRSPEED * std::cos(theta)) * along +
+        (real_t)(SIM_AIRSPEED * std::sin(theta)) * across;
+
+    /* The attitude rotates NED into the body frame. */
+    Quaternionr attitude =
+        Quaternionr(Eigen::AngleAxis<real_t>(
+            (real_t)-roll, Vector3r::UnitX())) *
+        Quaternionr(Eigen::AngleAxis<real_t>(
+            (real_t)-(yaw + theta), Vector3r::UnitZ()));
+    out.segment<4>(6) = attitude.coeffs();
+
+    if(theta > 0.0) {
+        out[11] = (real_t)(rate * std::sin(roll));
+        out[12] = (real_t)(rate * std::cos(roll));
+    }
+
+    out.segment<NMPC_CONTROL_DIM>(NMPC_STATE_DIM) << 0.5, 0.5, 0.5;
+    return out;
+}
+
+/* Adds measurement noise to the plant state. */
+static StateVector measure(const State &plant, real_t scale) {
+    State out = plant;
+    Vector3r rotation;
+    uint32_t i;
+
+    if(scale == (real_t)0.0) {
+        return out;
+    }
+
+    for(i = 0; i < 3; i++) {
+        out.position()[i] += scale * (real_t)SIM_POSITION_NOISE * gaussian();
+        out.velocity()[i] += scale * (real_t)SIM_VELOCITY_NOISE * gaussian();
+        out.angular_velocity()[i] +=
+            scale * (real_t)SIM_ANGULAR_VELOCITY_NOISE * gaussian();
+        rotation[i] = scale * (real_t)SIM_ATTITUDE_NOISE * gaussian();
+    }
+
+    /* Perturb the attitude by a small rotation. */
+    Quaternionr noise((real_t)1.0, (real_t)0.5 * rotation[0],
+                      (real_t)0.5 * rotation[1], (real_t)0.5 * rotation[2]);
+    noise.normalize();
+    out.attitude() = (noise * Quaternionr(out.attitude())).coeffs();
+
+    return out;
+}
+
+static void print_stats(const char *name, TimingPhase phase) {
+    const TimingStats &stats = ocp.get_timing_stats(phase);
+
+    printf("%-14s  %8.1f  %8.1f  %8.1f\n", name,
+           stats.get_percentile((real_t)0.5) * 1e6,
+           stats.get_percentile((real_t)0.99) * 1e6,
+           stats.get_max() * 1e6);
+}
+
+int main(int argc, char **argv) {
+    double duration = 600.0, dt, t, start, wall_time,
+           squared_error = 0.0, max_error = 0.0, error;
+    real_t noise_scale = 1.0, mass_ratio = 1.0;
+    Vector3r wind = Vector3r::Zero();
+    FILE *log = NULL;
+    uint32_t i, j, steps, horizon_steps;
+    unsigned int refresh_interval = OCP_JACOBIAN_REFRESH_INTERVAL,
+                 refresh_stages = OCP_JACOBIAN_REFRESH_STAGES;
+    int opt;
+    State plant;
+    ControlVector controls;
+    ReferenceVector reference;
+    bool failed = false;
+
+    while((opt = getopt(argc, argv, "t:s:n:m:w:j:o:")) != -1) {
+        switch(opt) {
+            case 't':
+                duration = atof(optarg);
+                break;
+            case 's':
+                noise_state = strtoull(optarg, NULL, 10) | 1u;
+                break;
+            case 'n':
+                noise_scale = (real_t)atof(optarg);
+                break;
+            case 'm':
+                mass_ratio = (real_t)atof(optarg);
+                break;
+            case 'w': {
+                double w[3] = {0.0, 0.0, 0.0};
+                sscanf(optarg, "%lf,%lf,%lf", &w[0], &w[1], &w[2]);
+                wind << (real_t)w[0], (real_t)w[1], (real_t)w[2];
+                break;
+            }
+            case 'j':
+                sscanf(optarg, "%u,%u", &refresh_interval, &refresh_stages);
+                break;
+            case 'o':
+                log = fopen(optarg, "w");
+                if(!log) {
+                    fprintf(stderr, "couldn't open %s\n", optarg);
+                    return 2;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-t seconds] [-s seed] "
+                        "[-n noise_scale] [-m mass_ratio] "
+                        "[-w north,east,down] [-j interval,stages] "
+                        "[-o log.csv]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if(duration <= 0.0 || mass_ratio <= (real_t)0.0 ||
+            refresh_interval == 0) {
+        fprintf(stderr, "duration, mass ratio and refresh interval must be "
+                "positive\n");
+        return 2;
+    }
+
+    /* Same tuning as nmpc-xplane-synthetic.py. */
+    DeltaVector state_weights, terminal_weights;
+    ControlVector control_weights;
+    state_weights << 1, 1, 1, 1, 1, 1, 1, 1, 1e1, 7e-1, 7e-1, 1e1;
+    terminal_weights = DeltaVector::Ones();
+    control_weights << 1e-1, 1e3, 1e3;
+
+    ocp.set_state_weights(state_weights);
+    ocp.set_terminal_weights(terminal_weights);
+    ocp.set_control_weights(control_weights);
+    ocp.set_lower_control_bound(ControlConstraintVector::Zero());
+    ocp.set_upper_control_bound(ControlConstraintVector::Ones());
+    ocp.set_jacobian_refresh(refresh_interval, refresh_stages);
+    ocp.initialise();
+
+    plant_model.set_mass(controller_model.get_mass() * mass_ratio);
+    plant_model.set_wind_velocity(wind);
+
+    dt = ocp.get_step_length();
+    horizon_steps = ocp.get_horizon_steps();
+    for(i = 0; i <= horizon_steps; i++) {
+        ocp.set_reference_point(reference_point(i * dt), i);
+    }
+
+    plant = reference_point(0.0).segment<NMPC_STATE_DIM>(0);
+    steps = (uint32_t)std::ceil(duration / dt);
+
+    start = timing_clock();
+    for(i = 0; i < steps; i++) {
+        t = i * dt;
+
+        ocp.preparation_step();
+        ocp.feedback_step(measure(plant, noise_scale));
+        controls = ocp.get_controls();
+
+        for(j = 0; j < SIM_PLANT_SUBSTEPS; j++) {
+            plant = plant_integrator.integrate(
+                plant, controls, &plant_model,
+                (real_t)(dt / SIM_PLANT_SUBSTEPS));
+        }
+        plant.attitude().normalize();
+
+        reference = reference_point(t + dt);
+        error = (plant.position() - reference.segment<3>(0)).norm();
+        squared_error += error * error;
+        max_error = std::max(max_error, error);
+
+        if(log) {
+            fprintf(log, "%.3f", t + dt);
+            for(j = 0; j < NMPC_STATE_DIM; j++) {
+                fprintf(log, ",%g", (double)plant[j]);
+            }
+            for(j = 0; j < NMPC_CONTROL_DIM; j++) {
+                fprintf(log, ",%g", (double)controls[j]);
+            }
+            for(j = 0; j < NMPC_STATE_DIM; j++) {
+                fprintf(log, ",%g", (double)reference[j]);
+            }
+            fprintf(log, "\n");
+        }
+
+        if(!(error <= SIM_MAX_POSITION_ERROR) || !plant.allFinite()) {
+            failed = true;
+            i++;
+            break;
+        }
+
+        ocp.update_horizon(reference_point(t + (horizon_steps + 1) * dt));
+    }
+    wall_time = timing_clock() - start;
+
+    if(log) {
+        fclose(log);
+    }
+
+    printf("%.1f s flown in %.2f s (%.0fx real time)\n", i * dt, wall_time,
+           i * dt / wall_time);
+    printf("position error: rms %.2f m, max %.2f m\n",
+           std::sqrt(squared_error / i), max_error);
+    printf("\nphase           p50 (us)  p99 (us)  max (us)\n");
+    print_stats("preparation", TIMING_PREPARATION);
+    print_stats("feedback", TIMING_FEEDBACK);
+    print_stats("update horizon", TIMING_UPDATE_HORIZON);
+
+    if(failed) {
+        printf("\nfailed: lost the reference at %.2f s\n", i * dt);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,316 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <cmath>
+#include <cassert>
+
+#include "types.h"
+#include "condensing.h"
+
+/*
+Condenses one group of stage variables: either the initial state delta
+(first == 0, Cols == DELTA_DIM) or the control delta of interval first - 1
+(Cols == CONTROL_DIM), which occupies columns col onwards.
+sensitivities[first] must already hold the sensitivity of the state delta
+at step `first` to the group.
+
+The sensitivities S_k are propagated forwards with S_{k+1} = A_k S_k. The
+backward sweep then accumulates Z_k = W_k S_k + A_k' Z_{k+1}, so that the
+Hessian block between the control of interval k and the group is
+B_k' Z_{k+1}. Only the blocks below the diagonal are calculated here, and
+mirrored into the upper triangle; Z_first is returned so the caller can
+calculate the diagonal block.
+*/
+template <class Types>
+template <int Cols>
+void QPCondenser<Types>::condense_group(
+const ContinuityConstraintMatrix *jacobians,
+const uint32_t *weight_scale,
+uint32_t n,
+uint32_t first,
+uint32_t col,
+const StateWeightMatrix &state_weights,
+const StateWeightMatrix *terminal_weights,
+MatrixXr &hessian,
+MatrixXr &continuity,
+Eigen::Matrix<real_t, DELTA_DIM, Cols> &z) {
+    typedef Eigen::Matrix<real_t, CONTROL_DIM, Cols> ControlRowMatrix;
+    uint32_t k, row;
+    ControlRowMatrix block;
+
+    /* Forward sweep. */
+    for(k = first; k < n; k++) {
+        sensitivities[k+1].template leftCols<Cols>() =
+            jacobians[k].template leftCols<DELTA_DIM>() *
+            sensitivities[k].template leftCols<Cols>();
+    }
+
+    continuity.template block<DELTA_DIM, Cols>(0, col) =
+        sensitivities[n].template leftCols<Cols>();
+
+    /* Backward sweep. */
+    if(terminal_weights) {
+        z = *terminal_weights * sensitivities[n].template leftCols<Cols>();
+    } else {
+        z.setZero();
+    }
+
+    for(k = n; k-- > first;) {
+        block = jacobians[k].template rightCols<CONTROL_DIM>()
+            .transpose() * z;
+        row = DELTA_DIM + CONTROL_DIM * k;
+        hessian.template block<CONTROL_DIM, Cols>(row, col) = block;
+        hessian.template block<Cols, CONTROL_DIM>(col, row) =
+            block.transpose();
+
+        z = (state_weights * (real_t)weight_scale[k]) *
+                sensitivities[k].template leftCols<Cols>() +
+            jacobians[k].template leftCols<DELTA_DIM>().transpose() * z;
+    }
+}
+
+template <class Types>
+void QPCondenser<Types>::condense(
+const ContinuityConstraintMatrix *jacobians,
+const DeltaVector *residuals,
+const uint32_t *weight_scale,
+uint32_t n,
+const StateWeightMatrix &state_weights,
+const ControlWeightMatrix &control_weights,
+const StateWeightMatrix *terminal_weights,
+MatrixXr &hessian,
+VectorXr &gradient,
+MatrixXr &continuity,
+DeltaVector &residual) {
+    uint32_t k, col;
+    DeltaVector y;
+    SensitivityMatrix state_z;
+    Eigen::Matrix<real_t, DELTA_DIM, CONTROL_DIM> control_z;
+
+    assert(jacobians && residuals && weight_scale);
+    assert(n > 0 && n <= OCP_MAX_HORIZON_LENGTH);
+    assert(hessian.rows() >= DELTA_DIM + CONTROL_DIM * n &&
+           hessian.cols() >= DELTA_DIM + CONTROL_DIM * n);
+    assert(gradient.rows() >= DELTA_DIM + CONTROL_DIM * n);
+    assert(continuity.rows() == DELTA_DIM &&
+           continuity.cols() >= DELTA_DIM + CONTROL_DIM * n);
+
+    /* Initial state delta. */
+    sensitivities[0] = SensitivityMatrix::Identity();
+    condense_group<DELTA_DIM>(
+        jacobians, weight_scale, n, 0, 0, state_weights, terminal_weights,
+        hessian, continuity, state_z);
+    hessian.block<DELTA_DIM, DELTA_DIM>(0, 0) = state_z;
+
+    /*
+    Control deltas. The control of interval k first affects the state delta
+    at the end of the interval, through the control part of the Jacobian.
+    */
+    for(k = 0; k < n; k++) {
+        col = DELTA_DIM + CONTROL_DIM * k;
+        sensitivities[k+1].template leftCols<CONTROL_DIM>() =
+            jacobians[k].template rightCols<CONTROL_DIM>();
+        condense_group<CONTROL_DIM>(
+            jacobians, weight_scale, n, k + 1, col, state_weights,
+            terminal_weights, hessian, continuity, control_z);
+
+        hessian.block<CONTROL_DIM, CONTROL_DIM>(col, col) =
+            jacobians[k].template rightCols<CONTROL_DIM>().transpose() *
+                control_z +
+            control_weights * (real_t)weight_scale[k];
+    }
+
+    /*
+    The integration residuals shift each state delta by a constant offset,
+    which gives the linear term of the objective and the residual of the
+    block's continuity constraint.
+    */
+    offsets[0] = DeltaVector::Zero();
+    for(k = 0; k < n; k++) {
+        offsets[k+1] =
+            jacobians[k].template leftCols<DELTA_DIM>() * offsets[k] +
+            residuals[k];
+    }
+
+    residual = offsets[n];
+
+    if(terminal_weights) {
+        y = *terminal_weights * offsets[n];
+    } else {
+        y = DeltaVector::Zero();
+    }
+
+    for(k = n; k-- > 0;) {
+        gradient.segment<CONTROL_DIM>(
+            DELTA_DIM + CONTROL_DIM * k) =
+            jacobians[k].template rightCols<CONTROL_DIM>().transpose() * y;
+        y = (state_weights * (real_t)weight_scale[k]) * offsets[k] +
+            jacobians[k].template leftCols<DELTA_DIM>().transpose() * y;
+    }
+
+    gradient.segment<DELTA_DIM>(0) = y;
+}
+
+void DenseQPSolver::resize(uint32_t n) {
+    reduced_hessian.resize(n, n);
+    reduced_step.resize(n);
+    qp_gradient.resize(n);
+    trial_gradient.resize(n);
+    step.resize(n);
+    trial.resize(n);
+    free_variables.resize(n);
+}
+
+/*
+Cholesky factorisation of the leading n x n block of reduced_hessian, in
+place. This is done by hand rather than with Eigen::LLT so the size can vary
+from one iteration to the next without allocating.
+*/
+bool DenseQPSolver::factorise(uint32_t n) {
+    uint32_t i, j;
+    real_t d;
+
+    for(j = 0; j < n; j++) {
+        d = reduced_hessian(j, j) -
+            reduced_hessian.row(j).head(j).squaredNorm();
+        if(!(d > (real_t)0.0)) {
+            return false;
+        }
+
+        reduced_hessian(j, j) = std::sqrt(d);
+        for(i = j + 1; i < n; i++) {
+            reduced_hessian(i, j) = (reduced_hessian(i, j) -
+                reduced_hessian.row(i).head(j).dot(
+                    reduced_hessian.row(j).head(j))) / reduced_hessian(j, j);
+        }
+    }
+
+    return true;
+}
+
+/* Solves LL'x = b in place in the leading n elements of reduced_step. */
+void DenseQPSolver::backsolve(uint32_t n) {
+    uint32_t i, j;
+
+    for(i = 0; i < n; i++) {
+        reduced_step[i] = (reduced_step[i] -
+            reduced_hessian.row(i).head(i).dot(reduced_step.head(i))) /
+            reduced_hessian(i, i);
+    }
+
+    for(i = n; i-- > 0;) {
+        for(j = i + 1; j < n; j++) {
+            reduced_step[i] -= reduced_hessian(j, i) * reduced_step[j];
+        }
+        reduced_step[i] /= reduced_hessian(i, i);
+    }
+}
+
+bool DenseQPSolver::solve(
+const MatrixXr &hessian,
+const VectorXr &gradient,
+const VectorXr &lower,
+const VectorXr &upper,
+VectorXr &solution) {
+    uint32_t i, j, n = (uint32_t)gradient.rows(), n_free;
+    real_t objective, trial_objective, alpha, stationarity, tolerance;
+
+    assert(hessian.rows() == n && hessian.cols() == n);
+    assert(lower.rows() == n && upper.rows() == n && solution.rows() == n);
+    assert(qp_gradient.rows() == n);
+
+    solution = solution.cwiseMax(lower).cwiseMin(upper);
+    tolerance = NMPC_EPS_SQRT * ((real_t)1.0 + gradient.cwiseAbs().maxCoeff());
+
+    for(iterations = 0; iterations < max_iterations; iterations++) {
+        qp_gradient.noalias() = hessian * solution;
+        objective = (real_t)0.5 * solution.dot(qp_gradient) +
+            gradient.dot(solution);
+        qp_gradient += gradient;
+
+        /*
+        Variables at a bound with the gradient pointing out of the feasible
+        region stay where they are; the rest are free to move.
+        */
+        n_free = 0;
+        stationarity = 0.0;
+        for(i = 0; i < n; i++) {
+            if((solution[i] <= lower[i] && qp_gradient[i] > (real_t)0.0) ||
+               (solution[i] >= upper[i] && qp_gradient[i] < (real_t)0.0)) {
+                continue;
+            }
+
+            free_variables[n_free++] = i;
+            stationarity = std::max(stationarity, std::abs(qp_gradient[i]));
+        }
+
+        if(stationarity <= tolerance) {
+            return true;
+        }
+
+        /* Newton step in the free variables. */
+        for(i = 0; i < n_free; i++) {
+            for(j = 0; j <= i; j++) {
+                reduced_hessian(i, j) =
+                    hessian(free_variables[i], free_variables[j]);
+            }
+            reduced_step[i] = -qp_gradient[free_variables[i]];
+        }
+
+        if(!factorise(n_free)) {
+            return false;
+        }
+        backsolve(n_free);
+
+        step.setZero();
+        for(i = 0; i < n_free; i++) {
+            step[free_variables[i]] = reduced_step[i];
+        }
+
+        /*
+        Backtrack along the projection arc until the objective decreases
+        sufficiently (Armijo condition).
+        */
+        for(alpha = 1.0; alpha > NMPC_EPS_SQRT; alpha *= (real_t)0.5) {
+            trial = (solution + alpha * step).cwiseMax(lower).cwiseMin(upper);
+            trial_gradient.noalias() = hessian * trial;
+            trial_objective = (real_t)0.5 * trial.dot(trial_gradient) +
+                gradient.dot(trial);
+
+            if(trial_objective <= objective + (real_t)1e-4 *
+                    qp_gradient.dot(trial - solution)) {
+                break;
+            }
+        }
+
+        if(alpha <= NMPC_EPS_SQRT) {
+            return false;
+        }
+
+        solution = trial;
+    }
+
+    return false;
+}
+
+template class QPCondenser<NMPCTypes>;
+template class QPCondenser<LongitudinalTypes>;
@@ -26,93 +26,3 @@ SOFTWARE.
 #include "dynamics.h"
 
 DynamicsModel::~DynamicsModel() {}
-
-/*
-Runs a dynamics model with hard-coded coefficients for the X8.
-*/
-AccelerationVector X8DynamicsModel::evaluate(
-const State &in, const ControlVector &control) const {
-    /* Cache state data for convenience */
-    Quaternionr attitude = Quaternionr(in.attitude());
-    real_t yaw_rate = in.angular_velocity()[2],
-           pitch_rate = in.angular_velocity()[1],
-           roll_rate = in.angular_velocity()[0];
-
-    /* External axes */
-    Vector3r airflow;
-    real_t v, v_inv, horizontal_v2, vertical_v2, vertical_v, vertical_v_inv;
-
-    airflow = attitude * (wind_velocity - in.velocity());
-    v = airflow.norm();
-    horizontal_v2 = airflow.y() * airflow.y() + airflow.x() * airflow.x();
-    vertical_v2 = airflow.z() * airflow.z() + airflow.x() * airflow.x();
-
-    v_inv = (real_t)1.0 / std::max(v, (real_t)1.0);
-    vertical_v = std::sqrt(vertical_v2);
-    vertical_v_inv = (real_t)1.0 / std::max(vertical_v, (real_t)1.0);
-
-    /* Determine alpha and beta: alpha = atan(wz/wx), beta = atan(wy/|wxz|) */
-    real_t alpha, sin_alpha, cos_alpha, sin_beta, cos_beta, a2, sin_cos_alpha;
-    alpha = std::atan2(-airflow.z(), -airflow.x());
-
-    sin_alpha = -airflow.z() * vertical_v_inv;
-    cos_alpha = -airflow.x() * vertical_v_inv;
-    sin_cos_alpha = sin_alpha * cos_alpha;
-    sin_beta = airflow.y() * v_inv;
-    cos_beta = vertical_v * v_inv;
-
-    a2 = alpha * alpha;
-
-    real_t lift, drag, side_force, roll_moment, pitch_moment, yaw_moment;
-    lift = -5 * a2 * alpha + a2 + 2.5 * alpha + 0.12;
-    if (alpha < -0.25) {
-        lift = std::min(lift, (real_t)0.8 * sin_cos_alpha);
-    } else {
-        lift = std::max(lift, (real_t)0.8 * sin_cos_alpha);
-    }
-
-    drag = 0.05 + 0.7 * sin_alpha * sin_alpha;
-    side_force = 0.3 * sin_beta * cos_beta;
-
-    pitch_moment = 0.001 - 0.1 * sin_cos_alpha - 0.003 * pitch_rate -
-                   0.04 * (control[1] - 0.5) - 0.04 * (control[2] - 0.5);
-    roll_moment = 0.03 * sin_beta - 0.015 * roll_rate +
-                  0.1 * (control[1] - 0.5) - 0.1 * (control[2] - 0.5);
-    yaw_moment = -0.02 * sin_beta - 0.05 * yaw_rate -
-                 0.01 * std::abs(control[1] - 0.5) +
-                 0.01 * std::abs(control[2] - 0.5);
-
-    /*
-    Determine motor thrust and torque.
-    */
-    real_t thrust, ve = 0.0025 * (control[0] * 25000.0), v0 = airflow.x();
-    thrust = (real_t)0.5 * RHO * 0.025 * (ve * ve - v0 * v0);
-    if (thrust < 0.0) {
-        /* Folding prop, so assume no drag */
-        thrust = 0.0;
-    }
-
-    /*
-    Sum and apply forces and moments
-    */
-    Vector3r sum_force, sum_torque;
-    real_t qbar = RHO * horizontal_v2 * (real_t)0.5;
-    sum_force << thrust + qbar * (lift * sin_alpha - drag * cos_alpha - side_force * sin_beta),
-                 qbar * side_force * cos_beta,
-                 -qbar * (lift * cos_alpha + drag * sin_alpha);
-    sum_torque = qbar * Vector3r(roll_moment, pitch_moment, yaw_moment);
-
-    /* Calculate linear acceleration (F / m) */
-    AccelerationVector output;
-    output.segment<3>(0) = sum_force * mass_inv +
-                           attitude * Vector3r(0, 0, G_ACCEL);
-
-    /* Calculate angular acceleration (tau / inertia tensor) */
-    /*output.segment<3>(3) = inertia_tensor_inv * sum_torque;*/
-    output.segment<3>(3) <<
-        qbar * (3.364222 * roll_moment + 0.27744448 * yaw_moment),
-        qbar * 5.8823528 * pitch_moment,
-        qbar * (0.27744448 * roll_moment + 2.4920163 * yaw_moment);
-
-    return output;
-}
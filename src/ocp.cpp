@@ -21,27 +21,45 @@ SOFTWARE.
 */
 
 #include <cmath>
-
-extern "C"
-{
-    #include <qpDUNES.h>
-}
+#include <cstring>
+#include <algorithm>
 
 #include "types.h"
 #include "ocp.h"
 #include "state.h"
+#include "dynamics.h"
 #include "debug.h"
 
-OptimalControlProblem::OptimalControlProblem(DynamicsModel *d) {
-#if defined(NMPC_INTEGRATOR_RK4)
-    integrator = IntegratorRK4();
-#elif defined(NMPC_INTEGRATOR_HEUN)
-    integrator = IntegratorHeun();
-#elif defined(NMPC_INTEGRATOR_EULER)
-    integrator = IntegratorEuler();
+/*
+Brackets the steps which shouldn't allocate, when NMPC_ASSERT_NO_MALLOC is
+defined in config.h.
+*/
+static inline void set_malloc_allowed(bool allowed) {
+#if defined(NMPC_ASSERT_NO_MALLOC)
+    Eigen::internal::set_is_malloc_allowed(allowed);
+#else
+    (void)allowed;
 #endif
+}
 
+template <class StateSpace, class IntegratorType>
+OptimalControlProblem<StateSpace, IntegratorType>::OptimalControlProblem(
+Dynamics *d) {
     dynamics = d;
+    preparation_threads = OCP_PREPARATION_THREADS;
+    set_horizon_length(OCP_HORIZON_LENGTH);
+    step_length = OCP_STEP_LENGTH;
+    integration_substeps = OCP_INTEGRATION_SUBSTEPS;
+    integration_tolerance = OCP_INTEGRATION_TOLERANCE;
+    cache_tolerance = OCP_LINEARISATION_CACHE_TOLERANCE;
+    jacobian_refresh_interval = OCP_JACOBIAN_REFRESH_INTERVAL;
+    jacobian_refresh_stages = OCP_JACOBIAN_REFRESH_STAGES;
+    reference_step = 0;
+    clear_linearisation_cache();
+    reset_linearisation_cache_stats();
+    qp_backend_type = QP_BACKEND_QPDUNES;
+    condensing_block_size = 0;
+    qp_backend = &qpdunes_backend;
 
     /* Initialise inequality constraints to +/-infinity. */
     lower_state_bound = StateConstraintVector::Ones() * -NMPC_INFTY;
@@ -54,84 +72,149 @@ OptimalControlProblem::OptimalControlProblem(DynamicsModel *d) {
     state_weights = StateWeightMatrix::Identity();
     control_weights = ControlWeightMatrix::Identity();
     terminal_weights = StateWeightMatrix::Identity();
+}
 
-    qp_options = qpDUNES_setupDefaultOptions();
-    qp_options.maxIter = 5;
-    qp_options.printLevel = 0;
-    qp_options.stationarityTolerance = 1e-3;
+/*
+Chooses the integration steps across interval i, from its reference state.
+Move-blocked intervals start from steps of the base step length, and others
+from a single step of the whole interval; either is divided into
+integration_substeps steps.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::plan_integration(
+uint32_t i, IntegrationSteps &steps) const {
+    uint32_t k = interval_offset[i];
+    uint32_t blocks = move_blocking ? interval_steps[i] : 1;
+    real_t delta = step_length * (real_t)(interval_steps[i] / blocks) /
+        (real_t)integration_substeps;
+
+    integrator.plan(
+        State(state_reference[k]),
+        control_reference[k],
+        dynamics,
+        delta,
+        blocks * integration_substeps,
+        integration_tolerance,
+        steps);
 }
 
-DeltaVector OptimalControlProblem::state_to_delta(
-const StateVector &s1, const StateVector &s2) {
-    DeltaVector delta;
+#if defined(NMPC_JACOBIAN_AD)
+/*
+Solve the initial value problems in order to set up continuity constraints,
+which effectively store the system dynamics for this SQP iteration.
+At the same time, compute the Jacobian by integrating the reference point in
+forward-mode automatic differentiation, with one derivative direction for
+each component of the state delta and control vector.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::solve_ivps(
+uint32_t i) {
+    uint32_t j;
+    uint32_t k = interval_offset[i], next = interval_offset[i+1];
+    IntegrationSteps steps;
+    DeltaVectorAD seeded_delta;
+    ControlVectorAD seeded_control;
+
+    /*
+    Seed a zero state delta, and apply it to the reference state the same
+    way the finite-difference perturbations are applied, so each component
+    of the delta gets its own derivative direction. The controls are seeded
+    directly.
+    */
+    for(j = 0; j < DELTA_DIM; j++) {
+        seeded_delta[j] = ADScalar((real_t)0.0, GRADIENT_DIM, j);
+    }
 
-    delta.segment<6>(0) = s2.segment<6>(0) - s1.segment<6>(0);
+    for(j = 0; j < CONTROL_DIM; j++) {
+        seeded_control[j] = ADScalar(
+            control_reference[k][j], GRADIENT_DIM, j+DELTA_DIM);
+    }
 
     /*
-    In order to increase the linearity of the problem and avoid quaternion
-    normalisation issues, we calculate the difference between attitudes as a
-    3-vector of Modified Rodrigues Parameters (MRP).
+    Solve the initial value problem at this horizon step. The control is
+    held across each of the interval's integration steps in turn, so the
+    derivatives are chained through all of them.
     */
-    Quaternionr err_q = (Quaternionr(s2.segment<4>(6)) *
-        Quaternionr(s1.segment<4>(6)).conjugate());
+    plan_integration(i, steps);
+    StateAD integrated_state = StateSpace::template apply_delta<ADScalar>(
+        state_reference[k].template cast<ADScalar>(),
+        seeded_delta);
+    for(j = 0; j < steps.count; j++) {
+        integrated_state = integrator.integrate(
+            integrated_state,
+            seeded_control,
+            dynamics,
+            steps.length(j));
+    }
 
-    if(err_q.w() < 0) {
-        err_q = Quaternionr(-err_q.w(), -err_q.x(), -err_q.y(), -err_q.z());
+    for(j = 0; j < STATE_DIM; j++) {
+        integrated_state_horizon[i][j] = integrated_state[j].value();
     }
 
-    delta.segment<3>(6) = NMPC_MRP_F *
-        (err_q.vec() / (NMPC_MRP_A + err_q.w()));
+    /*
+    Differentiate the delta between the integrated state and its value to
+    yield the Jacobian matrix one row at a time.
+    */
+    DeltaVectorAD integrated_delta =
+        StateSpace::template state_to_delta<ADScalar>(
+        integrated_state_horizon[i].template cast<ADScalar>(),
+        integrated_state);
 
-    delta.segment<3>(9) = s2.segment<3>(10) - s1.segment<3>(10);
+    for(j = 0; j < DELTA_DIM; j++) {
+        jacobians[i].row(j) = integrated_delta[j].derivatives().transpose();
+    }
 
-    return delta;
+    /*
+    Calculate integration residuals; these are needed for the continuity
+    constraints.
+    */
+    integration_residuals[i] = StateSpace::template state_to_delta<real_t>(
+        state_reference[next],
+        integrated_state_horizon[i]);
 }
-
+#elif defined(NMPC_JACOBIAN_FD)
 /*
 Solve the initial value problems in order to set up continuity constraints,
 which effectively store the system dynamics for this SQP iteration.
 At the same time, compute the Jacobian function by applying perturbations to
 each of the variables in turn, for use in the continuity constraints.
 */
-void OptimalControlProblem::solve_ivps(uint32_t i) {
-    uint32_t j;
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::solve_ivps(
+uint32_t i) {
+    uint32_t j, s;
+    uint32_t k = interval_offset[i], next = interval_offset[i+1];
+    IntegrationSteps steps;
 
-    /* Solve the initial value problem at this horizon step. */
-    integrated_state_horizon[i] = integrator.integrate(
-        State(state_reference[i]),
-        control_reference[i],
-        dynamics,
-        OCP_STEP_LENGTH);
-
-    for(j = 0; j < NMPC_GRADIENT_DIM; j++) {
-        ReferenceVector perturbed_state;
-        perturbed_state.segment<NMPC_STATE_DIM>(0) = state_reference[i];
-        perturbed_state.segment<NMPC_CONTROL_DIM>(NMPC_STATE_DIM) =
-            control_reference[i];
-        StateVector new_state;
+    /*
+    Solve the initial value problem at this horizon step. The control is
+    held across each of the interval's integration steps in turn, and the
+    perturbed states below take the same steps.
+    */
+    plan_integration(i, steps);
+    integrated_state_horizon[i] = state_reference[k];
+    for(s = 0; s < steps.count; s++) {
+        integrated_state_horizon[i] = integrator.integrate(
+            State(integrated_state_horizon[i]),
+            control_reference[k],
+            dynamics,
+            steps.length(s));
+    }
+
+    for(j = 0; j < GRADIENT_DIM; j++) {
+        StateVector new_state = state_reference[k];
+        ControlVector perturbed_control = control_reference[k];
         real_t perturbation = NMPC_EPS_4RT;
 
-        /* Need to calculate quaternion perturbations using MRPs. */
-        if(j < 6) {
-            perturbed_state[j] += perturbation;
-        } else if(j >= 6 && j <= 8) {
-            Vector3r d_p;
-            d_p << 0.0, 0.0, 0.0;
-            d_p[j-6] = perturbation;
-            real_t x_2 = d_p.squaredNorm();
-            real_t delta_w = (-NMPC_MRP_A * x_2 + NMPC_MRP_F * std::sqrt(
-                NMPC_MRP_F_2 + ((real_t)1.0 - NMPC_MRP_A_2) * x_2)) /
-                (NMPC_MRP_F_2 + x_2);
-            Vector3r delta_xyz = (((real_t)1.0 / NMPC_MRP_F) *
-                (NMPC_MRP_A + delta_w)) * d_p;
-            Quaternionr delta_q;
-            delta_q.vec() = delta_xyz;
-            delta_q.w() = delta_w;
-            Quaternionr temp = delta_q *
-                Quaternionr(perturbed_state.segment<4>(6));
-            perturbed_state.segment<4>(6) << temp.vec(), temp.w();
-        } else if(j < NMPC_DELTA_DIM) {
-            perturbed_state[j+1] += perturbation;
+        /*
+        States are perturbed through a state delta, so that the attitude is
+        perturbed by an MRP.
+        */
+        if(j < DELTA_DIM) {
+            DeltaVector perturbed_delta = DeltaVector::Zero();
+            perturbed_delta[j] = perturbation;
+            new_state = StateSpace::template apply_delta<real_t>(
+                new_state, perturbed_delta);
         } else {
             /*
             Perturbations for the control inputs should be proportional
@@ -139,114 +222,314 @@ void OptimalControlProblem::solve_ivps(uint32_t i) {
             precision.
             */
             perturbation *=
-                (upper_control_bound[j-NMPC_DELTA_DIM] -
-                lower_control_bound[j-NMPC_DELTA_DIM]);
-            perturbed_state[j+1] += perturbation;
+                (upper_control_bound[j-DELTA_DIM] -
+                lower_control_bound[j-DELTA_DIM]);
+            perturbed_control[j-DELTA_DIM] += perturbation;
         }
 
-        new_state.segment<NMPC_STATE_DIM>(0) = integrator.integrate(
-            State(perturbed_state.segment<NMPC_STATE_DIM>(0)),
-            perturbed_state.segment<NMPC_CONTROL_DIM>(NMPC_STATE_DIM),
-            dynamics,
-            OCP_STEP_LENGTH);
+        for(s = 0; s < steps.count; s++) {
+            new_state = integrator.integrate(
+                State(new_state),
+                perturbed_control,
+                dynamics,
+                steps.length(s));
+        }
 
         /*
         Calculate delta between perturbed state and original state, to
         yield a full column of the Jacobian matrix.
         */
         jacobians[i].col(j) =
-            state_to_delta(integrated_state_horizon[i], new_state) /
-            perturbation;
+            StateSpace::template state_to_delta<real_t>(
+                integrated_state_horizon[i], new_state) / perturbation;
+    }
+
+    /*
+    Calculate integration residuals; these are needed for the continuity
+    constraints.
+    */
+    integration_residuals[i] = StateSpace::template state_to_delta<real_t>(
+        state_reference[next],
+        integrated_state_horizon[i]);
+}
+#elif defined(NMPC_JACOBIAN_FD_LANES)
+/*
+Calculates the same finite differences as above, but rather than
+integrating the reference and each perturbation in turn, they are set up as
+the lanes of a StateLanes (lane 0 is the reference, and lane j+1 has
+perturbation j) and integrated together.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::solve_ivps(
+uint32_t i) {
+    uint32_t j, s;
+    uint32_t k = interval_offset[i], next = interval_offset[i+1];
+    IntegrationSteps steps;
+    real_t perturbations[GRADIENT_DIM];
+    StateLanes states;
+    ControlVectorLanes controls;
+
+    states.col(0) = state_reference[k];
+    controls.col(0) = control_reference[k];
+
+    for(j = 0; j < GRADIENT_DIM; j++) {
+        StateVector new_state = state_reference[k];
+        ControlVector perturbed_control = control_reference[k];
+        real_t perturbation = NMPC_EPS_4RT;
+
+        /*
+        States are perturbed through a state delta, so that the attitude is
+        perturbed by an MRP.
+        */
+        if(j < DELTA_DIM) {
+            DeltaVector perturbed_delta = DeltaVector::Zero();
+            perturbed_delta[j] = perturbation;
+            new_state = StateSpace::template apply_delta<real_t>(
+                new_state, perturbed_delta);
+        } else {
+            /*
+            Perturbations for the control inputs should be proportional
+            to the control range to make sure we don't lose too much
+            precision.
+            */
+            perturbation *=
+                (upper_control_bound[j-DELTA_DIM] -
+                lower_control_bound[j-DELTA_DIM]);
+            perturbed_control[j-DELTA_DIM] += perturbation;
+        }
+
+        states.col(j+1) = new_state;
+        controls.col(j+1) = perturbed_control;
+        perturbations[j] = perturbation;
+    }
+
+    /*
+    Solve the initial value problems for every lane at once, holding the
+    controls across each of the interval's integration steps in turn.
+    */
+    plan_integration(i, steps);
+    for(s = 0; s < steps.count; s++) {
+        states = integrator.integrate(
+            states, controls, dynamics, steps.length(s));
+    }
+
+    integrated_state_horizon[i] = states.col(0);
+
+    /*
+    Calculate delta between each perturbed state and the original state, to
+    yield the Jacobian matrix one column at a time.
+    */
+    for(j = 0; j < GRADIENT_DIM; j++) {
+        jacobians[i].col(j) =
+            StateSpace::template state_to_delta<real_t>(
+                integrated_state_horizon[i], states.col(j+1)) /
+            perturbations[j];
     }
 
     /*
     Calculate integration residuals; these are needed for the continuity
     constraints.
     */
-    integration_residuals[i] = state_to_delta(
-        state_reference[i+1],
+    integration_residuals[i] = StateSpace::template state_to_delta<real_t>(
+        state_reference[next],
         integrated_state_horizon[i]);
 }
+#endif
 
 /*
-Uses all of the information calculated so far to set up the various qpDUNES
-datastructures in preparation for the feedback step.
-This is really inefficient right now – there's heaps of probably unnecessary
-copying going on.
+Integrates the reference of interval i without differentiating it, to
+update the integrated state and residuals while keeping its previous
+Jacobian. The residuals are exact, so the QP still converges on a
+trajectory which satisfies the dynamics; only the sensitivities are out of
+date.
 */
-void OptimalControlProblem::initialise_qp() {
-    uint32_t i;
-    real_t Q[NMPC_DELTA_DIM*NMPC_DELTA_DIM];
-    Eigen::Map<StateWeightMatrix> Q_map(Q);
-    real_t R[NMPC_CONTROL_DIM*NMPC_CONTROL_DIM];
-    Eigen::Map<ControlWeightMatrix> R_map(R);
-    real_t P[NMPC_DELTA_DIM*NMPC_DELTA_DIM];
-    Eigen::Map<StateWeightMatrix> P_map(P);
-    real_t g[NMPC_GRADIENT_DIM];
-    Eigen::Map<GradientVector> g_map(g);
-    real_t C[(NMPC_STATE_DIM-1)*NMPC_GRADIENT_DIM];
-    Eigen::Map<ContinuityConstraintMatrix> C_map(C);
-    real_t c[NMPC_DELTA_DIM];
-    Eigen::Map<DeltaVector> c_map(c);
-    real_t zLow[NMPC_GRADIENT_DIM];
-    Eigen::Map<GradientVector> zLow_map(zLow);
-    real_t zUpp[NMPC_GRADIENT_DIM];
-    Eigen::Map<GradientVector> zUpp_map(zUpp);
-
-    zLow_map.segment<NMPC_DELTA_DIM>(0) = lower_state_bound;
-    zUpp_map.segment<NMPC_DELTA_DIM>(0) = upper_state_bound;
-
-    /* Set up problem dimensions. */
-    /* TODO: Determine number of affine constraints (D), and add them. */
-    qpDUNES_setup(
-        &qp_data,
-        OCP_HORIZON_LENGTH,
-        NMPC_DELTA_DIM,
-        NMPC_CONTROL_DIM,
-        0,
-        &qp_options);
-
-    return_t status_flag;
-
-    /* Gradient vector fixed to zero. */
-    g_map = GradientVector::Zero();
-
-    /* Continuity constraint constant term fixed to zero. */
-    c_map = DeltaVector::Zero();
-
-    /* Zero Jacobians for now */
-    C_map = ContinuityConstraintMatrix::Zero();
-
-    Q_map = state_weights;
-    R_map = control_weights;
-
-    /* Copy the relevant data into the qpDUNES arrays. */
-    zLow_map.segment<NMPC_CONTROL_DIM>(NMPC_DELTA_DIM) = lower_control_bound;
-    zUpp_map.segment<NMPC_CONTROL_DIM>(NMPC_DELTA_DIM) = upper_control_bound;
-
-    for(i = 0; i < OCP_HORIZON_LENGTH; i++) {
-        status_flag = qpDUNES_setupRegularInterval(
-            &qp_data, qp_data.intervals[i],
-            0, Q, R, 0, g, C, 0, 0, c, zLow, zUpp, 0, 0, 0, 0, 0, 0, 0);
-        AssertOK(status_flag);
-    }
-
-    /* Set up final interval. */
-    P_map = terminal_weights;
-    status_flag = qpDUNES_setupFinalInterval(&qp_data, qp_data.intervals[i],
-        P, g, zLow, zUpp, 0, 0, 0);
-    AssertOK(status_flag);
-
-    qpDUNES_setupAllLocalQPs(&qp_data, QPDUNES_FALSE);
-
-    qpDUNES_indicateDataChange(&qp_data);
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::integrate_reference(
+uint32_t i) {
+    uint32_t s;
+    uint32_t k = interval_offset[i], next = interval_offset[i+1];
+    IntegrationSteps steps;
+
+    plan_integration(i, steps);
+    integrated_state_horizon[i] = state_reference[k];
+    for(s = 0; s < steps.count; s++) {
+        integrated_state_horizon[i] = integrator.integrate(
+            State(integrated_state_horizon[i]),
+            control_reference[k],
+            dynamics,
+            steps.length(s));
+    }
+
+    integration_residuals[i] = StateSpace::template state_to_delta<real_t>(
+        state_reference[next],
+        integrated_state_horizon[i]);
+}
+
+/*
+Calculates the linearisation cache key of interval i, and returns its slot
+in the cache. Each real-valued component is rounded to the nearest multiple
+of the cache tolerance.
+*/
+template <class StateSpace, class IntegratorType>
+uint32_t OptimalControlProblem<StateSpace, IntegratorType>::
+linearisation_key(uint32_t i, int32_t key[]) const {
+    uint32_t j, n = 0, hash = 2166136261u;
+    uint32_t k = interval_offset[i];
+    real_t scale = (real_t)1.0 / cache_tolerance, quantised;
+    real_t values[CACHE_KEY_DIM - 1];
+    const typename StateSpace::WindVector &wind_velocity =
+        dynamics->get_wind_velocity();
+
+    for(j = StateSpace::INVARIANT_DIM; j < STATE_DIM; j++) {
+        values[n++] = state_reference[k][j];
+    }
+    for(j = 0; j < CONTROL_DIM; j++) {
+        values[n++] = control_reference[k][j];
+    }
+    for(j = 0; j < StateSpace::WIND_DIM; j++) {
+        values[n++] = wind_velocity[j];
+    }
+
+    for(j = 0; j < n; j++) {
+        quantised = std::floor(values[j] * scale + (real_t)0.5);
+        key[j] = (int32_t)std::min(
+            std::max(quantised, (real_t)-2e9), (real_t)2e9);
+    }
+    key[n] = (int32_t)(interval_steps[i] * 2 + (move_blocking ? 1 : 0));
+
+    /* FNV-1a hash of the key's words. */
+    for(j = 0; j < CACHE_KEY_DIM; j++) {
+        hash = (hash ^ (uint32_t)key[j]) * 16777619u;
+    }
+
+    return hash & (OCP_LINEARISATION_CACHE_SIZE - 1);
+}
+
+/* Looks up interval i in the linearisation cache. */
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::lookup_linearisation(
+uint32_t i) {
+    int32_t key[CACHE_KEY_DIM];
+    uint32_t slot = linearisation_key(i, key);
+    const LinearisationCacheEntry &entry = linearisation_cache[slot];
+
+    cache_slots[i] = slot;
+    cache_hits[i] = entry.valid && memcmp(entry.key, key, sizeof(key)) == 0;
+    if(cache_hits[i]) {
+        cache_hit_count++;
+    } else {
+        cache_miss_count++;
+    }
+}
+
+/*
+Takes the linearisation of interval i from its cache entry. The reference
+can differ from the entry's by up to the cache tolerance in each component
+of the key (and by any amount in the invariant components), so the
+integrated state is corrected for the difference to first order with the
+cached Jacobian.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::reuse_linearisation(
+uint32_t i) {
+    uint32_t k = interval_offset[i], next = interval_offset[i+1];
+    const LinearisationCacheEntry &entry =
+        linearisation_cache[cache_slots[i]];
+    GradientVector offset;
+
+    offset.template segment<DELTA_DIM>(0) =
+        StateSpace::template state_to_delta<real_t>(
+            entry.state, state_reference[k]);
+    offset.template segment<CONTROL_DIM>(DELTA_DIM) =
+        control_reference[k] - entry.control;
+
+    jacobians[i] = entry.jacobian;
+    integrated_state_horizon[i] = StateSpace::template apply_delta<real_t>(
+        entry.integrated_state, entry.jacobian * offset);
+    integration_residuals[i] = StateSpace::template state_to_delta<real_t>(
+        state_reference[next],
+        integrated_state_horizon[i]);
+}
+
+/* Stores the linearisation of interval i in its cache slot. */
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::store_linearisation(
+uint32_t i) {
+    uint32_t k = interval_offset[i];
+    LinearisationCacheEntry &entry = linearisation_cache[cache_slots[i]];
+
+    linearisation_key(i, entry.key);
+    entry.valid = true;
+    entry.state = state_reference[k];
+    entry.control = control_reference[k];
+    entry.integrated_state = integrated_state_horizon[i];
+    entry.jacobian = jacobians[i];
 }
 
 /*
-Updates the QP with the latest linearisations.
+Selects the QP backend for the current horizon, points the QP data at the
+OCP's arrays and sets the backend up. Any allocation the backend needs
+happens here.
 */
-void OptimalControlProblem::update_qp() {
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::initialise_qp() {
+    switch(qp_backend_type) {
+        case QP_BACKEND_DENSE:
+            qp_backend = &dense_backend;
+            break;
+        case QP_BACKEND_RICCATI:
+            qp_backend = &riccati_backend;
+            break;
+        case QP_BACKEND_QPDUNES:
+        default:
+            if(condensing_block_size >= horizon_length) {
+                qp_backend = &dense_backend;
+            } else {
+                qpdunes_backend.set_block_size(condensing_block_size);
+                qp_backend = &qpdunes_backend;
+            }
+            break;
+    }
+
+    qp_problem.horizon_length = horizon_length;
+    qp_problem.horizon_steps = horizon_steps;
+    qp_problem.interval_steps = interval_steps;
+    qp_problem.jacobians = jacobians;
+    qp_problem.integration_residuals = integration_residuals;
+    qp_problem.lower_control_bound = qp_lower_control_bound;
+    qp_problem.upper_control_bound = qp_upper_control_bound;
+    qp_problem.lower_state_bound = &lower_state_bound;
+    qp_problem.upper_state_bound = &upper_state_bound;
+    qp_problem.state_weights = &state_weights;
+    qp_problem.control_weights = &control_weights;
+    qp_problem.terminal_weights = &terminal_weights;
+
+    initial_delta = DeltaVector::Zero();
+    update_qp_bounds();
+    qp_backend->initialise(qp_problem);
+}
+
+/*
+Calculates the control bounds of each interval relative to the control
+reference for that interval.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::update_qp_bounds() {
+    uint32_t i;
+
+    for(i = 0; i < horizon_length; i++) {
+        const ControlVector &control = control_reference[interval_offset[i]];
+
+        qp_lower_control_bound[i] = lower_control_bound - control;
+        qp_upper_control_bound[i] = upper_control_bound - control;
+    }
+}
 
+/* Hands the latest linearisations to the QP backend. */
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::update_qp() {
+    update_qp_bounds();
+    qp_backend->update(qp_problem);
 }
 
 /*
@@ -255,70 +538,162 @@ measurement should be provided in order to to set up the initial state for
 the SQP iteration. This allows the feedback delay to be significantly less
 than one time step.
 */
-void OptimalControlProblem::initial_constraint(StateVector measurement) {
-    real_t zLow[NMPC_GRADIENT_DIM];
-    Eigen::Map<GradientVector> zLow_map(zLow);
-    real_t zUpp[NMPC_GRADIENT_DIM];
-    Eigen::Map<GradientVector> zUpp_map(zUpp);
-
-    /* Control constraints are unchanged. */
-    zLow_map.segment<NMPC_CONTROL_DIM>(NMPC_DELTA_DIM) =
-        lower_control_bound - control_reference[0];
-    zUpp_map.segment<NMPC_CONTROL_DIM>(NMPC_DELTA_DIM) =
-        upper_control_bound - control_reference[0];
-
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::initial_constraint(
+StateVector measurement) {
     /*
     Initial delta is constrained to be the difference between the measurement
     and the initial state horizon point.
     */
-    DeltaVector initial_delta = state_to_delta(
+    initial_delta = StateSpace::template state_to_delta<real_t>(
         state_reference[0],
         measurement);
-    zLow_map.segment<NMPC_DELTA_DIM>(0) = initial_delta;
-    zUpp_map.segment<NMPC_DELTA_DIM>(0) = initial_delta;
-
-    return_t status_flag = qpDUNES_updateIntervalData(
-        &qp_data, qp_data.intervals[0],
-        0, 0, 0, 0, zLow, zUpp, 0, 0, 0, 0);
-    AssertOK(status_flag);
-
-    qpDUNES_indicateDataChange(&qp_data);
 }
 
-/* Solves the QP using qpDUNES. */
-void OptimalControlProblem::solve_qp() {
-    uint32_t i;
-    real_t solution[NMPC_GRADIENT_DIM*(OCP_HORIZON_LENGTH+1)];
-
-    return_t status_flag = qpDUNES_solve(&qp_data);
-    AssertSolutionFound(status_flag);
-
-    if (status_flag == QPDUNES_SUCC_OPTIMAL_SOLUTION_FOUND) {
-        /* Get the solution. */
-        qpDUNES_getPrimalSol(&qp_data, solution);
+/*
+Solves the QP with the selected backend. If no solution is found, the
+previous controls are left as they are.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::solve_qp() {
+    ControlVector control_delta;
+    QPSolveTimings timings;
 
-        /* Extract the first set of control values */
-        Eigen::Map<GradientVector> solution_map(
-            &solution[0]);
+    if(qp_backend->solve(qp_problem, initial_delta, control_delta)) {
+        control_horizon[0] = control_reference[0] + control_delta;
+    }
 
-        control_horizon[0] =
-            control_reference[0] +
-            solution_map.segment<NMPC_CONTROL_DIM>(NMPC_DELTA_DIM);
+    if(qp_backend->get_solve_timings(timings)) {
+        timing_stats[TIMING_QP_NEWTON_SETUP].record(timings.newton_setup);
+        timing_stats[TIMING_QP_FACTORISATION].record(timings.factorisation);
+        timing_stats[TIMING_QP_LINE_SEARCH].record(timings.line_search);
+        timing_stats[TIMING_QP_STAGE_QPS].record(timings.stage_qps);
     }
 }
 
-/* Copies the reference trajectory into the state and control horizons. */
-void OptimalControlProblem::initialise() {
+/*
+Sets the QP solver up for the configured horizon, and schedules a full
+Jacobian refresh for the first preparation step.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::initialise() {
     initialise_qp();
+    jacobian_refresh_countdown = 0;
+}
+
+/*
+Brings the linearisation of interval i up to date for a preparation step,
+either from the cache or by integrating it again. Intervals below
+refresh_stages (and the final one) get new Jacobians.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::prepare_interval(
+uint32_t i, int32_t refresh_stages) {
+    if(cache_hits[i]) {
+        reuse_linearisation(i);
+    } else if((int32_t)i < refresh_stages || i == horizon_length - 1) {
+        solve_ivps(i);
+    } else {
+        integrate_reference(i);
+    }
 }
 
 /*
 Completes the most computationally intense part of the NMPC iteration; this
 step is independent of the lastest sensor measurements and so can be
 executed as soon as possible after the previous iteration.
+
+Any queued reference points are applied first, then the whole horizon is
+re-linearised around the current (shifted) reference trajectory, and all of
+the interval data is rebuilt, so that the feedback step only has to embed
+the initial value and run the QP solver. Between
+full Jacobian refreshes (see set_jacobian_refresh()), only the first few
+intervals are differentiated, and the rest just have their residuals
+updated.
 */
-void OptimalControlProblem::preparation_step() {
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::preparation_step() {
+    int32_t i, refresh_stages;
+    double start = timing_clock(), split, end;
+
+    set_malloc_allowed(false);
+    drain_references();
+
+    /*
+    Intervals below refresh_stages get new Jacobians; the final interval is
+    always included, since on a uniform grid it holds the Jacobian shifted
+    out of the previous one.
+    */
+    if(jacobian_refresh_countdown == 0) {
+        refresh_stages = (int32_t)horizon_length;
+        jacobian_refresh_countdown = jacobian_refresh_interval - 1;
+    } else {
+        refresh_stages = (int32_t)std::min(jacobian_refresh_stages,
+                                           horizon_length - 1);
+        jacobian_refresh_countdown--;
+    }
+
+    /*
+    The cache lookup stays serial, since it reads the shared cache entries
+    and updates the shared hit and miss counts.
+    */
+    if(cache_tolerance > (real_t)0.0) {
+        for(i = 0; i < (int32_t)horizon_length; i++) {
+            lookup_linearisation(i);
+        }
+    } else {
+        memset(cache_hits, 0, sizeof(bool) * horizon_length);
+    }
+
+    /*
+    The initial value problems for each shooting interval only depend on the
+    reference trajectory, so they can be shared out between worker threads.
+    solve_ivps() keeps all of its integrator scratch on the stack and only
+    writes to the outputs for interval i, and the integrator and dynamics
+    model are not modified, so each stage is calculated with exactly the same
+    operations regardless of the number of threads.
+
+    libgomp allocates a new team for every single-threaded parallel region
+    (larger teams are pooled), so the region is skipped entirely when there's
+    only one preparation thread.
+    */
+#if defined(_OPENMP)
+    if(preparation_threads > 1) {
+        #pragma omp parallel for num_threads(preparation_threads) \
+            schedule(static)
+        for(i = 0; i < (int32_t)horizon_length; i++) {
+            prepare_interval(i, refresh_stages);
+        }
+    } else
+#endif
+    {
+        for(i = 0; i < (int32_t)horizon_length; i++) {
+            prepare_interval(i, refresh_stages);
+        }
+    }
+
+    /*
+    The cache is only updated once all of the intervals are done, since the
+    entries for some intervals may be replaced by others. Intervals which
+    kept their previous Jacobians aren't stored.
+    */
+    if(cache_tolerance > (real_t)0.0) {
+        for(i = 0; i < (int32_t)horizon_length; i++) {
+            if(!cache_hits[i] && (i < refresh_stages ||
+                                  i == (int32_t)horizon_length - 1)) {
+                store_linearisation(i);
+            }
+        }
+    }
+
+    split = timing_clock();
     update_qp();
+    end = timing_clock();
+
+    timing_stats[TIMING_SOLVE_IVPS].record((real_t)(split - start));
+    timing_stats[TIMING_QP_UPDATE].record((real_t)(end - split));
+    timing_stats[TIMING_PREPARATION].record((real_t)(end - start));
+    set_malloc_allowed(true);
 }
 
 /*
@@ -328,72 +703,299 @@ should be executed at the last possible moment with the latest sensor data,
 in order to make the control latency significantly less than the horizon step
 length.
 */
-void OptimalControlProblem::feedback_step(StateVector measurement) {
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::feedback_step(
+StateVector measurement) {
+    double start = timing_clock(), split, end;
+
+    set_malloc_allowed(false);
     initial_constraint(measurement);
+    split = timing_clock();
     solve_qp();
+    end = timing_clock();
+
+    timing_stats[TIMING_INITIAL_CONSTRAINT].record((real_t)(split - start));
+    timing_stats[TIMING_QP_SOLVE].record((real_t)(end - split));
+    timing_stats[TIMING_FEEDBACK].record((real_t)(end - start));
+    set_malloc_allowed(true);
+}
+
+/*
+Shift the horizon across by one base step and add a new point to the end of
+the reference trajectory. The reference is stored on the base grid, so this
+is exact for any interval grid.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::update_horizon(
+ReferenceVector new_reference) {
+    shift_horizon();
+    set_reference_point(new_reference, horizon_steps);
 }
 
 /*
-Shift the horizon across and add a new point to the end of the reference
-trajectory.
+Shift the horizon across by one base step, leaving the last reference point
+where it is; it's normally replaced from the reference queue before the next
+preparation step.
 */
-void OptimalControlProblem::update_horizon(ReferenceVector new_reference) {
-    memmove(state_reference, &state_reference[1],
-            sizeof(StateVector) * OCP_HORIZON_LENGTH);
-    memmove(control_reference, &control_reference[1],
-            sizeof(ControlVector) * (OCP_HORIZON_LENGTH - 1));
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::shift_horizon() {
+    double start = timing_clock();
+
+    set_malloc_allowed(false);
+    reference_step++;
+    std::copy(&state_reference[1], &state_reference[horizon_steps + 1],
+              state_reference);
+    std::copy(&control_reference[1], &control_reference[horizon_steps],
+              control_reference);
 
     /* Prepare the QP for the next solution. */
-    qpDUNES_shiftLambda(&qp_data);
-    qpDUNES_shiftIntervals(&qp_data);
+    qp_backend->shift(qp_problem);
+
+    /*
+    Jacobians which aren't refreshed on the next preparation step need to
+    stay with their intervals; this only works on a uniform grid, where an
+    interval is one base step long.
+    */
+    if(jacobian_refresh_interval > 1 && horizon_steps == horizon_length) {
+        std::copy(&jacobians[1], &jacobians[horizon_length], jacobians);
+    }
 
-    set_reference_point(new_reference, OCP_HORIZON_LENGTH);
+    timing_stats[TIMING_UPDATE_HORIZON].record(
+        (real_t)(timing_clock() - start));
+    set_malloc_allowed(true);
 }
 
-void OptimalControlProblem::set_reference_point(const ReferenceVector &in,
-uint32_t i) {
-    state_reference[i] = in.segment<NMPC_STATE_DIM>(0);
+/* Clears the latency statistics of every phase. */
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::reset_timing_stats() {
+    uint32_t i;
+
+    for(i = 0; i < TIMING_PHASES; i++) {
+        timing_stats[i].reset();
+    }
+}
+
+/*
+Sets reference point i of the horizon, where i is an index into the base
+grid of horizon_steps + 1 points spaced step_length apart. Point i holds the
+state reference for base step i, and the control reference for the base step
+leading up to it. The linearisation is deferred until the next preparation
+step.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::set_reference_point(
+const ReferenceVector &in, uint32_t i) {
+    assert(i <= horizon_steps);
 
-    if(i > 0 && i <= OCP_HORIZON_LENGTH) {
+    state_reference[i] = in.template segment<STATE_DIM>(0);
+
+    if(i > 0 && i <= horizon_steps) {
         control_reference[i-1] =
-            in.segment<NMPC_CONTROL_DIM>(NMPC_STATE_DIM);
+            in.template segment<CONTROL_DIM>(STATE_DIM);
+    }
+}
+
+/*
+Sets reference points 0 to n - 1 from n consecutive reference vectors, such
+as a whole new trajectory from a mission planner. Jacobians kept from the
+old trajectory won't be anywhere near the new one, so the next preparation
+step refreshes all of them; it linearises the whole horizon in one pass
+either way.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::set_reference_horizon(
+const real_t *in, uint32_t n) {
+    uint32_t i;
 
-        solve_ivps(i-1);
+    assert(in && n > 0 && n <= horizon_steps + 1);
 
-        real_t g[NMPC_GRADIENT_DIM];
-        Eigen::Map<GradientVector> g_map(g);
-        real_t C[(NMPC_STATE_DIM-1)*NMPC_GRADIENT_DIM];
-        Eigen::Map<ContinuityConstraintMatrix> C_map(C);
-        real_t c[NMPC_DELTA_DIM];
-        Eigen::Map<DeltaVector> c_map(c);
-        real_t zLow[NMPC_GRADIENT_DIM];
-        Eigen::Map<GradientVector> zLow_map(zLow);
-        real_t zUpp[NMPC_GRADIENT_DIM];
-        Eigen::Map<GradientVector> zUpp_map(zUpp);
+    for(i = 0; i < n; i++) {
+        set_reference_point(
+            Eigen::Map<const ReferenceVector>(&in[i * REFERENCE_DIM]), i);
+    }
 
-        zLow_map.segment<NMPC_DELTA_DIM>(0) = lower_state_bound;
-        zUpp_map.segment<NMPC_DELTA_DIM>(0) = upper_state_bound;
+    jacobian_refresh_countdown = 0;
+}
+
+/*
+Queues a reference point for base step `step` of the trajectory, counted
+from when the OCP was created (see get_reference_step()). This is the only
+method which may be called from another thread while the OCP is running,
+and only one thread may call it; it never blocks, and returns false if the
+queue is full.
+*/
+template <class StateSpace, class IntegratorType>
+bool OptimalControlProblem<StateSpace, IntegratorType>::queue_reference_point(
+const ReferenceVector &in, uint32_t step) {
+    QueuedReference queued;
+
+    queued.point = in;
+    queued.step = step;
+    return reference_queue.push(queued);
+}
+
+/*
+Applies the queued reference points to the horizon, in the order they were
+queued. Points for steps which have already been shifted out of the horizon
+are dropped, and the first point beyond the end of the horizon stays queued
+until the horizon reaches it, along with everything queued after it.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::drain_references() {
+    const QueuedReference *queued;
 
-        return_t status_flag;
+    while((queued = reference_queue.front()) != NULL) {
+        if(queued->step >= reference_step) {
+            if(queued->step - reference_step > horizon_steps) {
+                break;
+            }
 
-        /* Gradient vector fixed to zero. */
-        g_map = GradientVector::Zero();
+            set_reference_point(queued->point, queued->step - reference_step);
+        }
 
-        /* Continuity constraint constant term fixed to zero. */
-        c_map = integration_residuals[i-1];
+        reference_queue.pop();
+    }
+}
 
-        /* Copy the relevant data into the qpDUNES arrays. */
-        C_map = jacobians[i-1];
-        zLow_map.segment<NMPC_CONTROL_DIM>(NMPC_DELTA_DIM) =
-            lower_control_bound - control_reference[i-1];
-        zUpp_map.segment<NMPC_CONTROL_DIM>(NMPC_DELTA_DIM) =
-            upper_control_bound - control_reference[i-1];
+/*
+Sets the number of steps in the horizon, with each interval one base step
+long. Storage is allocated for OCP_MAX_HORIZON_LENGTH steps, so this doesn't
+allocate; however, the QP structure depends on the horizon length, so
+initialise() must be called before the next preparation step. The reference
+trajectory must be set for all horizon_length + 1 points.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::set_horizon_length(
+uint32_t in) {
+    uint32_t i;
 
-        status_flag = qpDUNES_updateIntervalData(
-            &qp_data, qp_data.intervals[i-1],
-            0, g, C, c, zLow, zUpp, 0, 0, 0, 0);
-        AssertOK(status_flag);
+    assert(in > 0 && in <= OCP_MAX_HORIZON_LENGTH &&
+           in <= OCP_MAX_HORIZON_STEPS);
 
-        qpDUNES_indicateDataChange(&qp_data);
+    for(i = 0; i < in; i++) {
+        interval_steps[i] = 1;
+        interval_offset[i] = i;
     }
+
+    interval_offset[in] = in;
+    horizon_length = in;
+    horizon_steps = in;
+    move_blocking = false;
 }
+
+/*
+Sets a non-uniform interval grid, where interval i covers steps[i] base
+steps of step_length each. This allows fine steps at the start of the
+horizon followed by coarser steps further out. The reference trajectory
+remains on the base grid, so it must be set for all horizon_steps + 1
+points, where horizon_steps is the sum of the interval steps. As for
+set_horizon_length(), initialise() must be called afterwards.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::set_horizon_grid(
+const uint32_t *steps, uint32_t length) {
+    uint32_t i;
+
+    assert(steps);
+    assert(length > 0 && length <= OCP_MAX_HORIZON_LENGTH);
+
+    interval_offset[0] = 0;
+    for(i = 0; i < length; i++) {
+        assert(steps[i] > 0);
+        interval_steps[i] = steps[i];
+        interval_offset[i+1] = interval_offset[i] + steps[i];
+    }
+
+    assert(interval_offset[length] <= OCP_MAX_HORIZON_STEPS);
+    horizon_length = length;
+    horizon_steps = interval_offset[length];
+    move_blocking = false;
+}
+
+/*
+Sets up move blocking, where the horizon is divided into `length` blocks and
+block i holds a single control input for blocks[i] base steps. Each block is
+one QP stage, so this reduces the number of QP variables and control
+Jacobian columns, but unlike a coarse grid the dynamics are still integrated
+with the base step length. The reference trajectory remains on the base
+grid, and initialise() must be called afterwards.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::set_move_blocking(
+const uint32_t *blocks, uint32_t length) {
+    set_horizon_grid(blocks, length);
+    move_blocking = true;
+}
+
+/*
+Sets the control step length (seconds). Only the IVPs depend on this, so the
+new value is used from the next preparation step onwards.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::set_step_length(
+real_t in) {
+    assert(in > (real_t)0.0);
+    step_length = in;
+    clear_linearisation_cache();
+}
+
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::
+set_integration_substeps(uint32_t in) {
+    assert(in > 0);
+    integration_substeps = in;
+    clear_linearisation_cache();
+}
+
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::
+set_integration_tolerance(real_t in) {
+    assert(in >= (real_t)0.0);
+    integration_tolerance = in;
+    clear_linearisation_cache();
+}
+
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::
+set_linearisation_cache_tolerance(real_t in) {
+    assert(in >= (real_t)0.0);
+    cache_tolerance = in;
+    clear_linearisation_cache();
+}
+
+/*
+Invalidates every entry of the linearisation cache, and makes the next
+preparation step recalculate all of the Jacobians. This happens whenever a
+setting which affects the linearisation changes, but must be called after
+changing any of the dynamics model's parameters other than the wind
+velocity.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::
+clear_linearisation_cache() {
+    uint32_t i;
+
+    for(i = 0; i < OCP_LINEARISATION_CACHE_SIZE; i++) {
+        linearisation_cache[i].valid = false;
+    }
+
+    jacobian_refresh_countdown = 0;
+}
+
+/*
+Sets the Jacobian refresh schedule: every interval's Jacobian is
+recalculated on every interval'th preparation step, and the first stages
+intervals' on every step. The next preparation step refreshes all of
+them.
+*/
+template <class StateSpace, class IntegratorType>
+void OptimalControlProblem<StateSpace, IntegratorType>::set_jacobian_refresh(
+uint32_t interval, uint32_t stages) {
+    assert(interval > 0);
+    jacobian_refresh_interval = interval;
+    jacobian_refresh_stages = stages;
+    jacobian_refresh_countdown = 0;
+}
+
+template class OptimalControlProblem<X8StateSpace>;
+template class OptimalControlProblem<LongitudinalStateSpace>;
@@ -0,0 +1,106 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <cstring>
+
+#include "types.h"
+#include "qp.h"
+
+/*
+Sizes the condensing workspace and the dense QP. All of the allocation
+happens here, so the preparation and feedback steps don't allocate.
+*/
+template <class Types>
+void DenseQPBackend<Types>::initialise(const QPData &qp) {
+    uint32_t n = CONTROL_DIM * qp.horizon_length;
+
+    stage_hessian.resize(DELTA_DIM + n, DELTA_DIM + n);
+    stage_continuity.resize(DELTA_DIM, DELTA_DIM + n);
+    stage_gradient.resize(DELTA_DIM + n);
+    stage_residual = DeltaVector::Zero();
+
+    dense_qp.resize(n);
+    dense_hessian.resize(n, n);
+    dense_gradient.resize(n);
+    dense_lower_bound.resize(n);
+    dense_upper_bound.resize(n);
+    dense_solution = VectorXr::Zero(n);
+}
+
+/*
+Condenses the whole horizon, including the terminal weights, into a dense QP
+in the controls. The part of the gradient which depends on the initial delta
+is added in solve().
+*/
+template <class Types>
+void DenseQPBackend<Types>::update(const QPData &qp) {
+    uint32_t i, n = CONTROL_DIM * qp.horizon_length;
+
+    condenser.condense(
+        qp.jacobians, qp.integration_residuals, qp.interval_steps,
+        qp.horizon_length, *qp.state_weights, *qp.control_weights,
+        qp.terminal_weights, stage_hessian, stage_gradient,
+        stage_continuity, stage_residual);
+
+    dense_hessian = stage_hessian.bottomRightCorner(n, n);
+    for(i = 0; i < qp.horizon_length; i++) {
+        dense_lower_bound.segment<CONTROL_DIM>(CONTROL_DIM * i) =
+            qp.lower_control_bound[i];
+        dense_upper_bound.segment<CONTROL_DIM>(CONTROL_DIM * i) =
+            qp.upper_control_bound[i];
+    }
+}
+
+/*
+A fully condensed QP only depends on the initial delta through its
+gradient.
+*/
+template <class Types>
+bool DenseQPBackend<Types>::solve(const QPData &qp,
+const DeltaVector &initial_delta, ControlVector &control_delta) {
+    uint32_t n = CONTROL_DIM * qp.horizon_length;
+
+    dense_gradient = stage_gradient.tail(n);
+    dense_gradient.noalias() +=
+        stage_hessian.bottomLeftCorner(n, DELTA_DIM) * initial_delta;
+
+    if(!dense_qp.solve(dense_hessian, dense_gradient, dense_lower_bound,
+                       dense_upper_bound, dense_solution)) {
+        return false;
+    }
+
+    control_delta = dense_solution.segment<CONTROL_DIM>(0);
+    return true;
+}
+
+/* Warm-start the dense solver from the shifted previous solution. */
+template <class Types>
+void DenseQPBackend<Types>::shift(const QPData &qp) {
+    if(qp.horizon_steps == qp.horizon_length) {
+        memmove(dense_solution.data(),
+                dense_solution.data() + CONTROL_DIM,
+                sizeof(real_t) * CONTROL_DIM * (qp.horizon_length - 1));
+    }
+}
+
+template class DenseQPBackend<NMPCTypes>;
+template class DenseQPBackend<LongitudinalTypes>;
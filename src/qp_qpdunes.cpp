@@ -0,0 +1,561 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+extern "C"
+{
+    #include <qpDUNES.h>
+}
+
+#include "types.h"
+#include "qp.h"
+#include "timing.h"
+#include "debug.h"
+
+template <class Types>
+QPDUNESBackend<Types>::QPDUNESBackend() {
+    qp_allocated = false;
+    block_size = 0;
+    qp_stages = 0;
+
+    qp_options = qpDUNES_setupDefaultOptions();
+    qp_options.maxIter = 5;
+    qp_options.printLevel = 0;
+    qp_options.stationarityTolerance = 1e-3;
+}
+
+template <class Types>
+QPDUNESBackend<Types>::~QPDUNESBackend() {
+    if(qp_allocated) {
+        qpDUNES_cleanup(&qp_data);
+    }
+}
+
+/* Returns the workspace, aligned to the next cache line boundary. */
+template <class Types>
+typename QPDUNESBackend<Types>::Workspace *QPDUNESBackend<Types>::workspace() {
+    uintptr_t address = (uintptr_t)workspace_data;
+
+    address = (address + OCP_CACHE_LINE_SIZE - 1) &
+        ~(uintptr_t)(OCP_CACHE_LINE_SIZE - 1);
+    return (Workspace *)address;
+}
+
+/*
+Set up a qpDUNES interval with static allocation -- refer to
+qpDUNES_allocInterval in qpDUNES/setup_qp.c.
+*/
+template <class Types>
+void QPDUNESBackend<Types>::setup_static_interval(IntervalWorkspace *rec,
+uint32_t nV) {
+    interval_t *i = &rec->interval;
+
+    i->nD = 0;
+    i->nV = nV;
+
+    i->H.data = rec->H_data;
+    i->H.sparsityType = QPDUNES_MATRIX_UNDEFINED;
+    i->cholH.data = rec->cholH_data;
+    i->cholH.sparsityType = QPDUNES_MATRIX_UNDEFINED;
+
+    i->g.data = rec->g_data;
+    i->q.data = rec->q_data;
+
+    i->C.data = rec->C_data;
+    i->C.sparsityType = QPDUNES_MATRIX_UNDEFINED;
+    i->c.data = rec->c_data;
+
+    i->zLow.data = rec->zLow_data;
+    i->zUpp.data = rec->zUpp_data;
+
+    i->D.data = rec->D_data;
+    i->D.sparsityType = QPDUNES_MATRIX_UNDEFINED;
+    i->dLow.data = rec->dLow_data;
+    i->dUpp.data = rec->dUpp_data;
+
+    i->z.data = rec->z_data;
+    i->y.data = rec->y_data;
+
+    i->lambdaK.data = rec->lambdaK_data;
+    i->lambdaK.isDefined = QPDUNES_TRUE;
+    i->lambdaK1.data = rec->lambdaK1_data;
+    i->lambdaK1.isDefined = QPDUNES_TRUE;
+
+    i->qpSolverClipping.qStep.data = rec->clippingSolver_qStep_data;
+    i->qpSolverClipping.zUnconstrained.data =
+        rec->clippingSolver_zUnconstrained_data;
+    i->qpSolverClipping.dz.data = rec->clippingSolver_dz_data;
+    i->qpSolverSpecification = QPDUNES_STAGE_QP_SOLVER_UNDEFINED;
+
+    i->qpSolverQpoases.qpoasesObject = NULL;
+    i->qpSolverQpoases.qFullStep.data = NULL;
+
+    /* Allocated per interval by qpDUNES_setup(). */
+    i->xVecTmp.data = rec->xVecTmp_data;
+    i->uVecTmp.data = rec->uVecTmp_data;
+    i->zVecTmp.data = rec->zVecTmp_data;
+}
+
+/*
+Set up qp_data in the workspace; equivalent to:
+    qpDUNES_setup(
+        &qp_data, horizon_length, DELTA_DIM, CONTROL_DIM, 0, &qp_options);
+*/
+template <class Types>
+void QPDUNESBackend<Types>::setup_static_qp(uint32_t horizon_length) {
+    uint32_t i;
+    Workspace *ws = workspace();
+
+    assert(horizon_length > 0 && horizon_length <= OCP_MAX_HORIZON_LENGTH);
+
+    /*
+    Clear out any multipliers and workspace left over from a previous
+    initialisation, so that the solver always starts from the same point.
+    */
+    memset(ws, 0, sizeof(Workspace));
+    memset(&qp_data, 0, sizeof(qp_data));
+
+    qp_data.options = qp_options;
+    qp_data.nI = horizon_length;
+    qp_data.nX = DELTA_DIM;
+    qp_data.nU = CONTROL_DIM;
+    qp_data.nZ = GRADIENT_DIM;
+    qp_data.nDttl = 0;
+
+    qp_data.intervals = ws->intervals_data;
+    for(i = 0; i < horizon_length + 1; i++) {
+        qp_data.intervals[i] = &ws->interval_recs[i].interval;
+        qp_data.intervals[i]->id = i;
+
+        setup_static_interval(
+            &ws->interval_recs[i],
+            i < horizon_length ? GRADIENT_DIM : DELTA_DIM);
+    }
+
+    /* Last interval doesn't need a Jacobian. */
+    qpDUNES_setMatrixNull(&qp_data.intervals[horizon_length]->C);
+
+    qp_data.intervals[0]->lambdaK.isDefined = QPDUNES_FALSE;
+    qp_data.intervals[horizon_length]->lambdaK1.isDefined = QPDUNES_FALSE;
+
+    qp_data.lambda.data = ws->lambda_data;
+    qp_data.deltaLambda.data = ws->deltaLambda_data;
+
+    qp_data.hessian.data = ws->hessian_data;
+    qp_data.cholHessian.data = ws->cholHessian_data;
+    qp_data.gradient.data = ws->gradient_data;
+
+    qp_data.xVecTmp.data = ws->xVecTmp_data;
+    qp_data.uVecTmp.data = ws->uVecTmp_data;
+    qp_data.zVecTmp.data = ws->zVecTmp_data;
+    qp_data.xnVecTmp.data = ws->xnVecTmp_data;
+    qp_data.xnVecTmp2.data = ws->xnVecTmp2_data;
+    qp_data.xxMatTmp.data = ws->xxMatTmp_data;
+    qp_data.xxMatTmp2.data = ws->xxMatTmp2_data;
+    qp_data.xzMatTmp.data = ws->xzMatTmp_data;
+    qp_data.uxMatTmp.data = ws->uxMatTmp_data;
+    qp_data.zxMatTmp.data = ws->zxMatTmp_data;
+    qp_data.zzMatTmp.data = ws->zzMatTmp_data;
+    qp_data.zzMatTmp2.data = ws->zzMatTmp2_data;
+
+    qp_data.optObjVal = -qp_data.options.QPDUNES_INFTY;
+
+    qp_data.log.itLog = &ws->itLog_data;
+    qp_data.log.itLog[0].ieqStatus = ws->ieqStatus_data;
+    qp_data.log.itLog[0].prevIeqStatus = ws->prevIeqStatus_data;
+    for(i = 0; i < horizon_length + 1; i++) {
+        qp_data.log.itLog[0].ieqStatus[i] =
+            &ws->ieqStatus_n_data[i * GRADIENT_DIM];
+        qp_data.log.itLog[0].prevIeqStatus[i] =
+            &ws->prevIeqStatus_n_data[i * GRADIENT_DIM];
+    }
+
+    qpDUNES_indicateDataChange(&qp_data);
+}
+
+/*
+Uses all of the information calculated so far to set up the various qpDUNES
+datastructures in preparation for the feedback step.
+This is really inefficient right now – there's heaps of probably unnecessary
+copying going on.
+*/
+template <class Types>
+void QPDUNESBackend<Types>::initialise(const QPData &qp) {
+    uint32_t i;
+    real_t Q[DELTA_DIM*DELTA_DIM];
+    Eigen::Map<StateWeightMatrix> Q_map(Q);
+    real_t R[CONTROL_DIM*CONTROL_DIM];
+    Eigen::Map<ControlWeightMatrix> R_map(R);
+    real_t P[DELTA_DIM*DELTA_DIM];
+    Eigen::Map<StateWeightMatrix> P_map(P);
+    real_t g[GRADIENT_DIM];
+    Eigen::Map<GradientVector> g_map(g);
+    real_t C[DELTA_DIM*GRADIENT_DIM];
+    Eigen::Map<ContinuityConstraintMatrix> C_map(C);
+    real_t c[DELTA_DIM];
+    Eigen::Map<DeltaVector> c_map(c);
+    real_t zLow[GRADIENT_DIM];
+    Eigen::Map<GradientVector> zLow_map(zLow);
+    real_t zUpp[GRADIENT_DIM];
+    Eigen::Map<GradientVector> zUpp_map(zUpp);
+
+    zLow_map.template segment<DELTA_DIM>(0) = *qp.lower_state_bound;
+    zUpp_map.template segment<DELTA_DIM>(0) = *qp.upper_state_bound;
+
+    /*
+    Release the previous QP if the problem is being re-initialised with
+    partial condensing, since the horizon length may have changed.
+    */
+    if(qp_allocated) {
+        qpDUNES_cleanup(&qp_data);
+        qp_allocated = false;
+    }
+
+    if(block_size > 0) {
+        initialise_condensed(qp);
+        return;
+    }
+
+    qp_stages = qp.horizon_length;
+    qp_solution.resize(GRADIENT_DIM * qp.horizon_length + DELTA_DIM);
+
+    /* Set up problem dimensions. */
+    /* TODO: Determine number of affine constraints (D), and add them. */
+    setup_static_qp(qp.horizon_length);
+
+    return_t status_flag;
+
+    /* Gradient vector fixed to zero. */
+    g_map = GradientVector::Zero();
+
+    /* Continuity constraint constant term fixed to zero. */
+    c_map = DeltaVector::Zero();
+
+    /* Zero Jacobians for now */
+    C_map = ContinuityConstraintMatrix::Zero();
+
+    for(i = 0; i < qp.horizon_length; i++) {
+        /* Copy the relevant data into the qpDUNES arrays. */
+        zLow_map.template segment<CONTROL_DIM>(DELTA_DIM) =
+            qp.lower_control_bound[i];
+        zUpp_map.template segment<CONTROL_DIM>(DELTA_DIM) =
+            qp.upper_control_bound[i];
+
+        /*
+        Scale the stage weights by the number of base steps the interval
+        covers, so that coarse intervals are weighted according to the
+        length of time they represent.
+        */
+        Q_map = *qp.state_weights * (real_t)qp.interval_steps[i];
+        R_map = *qp.control_weights * (real_t)qp.interval_steps[i];
+
+        status_flag = qpDUNES_setupRegularInterval(
+            &qp_data, qp_data.intervals[i],
+            0, Q, R, 0, g, C, 0, 0, c, zLow, zUpp, 0, 0, 0, 0, 0, 0, 0);
+        AssertOK(status_flag);
+    }
+
+    /* Set up final interval. */
+    P_map = *qp.terminal_weights;
+    status_flag = qpDUNES_setupFinalInterval(&qp_data, qp_data.intervals[i],
+        P, g, zLow, zUpp, 0, 0, 0);
+    AssertOK(status_flag);
+
+    qpDUNES_setupAllLocalQPs(&qp_data, QPDUNES_FALSE);
+
+    qpDUNES_indicateDataChange(&qp_data);
+}
+
+/*
+Updates the QP with the latest linearisations. Every interval's gradient,
+continuity constraint and bounds are rewritten, and since a gradient is
+passed in, qpDUNES also re-runs the stage QP setup for each interval (solving
+the unconstrained stage QPs with the current multiplier guess). That leaves
+only the initial value embedding and the Newton iterations for the feedback
+step.
+*/
+template <class Types>
+void QPDUNESBackend<Types>::update(const QPData &qp) {
+    uint32_t i;
+    real_t g[GRADIENT_DIM];
+    Eigen::Map<GradientVector> g_map(g);
+    real_t C[DELTA_DIM*GRADIENT_DIM];
+    Eigen::Map<ContinuityConstraintMatrix> C_map(C);
+    real_t c[DELTA_DIM];
+    Eigen::Map<DeltaVector> c_map(c);
+    real_t zLow[GRADIENT_DIM];
+    Eigen::Map<GradientVector> zLow_map(zLow);
+    real_t zUpp[GRADIENT_DIM];
+    Eigen::Map<GradientVector> zUpp_map(zUpp);
+    return_t status_flag;
+
+    if(block_size > 0) {
+        update_condensed(qp);
+        return;
+    }
+
+    /* Gradient vector fixed to zero. */
+    g_map = GradientVector::Zero();
+
+    zLow_map.template segment<DELTA_DIM>(0) = *qp.lower_state_bound;
+    zUpp_map.template segment<DELTA_DIM>(0) = *qp.upper_state_bound;
+
+    for(i = 0; i < qp.horizon_length; i++) {
+        /* Copy the relevant data into the qpDUNES arrays. */
+        C_map = qp.jacobians[i];
+        c_map = qp.integration_residuals[i];
+        zLow_map.template segment<CONTROL_DIM>(DELTA_DIM) =
+            qp.lower_control_bound[i];
+        zUpp_map.template segment<CONTROL_DIM>(DELTA_DIM) =
+            qp.upper_control_bound[i];
+
+        status_flag = qpDUNES_updateIntervalData(
+            &qp_data, qp_data.intervals[i],
+            0, g, C, c, zLow, zUpp, 0, 0, 0, 0);
+        AssertOK(status_flag);
+    }
+
+    /* The continuity constraints have changed, so the Newton Hessian must be
+    refactorised on the next solve. */
+    qpDUNES_indicateDataChange(&qp_data);
+}
+
+/*
+Sets the stage bounds for a condensed stage starting at interval `first` and
+covering n intervals. Any padding controls in a short final block are fixed
+at zero.
+*/
+template <class Types>
+void QPDUNESBackend<Types>::condensed_stage_bounds(const QPData &qp,
+uint32_t first, uint32_t n) {
+    uint32_t i;
+
+    stage_lower_bound.setZero();
+    stage_upper_bound.setZero();
+    stage_lower_bound.segment<DELTA_DIM>(0) = *qp.lower_state_bound;
+    stage_upper_bound.segment<DELTA_DIM>(0) = *qp.upper_state_bound;
+
+    for(i = 0; i < n; i++) {
+        stage_lower_bound.segment<CONTROL_DIM>(
+            DELTA_DIM + CONTROL_DIM * i) =
+            qp.lower_control_bound[first + i];
+        stage_upper_bound.segment<CONTROL_DIM>(
+            DELTA_DIM + CONTROL_DIM * i) =
+            qp.upper_control_bound[first + i];
+    }
+}
+
+/*
+Sizes the condensing workspace and sets up qpDUNES with one stage per block.
+All of the allocation happens here, so the preparation and feedback steps
+don't allocate.
+*/
+template <class Types>
+void QPDUNESBackend<Types>::initialise_condensed(const QPData &qp) {
+    uint32_t i, j, first, n;
+    uint32_t block = std::min(block_size, qp.horizon_length);
+    uint32_t nz = DELTA_DIM + CONTROL_DIM * block;
+    real_t P[DELTA_DIM*DELTA_DIM];
+    Eigen::Map<StateWeightMatrix> P_map(P);
+    return_t status_flag;
+
+    qp_stages = (qp.horizon_length + block - 1) / block;
+
+    stage_hessian.resize(nz, nz);
+    stage_continuity.resize(DELTA_DIM, nz);
+    stage_gradient.resize(nz);
+    stage_lower_bound.resize(nz);
+    stage_upper_bound.resize(nz);
+    stage_residual = DeltaVector::Zero();
+
+    qpDUNES_setup(
+        &qp_data,
+        qp_stages,
+        DELTA_DIM,
+        CONTROL_DIM * block,
+        0,
+        &qp_options);
+    qp_solution.resize(nz * qp_stages + DELTA_DIM);
+
+    /*
+    There are no linearisations until the first preparation step, so each
+    stage starts out with just its weights. Once the blocks are condensed
+    the stage Hessians are dense, so qpDUNES is told so up front rather than
+    detecting a diagonal Hessian here; this requires a qpDUNES build with
+    the qpOASES stage QP solver.
+    */
+    stage_continuity.setZero();
+    stage_gradient.setZero();
+
+    for(i = 0; i < qp_stages; i++) {
+        first = i * block;
+        n = std::min(block, qp.horizon_length - first);
+
+        stage_hessian.setIdentity();
+        stage_hessian.block<DELTA_DIM, DELTA_DIM>(0, 0) =
+            *qp.state_weights * (real_t)qp.interval_steps[first];
+        for(j = 0; j < n; j++) {
+            stage_hessian.block<CONTROL_DIM, CONTROL_DIM>(
+                DELTA_DIM + CONTROL_DIM * j,
+                DELTA_DIM + CONTROL_DIM * j) =
+                *qp.control_weights * (real_t)qp.interval_steps[first + j];
+        }
+
+        condensed_stage_bounds(qp, first, n);
+
+        qp_data.intervals[i]->H.sparsityType = QPDUNES_DENSE;
+        status_flag = qpDUNES_setupRegularInterval(
+            &qp_data, qp_data.intervals[i],
+            stage_hessian.data(), 0, 0, 0, stage_gradient.data(),
+            stage_continuity.data(), 0, 0, stage_residual.data(),
+            stage_lower_bound.data(), stage_upper_bound.data(),
+            0, 0, 0, 0, 0, 0, 0);
+        AssertOK(status_flag);
+    }
+
+    /* Set up final interval. */
+    P_map = *qp.terminal_weights;
+    status_flag = qpDUNES_setupFinalInterval(
+        &qp_data, qp_data.intervals[qp_stages], P, stage_gradient.data(),
+        stage_lower_bound.data(), stage_upper_bound.data(), 0, 0, 0);
+    AssertOK(status_flag);
+
+    qpDUNES_setupAllLocalQPs(&qp_data, QPDUNES_FALSE);
+
+    qpDUNES_indicateDataChange(&qp_data);
+
+    qp_allocated = true;
+}
+
+/* Condenses each block and copies it into its qpDUNES stage. */
+template <class Types>
+void QPDUNESBackend<Types>::update_condensed(const QPData &qp) {
+    uint32_t i, first, n;
+    uint32_t block = std::min(block_size, qp.horizon_length);
+    return_t status_flag;
+
+    for(i = 0; i < qp_stages; i++) {
+        first = i * block;
+        n = std::min(block, qp.horizon_length - first);
+
+        /* Pad a short final block with fixed, unit-weighted controls. */
+        if(n < block) {
+            stage_hessian.setIdentity();
+            stage_gradient.setZero();
+            stage_continuity.setZero();
+        }
+
+        condenser.condense(
+            &qp.jacobians[first], &qp.integration_residuals[first],
+            &qp.interval_steps[first], n, *qp.state_weights,
+            *qp.control_weights, 0, stage_hessian, stage_gradient,
+            stage_continuity, stage_residual);
+        condensed_stage_bounds(qp, first, n);
+
+        status_flag = qpDUNES_updateIntervalData(
+            &qp_data, qp_data.intervals[i],
+            stage_hessian.data(), stage_gradient.data(),
+            stage_continuity.data(), stage_residual.data(),
+            stage_lower_bound.data(), stage_upper_bound.data(),
+            0, 0, 0, 0);
+        AssertOK(status_flag);
+    }
+
+    qpDUNES_indicateDataChange(&qp_data);
+}
+
+/*
+Fixes the state delta of the first stage to the initial delta, and solves
+the QP. With partial condensing, the first stage covers several intervals'
+worth of controls.
+*/
+template <class Types>
+bool QPDUNESBackend<Types>::solve(const QPData &qp,
+const DeltaVector &initial_delta, ControlVector &control_delta) {
+    real_t zLow[GRADIENT_DIM];
+    Eigen::Map<GradientVector> zLow_map(zLow);
+    real_t zUpp[GRADIENT_DIM];
+    Eigen::Map<GradientVector> zUpp_map(zUpp);
+    return_t status_flag;
+
+    if(block_size > 0) {
+        condensed_stage_bounds(
+            qp, 0, std::min(block_size, qp.horizon_length));
+        stage_lower_bound.segment<DELTA_DIM>(0) = initial_delta;
+        stage_upper_bound.segment<DELTA_DIM>(0) = initial_delta;
+
+        status_flag = qpDUNES_updateIntervalData(
+            &qp_data, qp_data.intervals[0],
+            0, 0, 0, 0, stage_lower_bound.data(), stage_upper_bound.data(),
+            0, 0, 0, 0);
+        AssertOK(status_flag);
+    } else {
+        /* Control constraints are unchanged. */
+        zLow_map.template segment<CONTROL_DIM>(DELTA_DIM) =
+            qp.lower_control_bound[0];
+        zUpp_map.template segment<CONTROL_DIM>(DELTA_DIM) =
+            qp.upper_control_bound[0];
+
+        zLow_map.template segment<DELTA_DIM>(0) = initial_delta;
+        zUpp_map.template segment<DELTA_DIM>(0) = initial_delta;
+
+        status_flag = qpDUNES_updateIntervalData(
+            &qp_data, qp_data.intervals[0],
+            0, 0, 0, 0, zLow, zUpp, 0, 0, 0, 0);
+        AssertOK(status_flag);
+    }
+
+    qpDUNES_indicateDataChange(&qp_data);
+
+    status_flag = qpDUNES_solve(&qp_data);
+    AssertSolutionFound(status_flag);
+
+    if (status_flag != QPDUNES_SUCC_OPTIMAL_SOLUTION_FOUND) {
+        return false;
+    }
+
+    /* Get the solution, and extract the first set of control values. */
+    qpDUNES_getPrimalSol(&qp_data, qp_solution.data());
+    control_delta = qp_solution.segment<CONTROL_DIM>(DELTA_DIM);
+
+    return true;
+}
+
+/*
+The multipliers and interval data can only be shifted if each interval is
+one base step long; otherwise the previous multipliers are kept as they are,
+since each interval still covers roughly the same part of the horizon.
+*/
+template <class Types>
+void QPDUNESBackend<Types>::shift(const QPData &qp) {
+    if(qp.horizon_steps == qp.horizon_length && block_size == 0) {
+        qpDUNES_shiftLambda(&qp_data);
+        qpDUNES_shiftIntervals(&qp_data);
+    }
+}
+
+template class QPDUNESBackend<NMPCTypes>;
+template class QPDUNESBackend<LongitudinalTypes>;
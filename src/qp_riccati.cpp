@@ -0,0 +1,327 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#include "types.h"
+#include "qp.h"
+
+/* Starts from zero control deltas, with all of the controls free. */
+template <class Types>
+void RiccatiQPBackend<Types>::initialise(const QPData &qp) {
+    uint32_t i;
+
+    assert(qp.horizon_length > 0 &&
+           qp.horizon_length <= OCP_MAX_HORIZON_LENGTH);
+
+    for(i = 0; i < qp.horizon_length; i++) {
+        controls[i] = ControlVector::Zero();
+        free_mask[i] = ControlVector::Ones();
+    }
+
+    factorised = false;
+}
+
+/*
+Factorises the new linearisation with the active set of the previous
+solution, so that unless the active set changes, the feedback step only
+needs the vector recursion.
+*/
+template <class Types>
+void RiccatiQPBackend<Types>::update(const QPData &qp) {
+    factorise(qp);
+}
+
+/*
+Backward Riccati recursion for the cost-to-go Hessians P_k and feedback
+gains K_k, with the controls fixed by free_mask taken out of each stage.
+Rather than working with a different number of controls in each stage, the
+fixed controls' columns of B_k are zeroed and their rows and columns of the
+control Hessian are replaced by the identity, which gives them zero gains.
+
+    H_k = R_k + B_k' P_{k+1} B_k
+    K_k = -H_k^-1 B_k' P_{k+1} A_k
+    P_k = Q_k + A_k' P_{k+1} A_k + (B_k' P_{k+1} A_k)' K_k
+*/
+template <class Types>
+bool RiccatiQPBackend<Types>::factorise(const QPData &qp) {
+    uint32_t k;
+    real_t scale;
+    Eigen::Matrix<real_t, DELTA_DIM, CONTROL_DIM> B;
+    GainMatrix BtP, G;
+    ControlWeightMatrix H;
+    StateWeightMatrix PA;
+
+    cost_to_go[qp.horizon_length] = *qp.terminal_weights;
+
+    for(k = qp.horizon_length; k-- > 0;) {
+        const ContinuityConstraintMatrix &jacobian = qp.jacobians[k];
+        const StateWeightMatrix &P = cost_to_go[k+1];
+        scale = (real_t)qp.interval_steps[k];
+
+        B = jacobian.template rightCols<CONTROL_DIM>() *
+            free_mask[k].asDiagonal();
+        BtP.noalias() = B.transpose() * P;
+
+        H = (*qp.control_weights * scale).cwiseProduct(
+            free_mask[k] * free_mask[k].transpose());
+        H.noalias() += BtP * B;
+        H.diagonal() += ControlVector::Ones() - free_mask[k];
+        control_hessians[k].compute(H);
+        if(control_hessians[k].info() != Eigen::Success) {
+            factorised = false;
+            return false;
+        }
+
+        G.noalias() = BtP * jacobian.template leftCols<DELTA_DIM>();
+        gains[k] = -control_hessians[k].solve(G);
+
+        PA.noalias() = P * jacobian.template leftCols<DELTA_DIM>();
+        cost_to_go[k] = *qp.state_weights * scale;
+        cost_to_go[k].noalias() +=
+            jacobian.template leftCols<DELTA_DIM>().transpose() * PA;
+        cost_to_go[k].noalias() += G.transpose() * gains[k];
+
+        /* Keep P_k symmetric, since rounding errors build up over the
+        horizon otherwise. */
+        PA = cost_to_go[k].transpose();
+        cost_to_go[k] = (real_t)0.5 * (cost_to_go[k] + PA);
+
+        factorised_mask[k] = free_mask[k];
+    }
+
+    factorised = true;
+    return true;
+}
+
+/*
+Calculates the Newton point for the current active set using the existing
+factorisation, and writes it to steps. The fixed controls keep their current
+values, so they enter the recursion as a constant offset in the dynamics.
+The backward sweep calculates the cost-to-go gradients p_k and feedforward
+terms, and the forward sweep then simulates the resulting feedback law from
+the initial delta.
+*/
+template <class Types>
+void RiccatiQPBackend<Types>::newton_step(const QPData &qp,
+const DeltaVector &initial_delta) {
+    uint32_t k;
+    DeltaVector p = DeltaVector::Zero(), v;
+    ControlVector fixed, h;
+
+    for(k = qp.horizon_length; k-- > 0;) {
+        const ContinuityConstraintMatrix &jacobian = qp.jacobians[k];
+
+        fixed = (ControlVector::Ones() - factorised_mask[k]).cwiseProduct(
+            controls[k]);
+        v = qp.integration_residuals[k] +
+            jacobian.template rightCols<CONTROL_DIM>() * fixed;
+        v = cost_to_go[k+1] * v + p;
+
+        h = factorised_mask[k].cwiseProduct(
+            (*qp.control_weights * (real_t)qp.interval_steps[k]) * fixed +
+            jacobian.template rightCols<CONTROL_DIM>().transpose() * v);
+        feedforward[k] = -control_hessians[k].solve(h);
+
+        p = jacobian.template leftCols<DELTA_DIM>().transpose() * v +
+            gains[k].transpose() * h;
+    }
+
+    states[0] = initial_delta;
+    for(k = 0; k < qp.horizon_length; k++) {
+        const ContinuityConstraintMatrix &jacobian = qp.jacobians[k];
+
+        fixed = (ControlVector::Ones() - factorised_mask[k]).cwiseProduct(
+            controls[k]);
+        steps[k] = gains[k] * states[k] + feedforward[k] + fixed;
+        states[k+1] = jacobian.template leftCols<DELTA_DIM>() * states[k] +
+            jacobian.template rightCols<CONTROL_DIM>() * steps[k] +
+            qp.integration_residuals[k];
+    }
+}
+
+/*
+Simulates the linearised dynamics from the initial delta with controls u,
+leaving the state deltas in states, and returns the QP objective.
+*/
+template <class Types>
+real_t RiccatiQPBackend<Types>::objective(const QPData &qp,
+const DeltaVector &initial_delta, const ControlVector *u) {
+    uint32_t k;
+    real_t result = 0.0;
+
+    states[0] = initial_delta;
+    for(k = 0; k < qp.horizon_length; k++) {
+        const ContinuityConstraintMatrix &jacobian = qp.jacobians[k];
+
+        result += (real_t)0.5 * (real_t)qp.interval_steps[k] * (
+            states[k].dot(*qp.state_weights * states[k]) +
+            u[k].dot(*qp.control_weights * u[k]));
+        states[k+1] = jacobian.template leftCols<DELTA_DIM>() * states[k] +
+            jacobian.template rightCols<CONTROL_DIM>() * u[k] +
+            qp.integration_residuals[k];
+    }
+
+    return result + (real_t)0.5 * states[qp.horizon_length].dot(
+        *qp.terminal_weights * states[qp.horizon_length]);
+}
+
+/*
+Gradient of the objective with respect to the controls, using the state
+deltas from the last call to objective() for the current controls and a
+backward sweep of the costates.
+*/
+template <class Types>
+void RiccatiQPBackend<Types>::objective_gradient(const QPData &qp) {
+    uint32_t k;
+    real_t scale;
+    DeltaVector costate;
+
+    costate = *qp.terminal_weights * states[qp.horizon_length];
+    for(k = qp.horizon_length; k-- > 0;) {
+        const ContinuityConstraintMatrix &jacobian = qp.jacobians[k];
+        scale = (real_t)qp.interval_steps[k];
+
+        gradients[k] = (*qp.control_weights * scale) * controls[k] +
+            jacobian.template rightCols<CONTROL_DIM>().transpose() * costate;
+        costate = (*qp.state_weights * scale) * states[k] +
+            jacobian.template leftCols<DELTA_DIM>().transpose() * costate;
+    }
+}
+
+/*
+Projected Newton iteration, as in DenseQPSolver::solve(), starting from the
+shifted previous solution. The stationarity tolerance is relative to the
+gradient at the starting point.
+*/
+template <class Types>
+bool RiccatiQPBackend<Types>::solve(const QPData &qp,
+const DeltaVector &initial_delta, ControlVector &control_delta) {
+    uint32_t i, k;
+    real_t f, trial_f, alpha, decrease, stationarity, tolerance = 0.0;
+    bool active_set_changed;
+
+    for(k = 0; k < qp.horizon_length; k++) {
+        controls[k] = controls[k].cwiseMax(qp.lower_control_bound[k])
+            .cwiseMin(qp.upper_control_bound[k]);
+    }
+
+    f = objective(qp, initial_delta, controls);
+
+    for(iterations = 0; iterations < max_iterations; iterations++) {
+        objective_gradient(qp);
+
+        /*
+        Controls at a bound with the gradient pointing out of the feasible
+        region stay where they are; the rest are free to move.
+        */
+        stationarity = 0.0;
+        active_set_changed = !factorised;
+        for(k = 0; k < qp.horizon_length; k++) {
+            for(i = 0; i < CONTROL_DIM; i++) {
+                if((controls[k][i] <= qp.lower_control_bound[k][i] &&
+                        gradients[k][i] > (real_t)0.0) ||
+                   (controls[k][i] >= qp.upper_control_bound[k][i] &&
+                        gradients[k][i] < (real_t)0.0)) {
+                    free_mask[k][i] = 0.0;
+                } else {
+                    free_mask[k][i] = 1.0;
+                    stationarity = std::max(stationarity,
+                                            std::abs(gradients[k][i]));
+                }
+
+                active_set_changed |=
+                    free_mask[k][i] != factorised_mask[k][i];
+            }
+        }
+
+        if(iterations == 0) {
+            tolerance = NMPC_EPS_SQRT * ((real_t)1.0 + stationarity);
+        }
+
+        if(stationarity <= tolerance) {
+            control_delta = controls[0];
+            return true;
+        }
+
+        if(active_set_changed && !factorise(qp)) {
+            return false;
+        }
+
+        newton_step(qp, initial_delta);
+        for(k = 0; k < qp.horizon_length; k++) {
+            steps[k] -= controls[k];
+        }
+
+        /*
+        Backtrack along the projection arc until the objective decreases
+        sufficiently (Armijo condition).
+        */
+        for(alpha = 1.0; alpha > NMPC_EPS_SQRT; alpha *= (real_t)0.5) {
+            decrease = 0.0;
+            for(k = 0; k < qp.horizon_length; k++) {
+                trial[k] = (controls[k] + alpha * steps[k])
+                    .cwiseMax(qp.lower_control_bound[k])
+                    .cwiseMin(qp.upper_control_bound[k]);
+                decrease += gradients[k].dot(trial[k] - controls[k]);
+            }
+
+            trial_f = objective(qp, initial_delta, trial);
+            if(trial_f <= f + (real_t)1e-4 * decrease) {
+                break;
+            }
+        }
+
+        if(alpha <= NMPC_EPS_SQRT) {
+            return false;
+        }
+
+        /* objective() has left the state deltas for the new controls. */
+        for(k = 0; k < qp.horizon_length; k++) {
+            controls[k] = trial[k];
+        }
+        f = trial_f;
+    }
+
+    return false;
+}
+
+/*
+Shift the previous solution and active set along by one interval, if each
+interval is one base step long; the final interval keeps its previous
+values.
+*/
+template <class Types>
+void RiccatiQPBackend<Types>::shift(const QPData &qp) {
+    if(qp.horizon_steps != qp.horizon_length) {
+        return;
+    }
+
+    std::copy(&controls[1], &controls[qp.horizon_length], controls);
+    std::copy(&free_mask[1], &free_mask[qp.horizon_length], free_mask);
+}
+
+template class RiccatiQPBackend<NMPCTypes>;
+template class RiccatiQPBackend<LongitudinalTypes>;
@@ -24,40 +24,114 @@ SOFTWARE.
 
 #include "types.h"
 #include "state.h"
-#include "dynamics.h"
 
 /*
-Runs the kinematics model on the state vector and returns a vector with the
-derivative of each components (except for the accelerations, which must be
-calculated directly using a dynamics model).
-Contents are as follows:
-    - Rate of change in position (3-vector, m/s, NED frame)
-    - Rate of change in linear velocity (3-vector, m/s^2, NED frame)
-    - Rate of change in attitude (quaternion (x, y, z, w), 1/s, body frame)
-    - Rate of change in angular velocity (3-vector, rad/s^2, body frame)
+Calculates the delta between two states.
 */
-const StateVectorDerivative State::model(ControlVector c, DynamicsModel *d) {
-    StateVectorDerivative output;
+template <typename Scalar>
+Eigen::Matrix<Scalar, NMPC_DELTA_DIM, 1> X8StateSpace::state_to_delta(
+const Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> &s1,
+const Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> &s2) {
+    typedef Eigen::Quaternion<Scalar> Quaternions;
+    Eigen::Matrix<Scalar, NMPC_DELTA_DIM, 1> delta;
 
-    AccelerationVector a = d->evaluate(*this, c);
+    delta.template segment<6>(0) =
+        s2.template segment<6>(0) - s1.template segment<6>(0);
 
-    /* Calculate change in position. */
-    output.segment<3>(0) << velocity();
+    /*
+    In order to increase the linearity of the problem and avoid quaternion
+    normalisation issues, we calculate the difference between attitudes as a
+    3-vector of Modified Rodrigues Parameters (MRP).
+    */
+    Quaternions err_q = (Quaternions(s2.template segment<4>(6)) *
+        Quaternions(s1.template segment<4>(6)).conjugate());
 
-    /* Calculate change in velocity. */
-    Quaternionr attitude_q = Quaternionr(attitude());
-    output.segment<3>(3) = attitude_q.conjugate() * a.segment<3>(0);
+    if(err_q.w() < (real_t)0.0) {
+        err_q = Quaternions(-err_q.w(), -err_q.x(), -err_q.y(), -err_q.z());
+    }
 
-    /* Calculate change in attitude. */
-    Eigen::Matrix<real_t, 4, 1> omega_q;
-    omega_q << angular_velocity(), 0;
+    delta.template segment<3>(6) = Scalar(NMPC_MRP_F) *
+        (err_q.vec() / Scalar(NMPC_MRP_A + err_q.w()));
 
-    attitude_q = Quaternionr(omega_q).conjugate() * attitude_q;
-    output.segment<4>(6) << attitude_q.vec(), attitude_q.w();
-    output.segment<4>(6) *= 0.5;
+    delta.template segment<3>(9) =
+        s2.template segment<3>(10) - s1.template segment<3>(10);
 
-    /* Calculate change in angular velocity (just angular acceleration). */
-    output.segment<3>(10) = a.segment<3>(3);
+    return delta;
+}
+
+/*
+Applies a delta to a state. The attitude part of the delta is converted from
+an MRP to a quaternion, which is applied to the attitude of the state.
+*/
+template <typename Scalar>
+Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> X8StateSpace::apply_delta(
+const Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> &s,
+const Eigen::Matrix<Scalar, NMPC_DELTA_DIM, 1> &delta) {
+    using std::sqrt;
+    typedef Eigen::Quaternion<Scalar> Quaternions;
+    Eigen::Matrix<Scalar, NMPC_STATE_DIM, 1> out;
+    Eigen::Matrix<Scalar, 3, 1> d_p = delta.template segment<3>(6);
+    Quaternions delta_q, temp;
+
+    out.template segment<6>(0) =
+        s.template segment<6>(0) + delta.template segment<6>(0);
+
+    Scalar x_2 = d_p.squaredNorm();
+    Scalar delta_w = (-NMPC_MRP_A * x_2 + NMPC_MRP_F * sqrt(
+        NMPC_MRP_F_2 + ((real_t)1.0 - NMPC_MRP_A_2) * x_2)) /
+        (NMPC_MRP_F_2 + x_2);
+    delta_q.vec() = (Scalar((real_t)1.0 / NMPC_MRP_F) *
+        (NMPC_MRP_A + delta_w)) * d_p;
+    delta_q.w() = delta_w;
+    temp = delta_q * Quaternions(s.template segment<4>(6));
+    out.template segment<4>(6) << temp.vec(), temp.w();
+
+    out.template segment<3>(10) =
+        s.template segment<3>(10) + delta.template segment<3>(9);
 
-    return output;
+    return out;
 }
+
+template DeltaVector X8StateSpace::state_to_delta<real_t>(
+    const StateVector &s1, const StateVector &s2);
+template DeltaVectorAD X8StateSpace::state_to_delta<real_ad_t>(
+    const StateVectorAD &s1, const StateVectorAD &s2);
+template StateVector X8StateSpace::apply_delta<real_t>(
+    const StateVector &s, const DeltaVector &delta);
+template StateVectorAD X8StateSpace::apply_delta<real_ad_t>(
+    const StateVectorAD &s, const DeltaVectorAD &delta);
+
+/* Calculates the delta between two longitudinal states. */
+template <typename Scalar>
+Eigen::Matrix<Scalar, LongitudinalStateSpace::DELTA_DIM, 1>
+LongitudinalStateSpace::state_to_delta(
+const Eigen::Matrix<Scalar, LongitudinalStateSpace::STATE_DIM, 1> &s1,
+const Eigen::Matrix<Scalar, LongitudinalStateSpace::STATE_DIM, 1> &s2) {
+    return s2 - s1;
+}
+
+/* Applies a delta to a longitudinal state. */
+template <typename Scalar>
+Eigen::Matrix<Scalar, LongitudinalStateSpace::STATE_DIM, 1>
+LongitudinalStateSpace::apply_delta(
+const Eigen::Matrix<Scalar, LongitudinalStateSpace::STATE_DIM, 1> &s,
+const Eigen::Matrix<Scalar, LongitudinalStateSpace::DELTA_DIM, 1> &delta) {
+    return s + delta;
+}
+
+template LongitudinalTypes::DeltaVector
+LongitudinalStateSpace::state_to_delta<real_t>(
+    const LongitudinalTypes::StateVector &s1,
+    const LongitudinalTypes::StateVector &s2);
+template LongitudinalTypes::DeltaVectorAD
+LongitudinalStateSpace::state_to_delta<LongitudinalTypes::ADScalar>(
+    const LongitudinalTypes::StateVectorAD &s1,
+    const LongitudinalTypes::StateVectorAD &s2);
+template LongitudinalTypes::StateVector
+LongitudinalStateSpace::apply_delta<real_t>(
+    const LongitudinalTypes::StateVector &s,
+    const LongitudinalTypes::DeltaVector &delta);
+template LongitudinalTypes::StateVectorAD
+LongitudinalStateSpace::apply_delta<LongitudinalTypes::ADScalar>(
+    const LongitudinalTypes::StateVectorAD &s,
+    const LongitudinalTypes::DeltaVectorAD &delta);
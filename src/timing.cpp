@@ -0,0 +1,79 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <time.h>
+#include <cmath>
+#include <algorithm>
+
+#include "types.h"
+#include "timing.h"
+
+double timing_clock() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1.0e-9;
+}
+
+void TimingStats::reset() {
+    count = 0;
+    minimum = 0.0;
+    maximum = 0.0;
+    total = 0.0;
+}
+
+void TimingStats::record(real_t seconds) {
+    if(count == 0 || seconds < minimum) {
+        minimum = seconds;
+    }
+    if(count == 0 || seconds > maximum) {
+        maximum = seconds;
+    }
+
+    window[count % OCP_TIMING_WINDOW] = seconds;
+    total += seconds;
+    count++;
+}
+
+real_t TimingStats::get_mean() const {
+    return count ? (real_t)(total / count) : (real_t)0.0;
+}
+
+/*
+Returns the p-th percentile (0 < p <= 1) of the samples in the window, by
+the nearest-rank method.
+*/
+real_t TimingStats::get_percentile(real_t p) const {
+    real_t sorted[OCP_TIMING_WINDOW];
+    uint32_t n = std::min(count, (uint32_t)OCP_TIMING_WINDOW), rank;
+
+    if(n == 0) {
+        return 0.0;
+    }
+
+    std::copy(window, window + n, sorted);
+    std::sort(sorted, sorted + n);
+
+    rank = (uint32_t)std::ceil(p * (real_t)n);
+    rank = std::min(std::max(rank, (uint32_t)1), n);
+    return sorted[rank - 1];
+}
@@ -0,0 +1,267 @@
+/*
+Copyright (C) 2013 Daniel Dyer
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Checks that nothing allocates once an instance has been initialised. This
+program defines malloc() and friends itself, so every allocation in the
+process goes through them -- including those made by qpDUNES, the C++
+runtime and OpenMP, which Eigen's own allocation check can't see -- and
+counts them while the closed-loop sequence of preparation step, feedback
+step and horizon update runs.
+
+Each QP backend is run with one preparation thread and with
+NO_MALLOC_THREADS of them. The OpenMP thread pool is started before
+nmpc_ctx_init(), since the OpenMP runtime allocates its threads the first
+time they're used. Partial condensing isn't covered, since it needs
+qpDUNES built with its qpOASES stage QP solver.
+
+The allocator is passed on to glibc's __libc_* functions, so this only
+builds against glibc. Exits with a non-zero status if anything allocated.
+
+Usage: no_malloc [iterations]
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#include "config.h"
+#include "cnmpc.h"
+
+#define NO_MALLOC_AIRSPEED ((real_t)20.0)
+#define NO_MALLOC_THREADS 4u
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+/* Set while the allocations are being counted. */
+static volatile int counting;
+static volatile uint32_t allocations;
+
+static void _count_allocation(void) {
+    if (counting) {
+        __atomic_add_fetch(&allocations, 1u, __ATOMIC_RELAXED);
+    }
+}
+
+void *malloc(size_t size) {
+    _count_allocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    _count_allocation();
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    _count_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    _count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    _count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    void *out;
+
+    _count_allocation();
+    out = __libc_memalign(alignment, size);
+    if (!out) {
+        return ENOMEM;
+    }
+
+    *ptr = out;
+    return 0;
+}
+
+static void _reference_point(real_t out[NMPC_REFERENCE_DIM], real_t t) {
+    /* Straight and level flight heading north at 100 m altitude. */
+    memset(out, 0, sizeof(real_t) * NMPC_REFERENCE_DIM);
+    out[0] = NO_MALLOC_AIRSPEED * t;
+    out[2] = (real_t)-100.0;
+    out[3] = NO_MALLOC_AIRSPEED;
+    out[9] = (real_t)1.0;
+    out[13] = (real_t)0.4;
+    out[14] = (real_t)0.5;
+    out[15] = (real_t)0.5;
+}
+
+/* Returns the number of allocations made after nmpc_ctx_init(). */
+static uint32_t _run(enum nmpc_qp_backend_t backend, uint32_t threads,
+uint32_t iterations) {
+    real_t state_weights[NMPC_DELTA_DIM] =
+        {1, 1, 1, 1, 1, 1, 10, 10, 10, 1, 1, 1};
+    real_t control_weights[NMPC_CONTROL_DIM] = {1, 1, 1};
+    real_t lower_control_bound[NMPC_CONTROL_DIM] = {0, 0.25, 0.25};
+    real_t upper_control_bound[NMPC_CONTROL_DIM] = {1, 0.75, 0.75};
+    real_t reference[NMPC_REFERENCE_DIM], measurement[NMPC_REFERENCE_DIM],
+           controls[NMPC_CONTROL_DIM], step_length;
+    struct nmpc_ctx_t *ctx;
+    uint32_t i, horizon_steps, result;
+
+    ctx = nmpc_create();
+    if (!ctx) {
+        fprintf(stderr, "nmpc_create failed\n");
+        exit(1);
+    }
+
+    nmpc_ctx_set_state_weights(ctx, state_weights);
+    nmpc_ctx_set_control_weights(ctx, control_weights);
+    nmpc_ctx_set_terminal_weights(ctx, state_weights);
+    nmpc_ctx_set_lower_control_bound(ctx, lower_control_bound);
+    nmpc_ctx_set_upper_control_bound(ctx, upper_control_bound);
+    nmpc_ctx_config_set_qp_backend(ctx, backend);
+    nmpc_ctx_set_preparation_threads(ctx, threads);
+
+#if defined(_OPENMP)
+    #pragma omp parallel num_threads(threads)
+    {
+        (void)omp_get_thread_num();
+    }
+#endif
+
+    nmpc_ctx_init(ctx);
+
+    allocations = 0;
+    counting = 1;
+
+    step_length = nmpc_ctx_config_get_step_length(ctx);
+    horizon_steps = nmpc_ctx_config_get_horizon_steps(ctx);
+    nmpc_ctx_set_wind_velocity(ctx, 0, 0, 0);
+    for (i = 0; i <= horizon_steps; i++) {
+        _reference_point(reference, step_length * (real_t)i);
+        nmpc_ctx_set_reference_point(ctx, reference, i);
+    }
+
+    for (i = 0; i < iterations; i++) {
+        nmpc_ctx_preparation_step(ctx);
+
+        /*
+        Offset the measurement from the reference slightly, so the solver
+        has some work to do. Only the state part of the reference point is
+        read by nmpc_ctx_feedback_step().
+        */
+        _reference_point(measurement, step_length * (real_t)i);
+        measurement[0] += (real_t)0.1;
+        measurement[1] += (real_t)0.2;
+        measurement[2] -= (real_t)0.5;
+        measurement[6] = (real_t)0.01;
+        measurement[9] = (real_t)sqrt(1.0 - 0.01 * 0.01);
+        nmpc_ctx_feedback_step(ctx, measurement);
+        nmpc_ctx_get_controls(ctx, controls);
+
+        /*
+        Alternate between updating the horizon directly, and shifting it
+        and feeding the new point through the reference queue.
+        */
+        _reference_point(reference,
+                         step_length * (real_t)(i + horizon_steps + 1u));
+        if (i % 2u) {
+            nmpc_ctx_shift_horizon(ctx);
+            nmpc_ctx_queue_reference_point(
+                ctx, reference, nmpc_ctx_get_reference_step(ctx) +
+                horizon_steps);
+        } else {
+            nmpc_ctx_update_horizon(ctx, reference);
+        }
+
+        nmpc_ctx_set_wind_velocity(ctx, (real_t)(i % 3u), 0, 0);
+    }
+
+    counting = 0;
+    result = allocations;
+
+    nmpc_destroy(ctx);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        enum nmpc_qp_backend_t backend;
+        const char *name;
+    } backends[] = {
+        {NMPC_QP_QPDUNES, "qpdunes"},
+        {NMPC_QP_DENSE, "dense"},
+        {NMPC_QP_RICCATI, "riccati"}
+    };
+    static const uint32_t threads[] = {1u, NO_MALLOC_THREADS};
+    uint32_t iterations = 200, i, j, count, failures = 0;
+    void *volatile check;
+
+    if (argc > 1) {
+        iterations = (uint32_t)atoi(argv[1]);
+    }
+    if (iterations < 1) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    /* Make sure the allocator above is the one actually being called. */
+    allocations = 0;
+    counting = 1;
+    check = malloc(16);
+    counting = 0;
+    free(check);
+    if (allocations != 1u) {
+        fprintf(stderr, "malloc() isn't being interposed\n");
+        return 1;
+    }
+
+    printf("%u iterations\n", iterations);
+    printf("qp        threads  allocations\n");
+
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        for (j = 0; j < sizeof(threads) / sizeof(threads[0]); j++) {
+            count = _run(backends[i].backend, threads[j], iterations);
+            printf("%-8s  %7u  %11u\n", backends[i].name, threads[j],
+                   count);
+            if (count) {
+                failures++;
+            }
+        }
+    }
+
+    if (failures) {
+        printf("FAILED: %u configurations allocated after nmpc_init()\n",
+               failures);
+        return 1;
+    }
+
+    return 0;
+}